@@ -539,18 +539,14 @@ void get_all_balances_internal (string exchange)
 // Gets all balances for all coins identifiers in all wallets on all exchanges.
 void get_all_balances ()
 {
-  // Storage for parallel jobs.
-  vector <thread *> jobs;
-  // Start threads for all exchanges.
+  // Get the balances of all exchanges in parallel on the thread pool.
   vector <string> exchanges = exchange_get_names ();
+  task_group jobs (exchanges.size ());
   for (auto exchange : exchanges) {
-    thread * job = new thread (get_all_balances_internal, exchange);
-    jobs.push_back (job);
-  }
-  // Wait till all threads have completed.
-  for (auto job : jobs) {
-    job->join ();
+    jobs.run ([exchange] { get_all_balances_internal (exchange); });
   }
+  // Wait till all exchanges have completed.
+  jobs.wait_all ();
 }
 
 
@@ -618,6 +614,12 @@ void record_all_balances ()
   }
   
   
+  // The balances of all coins are recorded with multi-row statements.
+  // The statements are sent to the database when they reach the maximum packet size,
+  // and at the end.
+  SQLInsert insert (sql, "INSERT INTO balances (seconds, exchange, coin, total, btc, euro) VALUES");
+  
+  
   // Iterate over all the exchanges.
   for (auto exchange : exchanges) {
     
@@ -643,27 +645,19 @@ void record_all_balances ()
       }
       
       // Record the balances into the database.
-      sql.clear ();
-      sql.add ("INSERT INTO balances (seconds, exchange, coin, total, btc, euro) VALUES (");
-      sql.add (seconds);
-      sql.add (",");
-      sql.add (exchange);
-      sql.add (",");
-      sql.add (coin);
-      sql.add (",");
+      insert.row ();
+      insert.add (seconds);
+      insert.add (exchange);
+      insert.add (coin);
       // The total balance for this coin.
       // This includes also the reserved and unconfirmed amounts.
-      sql.add (total);
-      sql.add (",");
+      insert.add (total);
       // Calculate the value of this expressed in Bitcoins with the current rate.
       float btc = total * allrates [exchange + bitcoin_id () + coin];
-      sql.add (btc);
-      sql.add (",");
+      insert.add (btc);
       // Calculate the value of this expressed in Euros with the current rate.
       float euro = bitcoin2euro (btc);
-      sql.add (euro);
-      sql.add (");");
-      sql.execute ();
+      insert.add (euro);
 
       
       // Output the balances visibly.
@@ -698,6 +692,10 @@ void record_all_balances ()
       sql.execute ();
     }
   }
+  
+  
+  // Store the remaining balances.
+  insert.flush ();
 }
 
 
@@ -1771,32 +1769,18 @@ void get_market_summaries_hurry (const vector <string> exchanges,
   seller_quantities.clear ();
   seller_rates.clear ();
   
-  // Storage for parallel jobs.
-  vector <thread *> jobs;
-
-  // Start threads for all exchanges.
-  // The purpose of using threads is to get the market summaries sooner.
+  // Get the buyers and sellers at all exchanges simultaneously.
+  // The purpose of doing it simultaneously is to get the market summaries sooner.
   // When doing arbitrage, the timing is very important.
   // Bad timing leads to losses.
   // Good timing leads to gains.
-  for (auto exchange : exchanges) {
-    thread * job;
-    job = new thread (exchange_get_buyers_via_satellite, exchange, market, coin,
-                      ref (buyer_quantities[exchange]),
-                      ref (buyer_rates[exchange]),
-                      true, output);
-    jobs.push_back (job);
-    job = new thread (exchange_get_sellers_via_satellite, exchange, market, coin,
-                      ref (seller_quantities[exchange]),
-                      ref (seller_rates[exchange]),
-                      true, output);
-    jobs.push_back (job);
-  }
-
-  // Wait till all threads have completed.
-  for (auto job : jobs) {
-    job->join ();
-  }
+  // It used to start two threads per exchange.
+  // It now runs all satellite requests together on this thread.
+  // This gives less scheduling jitter between the snapshots of the buyers and of the sellers.
+  exchange_get_buyers_sellers_via_satellite (exchanges, market, coin,
+                                             buyer_quantities, buyer_rates,
+                                             seller_quantities, seller_rates,
+                                             true, output);
 }
 
 
@@ -1824,43 +1808,35 @@ bool multipath_investigate (void * output,
   // Obtain prices in a hurry for a more realistic picture.
   bool hurry = true;
   
-  // Fetch the relevant order books in parallel jobs for better speed and more actual prices.
-  vector <thread *> jobs;
-  
-  // Step 1: Get prices for buying coin 1 at market 1, if the market differs from the coin.
-  if (mp->market1name != mp->coin1name) {
-    thread * job;
-    job = new thread (exchange_get_sellers_via_satellite, mp->exchange, mp->market1name, mp->coin1name, ref (quantities1), ref (asks1), hurry, output);
-    jobs.push_back (job);
-  }
-  
-  // Step 2: Get prices for selling coin 2 at market 2, if the market differs from the coin..
-  if (mp->market2name != mp->coin2name) {
-    thread * job;
-    // Obtain it in a hurry for a more realistic picture.
-    job = new thread (exchange_get_buyers_via_satellite, mp->exchange, mp->market2name, mp->coin2name, ref (quantities2), ref (bids2), hurry, output);
-    jobs.push_back (job);
-  }
-  
-  // Step 3: Get prices for buying coin 3 at market 3, if the market differs from the coin..
-  if (mp->market3name != mp->coin3name) {
-    thread * job;
-    // Obtain it in a hurry for a more realistic picture.
-    job = new thread (exchange_get_sellers_via_satellite, mp->exchange, mp->market3name, mp->coin3name, ref (quantities3), ref (asks3), hurry, output);
-    jobs.push_back (job);
-  }
-  
-  // Step 4: Get prices for selling coin 4 at market 4, if the market differs from the coin..
-  if (mp->market4name != mp->coin4name) {
-    thread * job;
-    // Obtain it in a hurry for a more realistic picture.
-    job = new thread (exchange_get_buyers_via_satellite, mp->exchange, mp->market4name, mp->coin4name, ref (quantities4), ref (bids4), hurry, output);
-    jobs.push_back (job);
-  }
-  
-  // Wait till all order books have been received.
-  for (auto job : jobs) {
-    job->join ();
+  // The relevant order books used to be fetched in a thread each.
+  // Those threads were never deleted, so every investigated path leaked them.
+  // Now it fetches all order books in one batch, for better speed and more actual prices.
+  // Skip the steps where the market is the same as the coin.
+  vector <exchange_order_book> books;
+  vector <vector <float> *> book_quantities, book_rates;
+  auto add_book = [&] (const string & market, const string & coin, bool buyers, vector <float> & quantities, vector <float> & rates) {
+    if (market == coin) return;
+    exchange_order_book book;
+    book.exchange = mp->exchange;
+    book.market = market;
+    book.coin = coin;
+    book.buyers = buyers;
+    books.push_back (book);
+    book_quantities.push_back (&quantities);
+    book_rates.push_back (&rates);
+  };
+  // Step 1: Get prices for buying coin 1 at market 1.
+  add_book (mp->market1name, mp->coin1name, false, quantities1, asks1);
+  // Step 2: Get prices for selling coin 2 at market 2.
+  add_book (mp->market2name, mp->coin2name, true, quantities2, bids2);
+  // Step 3: Get prices for buying coin 3 at market 3.
+  add_book (mp->market3name, mp->coin3name, false, quantities3, asks3);
+  // Step 4: Get prices for selling coin 4 at market 4.
+  add_book (mp->market4name, mp->coin4name, true, quantities4, bids4);
+  exchange_get_order_books_via_satellite (books, hurry, output);
+  for (size_t i = 0; i < books.size (); i++) {
+    * book_quantities [i] = books[i].quantities;
+    * book_rates [i] = books[i].rates;
   }
   
   // Error handling of the exchange calls.
@@ -2930,20 +2906,16 @@ void pattern_prepare (void * output,
                       const vector <int> & seconds,
                       const vector <float> & asks,
                       const vector <float> & bids,
-                      unordered_map <int, float> & minute_asks,
-                      unordered_map <int, float> & minute_bids,
-                      unordered_map <int, float> & hour_asks,
-                      unordered_map <int, float> & hour_bids)
+                      TimeSeries & minutes,
+                      TimeSeries & hours)
 {
   // The output object.
   to_output * out = (to_output *) output;
   
-  // The unordered maps are for super fast access to the bids and the asks.
+  // The time series are for super fast access to the bids and the asks.
   // Clear the containers.
-  minute_asks.clear ();
-  minute_bids.clear ();
-  hour_asks.clear ();
-  hour_bids.clear ();
+  minutes.clear ();
+  hours.clear ();
   
   // No rates available: Done.
   if (seconds.empty ()) {
@@ -2966,6 +2938,9 @@ void pattern_prepare (void * output,
   // Convert the seconds since the Epoch to minutes relative to now.
   // That's for easier and faster access.
   // Interpolate missing rates.
+  // The rates are ordered by second, so the first one is the oldest.
+  // Make room for all minutes in one go.
+  minutes.range (0 - (int) (float (current_second - seconds.front () + 30) / 60), 0);
   int oldest_minute = 0;
   int previous_minute = 0;
   float previous_ask = 0, previous_bid = 0;
@@ -2995,13 +2970,11 @@ void pattern_prepare (void * output,
           float bid = previous_bid + (interpolate - previous_minute) * (next_bid - previous_bid) / (float) (minute - previous_minute);
           if (isnan (bid)) bid = 0;
           if (isinf (bid)) bid = 0;
-          minute_asks [interpolate] = ask;
-          minute_bids [interpolate] = bid;
+          minutes.set (interpolate, ask, bid);
         }
       }
     }
-    minute_asks [minute] = asks[i];
-    minute_bids [minute] = bids[i];
+    minutes.set (minute, asks[i], bids[i]);
     // Record the oldest minute.
     if (minute < oldest_minute) oldest_minute = minute;
     // Record state.
@@ -3011,6 +2984,7 @@ void pattern_prepare (void * output,
   }
   
   // Roll-over hour detection.
+  hours.range (oldest_minute / 60, 0);
   int previous_hour = 0;
   // Detect total minutes for rate calculation.
   int minutes_with_rate = 0;
@@ -3034,8 +3008,7 @@ void pattern_prepare (void * output,
       // An hour of -1 is last hour.
       // An hour of -2 is two hours ago.
       // And so on.
-      hour_asks [previous_hour] = average_ask;
-      hour_bids [previous_hour] = average_bid;
+      hours.set (previous_hour, average_ask, average_bid);
       // Reset values.
       previous_hour = hour;
       minutes_with_rate = 0;
@@ -3044,45 +3017,45 @@ void pattern_prepare (void * output,
     }
     // Store total asks and bids.
     // Record minutes with values.
-    float bid = minute_bids [minute];
+    float bid = minutes.bid (minute);
     if (bid > 0) minutes_with_rate++;
     total_bid += bid;
-    total_ask += minute_asks [minute];
+    total_ask += minutes.ask (minute);
   }
 }
 
 
 void pattern_prepare (void * output,
                       const string & exchange, const string & market, const string & coin,
-                      unordered_map <int, float> & minute_asks,
-                      unordered_map <int, float> & minute_bids,
-                      unordered_map <int, float> & hour_asks,
-                      unordered_map <int, float> & hour_bids)
+                      TimeSeries & minutes,
+                      TimeSeries & hours)
 {
   vector <int> seconds;
   vector <float> asks, bids;
   allrates_get (exchange, market, coin, seconds, bids, asks);
-  pattern_prepare (output, seconds, asks, bids, minute_asks, minute_bids, hour_asks, hour_bids);
+  pattern_prepare (output, seconds, asks, bids, minutes, hours);
 }
 
 
 void pattern_prepare (void * output,
                       const string & exchange, const string & market, const string & coin,
                       int hours,
-                      unordered_map <int, float> & minute_asks,
-                      unordered_map <int, float> & minute_bids,
-                      unordered_map <int, float> & hour_asks,
-                      unordered_map <int, float> & hour_bids)
+                      TimeSeries & minutes,
+                      TimeSeries & hour_series)
 {
   // Clear containers.
-  minute_asks.clear ();
-  minute_bids.clear ();
-  hour_asks.clear ();
-  hour_bids.clear ();
+  minutes.clear ();
+  hour_series.clear ();
   
   // If the requested market exists, take the rates straight from the database.
+  // Read only the requested hours, plus one more for the interpolation at the start.
+  // The time index of the rates store skips the older data without reading it.
   if (allrates_exists (exchange, market, coin)) {
-    pattern_prepare (output, exchange, market, coin, minute_asks, minute_bids, hour_asks, hour_bids);
+    vector <int> seconds;
+    vector <float> asks, bids;
+    int from_second = seconds_since_epoch () - ((hours + 1) * 3600);
+    allrates_get (exchange, market, coin, from_second, seconds, bids, asks);
+    pattern_prepare (output, seconds, asks, bids, minutes, hour_series);
   }
   
   // If the requested market does not exist,
@@ -3092,78 +3065,68 @@ void pattern_prepare (void * output,
   else {
     
     // Get the rates of the coin on the Bitcoin market.
-    unordered_map <int, float> bitcoin_minute_asks, bitcoin_minute_bids, bitcoin_hour_asks, bitcoin_hour_bids;
-    pattern_prepare (output, exchange, bitcoin_id (), coin,
-                     bitcoin_minute_asks, bitcoin_minute_bids, bitcoin_hour_asks, bitcoin_hour_bids);
+    TimeSeries bitcoin_minutes, bitcoin_hours;
+    pattern_prepare (output, exchange, bitcoin_id (), coin, bitcoin_minutes, bitcoin_hours);
     
     // Get the rates of the Bitcoin on the desired market.
-    unordered_map <int, float> market_minute_asks, market_minute_bids, market_hour_asks, market_hour_bids;
+    TimeSeries market_minutes, market_hours;
     vector <string> exchanges = exchange_get_names ();
     for (auto exchange : exchanges) {
       if (!allrates_exists (exchange, market, bitcoin_id ())) continue;
-      pattern_prepare (output, exchange, market, bitcoin_id (),
-                       market_minute_asks, market_minute_bids, market_hour_asks, market_hour_bids);
+      pattern_prepare (output, exchange, market, bitcoin_id (), market_minutes, market_hours);
       break;
     }
     
     // The negative minute before now, where to start calculating the minutely patterns.
     int starting_minute = 0 - (hours * 60);
+    minutes.range (starting_minute, 0);
     
     // Iterate over the data to generate the data points.
     for (int minute = starting_minute; minute <= 0; minute++) {
       
       // The rate of the coin.
-      float coin_btc_bid = bitcoin_minute_bids[minute];
-      float coin_btc_ask = bitcoin_minute_asks[minute];
-      float btc_market_bid = market_minute_bids[minute];
-      float btc_market_ask = market_minute_asks[minute];
-      float bid = coin_btc_bid * btc_market_bid;
-      float ask = coin_btc_ask * btc_market_ask;
+      float bid = bitcoin_minutes.bid (minute) * market_minutes.bid (minute);
+      float ask = bitcoin_minutes.ask (minute) * market_minutes.ask (minute);
       
       // If the conversion did not work, don't store the data.
       if ((bid == 0) || (ask == 0)) continue;
       
       // Store the ask and bid.
-      minute_asks [minute] = ask;
-      minute_bids [minute] = bid;
+      minutes.set (minute, ask, bid);
     }
     
     // The negative hour before now, where to start calculating the hourly patterns.
     int starting_hour = 0 - hours;
+    hour_series.range (starting_hour, 0);
     
     // Iterate over the data to generate the data points.
     for (int hour = starting_hour; hour <= 0; hour++) {
       
       // The rate of the coin.
-      float coin_btc_bid = bitcoin_hour_bids[hour];
-      float coin_btc_ask = bitcoin_hour_asks[hour];
-      float btc_market_bid = market_hour_bids[hour];
-      float btc_market_ask = market_hour_asks[hour];
-      float bid = coin_btc_bid * btc_market_bid;
-      float ask = coin_btc_ask * btc_market_ask;
+      float bid = bitcoin_hours.bid (hour) * market_hours.bid (hour);
+      float ask = bitcoin_hours.ask (hour) * market_hours.ask (hour);
       
       // If the conversion did not work, don't store the data.
       if ((bid == 0) || (ask == 0)) continue;
       
       // Store the ask and bid.
-      hour_asks [hour] = ask;
-      hour_bids [hour] = bid;
+      hour_series.set (hour, ask, bid);
     }
   }
 }
 
 
-void pattern_smooth (unordered_map <int, float> & asks, unordered_map <int, float> & bids,
-                     unordered_map <int, float> & smoothed_rates, unsigned int window)
+void pattern_smooth (const TimeSeries & rates, TimeSeries & smoothed_rates, unsigned int window)
 {
+  smoothed_rates.clear ();
+
   // Find the oldest time.
-  int oldest_time = 0;
-  for (auto & element : asks) {
-    int time = element.first;
-    if (time < oldest_time) oldest_time = time;
-  }
+  // If there are no rates, there's nothing to smooth.
+  int oldest_time;
+  if (!rates.oldest (oldest_time)) return;
+  oldest_time = min (oldest_time, 0);
 
-  smoothed_rates.clear ();
+  smoothed_rates.range (oldest_time, 0);
   
   // Store values for the moving average.
   queue <double> measurements;
@@ -3173,7 +3136,7 @@ void pattern_smooth (unordered_map <int, float> & asks, unordered_map <int, floa
 
   float oldrate = 0;
   for (int time = oldest_time; time <= 0; time++) {
-    float rate = (asks [time] + bids [time]) / 2;
+    float rate = (rates.ask (time) + rates.bid (time)) / 2;
     if (rate == 0) rate = oldrate;
     oldrate = rate;
     if (rate == 0) continue;
@@ -3184,7 +3147,8 @@ void pattern_smooth (unordered_map <int, float> & asks, unordered_map <int, floa
       measurements.pop();
     }
     rate = measurement_sum / measurements.size();
-    smoothed_rates [time] = rate;
+    // The smoothed rate is stored as both the ask and the bid.
+    smoothed_rates.set (time, rate, rate);
   }
 }
 
@@ -3192,7 +3156,7 @@ void pattern_smooth (unordered_map <int, float> & asks, unordered_map <int, floa
 // This returns the percentage change in the rates over the given period.
 // When the $start is 0, it refers to now.
 // The $window indicates how many units of the past time it includes for calculating the outcome.
-float pattern_change (unordered_map <int, float> & asks, unordered_map <int, float> & bids, int start, int window)
+float pattern_change (const TimeSeries & rates, int start, int window)
 {
   // Notes:
   // Is this averages calculation correct?
@@ -3207,7 +3171,7 @@ float pattern_change (unordered_map <int, float> & asks, unordered_map <int, flo
   double previous_rate = 0;
   int first = start - window;
   for (int i = first; i <= start; i++) {
-    double rate = (asks[i] + bids[i]) / 2;
+    double rate = (rates.ask (i) + rates.bid (i)) / 2;
     if (rate == 0) continue;
     if (previous_rate == 0) {
       previous_rate = rate;
@@ -3233,8 +3197,7 @@ float pattern_change (unordered_map <int, float> & asks, unordered_map <int, flo
 
 
 // This returns true if the price of the coin has moved regularly recently.
-bool pattern_coin_has_regular_recent_price_movements (unordered_map <int, float> & hour_asks,
-                                                      unordered_map <int, float> & hour_bids)
+bool pattern_coin_has_regular_recent_price_movements (const TimeSeries & hours)
 {
   // Check that the coin has regular price movements, rather than a stable price.
   // For the past month, the average price point for each hour
@@ -3247,7 +3210,7 @@ bool pattern_coin_has_regular_recent_price_movements (unordered_map <int, float>
   int different_price_counter = 0;
   int start_hour = -720;
   for (int hour = start_hour; hour <= 0; hour++) {
-    float price = (hour_asks [hour] + hour_bids [hour]) / 2;
+    float price = (hours.ask (hour) + hours.bid (hour)) / 2;
     if (price != previous_price) different_price_counter++;
     previous_price = price;
   }
@@ -3266,8 +3229,7 @@ bool pattern_coin_has_regular_recent_price_movements (unordered_map <int, float>
 void patterns_simulate_sale (void * output,
                              int buy_time, int max_open_time,
                              float buy_price, float sell_price,
-                             unordered_map <int, float> & time_asks,
-                             unordered_map <int, float> & time_bids,
+                             const TimeSeries & rates,
                              int & real_open_time, bool & sold_in_time)
 {
   // How long the order has been open.
@@ -3279,7 +3241,7 @@ void patterns_simulate_sale (void * output,
   // Iterate over the container with the rates.
   // Take the bid price, since the bot wants to sell the coin.
   for (int time = buy_time; time <= 0; time++) {
-    float bid_price = time_bids [time];
+    float bid_price = rates.bid (time);
     if (bid_price > sell_price) {
       // Sold: Set variables.
       real_open_time = time - buy_time;
@@ -3296,15 +3258,13 @@ void patterns_simulate_sale (void * output,
   }
   
   // Silence compile warnings.
-  (void) time_asks;
   (void) buy_price;
 }
 
 
 bool pattern_increase_day_week_detector (void * output,
                                          int detection_hour,
-                                         unordered_map <int, float> & hour_asks,
-                                         unordered_map <int, float> & hour_bids)
+                                         const TimeSeries & hours)
 {
   // The bundled output object.
   to_output * out = nullptr;
@@ -3322,9 +3282,9 @@ bool pattern_increase_day_week_detector (void * output,
   // Check whether there's an increase in the value of this coin at this very moment.
   // If not, it's done right away, no need to investigate the coin's history.
   bool pattern_detected = true;
-  float change_percentage_day = pattern_change (hour_asks, hour_bids, detection_hour, day_hours);
+  float change_percentage_day = pattern_change (hours, detection_hour, day_hours);
   if (change_percentage_day < minimum_daily_increase) pattern_detected = false;
-  float change_percentage_week = pattern_change (hour_asks, hour_bids, detection_hour, week_hours);
+  float change_percentage_week = pattern_change (hours, detection_hour, week_hours);
   if (change_percentage_week < minimum_weekly_increase) pattern_detected = false;
   
   if (out) {
@@ -3337,8 +3297,7 @@ bool pattern_increase_day_week_detector (void * output,
 
 
 bool pattern_increase_day_week_simulator (void * output,
-                                          unordered_map <int, float> & hour_asks,
-                                          unordered_map <int, float> & hour_bids,
+                                          const TimeSeries & hours,
                                           const string & reason)
 {
   // The bundled output object.
@@ -3350,14 +3309,14 @@ bool pattern_increase_day_week_simulator (void * output,
   float buy_price = 0;
   int maximum_open_order_hours = 48;
   for (int hour = -500; hour <= 0 - (maximum_open_order_hours); hour++) {
-    bool hit = pattern_increase_day_week_detector (nullptr, hour, hour_asks, hour_bids);
+    bool hit = pattern_increase_day_week_detector (nullptr, hour, hours);
     if (hit) {
-      buy_price = hour_asks [hour];
+      buy_price = hours.ask (hour);
       //if (out) out->add ({"purchased at", to_string (hour), "for", float2string (buy_price)});
       bought_counter++;
       int sold_after_hours = 0;
       bool sold_in_time = false;
-      patterns_simulate_sale (nullptr, hour, maximum_open_order_hours, buy_price, buy_price * 1.02, hour_asks, hour_bids, sold_after_hours, sold_in_time);
+      patterns_simulate_sale (nullptr, hour, maximum_open_order_hours, buy_price, buy_price * 1.02, hours, sold_after_hours, sold_in_time);
       if (sold_in_time) {
         sold_counter++;
       }
@@ -3440,29 +3399,27 @@ void pattern_verify_executed_sell_orders (void * output)
 
 
 /*
-void pattern_angles (unordered_map <int, float> & rates, unordered_map <int, float> & angles, unsigned int window)
+void pattern_angles (const TimeSeries & rates, TimeSeries & angles, unsigned int window)
 {
-  // Find the oldest time.
-  int oldest_time = 0;
-  for (auto & element : rates) {
-    int time = element.first;
-    if (time < oldest_time) oldest_time = time;
-  }
-
   angles.clear ();
 
+  // Find the oldest time.
+  int oldest_time;
+  if (!rates.oldest (oldest_time)) return;
+  oldest_time = min (oldest_time, 0);
+
   // Iterate over the values.
   // Do not begin right at the start, but at an offset equivalent to the window size.
   // This is to get good angles right from the start, rather than wildly fluctuating angles at the start.
   for (int time = oldest_time + window; time <= 0; time++) {
     float angle, deviation;
     pattern_angle_deviation (rates, time, window, angle, deviation);
-    angles [time] = angle;
+    angles.set (time, angle, angle);
   }
 }
 
 
-void pattern_angle_deviation (unordered_map <int, float> & rates,
+void pattern_angle_deviation (const TimeSeries & rates,
                               int start, int amount,
                               float & angle, float & deviation)
 {
@@ -3471,7 +3428,7 @@ void pattern_angle_deviation (unordered_map <int, float> & rates,
   float previousvalue = 0;
   for (int i = 0 - amount; i <= 0; i++) {
     int time = start + i;
-    float value = rates [time];
+    float value = rates.ask (time);
     if (value == 0) value = previousvalue;
     previousvalue = value;
     values.push_back (value);
@@ -3579,9 +3536,10 @@ vector <pair <float, float> > chart_rates (string exchange, string market, strin
     int starting_second = seconds_since_epoch () - (days * 3600 * 24);
     
     // Storage for the rates.
+    // Read only the rates from the starting second onwards.
     vector <int> seconds;
     vector <float> bids, asks;
-    allrates_get (exchange, market, coin, seconds, bids, asks);
+    allrates_get (exchange, market, coin, starting_second, seconds, bids, asks);
     
     // Iterate over the data to generate the data points.
     for (unsigned int i = 0; i < seconds.size (); i++) {
@@ -3613,17 +3571,15 @@ vector <pair <float, float> > chart_rates (string exchange, string market, strin
     
     // Get the rates of the coin on the Bitcoin market.
     to_output output ("");
-    unordered_map <int, float> bitcoin_minute_asks, bitcoin_minute_bids, bitcoin_hour_asks, bitcoin_hour_bids;
-    pattern_prepare (&output, exchange, bitcoin_id (), coin,
-                     bitcoin_minute_asks, bitcoin_minute_bids, bitcoin_hour_asks, bitcoin_hour_bids);
+    TimeSeries bitcoin_minutes, bitcoin_hours;
+    pattern_prepare (&output, exchange, bitcoin_id (), coin, bitcoin_minutes, bitcoin_hours);
     
     // Get the rates of the Bitcoin on the desired market.
-    unordered_map <int, float> market_minute_asks, market_minute_bids, market_hour_asks, market_hour_bids;
+    TimeSeries market_minutes, market_hours;
     vector <string> exchanges = exchange_get_names ();
     for (auto exchange : exchanges) {
       if (!allrates_exists (exchange, market, bitcoin_id ())) continue;
-      pattern_prepare (&output, exchange, market, bitcoin_id (),
-                       market_minute_asks, market_minute_bids, market_hour_asks, market_hour_bids);
+      pattern_prepare (&output, exchange, market, bitcoin_id (), market_minutes, market_hours);
       break;
     }
     
@@ -3641,8 +3597,8 @@ vector <pair <float, float> > chart_rates (string exchange, string market, strin
       float x = day;
       
       // The rate of the coin will be on the Y-axis.
-      float coin_btc_rate = (bitcoin_minute_bids[i] + bitcoin_minute_asks[i]) / 2;
-      float btc_market_rate = (market_minute_bids[i] + market_minute_asks[i]) / 2;
+      float coin_btc_rate = (bitcoin_minutes.bid (i) + bitcoin_minutes.ask (i)) / 2;
+      float btc_market_rate = (market_minutes.bid (i) + market_minutes.ask (i)) / 2;
       float y = coin_btc_rate * btc_market_rate;
       
       // If the conversion did not work, don't store this data point.
@@ -3740,6 +3696,53 @@ unordered_map <string, unordered_map <string, float> > cached_approximate_rates_
 unordered_map <string, unordered_map <string, float> > cached_approximate_rates_seconds_asks;
 
 
+// Stores the market summaries for the $exchange and $market in the memory cache.
+void cached_approximate_rates_store (const string & exchange, const string & market,
+                                     const vector <string> & coins,
+                                     const vector <float> & bids,
+                                     const vector <float> & asks)
+{
+  string key = exchange + market;
+
+  // Multiple threads can access the lookup containers simultaneously.
+  cached_approximate_rates_mutex.lock ();
+  
+  // Clear containers here.
+  // So if the exchange provided no rates, due to an error,
+  // the containers won't contain outdated rates.
+  // And since the age is stil stored for this exchange and market,
+  // the exchange won't be overloaded with multiple queries to retry.
+  cached_approximate_rates_seconds_bids[key].clear();
+  cached_approximate_rates_seconds_asks[key].clear();
+  
+  // Store the rates in the fast lookup containers.
+  for (unsigned int i = 0; i < coins.size(); i++) {
+    string coin = coins[i];
+    cached_approximate_rates_seconds_bids [key][coin] = bids[i];
+    cached_approximate_rates_seconds_asks [key][coin] = asks[i];
+  }
+  
+  // Record the new age of this lot of rates.
+  cached_approximate_rates_seconds [key] = seconds_since_epoch ();
+  
+  cached_approximate_rates_mutex.unlock ();
+}
+
+
+// Fetches fresh market summaries for all the given $exchanges and $markets in one go,
+// and stores them in the memory cache.
+// This is faster than letting get_cached_approximate_rate fetch them one market at a time.
+void refresh_cached_approximate_rates (const vector <string> & exchanges, const vector <string> & markets)
+{
+  vector <vector <string> > coins;
+  vector <vector <float> > bids, asks;
+  exchange_get_market_summaries_via_satellite (exchanges, markets, coins, bids, asks);
+  for (size_t i = 0; i < exchanges.size (); i++) {
+    cached_approximate_rates_store (exchanges [i], markets [i], coins [i], bids [i], asks [i]);
+  }
+}
+
+
 // This uses a memory cache and a timing mechanism.
 // It gets the current stored rates.
 // If a rate is outdated, it gets updated values from the exchange.
@@ -3768,28 +3771,8 @@ bool get_cached_approximate_rate (const string & exchange, const string & market
     vector <float> asks;
     exchange_get_market_summaries_via_satellite (exchange, market, coins, bids, asks);
     
-    // Multiple threads can access the lookup containers simultaneously.
-    cached_approximate_rates_mutex.lock ();
-    
-    // Clear containers here.
-    // So if the exchange provided no rates, due to an error,
-    // the containers won't contain outdated rates.
-    // And since the age is stil stored for this exchange and market,
-    // the exchange won't be overloaded with multiple queries to retry.
-    cached_approximate_rates_seconds_bids[key].clear();
-    cached_approximate_rates_seconds_asks[key].clear();
-    
-    // Store the rates in the fast lookup containers.
-    for (unsigned int i = 0; i < coins.size(); i++) {
-      string coin = coins[i];
-      cached_approximate_rates_seconds_bids [key][coin] = bids[i];
-      cached_approximate_rates_seconds_asks [key][coin] = asks[i];
-    }
-    
-    // Record the new age of this lot of rates.
-    cached_approximate_rates_seconds [key] = seconds_since_epoch ();
-    
-    cached_approximate_rates_mutex.unlock ();
+    // Store them in the memory cache.
+    cached_approximate_rates_store (exchange, market, coins, bids, asks);
   }
   
   // Get the rates from memory.
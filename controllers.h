@@ -110,40 +110,30 @@ void pattern_prepare (void * output,
                       const vector <int> & seconds,
                       const vector <float> & asks,
                       const vector <float> & bids,
-                      unordered_map <int, float> & minute_asks,
-                      unordered_map <int, float> & minute_bids,
-                      unordered_map <int, float> & hour_asks,
-                      unordered_map <int, float> & hour_bids);
+                      TimeSeries & minutes,
+                      TimeSeries & hours);
 void pattern_prepare (void * output,
                       const string & exchange, const string & market, const string & coin,
-                      unordered_map <int, float> & minute_asks,
-                      unordered_map <int, float> & minute_bids,
-                      unordered_map <int, float> & hour_asks,
-                      unordered_map <int, float> & hour_bids);
+                      TimeSeries & minutes,
+                      TimeSeries & hours);
 void pattern_prepare (void * output,
                       const string & exchange, const string & market, const string & coin,
                       int hours,
-                      unordered_map <int, float> & minute_asks,
-                      unordered_map <int, float> & minute_bids,
-                      unordered_map <int, float> & hour_asks,
-                      unordered_map <int, float> & hour_bids);
-void pattern_smooth (unordered_map <int, float> & asks, unordered_map <int, float> & bids,
-                     unordered_map <int, float> & smoothed_rates, unsigned int window);
-float pattern_change (unordered_map <int, float> & asks, unordered_map <int, float> & bids, int start, int window);
-bool pattern_coin_has_regular_recent_price_movements (unordered_map <int, float> & hour_asks,
-                                                      unordered_map <int, float> & hour_bids);
-void patterns_simulate_sale (int buy_time, int max_open_time,
+                      TimeSeries & minutes,
+                      TimeSeries & hour_series);
+void pattern_smooth (const TimeSeries & rates, TimeSeries & smoothed_rates, unsigned int window);
+float pattern_change (const TimeSeries & rates, int start, int window);
+bool pattern_coin_has_regular_recent_price_movements (const TimeSeries & hours);
+void patterns_simulate_sale (void * output,
+                             int buy_time, int max_open_time,
                              float buy_price, float sell_price,
-                             unordered_map <int, float> & time_asks,
-                             unordered_map <int, float> & time_bids,
+                             const TimeSeries & rates,
                              int & real_open_time, bool & sold_in_time);
 bool pattern_increase_day_week_detector (void * output,
                                          int detection_hour,
-                                         unordered_map <int, float> & hour_asks,
-                                         unordered_map <int, float> & hour_bids);
+                                         const TimeSeries & hours);
 bool pattern_increase_day_week_simulator (void * output,
-                                          unordered_map <int, float> & hour_asks,
-                                          unordered_map <int, float> & hour_bids,
+                                          const TimeSeries & hours,
                                           const string & reason);
 vector <pair <float, float> > chart_balances (vector <string> exchanges,
                                               string coin,
@@ -154,6 +144,7 @@ vector <pair <float, float> > chart_rates (string exchange, string market, strin
 bool locate_trade_order_id (void * output,
                             const string & exchange, const string & market, const string & coin, float rate,
                             string & order_id);
+void refresh_cached_approximate_rates (const vector <string> & exchanges, const vector <string> & markets);
 bool get_cached_approximate_rate (const string & exchange, const string & market, const string & coin,
                                   float & ask, float & bid);
 bool get_cached_approximate_buyers (const string & exchange,
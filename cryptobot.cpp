@@ -801,9 +801,8 @@ void individual_pattern_based_trader (const string & exchange, const string & ma
   if (paused) return;
   
   // Prepare the rates for use.
-  unordered_map <int, float> minute_asks, minute_bids, hour_asks, hour_bids;
-  pattern_prepare (nullptr, exchange, market, coin,
-                   minute_asks, minute_bids, hour_asks, hour_bids);
+  TimeSeries minutes, hours;
+  pattern_prepare (nullptr, exchange, market, coin, minutes, hours);
   
   // Deal with one type of pattern.
   if (reason == pattern_type_increase_day_week ()) {
@@ -811,13 +810,13 @@ void individual_pattern_based_trader (const string & exchange, const string & ma
     // If the rates have not yet been stored, the rate for the current minute can be zero.
     // If that's the case, bail out right here.
     // The rate for the current minute will be available shortly.
-    if (hour_bids [0] == 0) return;
-    if (minute_bids [0] == 0) return;
+    if (hours.bid (0) == 0) return;
+    if (minutes.bid (0) == 0) return;
 
     // The following checks on the required pattern.
-    bool coin_good = pattern_increase_day_week_detector (nullptr, 0, hour_asks, hour_bids);
+    bool coin_good = pattern_increase_day_week_detector (nullptr, 0, hours);
     if (coin_good) {
-      float buy_price = minute_asks [0];
+      float buy_price = minutes.ask (0);
       // pattern_place_buy_order (exchange, market, coin, buy_price, current_available_balances, update_mutex, minimum_trade_sizes, reason, paused_trading_exchanges_markets_coins);
     }
   }
@@ -58,25 +58,19 @@ int main (int argc, char *argv[])
       vector <float> front_total, front_btc, front_euro;
       if (most_recent_downloaded_second >= 0) {
         sql_front.clear ();
-        sql_front.add ("SELECT * FROM balances WHERE seconds >=");
+        sql_front.add ("SELECT seconds, stamp, exchange, coin, total, btc, euro FROM balances WHERE seconds >=");
         sql_front.add (most_recent_downloaded_second);
         sql_front.add ("ORDER BY id;");
-        map <string, vector <string> > result = sql_front.query ();
-        vector <string> seconds = result ["seconds"];
-        vector <string> stamp = result ["stamp"];
-        vector <string> exchange = result ["exchange"];
-        vector <string> coin = result ["coin"];
-        vector <string> total = result ["total"];
-        vector <string> btc = result ["btc"];
-        vector <string> euro = result ["euro"];
-        for (size_t i = 0; i < seconds.size(); i++) {
-          front_seconds.push_back (str2int (seconds[i]));
-          front_stamp.push_back (stamp[i]);
-          front_exchange.push_back (exchange[i]);
-          front_coin.push_back (coin[i]);
-          front_total.push_back (str2float (total[i]));
-          front_btc.push_back (str2float (btc[i]));
-          front_euro.push_back (str2float (euro[i]));
+        if (sql_front.stream ()) {
+          while (sql_front.fetch ()) {
+            front_seconds.push_back (sql_front.column_int (0));
+            front_stamp.push_back (sql_front.column_text (1));
+            front_exchange.push_back (sql_front.column_text (2));
+            front_coin.push_back (sql_front.column_text (3));
+            front_total.push_back (sql_front.column_float (4));
+            front_btc.push_back (sql_front.column_float (5));
+            front_euro.push_back (sql_front.column_float (6));
+          }
         }
       }
       to_tty ({"Downloaded new balances", to_string (front_seconds.size())});
@@ -101,37 +95,33 @@ int main (int argc, char *argv[])
       // Iterate over the new balances at the front bot,
       // check if an item is already stored at the back bot,
       // and store the relevant items at the back bot.
+      // The balances are stored with multi-row statements.
       int stored_balances_count = 0;
-      for (size_t i = 0; i < front_seconds.size(); i++) {
-        int seconds = front_seconds [i];
-        string stamp = front_stamp [i];
-        string exchange = front_exchange[i];
-        string coin = front_coin[i];
-        float total = front_total[i];
-        float btc = front_btc[i];
-        float euro = front_euro [i];
-        string key = exchange + coin;
-        bool stored = (seconds == most_recent_downloaded_second) && in_array (key, back_exchanges_plus_coins);
-        if (!stored) {
-          sql_back.clear ();
-          sql_back.add ("INSERT INTO balances (seconds, stamp, exchange, coin, total, btc, euro) VALUES (");
-          sql_back.add (seconds);
-          sql_back.add (",");
-          sql_back.add (stamp);
-          sql_back.add (",");
-          sql_back.add (exchange);
-          sql_back.add (",");
-          sql_back.add (coin);
-          sql_back.add (",");
-          sql_back.add (total);
-          sql_back.add (",");
-          sql_back.add (btc);
-          sql_back.add (",");
-          sql_back.add (euro);
-          sql_back.add (");");
-          sql_back.execute ();
-          stored_balances_count++;
+      {
+        SQLInsert insert (sql_back, "INSERT INTO balances (seconds, stamp, exchange, coin, total, btc, euro) VALUES");
+        for (size_t i = 0; i < front_seconds.size(); i++) {
+          int seconds = front_seconds [i];
+          string stamp = front_stamp [i];
+          string exchange = front_exchange[i];
+          string coin = front_coin[i];
+          float total = front_total[i];
+          float btc = front_btc[i];
+          float euro = front_euro [i];
+          string key = exchange + coin;
+          bool stored = (seconds == most_recent_downloaded_second) && in_array (key, back_exchanges_plus_coins);
+          if (!stored) {
+            insert.row ();
+            insert.add (seconds);
+            insert.add (stamp);
+            insert.add (exchange);
+            insert.add (coin);
+            insert.add (total);
+            insert.add (btc);
+            insert.add (euro);
+            stored_balances_count++;
+          }
         }
+        insert.flush ();
       }
       to_stdout ({"Stored", to_string (stored_balances_count), "new coin balances at the back bot"});
       
@@ -158,10 +148,10 @@ int main (int argc, char *argv[])
       availables_get (sql_front, ids, stamps, seconds, sellers, buyers, markets, coins, bidsizes, asksizes, realizeds);
       to_stdout ({"Downloaded", to_string (ids.size()), "new arbitrage quantities from the front bot"});
       // Store the downloaded data at the back bot and remove it from the front bot.
-      for (size_t i = 0; i < ids.size(); i++) {
-        availables_store (sql_back, stamps[i], seconds[i], sellers[i], buyers[i], markets[i], coins[i], bidsizes[i], asksizes[i], realizeds[i]);
-        availables_delete (sql_front, ids[i]);
-      }
+      // It used to store and delete them one by one.
+      // Now it stores them all in a few multi-row statements, and then deletes them in a few statements.
+      availables_store (sql_back, stamps, seconds, sellers, buyers, markets, coins, bidsizes, asksizes, realizeds);
+      availables_delete (sql_front, ids);
       to_stdout ({"Stored", to_string (ids.size()), "new arbitrage quantities at the back bot"});
     }
   }
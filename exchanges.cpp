@@ -36,6 +36,11 @@
 mutex exchange_hurried_mutex;
 unordered_map <string, int> exchange_hurried_call_pass;
 unordered_map <string, int> exchange_hurried_call_fail;
+// Whether to hedge the hurried requests for order books.
+bool exchange_hedging = true;
+// For each exchange, the number of hedged requests, and how often the second satellite won.
+unordered_map <string, int> exchange_hedged_calls;
+unordered_map <string, int> exchange_hedge_wins;
 
 
 vector <string> exchange_get_names ()
@@ -629,29 +634,36 @@ void exchange_get_market_summaries (string exchange, string market,
 }
 
 
-void exchange_get_market_summaries_via_satellite (const string & exchange, const string & market,
-                                                  vector <string> & coins,
-                                                  vector <float> & bids,
-                                                  vector <float> & asks)
+// Interprets the market summaries the $satellite returned after $milliseconds.
+void exchange_interpret_market_summaries_via_satellite (const string & exchange, const string & market,
+                                                        const string & satellite, long milliseconds,
+                                                        const string & summaries, string error,
+                                                        vector <string> & coins,
+                                                        vector <float> & bids,
+                                                        vector <float> & asks)
 {
-  // Assemble the call to the satellite.
-  vector <string> call = { "summaries", exchange, market };
-  
-  // Call the satellite.
-  string error;
-  string summaries = satellite_request (satellite_get (exchange), implode (call, " "), false, error);
-
   // Sample contents:
   // lumen 0.0000470000 0.0000471300
   // magi 0.0000551100 0.0000555000
   // monero 0.0268538408 0.0269063301
 
+  // Only a failure to get a response from the satellite counts against the satellite.
+  // An error from the exchange, like an unknown market, a rate limit, or an outage,
+  // would be the same whatever satellite relayed it.
+  bool delivered = error.empty ();
+
   // Interpret the response.
-  vector <string> lines = explode (summaries, '\n');
+  vector <string> lines;
+  if (!satellite_binary_reply (summaries)) lines = explode (summaries, '\n');
 
+  // A binary response needs no parsing.
+  if (satellite_binary_reply (summaries)) {
+    satellite_decode_summaries (summaries, exchange, market, coins, bids, asks, error);
+  }
+  
   // First error handler:
   // If the satellite returns one line only, this will be the error.
-  if (lines.size () == 1) {
+  else if (lines.size () == 1) {
     error.append (summaries);
   }
   
@@ -674,8 +686,65 @@ void exchange_get_market_summaries_via_satellite (const string & exchange, const
     }
   }
   
+  // Satellite selection statistics.
+  satellite_record (satellite, exchange, milliseconds, delivered, false);
+  
   // Error handler.
-  to_stdout (exchange_format_error (error, __FUNCTION__, exchange, market, "", ""));
+  to_stdout (exchange_format_error (error, "exchange_get_market_summaries_via_satellite", exchange, market, "", ""));
+}
+
+
+void exchange_get_market_summaries_via_satellite (const string & exchange, const string & market,
+                                                  vector <string> & coins,
+                                                  vector <float> & bids,
+                                                  vector <float> & asks)
+{
+  // Assemble the call to the satellite.
+  vector <string> call = { "summaries", exchange, market };
+  
+  // Call the satellite.
+  string satellite = satellite_get (exchange);
+  string error;
+  long start = milliseconds_since_epoch ();
+  string summaries = satellite_request (satellite, satellite_binary_request (implode (call, " ")), false, error);
+  long milliseconds = milliseconds_since_epoch () - start;
+
+  // Interpret the response.
+  exchange_interpret_market_summaries_via_satellite (exchange, market, satellite, milliseconds,
+                                                     summaries, error, coins, bids, asks);
+}
+
+
+// Gets the market summaries for all the given $exchanges and $markets in one go.
+// The satellite requests run simultaneously, without a thread per request.
+void exchange_get_market_summaries_via_satellite (const vector <string> & exchanges,
+                                                  const vector <string> & markets,
+                                                  vector <vector <string> > & coins,
+                                                  vector <vector <float> > & bids,
+                                                  vector <vector <float> > & asks)
+{
+  // Assemble the calls to the satellites.
+  vector <satellite_call> calls;
+  for (size_t i = 0; i < exchanges.size (); i++) {
+    satellite_call call;
+    call.host = satellite_get (exchanges [i]);
+    call.request = satellite_binary_request ("summaries " + exchanges [i] + " " + markets [i]);
+    calls.push_back (call);
+  }
+
+  // Call the satellites.
+  satellite_request_multi (calls);
+  
+  // Interpret the responses.
+  coins.assign (calls.size (), {});
+  bids.assign (calls.size (), {});
+  asks.assign (calls.size (), {});
+  for (size_t i = 0; i < calls.size (); i++) {
+    exchange_interpret_market_summaries_via_satellite (exchanges [i], markets [i],
+                                                       calls[i].host, calls[i].milliseconds,
+                                                       calls[i].response, calls[i].error,
+                                                       coins [i], bids [i], asks [i]);
+  }
 }
 
 
@@ -716,41 +785,49 @@ void exchange_get_buyers (string exchange,
 }
 
 
-void exchange_get_buyers_via_satellite (string exchange,
-                                        string market,
-                                        string coin,
-                                        vector <float> & quantities,
-                                        vector <float> & rates,
-                                        bool hurry,
-                                        void * output)
+// Interprets the buyers or sellers the $satellite returned after $milliseconds.
+// It handles the errors and records the statistics of the hurried calls.
+void exchange_interpret_order_book_via_satellite (const string & function,
+                                                  const string & exchange,
+                                                  const string & market,
+                                                  const string & coin,
+                                                  const string & satellite,
+                                                  long milliseconds,
+                                                  const string & response,
+                                                  string error,
+                                                  vector <float> & quantities,
+                                                  vector <float> & rates,
+                                                  bool hurry,
+                                                  void * output)
 {
   // Clear the containers, to start off.
   quantities.clear ();
   rates.clear ();
-  
-  // Assemble the call to the satellite.
-  vector <string> call = { "buyers", exchange, market, coin };
-
-  // Call the satellite.
-  string satellite = satellite_get (exchange);
-  string error;
-  string buyers = satellite_request (satellite, implode (call, " "), hurry, error);
 
   // Sample contents:
   // 1260.0000000000 0.0000003500
   // 164.7058868408 0.0000003400
   // 189.1515197754 0.0000003300
 
+  // Only a failure to get a response from the satellite counts against the satellite.
+  bool delivered = error.empty ();
+
   // Interpret the response.
-  vector <string> lines = explode (buyers, '\n');
+  vector <string> lines;
+  if (!satellite_binary_reply (response)) lines = explode (response, '\n');
+  
+  // A binary response needs no parsing.
+  if (satellite_binary_reply (response)) {
+    satellite_decode_order_book (response, exchange, market, coin, quantities, rates, error);
+  }
   
   // First error handler:
   // If the satellite returns one line only, this will be the error.
   // But if that single line contains floats only,
   // it means that the order book consists of one entry only,
   // and that is no error.
-  if ((lines.size () == 1) && (!has_floats_only (lines[0]))) {
-    error.append (buyers);
+  else if ((lines.size () == 1) && (!has_floats_only (lines[0]))) {
+    error.append (response);
   }
   
   // No error: Parse the response.
@@ -769,13 +846,16 @@ void exchange_get_buyers_via_satellite (string exchange,
     }
   }
 
+  // Satellite selection statistics.
+  satellite_record (satellite, exchange, milliseconds, delivered, hurry);
+  
   // Error handler.
   // Send it to either the stand-alone output, or to the bundled output.
   if (output) {
     to_output * out = (to_output *) output;
-    out->add (exchange_format_error (error, __FUNCTION__, exchange, market, coin, satellite));
+    out->add (exchange_format_error (error, function, exchange, market, coin, satellite));
   } else {
-    to_stdout (exchange_format_error (error, __FUNCTION__, exchange, market, coin, satellite));
+    to_stdout (exchange_format_error (error, function, exchange, market, coin, satellite));
   }
   
   // Hurried call statistics.
@@ -791,6 +871,96 @@ void exchange_get_buyers_via_satellite (string exchange,
 }
 
 
+// Sends a $request for an order book at the $exchange to a satellite.
+// It gives the $satellite that responded, and how many $milliseconds that took.
+// A hurried request is hedged:
+// If the response takes longer than nine out of ten responses took recently,
+// the request also goes out to a second satellite, and the first response wins.
+string exchange_order_book_request (const string & exchange, const string & request, bool hurry,
+                                    string & satellite, string & error, long & milliseconds)
+{
+  satellite = satellite_get (exchange);
+  long delay = satellite_latency_percentile (exchange, 90);
+  string response;
+  if (!hurry || !exchange_hedging || !delay) {
+    long start = milliseconds_since_epoch ();
+    response = satellite_request (satellite, satellite_binary_request (request), hurry, error);
+    milliseconds = milliseconds_since_epoch () - start;
+    return response;
+  }
+  // The hedge is only chosen when it is about to be sent.
+  // Choosing it earlier would start probing a satellite that was left out,
+  // and if no hedge went out, that satellite would never get probed.
+  string primary = satellite;
+  auto hedge_get = [&] {
+    return satellite_get (exchange, primary);
+  };
+  satellite_hedge_outcome primary_outcome, hedge_outcome;
+  response = satellite_request_hedged (primary, hedge_get, satellite_binary_request (request), hurry, delay,
+                                       error, satellite, primary_outcome, hedge_outcome);
+  exchange_hurried_mutex.lock ();
+  if (!hedge_outcome.host.empty ()) exchange_hedged_calls [exchange]++;
+  if (satellite != primary) exchange_hedge_wins [exchange]++;
+  exchange_hurried_mutex.unlock ();
+  // The caller records how it went at the winning satellite.
+  // Record the other one here, if it responded by now.
+  // A request that is still on its way says nothing yet about the satellite.
+  satellite_hedge_outcome & winner = (satellite == primary) ? primary_outcome : hedge_outcome;
+  satellite_hedge_outcome & loser = (satellite == primary) ? hedge_outcome : primary_outcome;
+  if (loser.completed) satellite_record (loser.host, exchange, loser.milliseconds, loser.succeeded, true);
+  milliseconds = winner.milliseconds;
+  return response;
+}
+
+
+// Enables or disables hedging the hurried requests for order books.
+void exchange_set_hedging (bool enabled)
+{
+  exchange_hedging = enabled;
+}
+
+
+int exchange_get_hedged_calls (const string & exchange)
+{
+  exchange_hurried_mutex.lock ();
+  int count = exchange_hedged_calls [exchange];
+  exchange_hurried_mutex.unlock ();
+  return count;
+}
+
+
+int exchange_get_hedge_wins (const string & exchange)
+{
+  exchange_hurried_mutex.lock ();
+  int count = exchange_hedge_wins [exchange];
+  exchange_hurried_mutex.unlock ();
+  return count;
+}
+
+
+void exchange_get_buyers_via_satellite (string exchange,
+                                        string market,
+                                        string coin,
+                                        vector <float> & quantities,
+                                        vector <float> & rates,
+                                        bool hurry,
+                                        void * output)
+{
+  // Assemble the call to the satellite.
+  vector <string> call = { "buyers", exchange, market, coin };
+
+  // Call the satellite.
+  string satellite;
+  string error;
+  long milliseconds;
+  string buyers = exchange_order_book_request (exchange, implode (call, " "), hurry, satellite, error, milliseconds);
+
+  // Interpret the response.
+  exchange_interpret_order_book_via_satellite (__FUNCTION__, exchange, market, coin, satellite, milliseconds,
+                                               buyers, error, quantities, rates, hurry, output);
+}
+
+
 void exchange_get_sellers (string exchange,
                            string market,
                            string coin,
@@ -836,69 +1006,185 @@ void exchange_get_sellers_via_satellite (string exchange,
                                          bool hurry,
                                          void * output)
 {
-  // Clear the containers, to start off.
-  quantities.clear ();
-  rates.clear ();
-
   // Assemble the call to the satellite.
   vector <string> call = { "sellers", exchange, market, coin };
   
   // Call the satellite.
-  string satellite = satellite_get (exchange);
+  string satellite;
   string error;
-  string buyers = satellite_request (satellite, implode (call, " "), hurry, error);
-  
-  // Sample contents:
-  // 1260.0000000000 0.0000003500
-  // 164.7058868408 0.0000003400
-  // 189.1515197754 0.0000003300
+  long milliseconds;
+  string sellers = exchange_order_book_request (exchange, implode (call, " "), hurry, satellite, error, milliseconds);
   
   // Interpret the response.
-  vector <string> lines = explode (buyers, '\n');
-  
-  // First error handler:
-  // If the satellite returns one line only, this will be the error.
-  // But if that single line contains floats only,
-  // it means that the order book consists of one entry only,
-  // and that is no error.
-  if ((lines.size () == 1) && (!has_floats_only (lines[0]))) {
-    error.append (buyers);
+  exchange_interpret_order_book_via_satellite (__FUNCTION__, exchange, market, coin, satellite, milliseconds,
+                                               sellers, error, quantities, rates, hurry, output);
+}
+
+
+// A batch request to the satellite should not exceed the satellite's limit on the length of a request.
+#define EXCHANGE_SATELLITE_BATCH_LENGTH 1000
+
+
+// Gets all the order $books in one go.
+// It sends one batch request per satellite, so it takes one round trip only.
+// The satellite gets the order books simultaneously.
+// The order books an older satellite cannot give in a batch, are fetched one by one.
+// A hurried batch is hedged like a hurried request for a single order book.
+// Then each batch holds the order books of one exchange only,
+// so it gets the delay and the second satellite for that exchange.
+void exchange_get_order_books_via_satellite (vector <exchange_order_book> & books,
+                                             bool hurry,
+                                             void * output)
+{
+  // The tuples and the satellites of the order books.
+  vector <string> tuples, satellites;
+  for (auto & book : books) {
+    string type = book.buyers ? "buyers" : "sellers";
+    tuples.push_back (type + " " + book.exchange + " " + book.market + " " + book.coin);
+    satellites.push_back (satellite_get (book.exchange));
   }
   
-  // No error: Parse the response.
-  else {
-    for (auto & line : lines) {
-      vector <string> words = explode (line, ' ');
-      if (words.size () == 2) {
-        float quantity = str2float (words[0]);
-        float rate = str2float (words[1]);
-        quantities.push_back (quantity);
-        rates.push_back (rate);
-      } else {
-        if (!error.empty ()) error.append (" ");
-        error.append (line);
+  // Assemble the batches, one or more for each satellite.
+  bool hedge = hurry && exchange_hedging;
+  vector <satellite_call> calls;
+  vector <string> call_exchanges;
+  vector <size_t> batches;
+  for (size_t i = 0; i < books.size (); i++) {
+    int batch = -1;
+    for (size_t c = 0; c < calls.size (); c++) {
+      if (calls[c].host != satellites [i]) continue;
+      if (hedge && (call_exchanges [c] != books[i].exchange)) continue;
+      if (calls[c].request.size () + tuples [i].size () + 1 > EXCHANGE_SATELLITE_BATCH_LENGTH) continue;
+      batch = c;
+    }
+    if (batch >= 0) {
+      calls[batch].request.append (";" + tuples [i]);
+    } else {
+      satellite_call call;
+      call.host = satellites [i];
+      call.request = "batch " + tuples [i];
+      call.hurry = hurry;
+      call.persistent = true;
+      if (hedge) {
+        string exchange = books[i].exchange;
+        string primary = satellites [i];
+        call.hedge_delay = satellite_latency_percentile (exchange, 90);
+        call.hedge_get = [exchange, primary] {
+          return satellite_get (exchange, primary);
+        };
       }
+      batch = calls.size ();
+      calls.push_back (call);
+      call_exchanges.push_back (books[i].exchange);
     }
+    batches.push_back (batch);
   }
   
-  // Error handler.
-  // Send it to either the stand-alone output, or to the bundled output.
-  if (output) {
-    to_output * out = (to_output *) output;
-    out->add (exchange_format_error (error, __FUNCTION__, exchange, market, coin, satellite));
-  } else {
-    to_stdout (exchange_format_error (error, __FUNCTION__, exchange, market, coin, satellite));
-  }
+  // Call the satellites.
+  satellite_request_multi (calls);
   
-  // Hurried call statistics.
-  if (hurry) {
+  // The hedging statistics.
+  // The order books are recorded with the satellite that gave them.
+  // Record the other satellite here, if it responded by now.
+  for (size_t c = 0; c < calls.size (); c++) {
+    satellite_call & call = calls [c];
+    if (call.hedge_outcome.host.empty ()) continue;
+    string exchange = call_exchanges [c];
     exchange_hurried_mutex.lock ();
-    if (error.empty ()) {
-      exchange_hurried_call_pass [exchange]++;
+    exchange_hedged_calls [exchange]++;
+    if (call.winner != call.host) exchange_hedge_wins [exchange]++;
+    exchange_hurried_mutex.unlock ();
+    satellite_hedge_outcome & loser = (call.winner == call.host) ? call.hedge_outcome : call.primary_outcome;
+    if (loser.completed) satellite_record (loser.host, exchange, loser.milliseconds, loser.succeeded, true);
+  }
+  for (size_t i = 0; i < books.size (); i++) {
+    satellites [i] = calls[batches [i]].winner;
+  }
+  
+  // Collect the order books from the batches.
+  map <string, string> responses;
+  for (auto & call : calls) {
+    satellite_decode_batch (call.response, responses);
+  }
+  
+  // Get the order books missing from the batches one by one.
+  // This is the case with an older satellite, or if the persistent connection broke.
+  // If the batch timed out, there's no time left to try again.
+  string timeout = "Receiving: " + string (strerror (ETIMEDOUT));
+  vector <string> errors (books.size ());
+  vector <long> milliseconds (books.size ());
+  vector <satellite_call> single_calls;
+  vector <size_t> single_books;
+  for (size_t i = 0; i < books.size (); i++) {
+    milliseconds [i] = calls[batches [i]].milliseconds;
+    if (responses.count (tuples [i])) continue;
+    if (calls[batches [i]].error == timeout) {
+      errors [i] = timeout;
+      continue;
+    }
+    satellite_call call;
+    call.host = satellites [i];
+    call.request = satellite_binary_request (tuples [i]);
+    call.hurry = hurry;
+    single_calls.push_back (call);
+    single_books.push_back (i);
+  }
+  satellite_request_multi (single_calls);
+  for (size_t i = 0; i < single_calls.size (); i++) {
+    responses [tuples [single_books [i]]] = single_calls[i].response;
+    errors [single_books [i]] = single_calls[i].error;
+    milliseconds [single_books [i]] += single_calls[i].milliseconds;
+  }
+  
+  // Interpret the responses.
+  for (size_t i = 0; i < books.size (); i++) {
+    exchange_order_book & book = books [i];
+    string function = book.buyers ? "exchange_get_buyers_via_satellite" : "exchange_get_sellers_via_satellite";
+    exchange_interpret_order_book_via_satellite (function, book.exchange, book.market, book.coin,
+                                                 satellites [i], milliseconds [i],
+                                                 responses [tuples [i]], errors [i],
+                                                 book.quantities, book.rates, hurry, output);
+  }
+}
+
+
+// Gets the buyers and the sellers of the $coin at the $market at all the $exchanges in one go.
+// This keeps the snapshots of the buyers and of the sellers as close together in time as possible.
+void exchange_get_buyers_sellers_via_satellite (const vector <string> & exchanges,
+                                                const string & market,
+                                                const string & coin,
+                                                map <string, vector <float> > & buyer_quantities,
+                                                map <string, vector <float> > & buyer_rates,
+                                                map <string, vector <float> > & seller_quantities,
+                                                map <string, vector <float> > & seller_rates,
+                                                bool hurry,
+                                                void * output)
+{
+  // The buyers and the sellers for each exchange.
+  vector <exchange_order_book> books;
+  for (auto & exchange : exchanges) {
+    for (auto buyers : { true, false }) {
+      exchange_order_book book;
+      book.exchange = exchange;
+      book.market = market;
+      book.coin = coin;
+      book.buyers = buyers;
+      books.push_back (book);
+    }
+  }
+  
+  // Get them all in one round trip.
+  exchange_get_order_books_via_satellite (books, hurry, output);
+  
+  // Store them.
+  for (auto & book : books) {
+    if (book.buyers) {
+      buyer_quantities [book.exchange] = book.quantities;
+      buyer_rates [book.exchange] = book.rates;
     } else {
-      exchange_hurried_call_fail [exchange]++;
+      seller_quantities [book.exchange] = book.quantities;
+      seller_rates [book.exchange] = book.rates;
     }
-    exchange_hurried_mutex.unlock ();
   }
 }
 
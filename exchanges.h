@@ -59,6 +59,11 @@ void exchange_get_market_summaries_via_satellite (const string & exchange, const
                                                   vector <string> & coins,
                                                   vector <float> & bids,
                                                   vector <float> & asks);
+void exchange_get_market_summaries_via_satellite (const vector <string> & exchanges,
+                                                  const vector <string> & markets,
+                                                  vector <vector <string> > & coins,
+                                                  vector <vector <float> > & bids,
+                                                  vector <vector <float> > & asks);
 void exchange_get_buyers (string exchange,
                           string market,
                           string coin,
@@ -87,6 +92,28 @@ void exchange_get_sellers_via_satellite (string exchange,
                                          vector <float> & rates,
                                          bool hurry,
                                          void * output);
+class exchange_order_book
+{
+public:
+  string exchange;
+  string market;
+  string coin;
+  bool buyers = false;
+  vector <float> quantities;
+  vector <float> rates;
+};
+void exchange_get_order_books_via_satellite (vector <exchange_order_book> & books,
+                                             bool hurry,
+                                             void * output);
+void exchange_get_buyers_sellers_via_satellite (const vector <string> & exchanges,
+                                                const string & market,
+                                                const string & coin,
+                                                map <string, vector <float> > & buyer_quantities,
+                                                map <string, vector <float> > & buyer_rates,
+                                                map <string, vector <float> > & seller_quantities,
+                                                map <string, vector <float> > & seller_rates,
+                                                bool hurry,
+                                                void * output);
 void exchange_get_open_orders (string exchange,
                                vector <string> & identifier,
                                vector <string> & market,
@@ -146,6 +173,9 @@ void exchange_get_minimum_trade_amounts (const string & exchange,
                                          map <string, float> & coin_amounts);
 int exchange_get_hurried_call_passes (const string & exchange);
 int exchange_get_hurried_call_fails (const string & exchange);
+void exchange_set_hedging (bool enabled);
+int exchange_get_hedged_calls (const string & exchange);
+int exchange_get_hedge_wins (const string & exchange);
 
 
 #endif
@@ -97,6 +97,9 @@ int main (int argc, char *argv[])
         }
       }
     }
+    // The order books are now in a memory-mapped cache.
+    // Remove the databases they used to be stored in.
+    order_books_remove_databases ();
     ran_command = true;
   }
 
@@ -105,51 +108,15 @@ int main (int argc, char *argv[])
   if (in_array (rates, arguments)) {
     to_stdout ({"Removing expired rates"});
     SQL sql (front_bot_ip_address ());
+    // The rates used to be added to the rates table every minute,
+    // and this used to delete the many duplicate rates from it.
+    // The rates are now stored one per exchange/market/coin in the latestrates table.
+    // Remove rates of coins that are no longer updated, for example removed by the exchange.
     sql.clear ();
-    // Retrieve the row identifier, plus exchange/market/coin information.
-    // The rates are not relevant here for expiry purposes.
-    // Because it will expire duplicate exchange/market/coin records,
-    // regardless of their rates values.
-    sql.add ("SELECT id, exchange, market, currency FROM rates ORDER BY id;");
-    map <string, vector <string> > result = sql.query ();
-    vector <string> id = result ["id"];
-    vector <string> exchange = result ["exchange"];
-    vector <string> market = result ["market"];
-    vector <string> coin = result ["currency"];
-    // The row identifiers to delete from the database.
-    vector <int> ids_to_delete;
-    // Store distinct values for exchange/market/coin.
-    unordered_map <string, int> distinctvalues;
-    for (unsigned int i = 0; i < id.size(); i++) {
-      string key = exchange[i] + market[i] + coin[i];
-      int value = stoi (id[i]);
-      // If the exchange/market/coin was stored already,
-      // this is an old entry that can be deleted,
-      // so store its row identifier.
-      int id_to_delete = distinctvalues [key];
-      if (id_to_delete) ids_to_delete.push_back (id_to_delete);
-      // Store the new distinct exchange/markete/coin.
-      distinctvalues [key] = value;
-    }
-    // It was tried to delete 100k+ of values in one go,
-    // but this took a very long time.
-    // So the code below deletes the row identifiers
-    // in chunks of 1k a time.
-    // That gives very good performance.
-    while (!ids_to_delete.empty ()) {
-      sql.clear ();
-      sql.add ("DELETE FROM rates WHERE");
-      for (unsigned int i = 0; i < 1000; i++) {
-        if (ids_to_delete.empty ()) continue;
-        if (i) sql.add ("OR");
-        sql.add ("id =");
-        sql.add (ids_to_delete[0]);
-        ids_to_delete.erase (ids_to_delete.begin());
-      }
-      sql.add (";");
-      sql.execute ();
-    }
-    // Finally delete entries older than a few weeks.
+    sql.add ("DELETE FROM latestrates WHERE stamp < NOW() - INTERVAL 15 DAY;");
+    sql.execute ();
+    // Nothing gets added to the old rates table anymore.
+    // Expire what remains in it.
     sql.clear ();
     sql.add ("DELETE FROM rates WHERE stamp < NOW() - INTERVAL 15 DAY;");
     sql.execute ();
@@ -159,12 +159,8 @@ void website_index_generator ()
 }
 
 
-void prospective_coin_item_generator (string coin, int & thread_count)
+void prospective_coin_item_generator (string coin)
 {
-  generator_mutex.lock ();
-  thread_count++;
-  generator_mutex.unlock ();
-  
   to_tty ({coin});
 
   SQL sql_back (back_bot_ip_address ());
@@ -212,13 +208,13 @@ void prospective_coin_item_generator (string coin, int & thread_count)
     appreciation.lines.push_back ("Exchanges: " + implode (exchanges, " "));
     
     // Prepare the rates for processing them.
-    unordered_map <int, float> minute_asks, minute_bids, hour_asks, hour_bids;
-    pattern_prepare (NULL, exchange_for_graphs, bitcoin_id (), coin, minute_asks, minute_bids, hour_asks, hour_bids);
+    TimeSeries minutes, hours;
+    pattern_prepare (NULL, exchange_for_graphs, bitcoin_id (), coin, minutes, hours);
     
     // The daily / weekly / monthly change in value of the coin.
-    float change_percentage_day = pattern_change (hour_asks, hour_bids, 0, 24);
-    float change_percentage_week = pattern_change (hour_asks, hour_bids, 0, 168);
-    float change_percentage_month = pattern_change (hour_asks, hour_bids, 0, 720);
+    float change_percentage_day = pattern_change (hours, 0, 24);
+    float change_percentage_week = pattern_change (hours, 0, 168);
+    float change_percentage_month = pattern_change (hours, 0, 720);
     appreciation.lines.push_back ("Change: daily " + float2visual (change_percentage_day) + "% weekly " + float2visual (change_percentage_week) + "% monthly " + float2visual (change_percentage_month) + "%");
 
     // Create the rates graph over plenty of days.
@@ -250,11 +246,6 @@ void prospective_coin_item_generator (string coin, int & thread_count)
     valuation_map [key] = appreciation;
     generator_mutex.unlock ();
   }
-  
-  // One producer has completed.
-  generator_mutex.lock ();
-  thread_count--;
-  generator_mutex.unlock ();
 }
 
 
@@ -278,29 +269,20 @@ void prospective_coin_page_generator (int max_threads)
     }
   }
   
-  int thread_count = 0;
+  // The producers run on the thread pool, no more than $max_threads at the same time.
+  task_group producers (max_threads);
 
   // Iterate over all supported coins.
   for (auto coin : all_coins) {
   
     // static int counter = 0; counter++; if (counter > 30) continue;
     
-    // Wait till there's an available slot for this new thread.
-    while (thread_count >= max_threads) {
-      this_thread::sleep_for (chrono::milliseconds (10));
-    }
-    
-    // Start the thread.
-    new thread (prospective_coin_item_generator, coin, ref (thread_count));
-    
-    // Wait shortly to give the previously started thread time to update the thread count.
-    this_thread::sleep_for (chrono::milliseconds (1));
+    // Queue the producer.
+    producers.run ([coin] { prospective_coin_item_generator (coin); });
   }
   
-  // Wait till all threads have completed.
-  while (thread_count > 0) {
-    this_thread::sleep_for (chrono::milliseconds (10));
-  }
+  // Wait till all producers have completed.
+  producers.wait_all ();
   
   // Write the appreciation items to the html page.
   // Sorted on best appreciation at the top.
@@ -334,17 +316,13 @@ void prospective_coin_page_generator (int max_threads)
 }
 
 
-void asset_performance_coin_generator (string coin, int & thread_count)
+void asset_performance_coin_generator (string coin)
 {
   // A counter for development purposes.
   static int coins_done_count = 0;
   //if (coins_done_count >= 2) return;
   //if (coin != "vsync") return;
 
-  generator_mutex.lock ();
-  thread_count++;
-  generator_mutex.unlock ();
-
   to_tty ({coin});
 
   SQL sql_back (back_bot_ip_address ());
@@ -408,8 +386,8 @@ void asset_performance_coin_generator (string coin, int & thread_count)
     webpage.lines.push_back (balance_line);
     
     // Prepare the rates for processing.
-    unordered_map <int, float> minute_asks, minute_bids, hour_asks, hour_bids;
-    pattern_prepare (NULL, exchange_with_highest_balance, bitcoin_id (), coin, minute_asks, minute_bids, hour_asks, hour_bids);
+    TimeSeries minutes, hours;
+    pattern_prepare (NULL, exchange_with_highest_balance, bitcoin_id (), coin, minutes, hours);
     
     // Output how long ago this coin was bought and for how much.
     float bought_days_ago = 0;
@@ -424,7 +402,7 @@ void asset_performance_coin_generator (string coin, int & thread_count)
       } else {
         bought_line.append (to_string (hours_ago / 24) + " days ago ");
       }
-      float current_bid = hour_bids [0];
+      float current_bid = hours.bid (0);
       float bought_rate = bought_rates[key];
       float percentage = get_percentage_change (bought_rate, current_bid);
       float coin_balance = coin_balances [exchange];
@@ -437,9 +415,9 @@ void asset_performance_coin_generator (string coin, int & thread_count)
     }
     
     // The daily / weekly / monthly change in value of the coin.
-    float change_percentage_day = pattern_change (hour_asks, hour_bids, 0, 24);
-    float change_percentage_week = pattern_change (hour_asks, hour_bids, 0, 168);
-    float change_percentage_month = pattern_change (hour_asks, hour_bids, 0, 720);
+    float change_percentage_day = pattern_change (hours, 0, 24);
+    float change_percentage_week = pattern_change (hours, 0, 168);
+    float change_percentage_month = pattern_change (hours, 0, 720);
     webpage.lines.push_back ("Change: daily " + float2visual (change_percentage_day) + "%, weekly " + float2visual (change_percentage_week) + "%, monthly " + float2visual (change_percentage_month) + "%");
 
     // Number of days to graph.
@@ -481,11 +459,6 @@ void asset_performance_coin_generator (string coin, int & thread_count)
     valuation_map [key] = webpage;
     generator_mutex.unlock ();
   }
-  
-  // One producer has completed.
-  generator_mutex.lock ();
-  thread_count--;
-  generator_mutex.unlock ();
 }
 
 
@@ -500,27 +473,18 @@ void asset_performance_page_generator (int max_threads)
 
   SQL sql_back (back_bot_ip_address ());
   
-  int thread_count = 0;
+  // The producers run on the thread pool, no more than $max_threads at the same time.
+  task_group producers (max_threads);
   
   vector <string> coins_with_balance = balances_get_distinct_daily_coins (sql_back);
   for (auto coin : coins_with_balance) {
     
-    // Wait till there's an available slot for this new thread.
-    while (thread_count >= max_threads) {
-      this_thread::sleep_for (chrono::milliseconds (10));
-    }
-    
-    // Start the thread.
-    new thread (asset_performance_coin_generator, coin, ref (thread_count));
-    
-    // Wait shortly to give the previously started thread time to update the thread count.
-    this_thread::sleep_for (chrono::milliseconds (1));
+    // Queue the producer.
+    producers.run ([coin] { asset_performance_coin_generator (coin); });
   }
   
-  // Wait till all threads have completed.
-  while (thread_count > 0) {
-    this_thread::sleep_for (chrono::milliseconds (10));
-  }
+  // Wait till all producers have completed.
+  producers.wait_all ();
   
   // Write the depreciation items to the html page.
   // Sorted on worst depreciation at the top.
@@ -692,12 +656,8 @@ void balances_arbitrage_generator ()
 }
 
 
-void balances_coin_generator (string coin, int & thread_count)
+void balances_coin_generator (string coin)
 {
-  generator_mutex.lock ();
-  thread_count++;
-  generator_mutex.unlock ();
-
   to_tty ({coin});
 
   SQL sql_back (back_bot_ip_address ());
@@ -799,11 +759,6 @@ void balances_coin_generator (string coin, int & thread_count)
     all_balances.push_back (local_balances);
     generator_mutex.unlock ();
   }
-  
-  // One producer has completed.
-  generator_mutex.lock ();
-  thread_count--;
-  generator_mutex.unlock ();
 }
 
 
@@ -827,29 +782,20 @@ void balances_page_generator (int max_threads)
   
   SQL sql_back (back_bot_ip_address ());
 
-  int thread_count = 0;
+  // The producers run on the thread pool, no more than $max_threads at the same time.
+  task_group producers (max_threads);
 
   // Iterate over the coins that are doing arbitrage trade.
   set <string> coins_with_balance;
   for (auto coin : trading_coins) coins_with_balance.insert (coin);
   for (auto coin : coins_with_balance) {
     
-    // Wait till there's an available slot for this new thread.
-    while (thread_count >= max_threads) {
-      this_thread::sleep_for (chrono::milliseconds (10));
-    }
-    
-    // Start the thread.
-    new thread (balances_coin_generator, coin, ref (thread_count));
-    
-    // Wait shortly to give the previously started thread time to update the thread count.
-    this_thread::sleep_for (chrono::milliseconds (1));
+    // Queue the producer.
+    producers.run ([coin] { balances_coin_generator (coin); });
   }
   
-  // Wait till all threads have completed.
-  while (thread_count > 0) {
-    this_thread::sleep_for (chrono::milliseconds (10));
-  }
+  // Wait till all producers have completed.
+  producers.wait_all ();
   
   // Write the items to the html page.
   // Sorted on lowest balances at the top.
@@ -1134,7 +1080,8 @@ void arbitrage_performance_page_generator (int max_threads)
   Html html ("Performance", "");
   html.h (1, "Performance");
 
-  int thread_count = 0;
+  // The producers run on the thread pool, no more than $max_threads at the same time.
+  task_group producers (max_threads);
   
   valuation_map.clear ();
   
@@ -1146,29 +1093,23 @@ void arbitrage_performance_page_generator (int max_threads)
   vector <string> markets_done;
   for (size_t i = 0; i < trading_exchange1s.size(); i++) {
 
-    // Wait till there's an available slot for this new thread.
-    while (thread_count >= max_threads) this_thread::sleep_for (chrono::milliseconds (10));
-    
-    // Start the thread.
+    // Queue the producer.
     string exchange1 = trading_exchange1s[i];
     string exchange2 = trading_exchange2s[i];
     string market = trading_markets[i];
     string coin = trading_coins[i];
-    new thread (arbitrage_coin_performance_generator, exchange1, exchange2, market, coin, ref (thread_count));
-    
-    // Wait shortly to give the previously started thread time to update the thread count.
-    this_thread::sleep_for (chrono::milliseconds (1));
+    producers.run ([exchange1, exchange2, market, coin] { arbitrage_coin_performance_generator (exchange1, exchange2, market, coin); });
     
     // The base market may have transfer losses, so list it too, even though it has no trades.
     string key = exchange1 + exchange2 + market;
     if (!in_array (key, markets_done)) {
-      new thread (arbitrage_coin_performance_generator, exchange1, exchange2, market, market, ref (thread_count));
+      producers.run ([exchange1, exchange2, market] { arbitrage_coin_performance_generator (exchange1, exchange2, market, market); });
       markets_done.push_back (key);
     }
   }
 
-  // Wait till all threads have completed.
-  while (thread_count > 0) this_thread::sleep_for (chrono::milliseconds (10));
+  // Wait till all producers have completed.
+  producers.wait_all ();
   
   // Write the reported items to the html page.
   // Sorted on worst performing coins at the top.
@@ -1217,12 +1158,8 @@ void arbitrage_performance_page_generator (int max_threads)
 }
 
 
-void arbitrage_coin_performance_generator (string exchange1, string exchange2, string market, string coin, int & thread_count)
+void arbitrage_coin_performance_generator (string exchange1, string exchange2, string market, string coin)
 {
-  generator_mutex.lock ();
-  thread_count++;
-  generator_mutex.unlock ();
-
   to_tty ({exchange1, exchange2, market, coin});
 
   SQL sql_front (front_bot_ip_address ());
@@ -1539,11 +1476,6 @@ void arbitrage_coin_performance_generator (string exchange1, string exchange2, s
   generator_mutex.lock ();
   valuation_map [key] = textfragment;
   generator_mutex.unlock ();
-
-  // One producer has completed.
-  generator_mutex.lock ();
-  thread_count--;
-  generator_mutex.unlock ();
 }
 
 
@@ -1617,7 +1549,8 @@ void arbitrage_opportunities_page_generator (int max_threads)
     
     // List coins that can be traded with profit on exchange pairs and their markets.
     {
-      int thread_count = 0;
+      // The producers run on the thread pool, no more than $max_threads at the same time.
+      task_group producers (max_threads);
       int opportunities_count = 0;
       
       // Iterate over the opportunities, best volumes first.
@@ -1639,18 +1572,14 @@ void arbitrage_opportunities_page_generator (int max_threads)
         // The maximum obtainable volume under ideal circumstances.
         float volume = 0 - element.first;
         
-        // Wait till there's an available slot for this new thread.
-        while (thread_count >= max_threads) this_thread::sleep_for (chrono::milliseconds (10));
-        
-        // Start the thread.
-        new thread (arbitrage_coin_opportunity_generator, exchange1, exchange2, market12, coin, volume, ref (thread_count), ref (opportunities_count));
-        
-        // Wait shortly to give the previously started thread time to update the thread count.
-        this_thread::sleep_for (chrono::milliseconds (1));
+        // Queue the producer.
+        producers.run ([exchange1, exchange2, market12, coin, volume, &opportunities_count] {
+          arbitrage_coin_opportunity_generator (exchange1, exchange2, market12, coin, volume, opportunities_count);
+        });
       }
       
-      // Wait till all threads have completed.
-      while (thread_count > 0) this_thread::sleep_for (chrono::milliseconds (10));
+      // Wait till all producers have completed.
+      producers.wait_all ();
       
       // Write the reported items to the html page.
       // Sorted on best coins at the top.
@@ -1683,13 +1612,8 @@ void arbitrage_opportunities_page_generator (int max_threads)
 void arbitrage_coin_opportunity_generator (string exchange1, string exchange2,
                                            string market, string coin,
                                            float volume,
-                                           int & thread_count,
                                            int & opportunities_count)
 {
-  generator_mutex.lock ();
-  thread_count++;
-  generator_mutex.unlock ();
-
   // Limit the number of opportunities to list.
   if (opportunities_count <= 100) {
 
@@ -1732,11 +1656,6 @@ void arbitrage_coin_opportunity_generator (string exchange1, string exchange2,
       generator_mutex.unlock ();
     }
   }
-  
-  // One producer has completed.
-  generator_mutex.lock ();
-  thread_count--;
-  generator_mutex.unlock ();
 }
 
 
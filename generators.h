@@ -26,26 +26,25 @@
 
 void generator_load_data ();
 void website_index_generator ();
-void prospective_coin_item_generator (string coin, int & thread_count);
+void prospective_coin_item_generator (string coin);
 void prospective_coin_page_generator (int max_threads);
-void asset_performance_coin_generator (string coin, int & thread_count);
+void asset_performance_coin_generator (string coin);
 void asset_performance_page_generator (int max_threads);
 void balances_total_bitcoin_generator ();
 void balances_total_converted_to_bitcoin_generator ();
 void balances_arbitrage_generator ();
-void balances_coin_generator (string coin, int & thread_count);
+void balances_coin_generator (string coin);
 void balances_page_generator (int max_threads);
 void website_javascript_copier ();
 void performance_reporter (bool mail);
 void load_bought_coins_details ();
 void delayed_transfers_reporter (bool mail);
 void arbitrage_performance_page_generator (int max_threads);
-void arbitrage_coin_performance_generator (string exchange1, string exchange2, string market, string coin, int & thread_count);
+void arbitrage_coin_performance_generator (string exchange1, string exchange2, string market, string coin);
 void arbitrage_opportunities_page_generator (int max_threads);
 void arbitrage_coin_opportunity_generator (string exchange1, string exchange2,
                                            string market, string coin,
                                            float volume,
-                                           int & thread_count,
                                            int & opportunities_count);
 string generator_chart_rates (string exchange1, string exchange2, string market, string coin, int days);
 void generator_list_comments (string coin, vector <string> & lines);
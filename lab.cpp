@@ -320,7 +320,7 @@ int main (int argc, char *argv[])
   {
     to_output output ("");
     // Generate sinoidal testing rates over 60+ days.
-    unordered_map <int, float> minute_asks, minute_bids, hour_asks, hour_bids;
+    TimeSeries minutes, hours;
     {
       vector <int> seconds;
       vector <float> asks, bids;
@@ -334,7 +334,7 @@ int main (int argc, char *argv[])
         asks.push_back (rate);
         bids.push_back (rate);
       }
-      pattern_prepare (&output, seconds, asks, bids, minute_asks, minute_bids, hour_asks, hour_bids);
+      pattern_prepare (&output, seconds, asks, bids, minutes, hours);
     }
     
     // Container for the forecast properties for all simulated hours.
@@ -343,7 +343,7 @@ int main (int argc, char *argv[])
     // Overall weights for all factors taken in account for making a forecast.
     forecast_weights weights;
 
-    learn_rates_process_observations (&output, "exchange", euro_id (), "coin", minute_asks, minute_bids, hour_asks, hour_bids, all_forecast_properties, weights);
+    learn_rates_process_observations (&output, "exchange", euro_id (), "coin", minutes, hours, all_forecast_properties, weights);
     
     // After gathering all forecast properties, start optimizing the weights,
     // so as to get the most accurate forecast.
@@ -459,6 +459,78 @@ int main (int argc, char *argv[])
   }
    */
   /*
+  {
+    // Benchmark the curve fitting solvers against each other on the recorded rates of a coin.
+    // It fits all curves over the same windows as the rates learner does, once a day over the past 30 days.
+    string exchange = "bittrex";
+    string market = bitcoin_id ();
+    string coin = "monero";
+    to_output output ("Curve fitting solvers for " + coin + " @ " + market + " @ " + exchange);
+    TimeSeries minutes, hours;
+    pattern_prepare (&output, exchange, market, coin, 61 * 24, minutes, hours);
+    vector <curve_solver> solvers = { curve_solver::coordinate_descent, curve_solver::levenberg_marquardt };
+    vector <string> titles = { "Coordinate descent", "Levenberg-Marquardt" };
+    vector <int> fits (solvers.size ()), failures (solvers.size ()), microseconds (solvers.size ());
+    vector <long> iterations (solvers.size ()), evaluations (solvers.size ());
+    int better = 0, same = 0, worse = 0;
+    for (int last_hour = -30 * 24; last_hour <= -24; last_hour += 24) {
+      for (int window : deep_learning_hours ()) {
+        vector <float> xs, ys;
+        if (window > 15) {
+          for (int hour = last_hour - window; hour <= last_hour; hour++) {
+            float rate = (hours.ask (hour) + hours.bid (hour)) / 2;
+            if (rate > 0) {
+              xs.push_back (hour);
+              ys.push_back (rate);
+            }
+          }
+        } else {
+          for (int minute = (last_hour - window) * 60; minute <= last_hour * 60; minute++) {
+            float rate = (minutes.ask (minute) + minutes.bid (minute)) / 2;
+            if (rate > 0) {
+              xs.push_back (minute);
+              ys.push_back (rate);
+            }
+          }
+        }
+        for (int iter = static_cast <int> (curve_type::begin) + 1; iter < static_cast <int> (curve_type::end); iter++) {
+          vector <float> residuals;
+          for (unsigned int s = 0; s < solvers.size (); s++) {
+            curve_description parameters;
+            parameters.curve = static_cast <curve_type> (iter);
+            auto start = chrono::steady_clock::now ();
+            float residual = fitted_curve_get_optimized_residuals (xs, ys, parameters, solvers [s]);
+            microseconds [s] += chrono::duration_cast <chrono::microseconds> (chrono::steady_clock::now () - start).count ();
+            iterations [s] += parameters.fitting_iterations;
+            evaluations [s] += parameters.fitting_evaluations;
+            if (isfinite (residual)) fits [s]++;
+            else failures [s]++;
+            residuals.push_back (residual);
+          }
+          // Compare the second solver with the first one.
+          if (!isfinite (residuals [0]) && !isfinite (residuals [1])) continue;
+          if (!isfinite (residuals [1])) worse++;
+          else if (!isfinite (residuals [0])) better++;
+          else if (residuals [1] < residuals [0] * 0.999) better++;
+          else if (residuals [1] > residuals [0] * 1.001) worse++;
+          else same++;
+        }
+      }
+    }
+    for (unsigned int s = 0; s < solvers.size (); s++) {
+      output.add ({
+        titles [s],
+        "fits", to_string (fits [s]),
+        "failures", to_string (failures [s]),
+        "iterations", to_string (iterations [s]),
+        "evaluations", to_string (evaluations [s]),
+        "milliseconds", to_string (microseconds [s] / 1000)
+      });
+    }
+    output.add ({titles [1], "better", to_string (better), "same", to_string (same), "worse", to_string (worse)});
+  }
+   */
+  /*
   {
     cout << bitcoin2euro (0.55) << endl; 
   }
@@ -552,11 +624,11 @@ int main (int argc, char *argv[])
           //if (coin != "bitbay") continue;
           //continue;
           to_output output ("Patterns for " + coin + " @ " + market + " @ " + exchange);
-          unordered_map <int, float> minute_asks, minute_bids, hour_asks, hour_bids;
-          pattern_prepare (&output, exchange, market, coin, minute_asks, minute_bids, hour_asks, hour_bids);
-          if (hour_asks.size () < 10) continue;
+          TimeSeries minutes, hours;
+          pattern_prepare (&output, exchange, market, coin, minutes, hours);
+          if (hours.size () < 10) continue;
           string reason = pattern_type_increase_day_week ();
-          bool coin_good = pattern_increase_day_week_simulator (&output, hour_asks, hour_bids, reason);
+          bool coin_good = pattern_increase_day_week_simulator (&output, hours, reason);
           {
             string signature = exchange + market + coin + reason;
             bool good_coin_stored = in_array (signature, profitable_exchanges_markets_coins_reasons);
@@ -573,7 +645,7 @@ int main (int argc, char *argv[])
             string picturepath;
             string basename = exchange + "-" + market + "-" + coin;
             for (int hour = -24 * 14; hour <= 0; hour++) {
-              float rate = (hour_asks [hour] + hour_bids [hour]) / 2;
+              float rate = (hours.ask (hour) + hours.bid (hour)) / 2;
               if (rate > 0) {
                 plotdata.push_back (make_pair (hour, rate));
               }
@@ -628,10 +700,9 @@ int main (int argc, char *argv[])
     unordered_map <string, vector <int> > allseconds;
     unordered_map <string, vector <float> > allbids, allasks;
     patterns_rates_get (sql, allseconds, allbids, allasks);
-    unordered_map <int, float> minute_asks, minute_bids, hour_asks, hour_bids;
+    TimeSeries minutes, hours;
     pattern_prepare (&output, exchange, market, coin,
-                     allseconds, allbids, allasks,
-                     minute_asks, minute_bids, hour_asks, hour_bids);
+                     allseconds, allbids, allasks, minutes, hours);
     for (auto element : minute_asks) {
       output.add ({"minute", to_string (element.first), "ask", float2string (element.second)});
     }
@@ -643,9 +714,9 @@ int main (int argc, char *argv[])
     string market = "bitcoin";
     string coin = "bitblocks";
     to_output output ("");
-    unordered_map <int, float> minute_asks, minute_bids, hour_asks, hour_bids;
-    pattern_prepare (&output, exchange, market, coin, minute_asks, minute_bids, hour_asks, hour_bids);
-    output.add ({"size", to_string (minute_asks.size())});
+    TimeSeries minutes, hours;
+    pattern_prepare (&output, exchange, market, coin, minutes, hours);
+    output.add ({"size", to_string (minutes.size())});
   }
    */
   /*
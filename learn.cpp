@@ -28,22 +28,15 @@
 #include "simulators.h"
 
 
-// Tracker for simultaneous deep learners.
-atomic <int> current_simultaneous_learner_count (0);
-
-
 // Main function for coin rates deep learning.
 // The function took 30 minutes on a Proliant DL360e.
 void learn_exchange_coin_processor (const string & exchange, const string & coin)
 {
-  // One more running learner.
-  current_simultaneous_learner_count++;
-
   to_output output (exchange + " " + coin);
   output.to_stderr (true);
   
   // Storage for the prepared rates for looking at the patterns.
-  unordered_map <int, float> minute_asks, minute_bids, hour_asks, hour_bids;
+  TimeSeries minutes, hours;
   // The change in a coin's value is measured against the Euro.
   // Measuring change against the Bitcoin is not always a good indicator of
   // how much the value of the coin changes.
@@ -55,7 +48,7 @@ void learn_exchange_coin_processor (const string & exchange, const string & coin
   string market = euro_id ();
   // The number of hours passed to the preparer is for many days.
   // There should be sufficient days to have enough data to learn from.
-  pattern_prepare (&output, exchange, market, coin, 61 * 24, minute_asks, minute_bids, hour_asks, hour_bids);
+  pattern_prepare (&output, exchange, market, coin, 61 * 24, minutes, hours);
   
   // Container for the forecast properties for all simulated hours.
   vector <forecast_properties> all_forecast_properties;
@@ -63,7 +56,7 @@ void learn_exchange_coin_processor (const string & exchange, const string & coin
   // Overall weights for all factors taken in account for making a forecast.
   forecast_weights weights;
   
-  learn_rates_process_observations (&output, exchange, market, coin, minute_asks, minute_bids, hour_asks, hour_bids, all_forecast_properties, weights);
+  learn_rates_process_observations (&output, exchange, market, coin, minutes, hours, all_forecast_properties, weights);
   
   // After gathering all forecast properties, start optimizing the weights,
   // so as to get the most accurate forecast.
@@ -107,9 +100,6 @@ void learn_exchange_coin_processor (const string & exchange, const string & coin
   SQL sql (front_bot_ip_address ());
   weights_save (sql, exchange, market, coin, json,
                 sum_absolute_residuals, maximum_residual_percentage, average_residual_percentage);
-
-  // One deep learner has completed.
-  current_simultaneous_learner_count--;
 }
 
 
@@ -133,6 +123,9 @@ int main (int argc, char *argv[])
     }
     to_tty ({"Maximum simultaneous deep learners is", to_string (maximum_simultaneous_learners)});
 
+    // The deep learners run on the thread pool.
+    task_group learners (maximum_simultaneous_learners);
+
     // Iterate over all exchanges and their coins.
     vector <string> exchanges = exchange_get_names ();
     for (auto exchange : exchanges) {
@@ -141,22 +134,14 @@ int main (int argc, char *argv[])
       for (auto coin : coins) {
         //if (coin != "goldcoin") continue;
         
-        // Wait till there's an available slot for this new deep learning thread.
-        while (current_simultaneous_learner_count >= maximum_simultaneous_learners) {
-          this_thread::sleep_for (chrono::milliseconds (10));
-        }
-
-        // Start the deep learning thread.
-        new thread (learn_exchange_coin_processor, exchange, coin);
-        // Wait shortly to give the previously started thread time to update the thread count.
-        this_thread::sleep_for (chrono::milliseconds (1));
+        // Queue the deep learner.
+        // It starts as soon as fewer than the maximum number of learners are running.
+        learners.run ([exchange, coin] { learn_exchange_coin_processor (exchange, coin); });
       }
     }
     
-    // Wait till all threads have completed.
-    while (current_simultaneous_learner_count > 0) {
-      this_thread::sleep_for (chrono::milliseconds (10));
-    }
+    // Wait till all deep learners have completed.
+    learners.wait_all ();
   }
   
   finalize_program ();
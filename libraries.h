@@ -38,6 +38,7 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -47,6 +48,23 @@
 #include <unistd.h>
 #include <libgen.h>
 #include <ifaddrs.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+
+// SIMD intrinsics for the curve fitting kernels.
+// The build assumes SSE2 on Intel processors, and selects AVX2 at runtime.
+#if defined (__GNUC__) && defined (__SSE2__)
+#include <immintrin.h>
+#define CURVE_FITTING_SSE
+#if defined (__x86_64__)
+#define CURVE_FITTING_AVX2
+#endif
+#endif
 
 
 // C++ headers.
@@ -71,6 +89,9 @@
 #include <atomic>
 #include <unordered_map>
 #include <queue>
+#include <condition_variable>
+#include <functional>
+#include <memory>
 
 
 // Libraries.
@@ -119,6 +119,9 @@ int main (int argc, char *argv[])
               sql.clear ();
               sql.add ("COMMIT;");
               sql.execute ();
+              
+              // The programs should no longer take the old value from the market snapshot.
+              market_snapshot_invalidate (sql);
             }
           }
         }
@@ -47,9 +47,51 @@
 */
  
 
-// This select all available rates from the database.
-// The database may contain duplicate rates,
-// but the call will return only the newest distinct values.
+/*
+ CREATE TABLE IF NOT EXISTS latestrates (
+ id INT NOT NULL AUTO_INCREMENT,
+ stamp TIMESTAMP,
+ second INT,
+ exchange VARCHAR(255),
+ market VARCHAR(255),
+ currency VARCHAR(255),
+ bid DOUBLE,
+ ask DOUBLE,
+ rate DOUBLE,
+ PRIMARY KEY (id),
+ UNIQUE KEY (exchange, market, currency)
+ );
+*/
+
+
+// The rates used to be added to the "rates" table every minute.
+// So that table contained many duplicate rates per coin,
+// and getting the rates had to read all of them, only to keep the newest one per coin.
+// The rates are now stored in the "latestrates" table,
+// which holds one row per exchange/market/coin, updated in place.
+// This stores the rates given, updating the existing rows.
+void rates_store (SQL & sql, int second,
+                  const vector <string> & exchanges, const vector <string> & markets, const vector <string> & coins,
+                  const vector <float> & bids, const vector <float> & asks)
+{
+  SQLInsert insert (sql,
+                    "INSERT INTO latestrates (second, exchange, market, currency, bid, ask, rate) VALUES",
+                    "ON DUPLICATE KEY UPDATE stamp = NOW(), second = VALUES(second), bid = VALUES(bid), ask = VALUES(ask), rate = VALUES(rate)");
+  for (unsigned int i = 0; i < exchanges.size(); i++) {
+    insert.row ();
+    insert.add (second);
+    insert.add (exchanges[i]);
+    insert.add (markets[i]);
+    insert.add (coins[i]);
+    insert.add (bids[i]);
+    insert.add (asks[i]);
+    insert.add ((bids[i] + asks[i]) / 2);
+  }
+  insert.flush ();
+}
+
+
+// This selects all available rates from the database, one per exchange/market/coin.
 // If only recent rates are requested,
 // the rates will not be older than a few minutes,
 // to be sure the rates are all current.
@@ -68,64 +110,34 @@ void rates_get (SQL & sql, vector <int> & seconds,
   asks.clear ();
   rates.clear ();
   
+  if (market_snapshot_rates (sql, seconds, exchanges, markets, coins, bids, asks, rates, only_recent)) return;
+  
   sql.clear ();
-  sql.add ("SELECT second, exchange, market, currency, bid, ask, rate FROM rates");
+  sql.add ("SELECT second, exchange, market, currency, bid, ask, rate FROM latestrates");
   if (only_recent) {
     sql.add ("WHERE stamp > NOW() - INTERVAL 5 MINUTE");
   }
-  sql.add ("ORDER BY id;");
-  map <string, vector <string> > result = sql.query ();
-  vector <string> second = result ["second"];
-  vector <string> exchange = result ["exchange"];
-  vector <string> market = result ["market"];
-  vector <string> coin = result ["currency"];
-  vector <string> bid = result ["bid"];
-  vector <string> ask = result ["ask"];
-  vector <string> rate = result ["rate"];
-  
-  // Multiple rates will have been stored in the database,
-  // for one coin/market/exchange.
-  // This is done for performance reasons.
-  // So the above query will have obtained multiple rates for one coin.
-  // We only need one rate per coin.
-  // Here is the container to ensure there's only distinct rates.
-  unordered_map <string, tuple <int, float, float, float> > distinct_values;
-  for (unsigned int i = 0; i < rate.size (); i++) {
-    string key = exchange[i] + " " + market [i] + " " + coin [i];
-    tuple <int, float, float, float> value =  make_tuple (stoi (second[i]),
-                                                          str2float (bid[i]),
-                                                          str2float (ask[i]),
-                                                          str2float (rate[i]));
-    distinct_values [key] = value;
-  }
+  sql.add (";");
   
-  // Iterate over the distinct rates.
-  for (auto & element : distinct_values) {
-    
-    string key = element.first;
-    tuple <int, float, float, float> value = element.second;
-    
-    // Obtain the exchange, the market, and the coin.
-    vector <string> exchange_market_coin = explode (key, ' ');
-    // Due to errors getting the rates, check there's no extra spaces.
-    // It should have three values exactly.
-    // Anything else is an error and should be skipped.
-    if (exchange_market_coin.size() != 3) continue;
-    
-    // Obtain the values.
-    int second = get <0> (value);
-    float bid = get <1> (value);
-    float ask = get <2> (value);
-    float rate = get <3> (value);
-    
-    // Store them for the caller.
-    seconds.push_back (second);
-    exchanges.push_back (exchange_market_coin [0]);
-    markets.push_back (exchange_market_coin [1]);
-    coins.push_back (exchange_market_coin [2]);
-    bids.push_back (bid);
-    asks.push_back (ask);
-    rates.push_back (rate);
+  if (sql.stream ()) {
+    while (sql.fetch ()) {
+      string exchange = sql.column_text (1);
+      string market = sql.column_text (2);
+      string coin = sql.column_text (3);
+      // Due to errors getting the rates, check there's no extra spaces.
+      // Anything like that is an error and should be skipped.
+      if (exchange.find (" ") != string::npos) continue;
+      if (market.find (" ") != string::npos) continue;
+      if (coin.find (" ") != string::npos) continue;
+      // Store them for the caller.
+      seconds.push_back (sql.column_int (0));
+      exchanges.push_back (exchange);
+      markets.push_back (market);
+      coins.push_back (coin);
+      bids.push_back (sql.column_float (4));
+      asks.push_back (sql.column_float (5));
+      rates.push_back (sql.column_float (6));
+    }
   }
 }
 
@@ -174,6 +186,446 @@ float rate_get_cached (const string & exchange, const string & market, const str
 }
 
 
+// Every bot program used to read the rates, the coins per market, the minimum trade sizes,
+// and the paused trades from MySQL at the front bot, each time it started.
+// The rates program now publishes all of that every minute in one snapshot,
+// in a memory-mapped file on the machine it runs on.
+// The other programs on that machine read the snapshot rather than querying MySQL.
+// The file has a header with a sequence number, followed by the data.
+// The sequence number is odd while the snapshot is being replaced.
+// A reader copies the data, and accepts it only if the sequence number was even and did not change meanwhile.
+// If there is no fresh and complete snapshot, the programs query MySQL, as they used to.
+// The data in the snapshot can be changed on any machine, for example when a bot pauses a trade.
+// Such a change stores a new serial in the settings at the front bot.
+// The snapshot holds the serial it was published with,
+// and the programs use the snapshot only while that is still the current serial.
+
+
+#define MARKET_SNAPSHOT_MAGIC 0x4d4b5331
+#define MARKET_SNAPSHOT_CAPACITY (32 * 1024 * 1024)
+#define MARKET_SNAPSHOT_MAXIMUM_AGE 180
+
+
+struct market_snapshot_header
+{
+  atomic <uint32_t> sequence;
+  uint32_t magic;
+  // The second the snapshot was published, or zero if it is no longer valid.
+  uint32_t second;
+  uint32_t size;
+  char host [64];
+};
+
+
+struct market_snapshot
+{
+  uint32_t sequence = 1;
+  int second = 0;
+  string host;
+  string serial;
+  vector <int> seconds;
+  vector <string> exchanges, markets, coins;
+  vector <float> bids, asks, rates;
+  vector <string> coins_exchanges, coins_markets, coins_coins;
+  map <string, float> minimum_trades;
+  vector <string> paused;
+  vector <int> paused_till;
+};
+
+
+mutex market_snapshot_mutex;
+market_snapshot_header * market_snapshot_mapping = nullptr;
+market_snapshot market_snapshot_cache;
+// While publishing, the getters should read from MySQL rather than from the snapshot.
+thread_local bool market_snapshot_publishing = false;
+
+
+// The files shared by the programs are named with this prefix.
+// The unit tests set another prefix, so they do not touch the files the bot uses.
+string shared_memory_prefix = "cryptobot_";
+
+
+// The path to the file $name to be mapped into memory and shared by the programs.
+// It is in shared memory, where available, else in the folder with the databases.
+string shared_memory_path (const string & name)
+{
+  if (file_or_dir_exists ("/dev/shm")) return "/dev/shm/" + shared_memory_prefix + name;
+  return SqliteDatabase::path ("") + "/" + shared_memory_prefix + name;
+}
+
+
+string market_snapshot_path ()
+{
+  return shared_memory_path ("market.snapshot");
+}
+
+
+const char * market_snapshot_setting ()
+{
+  return "market_snapshot_serial";
+}
+
+
+void market_snapshot_add (string & data, uint32_t value)
+{
+  data.append ((const char *) &value, sizeof (value));
+}
+
+
+void market_snapshot_add (string & data, float value)
+{
+  data.append ((const char *) &value, sizeof (value));
+}
+
+
+void market_snapshot_add (string & data, const string & value)
+{
+  market_snapshot_add (data, (uint32_t) value.size ());
+  data.append (value);
+}
+
+
+bool market_snapshot_get (const string & data, size_t & offset, uint32_t & value)
+{
+  if (offset + sizeof (value) > data.size ()) return false;
+  memcpy (&value, data.c_str () + offset, sizeof (value));
+  offset += sizeof (value);
+  return true;
+}
+
+
+bool market_snapshot_get (const string & data, size_t & offset, float & value)
+{
+  if (offset + sizeof (value) > data.size ()) return false;
+  memcpy (&value, data.c_str () + offset, sizeof (value));
+  offset += sizeof (value);
+  return true;
+}
+
+
+bool market_snapshot_get (const string & data, size_t & offset, string & value)
+{
+  uint32_t length;
+  if (!market_snapshot_get (data, offset, length)) return false;
+  if (offset + length > data.size ()) return false;
+  value.assign (data.c_str () + offset, length);
+  offset += length;
+  return true;
+}
+
+
+// Maps the snapshot file into memory.
+// $writable: Whether to create the file, and map it for writing.
+// Returns the file descriptor, or -1 on failure.
+int market_snapshot_open (bool writable, market_snapshot_header * & header)
+{
+  header = nullptr;
+  string path = market_snapshot_path ();
+  int fd = open (path.c_str (), writable ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+  if (fd < 0) return -1;
+  if (writable) {
+    // The file is sparse, so the capacity does not take memory or disk space till it is used.
+    struct stat st;
+    if ((fstat (fd, &st) != 0) || (st.st_size < MARKET_SNAPSHOT_CAPACITY)) {
+      if (ftruncate (fd, MARKET_SNAPSHOT_CAPACITY) != 0) {
+        close (fd);
+        return -1;
+      }
+    }
+  } else {
+    struct stat st;
+    if ((fstat (fd, &st) != 0) || (st.st_size < MARKET_SNAPSHOT_CAPACITY)) {
+      close (fd);
+      return -1;
+    }
+  }
+  void * address = mmap (nullptr, MARKET_SNAPSHOT_CAPACITY, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+  if (address == MAP_FAILED) {
+    close (fd);
+    return -1;
+  }
+  header = (market_snapshot_header *) address;
+  return fd;
+}
+
+
+// Replaces the snapshot with the $payload.
+// Several programs may write, so the writers take turns through a lock on the file.
+void market_snapshot_write (const string & host, int second, const string & payload)
+{
+  if (sizeof (market_snapshot_header) + payload.size () > MARKET_SNAPSHOT_CAPACITY) return;
+  market_snapshot_header * header;
+  int fd = market_snapshot_open (true, header);
+  if (fd < 0) return;
+  flock (fd, LOCK_EX);
+  uint32_t sequence = header->sequence.load ();
+  // A writer that crashed halfway may have left an odd sequence number.
+  if (sequence & 1) sequence++;
+  header->sequence.store (sequence + 1);
+  atomic_thread_fence (memory_order_release);
+  header->magic = MARKET_SNAPSHOT_MAGIC;
+  header->second = second;
+  if (!payload.empty ()) {
+    header->size = payload.size ();
+    memset (header->host, 0, sizeof (header->host));
+    strncpy (header->host, host.c_str (), sizeof (header->host) - 1);
+    memcpy ((char *) header + sizeof (market_snapshot_header), payload.c_str (), payload.size ());
+  }
+  header->sequence.store (sequence + 2, memory_order_release);
+  flock (fd, LOCK_UN);
+  munmap (header, MARKET_SNAPSHOT_CAPACITY);
+  close (fd);
+}
+
+
+// Reads the current data from the front bot's MySQL server,
+// and publishes it as the new snapshot.
+void market_snapshot_publish (SQL & sql)
+{
+  market_snapshot_publishing = true;
+  
+  string payload;
+  
+  // Read the serial before the data.
+  // A change made meanwhile then leaves the snapshot with an outdated serial, so it won't be used.
+  market_snapshot_add (payload, settings_get (sql, front_bot_name (), market_snapshot_setting ()));
+  
+  vector <int> seconds;
+  vector <string> exchanges, markets, coins;
+  vector <float> bids, asks, rates;
+  rates_get (sql, seconds, exchanges, markets, coins, bids, asks, rates, false);
+  market_snapshot_add (payload, (uint32_t) seconds.size ());
+  for (size_t i = 0; i < seconds.size (); i++) {
+    market_snapshot_add (payload, (uint32_t) seconds[i]);
+    market_snapshot_add (payload, exchanges[i]);
+    market_snapshot_add (payload, markets[i]);
+    market_snapshot_add (payload, coins[i]);
+    market_snapshot_add (payload, bids[i]);
+    market_snapshot_add (payload, asks[i]);
+    market_snapshot_add (payload, rates[i]);
+  }
+  
+  coins_market_get (sql, exchanges, markets, coins);
+  market_snapshot_add (payload, (uint32_t) exchanges.size ());
+  for (size_t i = 0; i < exchanges.size (); i++) {
+    market_snapshot_add (payload, exchanges[i]);
+    market_snapshot_add (payload, markets[i]);
+    market_snapshot_add (payload, coins[i]);
+  }
+  
+  map <string, float> minimum_trades = mintrade_get (sql);
+  market_snapshot_add (payload, (uint32_t) minimum_trades.size ());
+  for (auto & element : minimum_trades) {
+    market_snapshot_add (payload, element.first);
+    market_snapshot_add (payload, element.second);
+  }
+  
+  // The paused trades are stored with the second till when they are paused,
+  // so the readers can leave out the pauses that expired since the snapshot was published.
+  sql.clear ();
+  sql.add ("SELECT CONCAT(exchange,market,coin), trading FROM pausetrades WHERE trading AND UNIX_TIMESTAMP() < trading;");
+  map <string, vector <string> > result = sql.query ();
+  vector <string> paused = result ["CONCAT(exchange,market,coin)"];
+  vector <string> trading = result ["trading"];
+  market_snapshot_add (payload, (uint32_t) paused.size ());
+  for (size_t i = 0; i < paused.size (); i++) {
+    market_snapshot_add (payload, paused[i]);
+    market_snapshot_add (payload, (uint32_t) str2int (trading[i]));
+  }
+  
+  market_snapshot_publishing = false;
+  
+  market_snapshot_write (sql.address (), seconds_since_epoch (), payload);
+}
+
+
+// Marks the snapshot as no longer valid.
+// To be called after changing data that is in the snapshot,
+// so the programs read the change from MySQL till the next snapshot has been published.
+// It used to clear the snapshot on this machine only.
+// The programs on the other machines would keep using their snapshots till these expired.
+// It now also stores a new serial at the front bot, which tells all machines the snapshot is outdated.
+void market_snapshot_invalidate (SQL & sql)
+{
+  settings_set (sql, front_bot_name (), market_snapshot_setting (), to_string (milliseconds_since_epoch ()));
+  if (!file_or_dir_exists (market_snapshot_path ())) return;
+  market_snapshot_write ("", 0, "");
+}
+
+
+bool market_snapshot_decode (const string & payload, market_snapshot & snapshot)
+{
+  size_t offset = 0;
+  if (!market_snapshot_get (payload, offset, snapshot.serial)) return false;
+  uint32_t count;
+  if (!market_snapshot_get (payload, offset, count)) return false;
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t second;
+    string exchange, market, coin;
+    float bid, ask, rate;
+    if (!market_snapshot_get (payload, offset, second)) return false;
+    if (!market_snapshot_get (payload, offset, exchange)) return false;
+    if (!market_snapshot_get (payload, offset, market)) return false;
+    if (!market_snapshot_get (payload, offset, coin)) return false;
+    if (!market_snapshot_get (payload, offset, bid)) return false;
+    if (!market_snapshot_get (payload, offset, ask)) return false;
+    if (!market_snapshot_get (payload, offset, rate)) return false;
+    snapshot.seconds.push_back (second);
+    snapshot.exchanges.push_back (exchange);
+    snapshot.markets.push_back (market);
+    snapshot.coins.push_back (coin);
+    snapshot.bids.push_back (bid);
+    snapshot.asks.push_back (ask);
+    snapshot.rates.push_back (rate);
+  }
+  if (!market_snapshot_get (payload, offset, count)) return false;
+  for (uint32_t i = 0; i < count; i++) {
+    string exchange, market, coins;
+    if (!market_snapshot_get (payload, offset, exchange)) return false;
+    if (!market_snapshot_get (payload, offset, market)) return false;
+    if (!market_snapshot_get (payload, offset, coins)) return false;
+    snapshot.coins_exchanges.push_back (exchange);
+    snapshot.coins_markets.push_back (market);
+    snapshot.coins_coins.push_back (coins);
+  }
+  if (!market_snapshot_get (payload, offset, count)) return false;
+  for (uint32_t i = 0; i < count; i++) {
+    string key;
+    float quantity;
+    if (!market_snapshot_get (payload, offset, key)) return false;
+    if (!market_snapshot_get (payload, offset, quantity)) return false;
+    snapshot.minimum_trades [key] = quantity;
+  }
+  if (!market_snapshot_get (payload, offset, count)) return false;
+  for (uint32_t i = 0; i < count; i++) {
+    string key;
+    uint32_t till;
+    if (!market_snapshot_get (payload, offset, key)) return false;
+    if (!market_snapshot_get (payload, offset, till)) return false;
+    snapshot.paused.push_back (key);
+    snapshot.paused_till.push_back (till);
+  }
+  return offset == payload.size ();
+}
+
+
+// Brings the snapshot cached in this process up to date with the published snapshot.
+// Returns true if there is a fresh snapshot for the MySQL server of $sql.
+// The caller should hold the mutex.
+bool market_snapshot_load (SQL & sql)
+{
+  if (market_snapshot_publishing) return false;
+  
+  // Map the file once per process.
+  if (!market_snapshot_mapping) {
+    market_snapshot_header * header;
+    int fd = market_snapshot_open (false, header);
+    if (fd < 0) return false;
+    // The mapping remains valid after closing the file.
+    close (fd);
+    market_snapshot_mapping = header;
+  }
+  market_snapshot_header * header = market_snapshot_mapping;
+  
+  // If the sequence number did not change, the cached snapshot is still current.
+  uint32_t sequence = header->sequence.load (memory_order_acquire);
+  if (sequence != market_snapshot_cache.sequence) {
+    bool loaded = false;
+    for (int attempt = 0; attempt < 100; attempt++) {
+      sequence = header->sequence.load (memory_order_acquire);
+      if (sequence & 1) {
+        this_thread::sleep_for (chrono::microseconds (100));
+        continue;
+      }
+      uint32_t magic = header->magic;
+      int second = header->second;
+      size_t size = header->size;
+      string host (header->host, strnlen (header->host, sizeof (header->host)));
+      if (size > MARKET_SNAPSHOT_CAPACITY - sizeof (market_snapshot_header)) size = 0;
+      string payload ((const char *) header + sizeof (market_snapshot_header), size);
+      atomic_thread_fence (memory_order_acquire);
+      if (header->sequence.load (memory_order_relaxed) != sequence) continue;
+      market_snapshot snapshot;
+      snapshot.sequence = sequence;
+      if ((magic == MARKET_SNAPSHOT_MAGIC) && second) {
+        if (!market_snapshot_decode (payload, snapshot)) break;
+        snapshot.second = second;
+        snapshot.host = host;
+      }
+      market_snapshot_cache = snapshot;
+      loaded = true;
+      break;
+    }
+    if (!loaded) return false;
+  }
+  
+  if (!market_snapshot_cache.second) return false;
+  if (market_snapshot_cache.host != sql.address ()) return false;
+  if (seconds_since_epoch () - market_snapshot_cache.second > MARKET_SNAPSHOT_MAXIMUM_AGE) return false;
+  // Data changed since the snapshot was published: Read it from MySQL.
+  string serial = settings_get (sql, front_bot_name (), market_snapshot_setting ());
+  if (serial != market_snapshot_cache.serial) return false;
+  return true;
+}
+
+
+bool market_snapshot_rates (SQL & sql, vector <int> & seconds,
+                            vector <string> & exchanges, vector <string> & markets, vector <string> & coins,
+                            vector <float> & bids, vector <float> & asks, vector <float> & rates,
+                            bool only_recent)
+{
+  lock_guard <mutex> lock (market_snapshot_mutex);
+  if (!market_snapshot_load (sql)) return false;
+  const market_snapshot & snapshot = market_snapshot_cache;
+  // Recent rates are no older than a few minutes.
+  int oldest = seconds_since_epoch () - 300;
+  for (size_t i = 0; i < snapshot.seconds.size (); i++) {
+    if (only_recent && (snapshot.seconds[i] <= oldest)) continue;
+    seconds.push_back (snapshot.seconds[i]);
+    exchanges.push_back (snapshot.exchanges[i]);
+    markets.push_back (snapshot.markets[i]);
+    coins.push_back (snapshot.coins[i]);
+    bids.push_back (snapshot.bids[i]);
+    asks.push_back (snapshot.asks[i]);
+    rates.push_back (snapshot.rates[i]);
+  }
+  return true;
+}
+
+
+bool market_snapshot_coins_market (SQL & sql, vector <string> & exchanges, vector <string> & markets, vector <string> & coins)
+{
+  lock_guard <mutex> lock (market_snapshot_mutex);
+  if (!market_snapshot_load (sql)) return false;
+  exchanges = market_snapshot_cache.coins_exchanges;
+  markets = market_snapshot_cache.coins_markets;
+  coins = market_snapshot_cache.coins_coins;
+  return true;
+}
+
+
+bool market_snapshot_minimum_trades (SQL & sql, map <string, float> & minimum_trades)
+{
+  lock_guard <mutex> lock (market_snapshot_mutex);
+  if (!market_snapshot_load (sql)) return false;
+  minimum_trades = market_snapshot_cache.minimum_trades;
+  return true;
+}
+
+
+bool market_snapshot_paused_trades (SQL & sql, vector <string> & paused)
+{
+  lock_guard <mutex> lock (market_snapshot_mutex);
+  if (!market_snapshot_load (sql)) return false;
+  int second = seconds_since_epoch ();
+  const market_snapshot & snapshot = market_snapshot_cache;
+  for (size_t i = 0; i < snapshot.paused.size (); i++) {
+    if (second < snapshot.paused_till[i]) paused.push_back (snapshot.paused[i]);
+  }
+  return true;
+}
+
+
 /*
  CREATE TABLE IF NOT EXISTS arbitrage (
  id INT NOT NULL AUTO_INCREMENT,
@@ -426,34 +878,23 @@ void balances_get_month (SQL & sql,
                          vector <float> & euros)
 {
   sql.clear ();
-  sql.add ("SELECT * FROM balances WHERE stamp > NOW() - INTERVAL 31 DAY ORDER BY id;");
-  map <string, vector <string> > result = sql.query ();
-  
-  vector <string> values;
-
+  sql.add ("SELECT seconds, exchange, coin, total, btc, euro FROM balances WHERE stamp > NOW() - INTERVAL 31 DAY ORDER BY id;");
   seconds.clear ();
-  values = result ["seconds"];
-  for (auto & v : values) {
-    int second = 0;
-    if (!v.empty ()) second = stoi (v);
-    seconds.push_back (second);
-  }
-
-  exchanges = result ["exchange"];
-
-  coins = result ["coin"];
-
+  exchanges.clear ();
+  coins.clear ();
   totals.clear ();
-  values = result ["total"];
-  for (auto & v : values) totals.push_back (str2float (v));
-
   bitcoins.clear ();
-  values = result ["btc"];
-  for (auto & v : values) bitcoins.push_back (str2float (v));
-
   euros.clear ();
-  values = result ["euro"];
-  for (auto & v : values) euros.push_back (str2float (v));
+  if (sql.stream ()) {
+    while (sql.fetch ()) {
+      seconds.push_back (sql.column_int (0));
+      exchanges.push_back (sql.column_text (1));
+      coins.push_back (sql.column_text (2));
+      totals.push_back (sql.column_float (3));
+      bitcoins.push_back (sql.column_float (4));
+      euros.push_back (sql.column_float (5));
+    }
+  }
 }
 
 
@@ -1268,9 +1709,11 @@ bool withdrawals_present (SQL & sql, string exchange, string orderid)
 
 // Store a trade plus its parameters in the database.
 // This enabled coin performance monitoring, and exchange performance monitoring, and so on.
+// The write goes via the write-behind queue, unless it should be $synchronous.
 void trades_store (SQL & sql, string market, string coin,
                    string buyexchange, string sellexchange,
-                   float quantity, float marketgain)
+                   float quantity, float marketgain,
+                   bool synchronous)
 {
   sql.clear ();
   sql.add ("INSERT INTO trades (market, coin, buy, sell, quantity, marketgain) VALUES (");
@@ -1286,7 +1729,8 @@ void trades_store (SQL & sql, string market, string coin,
   sql.add (",");
   sql.add (marketgain);
   sql.add (");");
-  sql.execute ();
+  if (synchronous) sql.execute ();
+  else sql.defer ();
 }
 
 
@@ -1461,7 +1905,8 @@ string failures_hurried_call_failed ()
 }
 
 
-void failures_store (SQL & sql, string type, string exchange, string coin, float quantity, string message)
+// The write goes via the write-behind queue, unless it should be $synchronous.
+void failures_store (SQL & sql, string type, string exchange, string coin, float quantity, string message, bool synchronous)
 {
   sql.clear ();
   sql.add ("INSERT INTO failures (type, exchange, coin, quantity, message) VALUES (");
@@ -1475,7 +1920,8 @@ void failures_store (SQL & sql, string type, string exchange, string coin, float
   sql.add (",");
   sql.add (message);
   sql.add (");");
-  sql.execute ();
+  if (synchronous) sql.execute ();
+  else sql.defer ();
 }
 
 
@@ -1526,6 +1972,8 @@ PRIMARY KEY (id)
 // container [exchange+market+coin] = minimum trade size.
 map <string, float> mintrade_get (SQL & sql)
 {
+  map <string, float> minimum_trades;
+  if (market_snapshot_minimum_trades (sql, minimum_trades)) return minimum_trades;
   sql.clear ();
   sql.add ("SELECT * FROM mintrade;");
   map <string, vector <string> > result = sql.query ();
@@ -1533,7 +1981,6 @@ map <string, float> mintrade_get (SQL & sql)
   vector <string> market = result ["market"];
   vector <string> coin = result ["coin"];
   vector <string> quantity = result ["quantity"];
-  map <string, float> minimum_trades;
   for (unsigned int i = 0; i < exchange.size (); i++) {
     // Trim the values, because it has been seen that a user had entered a space after a name.
     string key = trim (exchange[i]) + trim (market[i]) + trim (coin[i]);
@@ -1662,6 +2109,7 @@ void pausetrade_set (SQL & sql,
   }
   sql.add (";");
   sql.execute ();
+  market_snapshot_invalidate (sql);
 }
 
 
@@ -1669,6 +2117,8 @@ void pausetrade_set (SQL & sql,
 // Storage format: exchange+coin.
 vector <string> pausetrade_get (SQL & sql)
 {
+  vector <string> paused;
+  if (market_snapshot_paused_trades (sql, paused)) return paused;
   sql.clear ();
   // The "trading" field indicates the seconds after which the wallet can trade again.
   // It is used to temporarily disable this exchange/coin pair for trading.
@@ -1691,34 +2141,186 @@ string allrates_database (int second)
 }
 
 
+// The rates of all exchange/market/coin pairs used to be stored in one SQLite database per pair.
+// Every minute the bot opened thousands of these databases, inserted one row into each, and closed them again.
+// Reading them back for the patterns and the learners returned every value as a string to be parsed again.
+// That was the largest I/O cost on the back bots.
+// Now the rates are stored in a dedicated time-series store.
+// Each pair has its own folder, with one append-only segment file per day.
+// A segment consists of fixed-width records of the second, the bid, and the ask.
+// Adding a rate is a single append to the segment of the day.
+// The day in the segment's name serves as the time index:
+// A reader that needs only recent rates skips older segments without opening them,
+// and it finds the first record within a segment by a binary search on the seconds.
+struct allrates_record
+{
+  int32_t second;
+  float bid;
+  float ask;
+};
+static_assert (sizeof (allrates_record) == 12, "The rates records should be 12 bytes wide");
+
+
+string allrates_folder (const string & exchange, const string & market, const string & coin)
+{
+  string folder = SqliteDatabase::path ("") + "/timeseries";
+  if (!exchange.empty ()) folder.append ("/" + allrates_database (exchange, market, coin));
+  return folder;
+}
+
+
+int allrates_segment_day (int second)
+{
+  return second / 86400;
+}
+
+
+string allrates_segment_suffix ()
+{
+  return ".rates";
+}
+
+
+// Returns the days the pair has segments for, the oldest first.
+vector <int> allrates_segment_days (const string & folder)
+{
+  vector <int> days;
+  vector <string> files = scandir (folder);
+  for (auto file : files) {
+    size_t pos = file.find (allrates_segment_suffix ());
+    if (pos == string::npos) continue;
+    days.push_back (atoi (file.substr (0, pos).c_str ()));
+  }
+  sort (days.begin (), days.end ());
+  return days;
+}
+
+
+string allrates_segment_path (const string & folder, int day)
+{
+  return folder + "/" + to_string (day) + allrates_segment_suffix ();
+}
+
+
+// Appends the rates to the segments they belong to.
+// It writes all records of one segment in one go,
+// and as the segment is opened for appending, concurrent writers don't overwrite each other.
+void allrates_append (const string & exchange, const string & market, const string & coin,
+                      const vector <int> & seconds, const vector <float> & bids, const vector <float> & asks)
+{
+  if (seconds.empty ()) return;
+  string folder = allrates_folder (exchange, market, coin);
+  if (!file_or_dir_exists (folder)) {
+    mkdir (allrates_folder ("", "", "").c_str (), 0755);
+    mkdir (folder.c_str (), 0755);
+  }
+  map <int, vector <allrates_record> > segments;
+  for (unsigned int i = 0; i < seconds.size (); i++) {
+    allrates_record record;
+    record.second = seconds[i];
+    record.bid = bids[i];
+    record.ask = asks[i];
+    segments [allrates_segment_day (seconds[i])].push_back (record);
+  }
+  for (auto & element : segments) {
+    string path = allrates_segment_path (folder, element.first);
+    int fd = open (path.c_str (), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+      to_stderr ({"Cannot append rates to", path, strerror (errno)});
+      continue;
+    }
+    size_t size = element.second.size () * sizeof (allrates_record);
+    ssize_t written = write (fd, element.second.data (), size);
+    if (written != (ssize_t) size) {
+      to_stderr ({"Failure appending rates to", path});
+    }
+    close (fd);
+  }
+}
+
+
+// Moves the rates from the SQLite database of a pair into the time-series store, if there's such a database.
+// The database is first renamed to a name unique to this process.
+// So if two processes try to migrate the same pair at once, only one of them does it.
+void allrates_migrate (const string & exchange, const string & market, const string & coin)
+{
+  string database = allrates_database (exchange, market, coin);
+  string path = SqliteDatabase::path (database);
+  if (!filesize (path)) return;
+  string migrating = database + "_migrating_" + to_string (getpid ());
+  if (rename (path.c_str (), SqliteDatabase::path (migrating).c_str ()) != 0) return;
+  vector <int> seconds;
+  vector <float> bids, asks;
+  {
+    SqliteDatabase sql (migrating);
+    sql.prepare ("SELECT second, bid, ask FROM pattern ORDER BY second;");
+    while (sql.step ()) {
+      seconds.push_back (sql.column_int (0));
+      bids.push_back (sql.column_double (1));
+      asks.push_back (sql.column_double (2));
+    }
+  }
+  allrates_append (exchange, market, coin, seconds, bids, asks);
+  unlink (SqliteDatabase::path (migrating).c_str ());
+}
+
+
+// Removes the databases left behind by processes that stopped halfway migrating the rates of a pair.
+// The name of such a database ends with the ID of the process that was migrating it.
+// As long as a process with that ID runs, the database may still be in use.
+void allrates_migrate_cleanup ()
+{
+  string folder = SqliteDatabase::path ("");
+  string marker = "_migrating_";
+  for (auto file : scandir (folder)) {
+    size_t pos = file.find (marker);
+    if (pos == string::npos) continue;
+    int pid = atoi (file.substr (pos + marker.size ()).c_str ());
+    if (pid <= 0) continue;
+    if ((kill (pid, 0) == 0) || (errno == EPERM)) continue;
+    to_stdout ({"Removing", file, "left behind while migrating rates"});
+    unlink ((folder + "/" + file).c_str ());
+  }
+}
+
+
 void allrates_add (const string & exchange, const string & market, const string & coin,
                    int second, float bid, float ask)
 {
-  string database = allrates_database (exchange, market, coin);
-  // It tests on file size.
-  // If data was read from an empty database, the file size will still be zero.
-  // So here, it will still create the table.
-  // If just testing for the file's existence,
-  // it would consider the database to be already there,
-  // and so not create the table.
-  bool exists = filesize (SqliteDatabase::path (database));
-  SqliteDatabase sql (database);
-  if (!exists) {
-    sql.add ("CREATE TABLE IF NOT EXISTS pattern (second integer, bid real, ask real);");
-    sql.execute ();
+  allrates_migrate (exchange, market, coin);
+  allrates_append (exchange, market, coin, {second}, {bid}, {ask});
+}
+
+
+// Stores many rates of many pairs in one go.
+// It groups the rates by pair, so every pair's store is appended to once,
+// rather than once for every rate.
+void allrates_import (const vector <int> & seconds,
+                      const vector <string> & exchanges,
+                      const vector <string> & markets,
+                      const vector <string> & coins,
+                      const vector <float> & bids,
+                      const vector <float> & asks)
+{
+  map <string, vector <size_t> > pairs;
+  for (size_t i = 0; i < seconds.size (); i++) {
+    pairs [allrates_database (exchanges[i], markets[i], coins[i])].push_back (i);
+  }
+  for (auto & element : pairs) {
+    vector <int> pair_seconds;
+    vector <float> pair_bids, pair_asks;
+    for (auto i : element.second) {
+      pair_seconds.push_back (seconds[i]);
+      pair_bids.push_back (bids[i]);
+      pair_asks.push_back (asks[i]);
+    }
+    size_t first = element.second[0];
+    const string & exchange = exchanges[first];
+    const string & market = markets[first];
+    const string & coin = coins[first];
+    allrates_migrate (exchange, market, coin);
+    allrates_append (exchange, market, coin, pair_seconds, pair_bids, pair_asks);
   }
-  sql.clear ();
-  sql.add ("PRAGMA synchronous = OFF;");
-  sql.execute ();
-  sql.clear ();
-  sql.add ("INSERT INTO pattern (second, bid, ask) VALUES (");
-  sql.add (second);
-  sql.add (",");
-  sql.add (bid);
-  sql.add (",");
-  sql.add (ask);
-  sql.add (");");
-  sql.execute ();
 }
 
 
@@ -1739,51 +2341,67 @@ void allrates_add (int second,
   sql.clear ();
   sql.add ("PRAGMA synchronous = OFF;");
   sql.execute ();
+  // Insert all rates in one transaction, through one prepared statement.
+  sql.begin ();
   for (unsigned int i = 0; i < exchanges.size(); i++) {
-    sql.clear ();
-    sql.add ("INSERT INTO pattern (exchange, market, coin, bid, ask) VALUES (");
-    sql.add (exchanges[i]);
-    sql.add (",");
-    sql.add (markets[i]);
-    sql.add (",");
-    sql.add (coins[i]);
-    sql.add (",");
-    sql.add (bids[i]);
-    sql.add (",");
-    sql.add (asks[i]);
-    sql.add (");");
-    sql.execute ();
+    sql.prepare ("INSERT INTO pattern (exchange, market, coin, bid, ask) VALUES (?, ?, ?, ?, ?);");
+    sql.bind (1, exchanges[i]);
+    sql.bind (2, markets[i]);
+    sql.bind (3, coins[i]);
+    sql.bind (4, (double) bids[i]);
+    sql.bind (5, (double) asks[i]);
+    sql.step ();
   }
+  sql.commit ();
 }
 
 
 bool allrates_exists (const string & exchange, const string & market, const string & coin)
 {
-  string database = allrates_database (exchange, market, coin);
-  bool exists = filesize (SqliteDatabase::path (database));
-  return exists;
+  allrates_migrate (exchange, market, coin);
+  string folder = allrates_folder (exchange, market, coin);
+  return !allrates_segment_days (folder).empty ();
 }
 
 
 void allrates_get (const string & exchange, const string & market, const string & coin,
                    vector <int> & seconds, vector <float> & bids, vector <float> & asks)
 {
-  string database = allrates_database (exchange, market, coin);
-  bool exists = filesize (SqliteDatabase::path (database));
-  if (!exists) return;
-  SqliteDatabase sql (database);
-  sql.add ("SELECT * FROM pattern ORDER BY second;");
-  map <string, vector <string> > result = sql.query ();
-  vector <string> v_seconds = result ["second"];
-  vector <string> v_bids = result ["bid"];
-  vector <string> v_asks = result ["ask"];
-  for (unsigned int i = 0; i < v_seconds.size(); i++) {
-    int second = stoi (v_seconds[i]);
-    seconds.push_back (second);
-    float bid = str2float (v_bids[i]);
-    bids.push_back (bid);
-    float ask = str2float (v_asks[i]);
-    asks.push_back (ask);
+  allrates_get (exchange, market, coin, 0, seconds, bids, asks);
+}
+
+
+// Reads the rates of the pair from $from_second onwards, ordered by second.
+void allrates_get (const string & exchange, const string & market, const string & coin, int from_second,
+                   vector <int> & seconds, vector <float> & bids, vector <float> & asks)
+{
+  allrates_migrate (exchange, market, coin);
+  string folder = allrates_folder (exchange, market, coin);
+  int from_day = allrates_segment_day (from_second);
+  vector <int> days = allrates_segment_days (folder);
+  for (auto day : days) {
+    // The time index: Skip the segments that are older than needed.
+    if (day < from_day) continue;
+    string contents = file_get_contents (allrates_segment_path (folder, day));
+    size_t count = contents.size () / sizeof (allrates_record);
+    vector <allrates_record> records (count);
+    if (count) memcpy (records.data (), contents.data (), count * sizeof (allrates_record));
+    // Rates are normally appended in time order.
+    // But a back bot that downloads the rates after downtime may append older rates later.
+    auto earlier = [] (const allrates_record & a, const allrates_record & b) {
+      return a.second < b.second;
+    };
+    if (!is_sorted (records.begin (), records.end (), earlier)) {
+      stable_sort (records.begin (), records.end (), earlier);
+    }
+    allrates_record from;
+    from.second = from_second;
+    auto iterator = lower_bound (records.begin (), records.end (), from, earlier);
+    for (; iterator != records.end (); ++iterator) {
+      seconds.push_back (iterator->second);
+      bids.push_back (iterator->bid);
+      asks.push_back (iterator->ask);
+    }
   }
 }
 
@@ -1796,65 +2414,52 @@ void allrates_get (const string & database,
                    vector <float> & asks)
 {
   SqliteDatabase sql (database);
-  sql.add ("SELECT * FROM pattern;");
-  map <string, vector <string> > result = sql.query ();
-  exchanges = result ["exchange"];
-  markets = result ["market"];
-  coins = result ["coin"];
-  vector <string> v_bids = result ["bid"];
-  vector <string> v_asks = result ["ask"];
-  for (unsigned int i = 0; i < v_bids.size(); i++) {
-    float bid = str2float (v_bids[i]);
-    bids.push_back (bid);
-    float ask = str2float (v_asks[i]);
-    asks.push_back (ask);
+  sql.prepare ("SELECT exchange, market, coin, bid, ask FROM pattern;");
+  while (sql.step ()) {
+    exchanges.push_back (sql.column_text (0));
+    markets.push_back (sql.column_text (1));
+    coins.push_back (sql.column_text (2));
+    bids.push_back (sql.column_double (3));
+    asks.push_back (sql.column_double (4));
   }
 }
 
 
 void allrates_delete (const string & exchange, const string & market, const string & coin)
 {
-  string database = allrates_database (exchange, market, coin);
-  string path = SqliteDatabase::path (database);
-  unlink (path.c_str());
+  allrates_migrate (exchange, market, coin);
+  string folder = allrates_folder (exchange, market, coin);
+  vector <int> days = allrates_segment_days (folder);
+  for (auto day : days) {
+    string path = allrates_segment_path (folder, day);
+    unlink (path.c_str());
+  }
+  rmdir (folder.c_str ());
 }
 
 
 void allrates_expire (const string & exchange, const string & market, const string & coin, int days)
 {
-  // Connect to the database if it exists.
-  string database = allrates_database (exchange, market, coin);
-  string path = SqliteDatabase::path (database);
-  if (!filesize (path)) return;
-  SqliteDatabase sql (database);
-  
-  // Select the minimum second stored.
-  sql.clear ();
-  sql.add ("SELECT MIN(second) FROM pattern;");
-  vector <string> seconds = sql.query () ["MIN(second)"];
-  if (seconds.empty ()) return;
-  int minimum_second = atoi (seconds[0].c_str());
-  if (!minimum_second) return;
+  allrates_migrate (exchange, market, coin);
+  string folder = allrates_folder (exchange, market, coin);
   
-  // Records older than this second to be deleted.
+  // Records older than this second are to be deleted.
   int cut_off_second = seconds_since_epoch () - (days * 24 * 3600);
-
-  // If there's nothing to delete, then just quit.
-  // The point of this is to not write to the database without a need.
-  // Then the expiry routine elsewhere will eventually remove this entire database from disk.
-  if (minimum_second > cut_off_second) return;
-
-  // Expire older seconds.
-  sql.clear ();
-  sql.add ("DELETE FROM pattern WHERE second <");
-  sql.add (cut_off_second);
-  sql.add (";");
-  sql.execute ();
+  int cut_off_day = allrates_segment_day (cut_off_second);
+
+  // Expire whole segments only.
+  // The segment that contains the cut-off second is kept.
+  // So there's no need to rewrite any segment,
+  // and the rates are kept for at most one day longer than the given number of days.
+  vector <int> segment_days = allrates_segment_days (folder);
+  for (auto day : segment_days) {
+    if (day >= cut_off_day) continue;
+    string path = allrates_segment_path (folder, day);
+    unlink (path.c_str());
+  }
   
-  // Compact the database, so its size on disk shrinks.
-  sql.clear ();
-  sql.add ("VACUUM;");
-  sql.execute ();
+  // Once there's no segments left, remove the pair from the store.
+  if (allrates_segment_days (folder).empty ()) rmdir (folder.c_str ());
 }
 
 
@@ -2362,33 +2967,114 @@ string settings_get (SQL & sql, const string & host, const string & setting)
 }
 
 
-string books_database (const string & exchange, const string & market, const string & coin)
-{
-  return "books_" + exchange + "_" + market + "_" + coin;
-}
-
-
-const char * books_buyers_table ()
-{
-  return "bids";
-}
-
-
-const char * books_sellers_table ()
-{
-  return "asks";
-}
-
-
-const char * books_buyers_reference_table ()
-{
-  return "buyref";
+// The approximate order books used to be stored in one SQLite database per exchange/market/coin.
+// Every refresh deleted the old book and inserted every level again,
+// and every lookup selected and parsed all levels.
+// The order books are now kept in a cache in a memory-mapped file,
+// shared by all programs on this machine.
+// The cache is a hash table with a fixed number of entries.
+// Each entry holds the buyers or the sellers for one exchange/market/coin,
+// with the reference price, the second it was stored, and a fixed number of levels.
+// Each entry has its own sequence number, which is odd while the entry is being written.
+// A reader copies the entry, and accepts the copy only if the sequence number was even and did not change meanwhile.
+// Writers take turns through a lock on the file.
+// Once all entries have been assigned, order books for other exchanges/markets/coins are not cached.
+// The number of those is logged.
+// The SQLite databases used to be rewritten or expired, so an order book never stayed around for long.
+// An entry in the cache stays until it is overwritten.
+// So a reader considers an entry that has not been written for a while as no longer there.
+
+
+#define ORDER_BOOK_CACHE_ENTRIES 16384
+#define ORDER_BOOK_CACHE_LEVELS 256
+// The number of seconds an entry is valid, as long as the market snapshot.
+#define ORDER_BOOK_CACHE_VALIDITY MARKET_SNAPSHOT_MAXIMUM_AGE
+
+
+struct order_book_cache_entry
+{
+  atomic <uint32_t> sequence;
+  // Whether the key has been assigned.
+  // Once assigned, the key of an entry never changes.
+  atomic <uint32_t> used;
+  char key [120];
+  float price;
+  int32_t second;
+  uint32_t count;
+  float quantities [ORDER_BOOK_CACHE_LEVELS];
+  float rates [ORDER_BOOK_CACHE_LEVELS];
+};
+
+
+mutex order_book_cache_mutex;
+int order_book_cache_fd = -1;
+order_book_cache_entry * order_book_cache = nullptr;
+// The number of order books this process could not store, as the cache had no room for them.
+int order_book_cache_dropped = 0;
+
+
+// Maps the cache into memory, once per process.
+bool order_book_cache_open ()
+{
+  lock_guard <mutex> lock (order_book_cache_mutex);
+  if (order_book_cache) return true;
+  size_t size = sizeof (order_book_cache_entry) * ORDER_BOOK_CACHE_ENTRIES;
+  string path = shared_memory_path ("orderbooks");
+  int fd = open (path.c_str (), O_RDWR | O_CREAT, 0644);
+  if (fd < 0) return false;
+  // The file is sparse, so it only takes memory for the entries that are used.
+  struct stat st;
+  if ((fstat (fd, &st) != 0) || ((size_t) st.st_size < size)) {
+    if (ftruncate (fd, size) != 0) {
+      close (fd);
+      return false;
+    }
+  }
+  void * address = mmap (nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (address == MAP_FAILED) {
+    close (fd);
+    return false;
+  }
+  order_book_cache_fd = fd;
+  order_book_cache = (order_book_cache_entry *) address;
+  return true;
 }
 
 
-const char * books_sellers_reference_table ()
-{
-  return "sellref";
+// Finds the entry for the $buyers or $sellers of $exchange $market $coin.
+// If $create is set, it assigns a free entry if there's none yet.
+// Returns nullptr if there's no entry.
+// The cache should have been opened.
+order_book_cache_entry * order_book_cache_find (bool buyers, bool sellers,
+                                                const string & exchange,
+                                                const string & market,
+                                                const string & coin,
+                                                bool create)
+{
+  string key;
+  if (buyers) key = "buyers";
+  if (sellers) key = "sellers";
+  key.append (" " + exchange + " " + market + " " + coin);
+  if (key.size () >= sizeof (order_book_cache_entry::key)) return nullptr;
+  // The 32 bits FNV-1a hash.
+  uint32_t hash = 2166136261u;
+  for (unsigned char c : key) {
+    hash ^= c;
+    hash *= 16777619u;
+  }
+  // Open addressing: Probe the entries following the one the hash points to.
+  for (uint32_t probe = 0; probe < ORDER_BOOK_CACHE_ENTRIES; probe++) {
+    order_book_cache_entry * entry = &order_book_cache [(hash + probe) % ORDER_BOOK_CACHE_ENTRIES];
+    if (!entry->used.load (memory_order_acquire)) {
+      if (!create) return nullptr;
+      // The writers hold the lock, so no other writer can assign this entry meanwhile.
+      strcpy (entry->key, key.c_str ());
+      entry->used.store (1, memory_order_release);
+      return entry;
+    }
+    if (key == entry->key) return entry;
+  }
+  return nullptr;
 }
 
 
@@ -2398,8 +3084,8 @@ const char * books_sellers_reference_table ()
 // $exchange $market $coin: Where the order book applies to.
 // $price: The reference price to store along with the order book.
 // $quantities $rates: The contents of the order book.
-// This will store the order books, not in MySQL online,
-// but in SQLite locally.
+// Only the best levels are kept, as many as an entry in the cache can hold.
+// This stores the order books, not in MySQL online, but locally.
 // This is faster. And it does not burden the MySQL database at the front bot.
 // And since the approximate order books are used for the analyzers running at the back bots,
 // there is no need to send the information over the wires to the front bot.
@@ -2411,90 +3097,32 @@ void order_books_set (bool buyers, bool sellers,
                       const vector <float> & quantities,
                       const vector <float> & rates)
 {
-  string database = books_database (exchange, market, coin);
-  // It tests on file size.
-  // If data was read from an empty database, the file size will still be zero.
-  // So here, it will still create the table.
-  // If just testing for the file's existence,
-  // it would consider the database to be already there,
-  // and so not create the table.
-  bool exists = filesize (SqliteDatabase::path (database));
-
-  // Connect to the database.
-  SqliteDatabase sql (database);
-
-  // Create the tables if they don't exist yet.
-  if (!exists) {
-    sql.clear ();
-    sql.add ("CREATE TABLE IF NOT EXISTS");
-    sql.add (books_buyers_table ());
-    sql.add ("(quantity real, rate real);");
-    sql.execute ();
-    sql.clear ();
-    sql.add ("CREATE TABLE IF NOT EXISTS");
-    sql.add (books_sellers_table ());
-    sql.add ("(quantity real, rate real);");
-    sql.execute ();
-    sql.clear ();
-    sql.add ("CREATE TABLE IF NOT EXISTS");
-    sql.add (books_buyers_reference_table ());
-    sql.add ("(price real);");
-    sql.execute ();
-    sql.clear ();
-    sql.add ("CREATE TABLE IF NOT EXISTS");
-    sql.add (books_sellers_reference_table ());
-    sql.add ("(price real);");
-    sql.execute ();
-  }
-
-  sql.clear ();
-  sql.add ("PRAGMA synchronous = OFF;");
-  sql.execute ();
-
-  // Delete existing quantities and rates before storing the new.
-  // It uses the SQLite truncate optimization.
-  sql.clear ();
-  sql.add ("DELETE FROM");
-  if (buyers) sql.add (books_buyers_table ());
-  if (sellers) sql.add (books_sellers_table ());
-  sql.add (";");
-  sql.execute ();
-
-  // Store the new quantities and rates.
-  for (unsigned int i = 0; i < quantities.size(); i++) {
-    sql.clear ();
-    sql.add ("INSERT INTO");
-    if (buyers) sql.add (books_buyers_table ());
-    if (sellers) sql.add (books_sellers_table ());
-    sql.add ("(quantity, rate) VALUES (");
-    sql.add (quantities[i]);
-    sql.add (",");
-    sql.add (rates[i]);
-    sql.add (");");
-    sql.execute ();
+  if (!order_book_cache_open ()) return;
+  lock_guard <mutex> lock (order_book_cache_mutex);
+  flock (order_book_cache_fd, LOCK_EX);
+  order_book_cache_entry * entry = order_book_cache_find (buyers, sellers, exchange, market, coin, true);
+  if (entry) {
+    uint32_t sequence = entry->sequence.load ();
+    // A writer that crashed halfway may have left an odd sequence number.
+    if (sequence & 1) sequence++;
+    entry->sequence.store (sequence + 1);
+    atomic_thread_fence (memory_order_release);
+    size_t count = min (quantities.size (), rates.size ());
+    if (count > ORDER_BOOK_CACHE_LEVELS) count = ORDER_BOOK_CACHE_LEVELS;
+    entry->price = price;
+    entry->second = seconds_since_epoch ();
+    entry->count = count;
+    memcpy (entry->quantities, quantities.data (), count * sizeof (float));
+    memcpy (entry->rates, rates.data (), count * sizeof (float));
+    entry->sequence.store (sequence + 2, memory_order_release);
+  } else {
+    // Log the first one, and then one out of many, so the log does not fill up.
+    order_book_cache_dropped++;
+    if ((order_book_cache_dropped % 1000) == 1) {
+      to_stderr ({"The order book cache has no room for", coin, "@", market, "@", exchange, "-", to_string (order_book_cache_dropped), "order books not stored"});
+    }
   }
-
-  // In the same manner, store the reference price.
-  sql.clear ();
-  sql.add ("DELETE FROM");
-  if (buyers) sql.add (books_buyers_reference_table ());
-  if (sellers) sql.add (books_sellers_reference_table ());
-  sql.add (";");
-  sql.execute ();
-  sql.clear ();
-  sql.add ("INSERT INTO");
-  if (buyers) sql.add (books_buyers_reference_table ());
-  if (sellers) sql.add (books_sellers_reference_table ());
-  sql.add ("(price) VALUES (");
-  sql.add (price);
-  sql.add (");");
-  sql.execute ();
-  
-  // It would be good practise, normally, to do a VACUUM now and then.
-  // But it appears that this is not needed in this case.
-  // The file sizes were observed for some days.
-  // The file sizes of all order book databases remain 20480 for all of them.
-  // So there's no need to VACUUM the databases.
+  flock (order_book_cache_fd, LOCK_UN);
 }
 
 
@@ -2511,46 +3139,36 @@ void order_books_get (bool buyers, bool sellers,
   quantities.clear ();
   rates.clear ();
   
-  string database = books_database (exchange, market, coin);
-  // It tests on file size.
-  // If data was read from an empty database, the file size will still be zero.
-  // So here, it will still create the table.
-  // If just testing for the file's existence,
-  // it would consider the database to be already there,
-  // and so not create the table.
-  bool exists = filesize (SqliteDatabase::path (database));
-  
-  // If the database does not exist, there's no data: Done.
-  if (!exists) return;
-  
-  // Open the database.
-  SqliteDatabase sql (database);
+  // If there's no entry, there's no data: Done.
+  if (!order_book_cache_open ()) return;
+  order_book_cache_entry * entry = order_book_cache_find (buyers, sellers, exchange, market, coin, false);
+  if (!entry) return;
   
-  // Read the quantities and the rates.
-  sql.add ("SELECT * FROM");
-  if (buyers) sql.add (books_buyers_table ());
-  if (sellers) sql.add (books_sellers_table ());
-  sql.add ("ORDER BY rowid;");
-  map <string, vector <string> > result = sql.query ();
-  vector <string> v_quantities = result ["quantity"];
-  vector <string> v_rates = result ["rate"];
-  for (unsigned int i = 0; i < v_quantities.size(); i++) {
-    float quantity = str2float (v_quantities[i]);
-    quantities.push_back (quantity);
-    float rate = str2float (v_rates[i]);
-    rates.push_back (rate);
-  }
-  
-  // Read the reference price.
-  sql.clear ();
-  sql.add ("SELECT * FROM");
-  if (buyers) sql.add (books_buyers_reference_table ());
-  if (sellers) sql.add (books_sellers_reference_table ());
-  sql.add (";");
-  result = sql.query ();
-  vector <string> v_prices = result ["price"];
-  if (!v_prices.empty ()) {
-    price = str2float (v_prices[0]);
+  float stored_price;
+  int32_t second;
+  uint32_t count;
+  float stored_quantities [ORDER_BOOK_CACHE_LEVELS];
+  float stored_rates [ORDER_BOOK_CACHE_LEVELS];
+  for (int attempt = 0; attempt < 100; attempt++) {
+    uint32_t sequence = entry->sequence.load (memory_order_acquire);
+    if (sequence & 1) {
+      this_thread::sleep_for (chrono::microseconds (10));
+      continue;
+    }
+    stored_price = entry->price;
+    second = entry->second;
+    count = entry->count;
+    if (count > ORDER_BOOK_CACHE_LEVELS) count = ORDER_BOOK_CACHE_LEVELS;
+    memcpy (stored_quantities, entry->quantities, count * sizeof (float));
+    memcpy (stored_rates, entry->rates, count * sizeof (float));
+    atomic_thread_fence (memory_order_acquire);
+    if (entry->sequence.load (memory_order_relaxed) != sequence) continue;
+    // An order book that has not been refreshed for a while is outdated: There's no data.
+    if (seconds_since_epoch () - second > ORDER_BOOK_CACHE_VALIDITY) return;
+    price = stored_price;
+    quantities.assign (stored_quantities, stored_quantities + count);
+    rates.assign (stored_rates, stored_rates + count);
+    return;
   }
 }
 
@@ -2601,9 +3219,21 @@ void sellers_get (const string & exchange,
 
 void buyers_sellers_delete (const string & exchange, const string & market, const string & coin)
 {
-  string database = books_database (exchange, market, coin);
-  string path = SqliteDatabase::path (database);
-  unlink (path.c_str());
+  // The entries remain assigned in the cache, but they no longer have data.
+  order_books_set (true, false, exchange, market, coin, 0, {}, {});
+  order_books_set (false, true, exchange, market, coin, 0, {}, {});
+}
+
+
+// Removes the SQLite databases the order books used to be stored in.
+// Nothing reads them anymore, since the order books are in the cache.
+void order_books_remove_databases ()
+{
+  string folder = SqliteDatabase::path ("");
+  for (auto file : scandir (folder)) {
+    if (file.find ("books_") != 0) continue;
+    unlink ((folder + "/" + file).c_str ());
+  }
 }
 
 
@@ -2622,6 +3252,7 @@ void buyers_sellers_delete (const string & exchange, const string & market, cons
 // Container $coins has all coins supported by the market at the exchange, separated by spaces.
 void coins_market_get (SQL & sql, vector <string> & exchanges, vector <string> & markets, vector <string> & coins)
 {
+  if (market_snapshot_coins_market (sql, exchanges, markets, coins)) return;
   sql.clear ();
   sql.add ("SELECT exchange, market, coins FROM coinsmarket;");
   map <string, vector <string> > result = sql.query ();
@@ -2644,6 +3275,7 @@ void coins_market_set (SQL & sql, const string & exchange, const string & market
   sql.add (market);
   sql.add (";");
   sql.execute ();
+  market_snapshot_invalidate (sql);
   // If no coins given: Ready.
   // This means that the database record will remain deleted.
   if (coins.empty ()) return;
@@ -2711,7 +3343,8 @@ void optimizer_get (SQL & sql,
 }
 
 
-void optimizer_add (SQL & sql, const string & exchange, const string & coin, float start, float forecast)
+// The write goes via the write-behind queue, unless it should be $synchronous.
+void optimizer_add (SQL & sql, const string & exchange, const string & coin, float start, float forecast, bool synchronous)
 {
   sql.clear ();
   sql.add ("INSERT INTO optimizer (exchange, coin, start, forecast) VALUES (");
@@ -2723,7 +3356,8 @@ void optimizer_add (SQL & sql, const string & exchange, const string & coin, flo
   sql.add (",");
   sql.add (forecast);
   sql.add (");");
-  sql.execute ();
+  if (synchronous) sql.execute ();
+  else sql.defer ();
 }
 
 
@@ -3285,33 +3919,105 @@ void availables_store (SQL & sql,
                        string coin,
                        float bidsize,
                        float asksize,
-                       float realized)
+                       float realized,
+                       bool synchronous)
 {
-  sql.clear ();
-  sql.add ("INSERT INTO availables (");
-  if (!stamp.empty ()) sql.add ("stamp,");
-  sql.add ("second, seller, buyer, market, coin, bidsize, asksize, realized) VALUES (");
-  if (!stamp.empty ()) {
-    sql.add (stamp);
+  // A deferred write is queued as text, so it does not use a prepared statement.
+  if (!synchronous) {
+    sql.clear ();
+    sql.add ("INSERT INTO availables (");
+    if (!stamp.empty ()) sql.add ("stamp,");
+    sql.add ("second, seller, buyer, market, coin, bidsize, asksize, realized) VALUES (");
+    if (!stamp.empty ()) {
+      sql.add (stamp);
+      sql.add (",");
+    }
+    sql.add (second);
+    sql.add (",");
+    sql.add (seller);
+    sql.add (",");
+    sql.add (buyer);
+    sql.add (",");
+    sql.add (market);
+    sql.add (",");
+    sql.add (coin);
     sql.add (",");
+    sql.add (bidsize);
+    sql.add (",");
+    sql.add (asksize);
+    sql.add (",");
+    sql.add (realized);
+    sql.add (");");
+    sql.defer ();
+    return;
+  }
+  
+  // The statement is prepared once per connection.
+  // Storing many rows binds the values to it, rather than formatting and parsing them again.
+  string statement = "INSERT INTO availables (";
+  if (!stamp.empty ()) statement.append ("stamp, ");
+  statement.append ("second, seller, buyer, market, coin, bidsize, asksize, realized) VALUES (");
+  if (!stamp.empty ()) statement.append ("?, ");
+  statement.append ("?, ?, ?, ?, ?, ?, ?, ?);");
+  if (!sql.prepare (statement)) return;
+  int index = 1;
+  if (!stamp.empty ()) sql.bind (index++, stamp);
+  sql.bind (index++, second);
+  sql.bind (index++, seller);
+  sql.bind (index++, buyer);
+  sql.bind (index++, market);
+  sql.bind (index++, coin);
+  sql.bind (index++, bidsize);
+  sql.bind (index++, asksize);
+  sql.bind (index++, realized);
+  sql.run ();
+}
+
+
+// Stores many availables at once, with their time stamps.
+// The rows go to the database in as few statements as the maximum packet size allows.
+void availables_store (SQL & sql,
+                       const vector <string> & stamps,
+                       const vector <int> & seconds,
+                       const vector <string> & sellers,
+                       const vector <string> & buyers,
+                       const vector <string> & markets,
+                       const vector <string> & coins,
+                       const vector <float> & bidsizes,
+                       const vector <float> & asksizes,
+                       const vector <float> & realizeds)
+{
+  SQLInsert insert (sql, "INSERT INTO availables (stamp, second, seller, buyer, market, coin, bidsize, asksize, realized) VALUES");
+  for (size_t i = 0; i < seconds.size (); i++) {
+    insert.row ();
+    insert.add (stamps[i]);
+    insert.add (seconds[i]);
+    insert.add (sellers[i]);
+    insert.add (buyers[i]);
+    insert.add (markets[i]);
+    insert.add (coins[i]);
+    insert.add (bidsizes[i]);
+    insert.add (asksizes[i]);
+    insert.add (realizeds[i]);
+  }
+  insert.flush ();
+}
+
+
+// Deletes the availables with the $ids, many at once.
+void availables_delete (SQL & sql, const vector <int> & ids)
+{
+  for (size_t begin = 0; begin < ids.size (); begin += 1000) {
+    size_t end = min (begin + 1000, ids.size ());
+    sql.clear ();
+    sql.add ("DELETE FROM availables WHERE id IN (");
+    for (size_t i = begin; i < end; i++) {
+      if (i > begin) sql.add (",");
+      sql.add (ids[i]);
+    }
+    sql.add (");");
+    sql.execute ();
   }
-  sql.add (second);
-  sql.add (",");
-  sql.add (seller);
-  sql.add (",");
-  sql.add (buyer);
-  sql.add (",");
-  sql.add (market);
-  sql.add (",");
-  sql.add (coin);
-  sql.add (",");
-  sql.add (bidsize);
-  sql.add (",");
-  sql.add (asksize);
-  sql.add (",");
-  sql.add (realized);
-  sql.add (");");
-  sql.execute ();
 }
 
 
@@ -3328,39 +4034,31 @@ void availables_get (SQL & sql,
                      vector <float> & realizeds)
 {
   sql.clear ();
-  sql.add ("SELECT * FROM availables ORDER BY id;");
-  map <string, vector <string> > result = sql.query ();
-  vector <string> values;
-  
+  sql.add ("SELECT id, stamp, second, seller, buyer, market, coin, bidsize, asksize, realized FROM availables ORDER BY id;");
   ids.clear ();
-  values = result ["id"];
-  for (auto & v : values) ids.push_back (str2int (v));
-
-  stamps = result ["stamp"];
-
+  stamps.clear ();
   seconds.clear ();
-  values = result ["second"];
-  for (auto & v : values) seconds.push_back (str2int (v));
-
-  sellers = result ["seller"];
-
-  buyers = result ["buyer"];
-
-  markets = result ["market"];
-
-  coins = result ["coin"];
-
+  sellers.clear ();
+  buyers.clear ();
+  markets.clear ();
+  coins.clear ();
   bidsizes.clear ();
-  values = result ["bidsize"];
-  for (auto & v : values) bidsizes.push_back (str2float (v));
-
   asksizes.clear ();
-  values = result ["asksize"];
-  for (auto & v : values) asksizes.push_back (str2float (v));
-
   realizeds.clear ();
-  values = result ["realized"];
-  for (auto & v : values) realizeds.push_back (str2float (v));
+  if (sql.stream ()) {
+    while (sql.fetch ()) {
+      ids.push_back (sql.column_int (0));
+      stamps.push_back (sql.column_text (1));
+      seconds.push_back (sql.column_int (2));
+      sellers.push_back (sql.column_text (3));
+      buyers.push_back (sql.column_text (4));
+      markets.push_back (sql.column_text (5));
+      coins.push_back (sql.column_text (6));
+      bidsizes.push_back (sql.column_float (7));
+      asksizes.push_back (sql.column_float (8));
+      realizeds.push_back (sql.column_float (9));
+    }
+  }
 }
 
 
@@ -25,11 +25,29 @@
 #define INCLUDED_MODELS_H
 
 
+void rates_store (SQL & sql, int second,
+                  const vector <string> & exchanges, const vector <string> & markets, const vector <string> & coins,
+                  const vector <float> & bids, const vector <float> & asks);
 void rates_get (SQL & sql, vector <int> & seconds,
                 vector <string> & exchanges, vector <string> & markets, vector <string> & coins,
                 vector <float> & bids, vector <float> & asks, vector <float> & rates,
                 bool only_recent);
 float rate_get_cached (const string & exchange, const string & market, const string & coin);
+extern string shared_memory_prefix;
+string market_snapshot_path ();
+void market_snapshot_add (string & data, uint32_t value);
+void market_snapshot_add (string & data, float value);
+void market_snapshot_add (string & data, const string & value);
+void market_snapshot_write (const string & host, int second, const string & payload);
+void market_snapshot_publish (SQL & sql);
+void market_snapshot_invalidate (SQL & sql);
+bool market_snapshot_rates (SQL & sql, vector <int> & seconds,
+                            vector <string> & exchanges, vector <string> & markets, vector <string> & coins,
+                            vector <float> & bids, vector <float> & asks, vector <float> & rates,
+                            bool only_recent);
+bool market_snapshot_coins_market (SQL & sql, vector <string> & exchanges, vector <string> & markets, vector <string> & coins);
+bool market_snapshot_minimum_trades (SQL & sql, map <string, float> & minimum_trades);
+bool market_snapshot_paused_trades (SQL & sql, vector <string> & paused);
 
 
 class arbitrage_item
@@ -172,7 +190,8 @@ bool withdrawals_present (SQL & sql, string exchange, string orderid);
 void trades_store (SQL & sql,
                    string market, string coin,
                    string buyexchange, string sellexchange,
-                   float quantity, float marketgain);
+                   float quantity, float marketgain,
+                   bool synchronous = false);
 void trades_get_month (SQL & sql,
                        vector <int> & seconds,
                        vector <string> & markets, vector <string> & coins,
@@ -190,7 +209,7 @@ string failures_type_api_error ();
 string failures_type_bot_error ();
 string failures_hurried_call_succeeded ();
 string failures_hurried_call_failed ();
-void failures_store (SQL & sql, string type, string exchange, string coin, float quantity, string message);
+void failures_store (SQL & sql, string type, string exchange, string coin, float quantity, string message, bool synchronous = false);
 void failures_retrieve (SQL & sql, string type,
                         vector <string> & timestamps,
                         vector <string> & exchanges,
@@ -216,6 +235,11 @@ vector <string> pausetrade_get (SQL & sql);
 
 string allrates_database (const string & exchange, const string & market, const string & coin);
 string allrates_database (int second);
+string allrates_folder (const string & exchange, const string & market, const string & coin);
+void allrates_append (const string & exchange, const string & market, const string & coin,
+                      const vector <int> & seconds, const vector <float> & bids, const vector <float> & asks);
+void allrates_migrate (const string & exchange, const string & market, const string & coin);
+void allrates_migrate_cleanup ();
 void allrates_add (const string & exchange, const string & market, const string & coin,
                    int second, float bid, float ask);
 void allrates_add (int second,
@@ -224,9 +248,17 @@ void allrates_add (int second,
                    const vector <string> & coins,
                    const vector <float> & bids,
                    const vector <float> & asks);
+void allrates_import (const vector <int> & seconds,
+                      const vector <string> & exchanges,
+                      const vector <string> & markets,
+                      const vector <string> & coins,
+                      const vector <float> & bids,
+                      const vector <float> & asks);
 bool allrates_exists (const string & exchange, const string & market, const string & coin);
 void allrates_get (const string & exchange, const string & market, const string & coin,
                    vector <int> & seconds, vector <float> & bids, vector <float> & asks);
+void allrates_get (const string & exchange, const string & market, const string & coin, int from_second,
+                   vector <int> & seconds, vector <float> & bids, vector <float> & asks);
 void allrates_get (const string & database,
                    vector <string> & exchanges,
                    vector <string> & markets,
@@ -362,6 +394,7 @@ void sellers_get (const string & exchange,
                   vector <float> & quantities,
                   vector <float> & rates);
 void buyers_sellers_delete (const string & exchange, const string & market, const string & coin);
+void order_books_remove_databases ();
 
 
 void coins_market_get (SQL & sql, vector <string> & exchanges, vector <string> & markets, vector <string> & coins);
@@ -375,7 +408,7 @@ void optimizer_get (SQL & sql,
                     vector <float> & starts,
                     vector <float> & forecasts,
                     vector <float> & realizeds);
-void optimizer_add (SQL & sql, const string & exchange, const string & coin, float start, float forecast);
+void optimizer_add (SQL & sql, const string & exchange, const string & coin, float start, float forecast, bool synchronous = false);
 void optimizer_update (SQL & sql, int identifier, float realized);
 void optimizer_delete (SQL & sql, int identifier);
 
@@ -465,7 +498,18 @@ void availables_store (SQL & sql,
                        string coin,
                        float bidsize,
                        float asksize,
-                       float realized);
+                       float realized,
+                       bool synchronous = false);
+void availables_store (SQL & sql,
+                       const vector <string> & stamps,
+                       const vector <int> & seconds,
+                       const vector <string> & sellers,
+                       const vector <string> & buyers,
+                       const vector <string> & markets,
+                       const vector <string> & coins,
+                       const vector <float> & bidsizes,
+                       const vector <float> & asksizes,
+                       const vector <float> & realizeds);
 void availables_get (SQL & sql,
                      vector <int> & ids,
                      vector <string> & stamps,
@@ -478,6 +522,7 @@ void availables_get (SQL & sql,
                      vector <float> & asksizes,
                      vector <float> & realizeds);
 void availables_delete (SQL & sql, int id);
+void availables_delete (SQL & sql, const vector <int> & ids);
 
 
 #endif
@@ -43,10 +43,6 @@ vector <string> paused_trading_exchanges_markets_coins;
 // The multipaths already stored at the front bot.
 vector <multipath> stored_multipaths;
 
-// Tracker for simultaneous analyzers.
-atomic <int> current_simultaneous_analyzer_count (0);
-
-
 void multipath_get_rates (const string & exchange, const string & market)
 {
   vector <string> coins = exchange_get_coins_per_market_cached (exchange, market);
@@ -68,9 +64,6 @@ void multipath_get_rates (const string & exchange, const string & market)
 
 void multipath_analyze_one (multipath & path)
 {
-  // One more running multipath analyzer.
-  current_simultaneous_analyzer_count++;
-
   // Flag whether the path is good to go.
   bool path_is_good = true;
   
@@ -150,9 +143,6 @@ void multipath_analyze_one (multipath & path)
       multipath_store (sql, path);
     }
   }
-  
-  // One multipath analyzer completed.
-  current_simultaneous_analyzer_count--;
 }
 
 
@@ -203,18 +193,21 @@ int main (int argc, char *argv[])
     stored_multipaths = multipath_get (sql);
 
     
-    // Fetch the approximate rates from the exchanges in parallel threads.
+    // Fetch the approximate rates from the exchanges.
+    // It used to do this in parallel threads, one per exchange and market.
+    // It now fetches all market summaries in one go, and then reads them from the memory cache.
     {
-      vector <thread *> jobs;
-      vector <string> exchanges = exchange_get_names ();
-      for (auto exchange : exchanges) {
-        vector <string> markets = exchange_get_supported_markets (exchange);
-        for (auto market : markets) {
-          thread * job = new thread (multipath_get_rates, exchange, market);
-          jobs.push_back (job);
+      vector <string> exchanges, markets;
+      for (auto exchange : exchange_get_names ()) {
+        for (auto market : exchange_get_supported_markets (exchange)) {
+          exchanges.push_back (exchange);
+          markets.push_back (market);
         }
       }
-      for (auto job : jobs) job->join ();
+      refresh_cached_approximate_rates (exchanges, markets);
+      for (size_t i = 0; i < exchanges.size (); i++) {
+        multipath_get_rates (exchanges [i], markets [i]);
+      }
     }
     to_stdout ({"Analyzing multipath trading in", to_string (exchange_market_coin_bids.size()), "exchange/market/coin combinations"});
 
@@ -372,26 +365,15 @@ int main (int argc, char *argv[])
       // Storage format: vector of exchange+market+coin, as one string.
       paused_trading_exchanges_markets_coins = pausetrade_get (sql);
       
-      // Investigate all the raw multipaths.
+      // Investigate all the raw multipaths on the thread pool.
+      // An analyzer starts as soon as fewer than the maximum number of analyzers are running.
+      task_group analyzers (maximum_simultaneous_analyzers);
       for (auto & path : bare_multipaths) {
-        
-        // Wait till there's an available free slot for a new analyzer.
-        while (current_simultaneous_analyzer_count >= maximum_simultaneous_analyzers) {
-          this_thread::sleep_for (chrono::milliseconds (10));
-        }
-
-        // Start the analyzer thread.
-        new thread (multipath_analyze_one, ref (path));
-
-        // Wait shortly to give the started thread a chance to update the thread count.
-        this_thread::sleep_for (chrono::milliseconds (1));
-        
+        analyzers.run ([&path] { multipath_analyze_one (path); });
       }
       
-      // Wait till all threads have completed.
-      while (current_simultaneous_analyzer_count > 0) {
-        this_thread::sleep_for (chrono::milliseconds (10));
-      }
+      // Wait till all analyzers have completed.
+      analyzers.wait_all ();
 
     }
 
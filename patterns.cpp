@@ -37,26 +37,20 @@
 // Store the exchange/markets/coins considered to be good coins for certain patterns.
 vector <string> profitable_exchanges_markets_coins_reasons;
 
-// Tracker for simultaneous detectors.
-atomic <int> current_simultaneous_detector_count (0);
-
 void patterns_detector (const string & exchange, const string & market, const string & coin)
 {
-  // One more running pattern detector.
-  current_simultaneous_detector_count++;
-  
   to_output output ("Patterns for " + coin + " @ " + market + " @ " + exchange);
   
   // Storage for super fast access to the minutely rates and the average hourly rates.
-  unordered_map <int, float> minute_asks, minute_bids, hour_asks, hour_bids;
-  pattern_prepare (&output, exchange, market, coin, minute_asks, minute_bids, hour_asks, hour_bids);
+  TimeSeries minutes, hours;
+  pattern_prepare (&output, exchange, market, coin, minutes, hours);
   
   // If there's insufficient rates, skip the analysis.
-  if (hour_asks.size () >= 10) {
+  if (hours.size () >= 10) {
 
     // Detect the specified patterns.
     string reason = pattern_type_increase_day_week ();
-    bool coin_good = pattern_increase_day_week_simulator (&output, hour_asks, hour_bids, reason);
+    bool coin_good = pattern_increase_day_week_simulator (&output, hours, reason);
     
     // Whether to store this coin plus details in the database, or to remove it.
     string signature = exchange + market + coin + reason;
@@ -87,16 +81,13 @@ void patterns_detector (const string & exchange, const string & market, const st
       string picturepath;
       string basename = exchange + "-" + market + "-" + coin;
       for (int hour = -300; hour <= 0; hour++) {
-        float rate = (hour_asks [hour] + hour_bids [hour]) / 2;
+        float rate = (hours.ask (hour) + hours.bid (hour)) / 2;
         plotdata.push_back (make_pair (hour, rate));
       }
       plot (plotdata, {}, basename, "", picturepath);
     }
     
   }
-
-  // One pattern detector completed.
-  current_simultaneous_detector_count--;
 }
 
 
@@ -149,6 +140,9 @@ int main (int argc, char *argv[])
       }
     }
     
+    // The detectors run on the thread pool.
+    task_group detectors (maximum_simultaneous_detectors);
+    
     // Iterate over all exchanges.
     vector <string> exchanges = exchange_get_names ();
     for (auto exchange : exchanges) {
@@ -168,22 +162,15 @@ int main (int argc, char *argv[])
           if (market != "bitcoin") continue;
           //if (coin != "bitbay") continue;
           //continue;
-          // Wait till there's an available slot for this new detection thread.
-          while (current_simultaneous_detector_count >= maximum_simultaneous_detectors) {
-            this_thread::sleep_for (chrono::milliseconds (10));
-          }
-          // Start the detection thread.
-          new thread (patterns_detector, exchange, market, coin);
-          // Wait shortly to give the previously started thread to update the thread count.
-          this_thread::sleep_for (chrono::milliseconds (1));
+          // Queue the detector.
+          // It starts as soon as fewer than the maximum number of detectors are running.
+          detectors.run ([exchange, market, coin] { patterns_detector (exchange, market, coin); });
         }
       }
     }
     
-    // Wait till all threads have completed.
-    while (current_simultaneous_detector_count > 0) {
-      this_thread::sleep_for (chrono::milliseconds (10));
-    }
+    // Wait till all detectors have completed.
+    detectors.wait_all ();
 
   }
   finalize_program ();
@@ -247,6 +247,12 @@ vector <string> proxy_servers_ipv4;
 vector <string> proxy_servers_ipv6;
 vector <string> proxy_servers_ipv46;
 vector <string> satellites;
+// The response times of the satellites to the heartbeat in the satellite test.
+map <string, long> satellite_heartbeat_milliseconds;
+// The seconds the satellites passed the satellite test.
+map <string, int> satellite_tested_seconds;
+// The number of seconds a satellite that passed the satellite test is considered live.
+#define SATELLITE_TESTS_VALIDITY 600
 
 
 vector <string> satellite_hosts ()
@@ -317,7 +323,9 @@ void satellite_test (const string & host)
   string request = "heartbeat";
   bool hurry = true;
   string error;
+  long start = milliseconds_since_epoch ();
   string result = satellite_request (host, request, hurry, error);
+  long milliseconds = milliseconds_since_epoch () - start;
 
   // There should be no error, if the satellite can be contacted.
   if (!error.empty ()) {
@@ -336,14 +344,78 @@ void satellite_test (const string & host)
   // Store this satellite as a live one.
   proxy_satellite_update_mutex.lock ();
   satellites.push_back (host);
+  satellite_heartbeat_milliseconds [host] = milliseconds;
+  satellite_tested_seconds [host] = seconds_since_epoch ();
+  proxy_satellite_update_mutex.unlock ();
+}
+
+
+// The file with the results of the last test of the satellites.
+string satellite_tests_path ()
+{
+  return "/tmp/satellites.txt";
+}
+
+
+// Stores the live satellites and their response times.
+// Each line has a live satellite, its response time in milliseconds, and the second it was tested.
+// The satellites that failed the test are not stored.
+void satellite_tests_save ()
+{
+  vector <string> lines;
+  proxy_satellite_update_mutex.lock ();
+  for (auto & host : satellites) {
+    lines.push_back (host + " " + to_string (satellite_heartbeat_milliseconds [host]) + " " + to_string (satellite_tested_seconds [host]));
+  }
+  proxy_satellite_update_mutex.unlock ();
+  // Write it to a temporary file first, then move it into place,
+  // so a bot that starts at the same time never reads half a file.
+  string path = satellite_tests_path ();
+  string temporary = path + "." + to_string (getpid ());
+  file_put_contents (temporary, implode (lines, "\n"));
+  rename (temporary.c_str (), path.c_str ());
+}
+
+
+// Loads the satellites that passed a recent test as live ones.
+void satellite_tests_load ()
+{
+  vector <string> lines = explode (file_get_contents (satellite_tests_path ()), '\n');
+  vector <string> hosts = satellite_hosts ();
+  int now = seconds_since_epoch ();
+  proxy_satellite_update_mutex.lock ();
+  for (auto & line : lines) {
+    vector <string> bits = explode (line, ' ');
+    if (bits.size () != 3) continue;
+    // Skip satellites no longer in the list.
+    if (!in_array (bits [0], hosts)) continue;
+    // Skip satellites tested too long ago.
+    int second = str2int (bits [2]);
+    if (now - second > SATELLITE_TESTS_VALIDITY) continue;
+    satellites.push_back (bits [0]);
+    satellite_heartbeat_milliseconds [bits [0]] = str2int (bits [1]);
+    satellite_tested_seconds [bits [0]] = second;
+  }
   proxy_satellite_update_mutex.unlock ();
 }
 
 
 void proxy_satellite_register_live_ones ()
 {
-  // The possible IPv4 proxy hosts and satellites.
-  vector <string> possible_hosts_ipv4 = satellite_hosts ();
+  // Most bots start every minute.
+  // Testing the satellites each time delays the bot, the more so if a satellite is down.
+  // So take the satellites that passed a recent test as live ones.
+  // A satellite that went down since, gets ejected once requests to it fail.
+  // A satellite that failed used to be left out till all results expired.
+  // Now the satellites that failed, or were not tested recently, are tested again each time.
+  satellite_tests_load ();
+  
+  // The possible IPv4 proxy hosts and satellites that need a test.
+  vector <string> possible_hosts_ipv4;
+  for (auto & host : satellite_hosts ()) {
+    if (!in_array (host, satellites)) possible_hosts_ipv4.push_back (host);
+  }
+  if (possible_hosts_ipv4.empty ()) return;
   // possible_hosts_ipv4 = { "localhost" };
   /*
   vector <string> possible_hosts_ipv6 = {
@@ -354,8 +426,8 @@ void proxy_satellite_register_live_ones ()
     "[2a00:f10:400:2:4d9:52ff:fe00:279]", // proxy05 @ pcextreme
   };
    */
-  // Store parallel jobs.
-  vector <thread *> jobs;
+  // Run the tests in parallel on the thread pool.
+  task_group jobs (possible_hosts_ipv4.size ());
   /*
   // Test all possible IPv4 proxies in parallel threads.
   for (auto host : possible_hosts_ipv4) {
@@ -370,15 +442,14 @@ void proxy_satellite_register_live_ones ()
     jobs.push_back (job);
   }
    */
-  // Test all satellites in parallel threads.
+  // Test all satellites in parallel.
   for (auto host : possible_hosts_ipv4) {
-    thread * job = new thread (satellite_test, host);
-    jobs.push_back (job);
-  }
-  // Wait till the threads are ready.
-  for (auto job : jobs) {
-    job->join ();
+    jobs.run ([host] { satellite_test (host); });
   }
+  // Wait till the tests are ready.
+  jobs.wait_all ();
+  // Store the results for the next bots that start.
+  if (!satellites.empty ()) satellite_tests_save ();
 }
 
 
@@ -433,26 +504,93 @@ string proxy_get_ipv46 (const string & exchange)
 }
 
 
-map <string, size_t> satellite_selector;
+// The bot used to rotate through the live satellites for each exchange.
+// It tested them once at startup, and kept using a satellite that failed later on.
+// And a slow satellite got as many requests as a fast one.
+// Now the bot keeps statistics on the requests through each satellite for each exchange:
+// The average response time and the error rate, both as exponentially weighted moving averages.
+// It uses the fastest satellite that does well.
+// A satellite that fails a few times in a row, is left out for a while.
+// After that time, one request goes to that satellite to probe it.
+// If it fails again, it is left out for longer.
+
+
+// The weight of the latest request in the moving averages.
+#define SATELLITE_EWMA_WEIGHT 0.2
+// The number of consecutive failures after which a satellite is left out.
+#define SATELLITE_EJECT_FAILURES 3
+// The initial and the maximum number of seconds a failing satellite is left out.
+#define SATELLITE_EJECT_SECONDS 30
+#define SATELLITE_EJECT_MAXIMUM 300
+
+
+class satellite_statistics
+{
+public:
+  // The moving average of the response time in milliseconds.
+  float milliseconds = 0;
+  // The moving average of the failures, from 0 to 1.
+  float error_rate = 0;
+  int consecutive_failures = 0;
+  int ejections = 0;
+  // Till when the satellite is left out.
+  int ejected_until = 0;
+  // When a probe request was sent after the satellite was left out, or 0 if none.
+  // A probe whose outcome never got recorded, e.g. because a hedge won, expires after a while.
+  int probing = 0;
+};
+
+
+map <string, satellite_statistics> satellite_statistics_data;
+// The response times of the latest successful hurried requests for order books for each exchange.
+// These give the delay for hedging those requests.
+// The market summaries take far longer, and they are not hurried, so they are left out.
+map <string, vector <long> > satellite_latencies;
+#define SATELLITE_LATENCY_SAMPLES 100
 
 
 // Returns the satellite to use.
-string satellite_get (const string & exchange)
+// It will not return the satellite to $avoid, if there's another one.
+string satellite_get (const string & exchange, const string & avoid)
 {
   // Any available live satellites?
   if (satellites.empty ()) return "";
   
-  // Take next satellite, rotating through the available hosts.
-  // The rotation depends on the name of the exchanges.
-  // The goal is that each exchange rotates sequentially through the satellites,
-  // rather than that the entire bot rotates through them.
   string satellite;
+  float best_score = 0;
+  int earliest_return = 0;
+  string earliest_satellite;
+  int now = seconds_since_epoch ();
   proxy_satellite_update_mutex.lock ();
-  satellite_selector [exchange]++;
-  if (satellite_selector [exchange] >= satellites.size()) {
-    satellite_selector [exchange] = 0;
+  for (auto & host : satellites) {
+    if (host == avoid) continue;
+    satellite_statistics & statistics = satellite_statistics_data [host + " " + exchange];
+    // Start off with the response time of the satellite test.
+    if (statistics.milliseconds == 0) statistics.milliseconds = satellite_heartbeat_milliseconds [host];
+    if (statistics.ejected_until) {
+      // Remember which satellite returns first, in case all are left out.
+      if (earliest_satellite.empty () || (statistics.ejected_until < earliest_return)) {
+        earliest_return = statistics.ejected_until;
+        earliest_satellite = host;
+      }
+      if (now < statistics.ejected_until) continue;
+      // The time is over: Probe the satellite with one request.
+      if (!statistics.probing || (now - statistics.probing > SATELLITE_EJECT_SECONDS)) {
+        statistics.probing = now;
+        satellite = host;
+        break;
+      }
+      continue;
+    }
+    // The fastest satellite wins, but failures weigh in heavily.
+    float score = statistics.milliseconds * (1 + 4 * statistics.error_rate);
+    if (satellite.empty () || (score < best_score)) {
+      best_score = score;
+      satellite = host;
+    }
   }
-  satellite = satellites [satellite_selector [exchange]];
+  // If all satellites are left out, use the one that returns first.
+  if (satellite.empty ()) satellite = earliest_satellite;
   proxy_satellite_update_mutex.unlock ();
   
   // Done.
@@ -460,6 +598,60 @@ string satellite_get (const string & exchange)
 }
 
 
+// Returns the $percentile of the response times of the hurried requests for order books at the $exchange.
+// Returns 0 if there's not enough data yet.
+long satellite_latency_percentile (const string & exchange, int percentile)
+{
+  proxy_satellite_update_mutex.lock ();
+  vector <long> latencies = satellite_latencies [exchange];
+  proxy_satellite_update_mutex.unlock ();
+  if (latencies.size () < 10) return 0;
+  size_t index = latencies.size () * percentile / 100;
+  if (index >= latencies.size ()) index = latencies.size () - 1;
+  nth_element (latencies.begin (), latencies.begin () + index, latencies.end ());
+  return latencies [index];
+}
+
+
+// Records the outcome of a request through the $satellite for the $exchange.
+// It took $milliseconds and the satellite responded or it did not.
+// A failure is one to connect, send, or receive, or a timeout.
+// An error the exchange gave is no failure of the satellite: It delivered that error.
+// The time of a $hurried request for an order book also goes into the response times for hedging.
+void satellite_record (const string & satellite, const string & exchange, long milliseconds, bool success, bool hurried)
+{
+  if (satellite.empty ()) return;
+  proxy_satellite_update_mutex.lock ();
+  satellite_statistics & statistics = satellite_statistics_data [satellite + " " + exchange];
+  if (statistics.milliseconds == 0) statistics.milliseconds = milliseconds;
+  statistics.milliseconds += SATELLITE_EWMA_WEIGHT * (milliseconds - statistics.milliseconds);
+  statistics.error_rate += SATELLITE_EWMA_WEIGHT * ((success ? 0 : 1) - statistics.error_rate);
+  if (success && hurried) {
+    vector <long> & latencies = satellite_latencies [exchange];
+    latencies.push_back (milliseconds);
+    if (latencies.size () > SATELLITE_LATENCY_SAMPLES) latencies.erase (latencies.begin ());
+  }
+  if (success) {
+    statistics.consecutive_failures = 0;
+    statistics.ejections = 0;
+    statistics.ejected_until = 0;
+    statistics.probing = 0;
+  } else {
+    statistics.consecutive_failures++;
+    // A failed probe, or too many failures in a row: Leave the satellite out, each time for longer.
+    if (statistics.probing || (statistics.consecutive_failures >= SATELLITE_EJECT_FAILURES)) {
+      int seconds = min (SATELLITE_EJECT_SECONDS << min (statistics.ejections, 4), SATELLITE_EJECT_MAXIMUM);
+      statistics.ejected_until = seconds_since_epoch () + seconds;
+      statistics.ejections++;
+      statistics.consecutive_failures = 0;
+      statistics.probing = 0;
+      to_stdout ({"Leaving satellite", satellite, "out for", exchange, "for", to_string (seconds), "seconds"});
+    }
+  }
+  proxy_satellite_update_mutex.unlock ();
+}
+
+
 vector <string> ipv4_interfaces;
 vector <string> ipv6_interfaces;
 // Cloudflare rate limiting applies to one IPv4 address or to an entire IPv6/64 block.
@@ -619,16 +811,8 @@ void satellite_register_known_hosts ()
 
 string satellite_get_interface (string url)
 {
-  // Remove the scheme http(s):// from the URL.
-  size_t pos = url.find ("://");
-  if (pos != string::npos) {
-    url.erase (0, pos + 3);
-  }
   // Extract the host.
-  pos = url.find (":");
-  if (pos == string::npos) pos = url.find ("/");
-  if (pos == string::npos) pos = url.length () + 1;
-  string host = url.substr (0, pos);
+  string host = http_get_host (url);
   
   // Can the host use an IPv6 interface?
   proxy_satellite_update_mutex.lock ();
@@ -28,7 +28,9 @@ vector <string> satellite_hosts ();
 void proxy_satellite_register_live_ones ();
 string proxy_get_ipv4 (const string & exchange);
 string proxy_get_ipv46 (const string & exchange);
-string satellite_get (const string & exchange);
+string satellite_get (const string & exchange, const string & avoid = "");
+void satellite_record (const string & satellite, const string & exchange, long milliseconds, bool success, bool hurried);
+long satellite_latency_percentile (const string & exchange, int percentile);
 void register_ip_interfaces ();
 string get_ipv46_interface (const string & host);
 string front_bot_ip_address ();
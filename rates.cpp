@@ -43,16 +43,16 @@ unordered_map <string, float> fastbids;
 unordered_map <string, float> fastasks;
 
 
-void fetch_rates_front (string exchange, string market)
-{
-  // Storage.
-  vector <string> coins;
-  vector <float> bids;
-  vector <float> asks;
-  
-  // Get the rates from the exchange.
-  exchange_get_market_summaries_via_satellite (exchange, market, coins, bids, asks);
+// The number of recorded seconds a back bot downloads the rates for in one request.
+// These are the seconds the front bot recorded rates at, not consecutive seconds.
+// It records rates about once a minute, so without gaps this would be about an hour of rates.
+#define RATES_BULK_SECONDS 60
+
 
+// Stores the rates fetched from the exchange in memory.
+void record_rates_front (const string & exchange, const string & market,
+                         const vector <string> & coins, const vector <float> & bids, const vector <float> & asks)
+{
   // Store the rates in memory.
   for (unsigned int i = 0; i < coins.size (); i++) {
     rate detail;
@@ -90,40 +90,19 @@ void store_rates_to_rates_database (int seconds)
 
   SQL sql (front_bot_ip_address ());
 
-  // Iterate over the data and store the rates in the database.
-  // Use one large multiple insert statement.
-  // That works much faster than doing multiple single insert statements.
-  // The result of this is that every minute there's going to be plenty of rates added.
-  // So the database is going to have multiple duplicate rates.
-  // The bot deals in two ways with this, elsewhere:
-  // 1. When getting the rates, it only gets the newest distinct values.
-  // 2. It regularly expires and removes duplicates.
-  sql.add ("INSERT INTO rates (second, exchange, market, currency, bid, ask, rate) VALUES");
+  // The rates used to be added to the rates table every minute,
+  // so the database contained multiple duplicate rates per coin.
+  // They now update one row per exchange/market/coin.
+  vector <string> exchanges, markets, coins;
+  vector <float> bids, asks;
   for (unsigned int i = 0; i < rates.size(); i++) {
-    string exchange = rates[i].exchange;
-    string market = rates[i].market;
-    string coin = rates[i].coin;
-    float bid = rates[i].bid;
-    float ask = rates[i].ask;
-    if (i) sql.add (",");
-    sql.add ("(");
-    sql.add (seconds);
-    sql.add (",");
-    sql.add (exchange);
-    sql.add (",");
-    sql.add (market);
-    sql.add (",");
-    sql.add (coin);
-    sql.add (",");
-    sql.add (bid);
-    sql.add (",");
-    sql.add (ask);
-    sql.add (",");
-    sql.add ((bid + ask) / 2);
-    sql.add (")");
+    exchanges.push_back (rates[i].exchange);
+    markets.push_back (rates[i].market);
+    coins.push_back (rates[i].coin);
+    bids.push_back (rates[i].bid);
+    asks.push_back (rates[i].ask);
   }
-  sql.add (";");
-  sql.execute ();
+  rates_store (sql, seconds, exchanges, markets, coins, bids, asks);
 }
 
 
@@ -145,6 +124,9 @@ int main (int argc, char *argv[])
     bool run_at_front = in_array (string ("front"), arguments);
     bool run_at_back = in_array (string ("back"), arguments);
     
+    // A process that crashed while migrating the rates of a pair, left that pair's old database behind.
+    allrates_migrate_cleanup ();
+    
     string setting = "last_rates_second";
     string settings_path = SqliteDatabase::path (setting);
 
@@ -166,21 +148,23 @@ int main (int argc, char *argv[])
     if (run_at_front) {
       to_stdout ({"Rates: Start getting from all exchanges"});
 
-      // Go over all known exchanges.
-      vector <string> exchanges = exchange_get_names ();
-      vector <thread *> jobs;
-      for (auto exchange : exchanges) {
-        vector <string> markets = exchange_get_supported_markets (exchange);
-        for (auto market : markets) {
+      // Go over all known exchanges and their markets.
+      vector <string> exchanges, markets;
+      for (auto exchange : exchange_get_names ()) {
+        for (auto market : exchange_get_supported_markets (exchange)) {
           to_tty ({"exchange", exchange, "market", market});
-          // Fetch the rates from the exchanges.
-          thread * job = new thread (fetch_rates_front, exchange, market);
-          jobs.push_back (job);
+          exchanges.push_back (exchange);
+          markets.push_back (market);
         }
       }
-      // Wait till all jobs are ready.
-      for (auto job : jobs) {
-        job->join ();
+      // Fetch the rates from the exchanges.
+      // It used to start a thread per exchange and market.
+      // It now fetches them all simultaneously on this thread.
+      vector <vector <string> > coins;
+      vector <vector <float> > bids, asks;
+      exchange_get_market_summaries_via_satellite (exchanges, markets, coins, bids, asks);
+      for (size_t i = 0; i < exchanges.size (); i++) {
+        record_rates_front (exchanges [i], markets [i], coins [i], bids [i], asks [i]);
       }
 
       to_stdout ({"Rates: Ready getting from all exchanges"});
@@ -189,6 +173,9 @@ int main (int argc, char *argv[])
       store_rates_to_rates_database (second);
       to_stdout ({"Rates: Ready storing them to MySQL"});
 
+      // Publish the market data for the other programs on this machine.
+      market_snapshot_publish (sql);
+
     }
     
     if (run_at_front) {
@@ -252,38 +239,101 @@ int main (int argc, char *argv[])
         to_stdout ({"Rates:", "Error:", error});
       } else {
 
-        // Iterate over all available seconds with newer rates.
-        vector <string> seconds = explode (result, '\n');
-        for (auto second : seconds) {
-          if (second.size() != 10) continue;
-          to_stdout ({"Rates:", "Downloading rates for second", second, to_string (seconds_since_epoch () - stoi (second)), "seconds old"});
-          command = "get rates " + second;
-          result = satellite_request (front_bot_ip_address (), command, false, error);
-          if (!error.empty ()) {
-            to_stdout ({"Rates:", "Error:", error});
-          } else {
-
-            // Store the rates for this second in a known database.
-            string database = "downloadedrates";
-            string path = SqliteDatabase::path (database);
-            file_put_contents (path, result);
-
-            // Read the contents of the downloaded database.
-            vector <string> exchanges, markets, coins;
-            vector <float> bids, asks;
-            allrates_get (database, exchanges, markets, coins, bids, asks);
-
-            // Store all rates in that database locally in multiple databases.
-            to_stdout ({"Rates:", "Storing", to_string (exchanges.size()), "downloaded rates"});
-            for (unsigned int i = 0; i < exchanges.size(); i++) {
-              allrates_add (exchanges[i], markets[i], coins[i], stoi (second), bids[i], asks[i]);
+        // The available seconds with newer rates.
+        vector <string> seconds;
+        for (auto second : explode (result, '\n')) {
+          if (second.size() == 10) seconds.push_back (second);
+        }
+        
+        // The back bot used to download the rates one second per request,
+        // and then to open and close the SQLite database of every pair for every rate it stored.
+        // After downtime that meant hundreds of thousands of file opens.
+        // Now it downloads the rates for many seconds per request,
+        // and it appends the rates of each pair to that pair's store in one go.
+        // A satellite that does not know bulk requests gives no reply, and it counts that against the back bot.
+        // So once it did not know them, the back bot no longer asks it for them during this run.
+        // The download stops at the first second it could not get.
+        // The next run then starts again from that second, rather than leaving a gap for good.
+        bool bulk = true;
+        bool failed = false;
+        for (size_t begin = 0; begin < seconds.size (); begin += RATES_BULK_SECONDS) {
+          size_t end = min (begin + RATES_BULK_SECONDS, seconds.size ());
+          vector <string> bulk_seconds (seconds.begin () + begin, seconds.begin () + end);
+          to_stdout ({"Rates:", "Downloading rates for", to_string (bulk_seconds.size ()), "seconds from second", bulk_seconds.front (), to_string (seconds_since_epoch () - stoi (bulk_seconds.front ())), "seconds old"});
+          long start = milliseconds_since_epoch ();
+          
+          // Storage for the downloaded rates.
+          vector <int> rate_seconds;
+          vector <string> exchanges, markets, coins;
+          vector <float> bids, asks;
+          // The most recent second downloaded.
+          string last_second;
+          
+          if (bulk) {
+            command = "bulk rates " + implode (bulk_seconds, " ");
+            result = satellite_request (front_bot_ip_address (), command, false, error);
+            if (error.empty () && satellite_decode_rates (result, rate_seconds, exchanges, markets, coins, bids, asks)) {
+              last_second = bulk_seconds.back ();
+            } else if (error.empty () && result.empty ()) {
+              bulk = false;
+            }
+          }
+          if (last_second.empty ()) {
+            // The satellite at the front bot may not yet know about bulk requests.
+            // Then download the rates one second at a time.
+            error.clear ();
+            rate_seconds.clear ();
+            exchanges.clear ();
+            markets.clear ();
+            coins.clear ();
+            bids.clear ();
+            asks.clear ();
+            for (auto second : bulk_seconds) {
+              command = "get rates " + second;
+              result = satellite_request (front_bot_ip_address (), command, false, error);
+              if (!error.empty ()) {
+                to_stdout ({"Rates:", "Error:", error});
+                failed = true;
+                break;
+              }
+              
+              // Store the rates for this second in a known database.
+              string database = "downloadedrates";
+              string path = SqliteDatabase::path (database);
+              file_put_contents (path, result);
+              
+              // Read the contents of the downloaded database.
+              vector <string> second_exchanges, second_markets, second_coins;
+              vector <float> second_bids, second_asks;
+              allrates_get (database, second_exchanges, second_markets, second_coins, second_bids, second_asks);
+              for (unsigned int i = 0; i < second_exchanges.size(); i++) {
+                rate_seconds.push_back (stoi (second));
+                exchanges.push_back (second_exchanges[i]);
+                markets.push_back (second_markets[i]);
+                coins.push_back (second_coins[i]);
+                bids.push_back (second_bids[i]);
+                asks.push_back (second_asks[i]);
+              }
+              last_second = second;
             }
-
-            // Update the setting for the back bot's most recently downloaded second.
-            // Write it to two places.
-            settings_set (sql, hostname (), setting, second);
-            file_put_contents (settings_path, second);
           }
+          
+          // Nothing downloaded: Try again next run.
+          if (last_second.empty ()) break;
+          
+          // Store all rates locally, grouped by exchange/market/coin.
+          allrates_import (rate_seconds, exchanges, markets, coins, bids, asks);
+          long milliseconds = milliseconds_since_epoch () - start;
+          if (!milliseconds) milliseconds = 1;
+          to_stdout ({"Rates:", "Stored", to_string (rate_seconds.size ()), "downloaded rates in", to_string (milliseconds), "ms", to_string (rate_seconds.size () * 1000 / milliseconds), "rates per second"});
+          
+          // Update the setting for the back bot's most recently downloaded second.
+          // Write it to two places.
+          settings_set (sql, hostname (), setting, last_second);
+          file_put_contents (settings_path, last_second);
+          
+          // Stop at a failed second, after storing the rates of the seconds before it.
+          if (failed) break;
         }
       }
     }
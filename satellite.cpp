@@ -71,6 +71,22 @@
 // The satellite shuts down after a few minutes.
 // The bot will have switched already to the second satellite.
 
+// Restarting every minute has its costs though.
+// Each new instance registers the network interfaces and tests the hosts for IPv6 access again.
+// It starts with an empty order book cache and without connections to the exchanges.
+// And while one instance stops and the next one starts, there's no satellite listening.
+// So now the satellite can keep running for a long time, and it checks itself:
+// - It detects an exchange whose order books no longer change, like the stuck websocket did.
+//   It then replies with an error for that exchange, and sets up new connections to the exchanges.
+// - It regularly sends a heartbeat to itself. If that fails, it shuts down.
+// - It forgets the rogue clients every minute, just like a restart used to do.
+// When a new instance does start, it asks the running instance for its listening sockets,
+// through a Unix domain socket.
+// The running instance passes them on, and stops accepting connections.
+// The connections waiting in the backlog are then accepted by the new instance.
+// So the clients never see the satellite port closed.
+
+
 // The bot used to get the order books through various proxy servers.
 // It now get the same information through this satellite.
 // The number of succeeded hurried calls to get the order books has improved a lot now.
@@ -88,14 +104,270 @@ bool binary_listener_healthy = true;
 mutex binary_server_mutex;
 unordered_map <string, int> binary_server_addresses;
 atomic <int> total_client_count (0);
-atomic <int> active_thread_count (0);
 
 
-// Processes a single request from a web client.
-void process_binary_client_request (int connfd, string clientaddress)
+// The satellite used to start a detached thread per client connection.
+// That thread then read the request one byte at a time.
+// With a burst of hurried requests from several bots, there were hundreds of threads,
+// and thousands of system calls that each read one byte.
+// Both increased the time it took for a client to receive the response.
+// Now there's one thread that accepts the connections and reads the requests without blocking.
+// Once a request has been read completely, it goes into a queue.
+// A fixed pool of worker threads processes the requests from the queue.
+// When the queue is full, the satellite stops accepting new connections for a while.
+// These connections then wait in the backlog of the listening socket.
+
+
+// The number of worker threads that process the requests.
+#define SATELLITE_WORKER_COUNT 64
+// The maximum number of requests waiting in the queue before the satellite stops accepting new connections.
+#define SATELLITE_QUEUE_LIMIT 256
+// The maximum length of a request.
+#define SATELLITE_REQUEST_LIMIT 1023
+// The number of seconds a client is given to send its request.
+#define SATELLITE_REQUEST_TIMEOUT 60
+// The maximum number of order books of one batch that are fetched at the same time.
+#define SATELLITE_BATCH_SIMULTANEOUS 16
+
+
+// A client connection whose request is being read.
+class satellite_connection
+{
+public:
+  int connfd;
+  string clientaddress;
+  string request;
+  int accepted;
+};
+
+
+// The satellite also listens on a second port for persistent connections.
+// A client sends many requests over such a connection, and it stays open.
+// Each request and each response is a frame: A header of 8 bytes followed by the payload.
+// The header has the request ID and the length of the payload,
+// both as 32 bits integers in network byte order.
+// The response carries the ID of its request, so the workers can respond in any order.
+class satellite_stream
+{
+public:
+  int connfd;
+  string clientaddress;
+  // The bytes received but not yet taken out as complete frames.
+  string input;
+  // Multiple workers may send responses at the same time.
+  mutex write_mutex;
+  int active;
+  // The connection closes once the server and all workers have let go of it.
+  ~satellite_stream ()
+  {
+    shutdown (connfd, SHUT_RDWR);
+    close (connfd);
+  }
+};
+
+
+// A client connection whose request has been read, waiting for a worker to process it.
+// For a persistent connection, it has the stream and the request ID.
+class satellite_job
+{
+public:
+  int connfd;
+  string clientaddress;
+  string request;
+  shared_ptr <satellite_stream> stream;
+  uint32_t identifier = 0;
+};
+
+
+mutex satellite_jobs_mutex;
+condition_variable satellite_jobs_condition;
+queue <satellite_job> satellite_jobs;
+bool satellite_workers_stop = false;
+vector <thread *> satellite_workers;
+
+
+// Several bots, or several threads of one bot, often ask for the same order book
+// within a few hundred milliseconds of each other.
+// Each of those requests used to result in a separate call to the exchange.
+// That used up the rate limits of the exchange APIs.
+// Now the satellite keeps each order book it fetched for a short while.
+// Requests that come in while the order book is still being fetched,
+// wait for that one call to complete, rather than calling the exchange again.
+// The binary replies tell the client how old the order book is.
+
+
+// The default number of milliseconds the satellite keeps an order book.
+// The first argument to the satellite overrides it.
+// Zero disables the cache, but simultaneous requests still share one call to the exchange.
+#define SATELLITE_BOOK_CACHE_TTL 500
+
+
+int satellite_book_cache_ttl = SATELLITE_BOOK_CACHE_TTL;
+
+
+// One cached order book.
+class satellite_book
+{
+public:
+  mutex lock;
+  condition_variable condition;
+  // Whether a worker is fetching the order book from the exchange right now.
+  bool loading = false;
+  // When the order book was fetched, in milliseconds since the Epoch.
+  long fetched = 0;
+  vector <float> quantities;
+  vector <float> rates;
+  string error;
+};
+
+
+// If none of the order books of an exchange changed for this many seconds, the data is considered stale.
+#define SATELLITE_STALE_SECONDS 300
+
+
+mutex satellite_books_mutex;
+unordered_map <string, shared_ptr <satellite_book> > satellite_books;
+// The last time, in milliseconds, that an order book of an exchange was fetched, and that one changed.
+unordered_map <string, long> satellite_exchange_fetched;
+unordered_map <string, long> satellite_exchange_changed;
+atomic <int> satellite_books_hits (0);
+atomic <int> satellite_books_coalesced (0);
+atomic <int> satellite_books_fetched (0);
+
+
+// Whether none of the order books of the $exchange changed for a while, while they were being fetched.
+bool satellite_exchange_stale (const string & exchange)
 {
-  // One extra active thread has started.
-  active_thread_count++;
+  satellite_books_mutex.lock ();
+  long fetched = satellite_exchange_fetched [exchange];
+  long changed = satellite_exchange_changed [exchange];
+  satellite_books_mutex.unlock ();
+  return fetched - changed > SATELLITE_STALE_SECONDS * 1000;
+}
+
+
+// Gets the $buyers or sellers of the $coin at the $market at the $exchange.
+// It takes them from the cache if they are fresh enough.
+// The $age is how many milliseconds ago the order book was fetched from the exchange.
+void satellite_get_book (bool buyers, const string & exchange, const string & market, const string & coin,
+                         vector <float> & quantities, vector <float> & rates, string & error, int & age)
+{
+  string key = string (buyers ? "buyers" : "sellers") + " " + exchange + " " + market + " " + coin;
+  satellite_books_mutex.lock ();
+  shared_ptr <satellite_book> book = satellite_books [key];
+  if (!book) {
+    book = make_shared <satellite_book> ();
+    satellite_books [key] = book;
+  }
+  satellite_books_mutex.unlock ();
+  
+  unique_lock <mutex> lock (book->lock);
+  bool fresh = false;
+  bool changed = false;
+  
+  if (book->loading) {
+    // Another worker is fetching this order book: Wait for its result, error included.
+    book->condition.wait (lock, [&] { return !book->loading; });
+    satellite_books_coalesced++;
+  } else if (book->fetched && book->error.empty () && (milliseconds_since_epoch () - book->fetched <= satellite_book_cache_ttl)) {
+    // The cached order book is fresh.
+    satellite_books_hits++;
+  } else {
+    // Fetch the order book from the exchange.
+    // No hurried calls here: The client determines the measure of hurry:
+    // The client disconnects when in a hurry, and the response is not yet in.
+    book->loading = true;
+    lock.unlock ();
+    vector <float> fetched_quantities, fetched_rates;
+    string fetched_error;
+    if (buyers) exchange_get_buyers (exchange, market, coin, fetched_quantities, fetched_rates, false, fetched_error);
+    else exchange_get_sellers (exchange, market, coin, fetched_quantities, fetched_rates, false, fetched_error);
+    // Limit the number of entries. It saves bandwidth.
+    if (fetched_quantities.size () > 10) {
+      fetched_quantities.resize (10);
+      fetched_rates.resize (10);
+    }
+    lock.lock ();
+    // Whether the exchange gave fresh data.
+    fresh = fetched_error.empty ();
+    changed = (book->fetched == 0) || (fetched_quantities != book->quantities) || (fetched_rates != book->rates);
+    book->quantities = fetched_quantities;
+    book->rates = fetched_rates;
+    book->error = fetched_error;
+    book->fetched = milliseconds_since_epoch ();
+    book->loading = false;
+    book->condition.notify_all ();
+    satellite_books_fetched++;
+  }
+  
+  quantities = book->quantities;
+  rates = book->rates;
+  error = book->error;
+  age = milliseconds_since_epoch () - book->fetched;
+  lock.unlock ();
+  
+  // Record when the exchange last gave order books, and when one last changed.
+  if (fresh) {
+    long now = milliseconds_since_epoch ();
+    satellite_books_mutex.lock ();
+    satellite_exchange_fetched [exchange] = now;
+    if (changed || !satellite_exchange_changed [exchange]) satellite_exchange_changed [exchange] = now;
+    satellite_books_mutex.unlock ();
+  }
+  
+  // Do not serve order books of an exchange whose data no longer changes.
+  if (error.empty () && satellite_exchange_stale (exchange)) {
+    quantities.clear ();
+    rates.clear ();
+    error = "Stale order books at " + exchange;
+  }
+}
+
+
+// Gets the order book for one $tuple of a batch, in binary format.
+void satellite_batch_book (string tuple, string * reply)
+{
+  vector <string> elements = explode (tuple, ' ');
+  if ((elements.size () != 4) || ((elements[0] != "buyers") && (elements[0] != "sellers"))) {
+    * reply = satellite_encode_order_book ("", "", "", {}, {}, "Invalid request: " + tuple);
+    return;
+  }
+  string exchange = elements[1];
+  string market = elements[2];
+  string coin = elements[3];
+  vector <float> quantities, rates;
+  string error;
+  int age;
+  satellite_get_book (elements[0] == "buyers", exchange, market, coin, quantities, rates, error, age);
+  * reply = satellite_encode_order_book (exchange, market, coin, quantities, rates, error, age);
+}
+
+
+// Gets the order books of a batch simultaneously.
+// It used to start a thread per order book, so a large batch started many threads,
+// on top of the fixed pool of workers.
+// Now the order books are fetched on the shared thread pool, a limited number at a time.
+string satellite_batch_reply (const string & request)
+{
+  vector <string> tuples = explode (request, ';');
+  vector <string> replies (tuples.size ());
+  task_group jobs (SATELLITE_BATCH_SIMULTANEOUS);
+  for (size_t i = 0; i < tuples.size (); i++) {
+    string tuple = tuples [i];
+    string * reply = &replies [i];
+    jobs.run ([tuple, reply] { satellite_batch_book (tuple, reply); });
+  }
+  jobs.wait_all ();
+  return satellite_encode_batch (tuples, replies);
+}
+
+
+// Generates the reply to a single request from a client.
+string satellite_reply (string clientaddress, string request)
+{
+  string reply;
+  // Whether the client asked for the rates of a second there are no rates for.
+  bool rates_gone = false;
   
   try {
     
@@ -105,37 +377,21 @@ void process_binary_client_request (int connfd, string clientaddress)
     // Connection healthy flag.
     bool connection_healthy = true;
     
-    // Read the client's request.
-    // It is not possible to read the request till EOF.
-    // The EOF does not come right away.
-    // The client keeps the connection open for receiving the response.
-    // The binary protocol consists of one line of input.
-    // Read one line of data from the client.
-    char inputbuffer [1024];
-    // Fix valgrind unitialized value message.
-    memset (&inputbuffer, 0, 1024);
-    {
-      unsigned int i = 0;
-      char character = '\0';
-      // Limit the input length, for dealing with rogue clients.
-      while ((i < sizeof (inputbuffer) - 1) && (character != '\n')) {
-        int n = recv (connfd, &character, 1, 0);
-        if (n > 0) {
-          inputbuffer[i] = character;
-          i++;
-        } else {
-          character = '\n';
-        }
-      }
-      // Terminate the C string with a NULL character.
-      inputbuffer[i] = '\0';
-    }
-    
     if (connection_healthy) {
       
-      string reply;
+      // Getting many order books at once.
+      if (request.find ("batch ") == 0) {
+        reply = satellite_batch_reply (trim (request.substr (6)));
+      }
+      
+      vector <string> elements = explode (trim (request), ' ');
       
-      vector <string> elements = explode (trim(inputbuffer), ' ');
+      // The client may ask for the market summaries and order books in binary format.
+      bool binary = false;
+      if (!elements.empty () && (elements[0] == "binary")) {
+        binary = true;
+        elements.erase (elements.begin ());
+      }
       
       // Heartbeat.
       if (elements.size () == 1) {
@@ -166,18 +422,23 @@ void process_binary_client_request (int connfd, string clientaddress)
           string error;
           // Call the API.
           exchange_get_market_summaries (exchange, market, coins, bids, asks, &error);
-          // Response container.
-          vector <string> response;
-          // Assemble the reply.
-          for (unsigned int i = 0; i < coins.size (); i++) {
-            string line = coins[i] + " " + float2string (bids[i]) + " " + float2string (asks[i]);
-            response.push_back (line);
+          if (binary) {
+            // The binary reply has the error, if any, in its header.
+            reply = satellite_encode_summaries (exchange, market, coins, bids, asks, error);
+          } else {
+            // Response container.
+            vector <string> response;
+            // Assemble the reply.
+            for (unsigned int i = 0; i < coins.size (); i++) {
+              string line = coins[i] + " " + float2string (bids[i]) + " " + float2string (asks[i]);
+              response.push_back (line);
+            }
+            // Error handling:
+            // If there's an error, the response to the caller consists of one line: The error.
+            if (!error.empty ()) response = { error };
+            // Done.
+            reply = implode (response, "\n");
           }
-          // Error handling:
-          // If there's an error, the response to the caller consists of one line: The error.
-          if (!error.empty ()) response = { error };
-          // Done.
-          reply = implode (response, "\n");
         }
       }
       
@@ -191,25 +452,26 @@ void process_binary_client_request (int connfd, string clientaddress)
           string coin = elements[3];
           vector <float> quantities, rates;
           string error;
-          // Call the API.
-          // No hurried calls here: The client determines the measure of hurry:
-          // The client disconnects when in a hurry, and the response is not yet in.
-          if (get_buyers) exchange_get_buyers (exchange, market, coin, quantities, rates, false, error);
-          if (get_sellers) exchange_get_sellers (exchange, market, coin, quantities, rates, false, error);
-          // Response container.
-          vector <string> response;
-          for (unsigned int i = 0; i < quantities.size (); i++) {
-            // Limit the number of entries. It saves bandwidth.
-            if (i >= 10) continue;
-            // Add this entry to the response.
-            string line = float2string (quantities[i]) + " " + float2string (rates[i]);
-            response.push_back (line);
+          int age;
+          // Call the API, or take the order book from the cache.
+          satellite_get_book (get_buyers, exchange, market, coin, quantities, rates, error, age);
+          if (binary) {
+            // The binary reply has the error, if any, and the age in its header.
+            reply = satellite_encode_order_book (exchange, market, coin, quantities, rates, error, age);
+          } else {
+            // Response container.
+            vector <string> response;
+            for (unsigned int i = 0; i < quantities.size (); i++) {
+              // Add this entry to the response.
+              string line = float2string (quantities[i]) + " " + float2string (rates[i]);
+              response.push_back (line);
+            }
+            // Error handling:
+            // If there's an error, the response to the caller consists of one line: The error.
+            if (!error.empty ()) response = { error };
+            // Done.
+            reply = implode (response, "\n");
           }
-          // Error handling:
-          // If there's an error, the response to the caller consists of one line: The error.
-          if (!error.empty ()) response = { error };
-          // Done.
-          reply = implode (response, "\n");
         }
       }
       
@@ -267,11 +529,44 @@ void process_binary_client_request (int connfd, string clientaddress)
               string database = allrates_database (second);
               string path = SqliteDatabase::path (database);
               reply = file_get_contents (path);
+              rates_gone = reply.empty ();
             }
           }
         }
       }
 
+      // Serve the rates for many seconds in one go.
+      // A back bot asks for them like this: "bulk rates 1500000000 1500000060".
+      // Sending them in one reply saves a round trip per second,
+      // and it saves the back bot from writing each second's database to disk before reading it.
+      if (elements.size () >= 3) {
+        if (elements[0] == "bulk") {
+          if (elements[1] == "rates") {
+            vector <int> seconds;
+            vector <string> exchanges, markets, coins;
+            vector <float> bids, asks;
+            for (size_t i = 2; i < elements.size (); i++) {
+              if (elements[i].size () != 10) continue;
+              int second = stoi (elements[i]);
+              string database = allrates_database (second);
+              if (!filesize (SqliteDatabase::path (database))) continue;
+              vector <string> second_exchanges, second_markets, second_coins;
+              vector <float> second_bids, second_asks;
+              allrates_get (database, second_exchanges, second_markets, second_coins, second_bids, second_asks);
+              for (size_t r = 0; r < second_bids.size (); r++) {
+                seconds.push_back (second);
+                exchanges.push_back (second_exchanges[r]);
+                markets.push_back (second_markets[r]);
+                coins.push_back (second_coins[r]);
+                bids.push_back (second_bids[r]);
+                asks.push_back (second_asks[r]);
+              }
+            }
+            reply = satellite_encode_rates (seconds, exchanges, markets, coins, bids, asks);
+          }
+        }
+      }
+
       // Serve and rotate the log file.
       if (elements.size () == 3) {
         if (elements[0] == "serve") {
@@ -287,17 +582,15 @@ void process_binary_client_request (int connfd, string clientaddress)
       }
 
       // Record this IP addresss whether it is a normal client or a rogue one.
+      // A back bot that falls back to getting the rates one second at a time,
+      // asks for seconds it was told about a moment ago.
+      // If such a second expired meanwhile, that is not the fault of the back bot.
       int addition = -1;
       if (!reply.empty ()) addition = 1;
+      if (rates_gone) addition = 0;
       binary_server_mutex.lock ();
       binary_server_addresses [clientaddress] += addition;
       binary_server_mutex.unlock ();
-      
-      // Send response to the client.
-      const char * output = reply.c_str();
-      // The C function strlen () fails on null characters in the reply, so use string::size() instead.
-      size_t length = reply.size ();
-      send (connfd, output, length, 0);
     }
     
   } catch (exception & e) {
@@ -308,19 +601,95 @@ void process_binary_client_request (int connfd, string clientaddress)
     to_stderr ({"A general internal error occurred"});
   }
   
+  return reply;
+}
+
+
+// Sends all $data over the non-blocking socket.
+// It waits while the socket's send buffer is full, up to the timeout.
+bool satellite_send_all (int connfd, const string & data)
+{
+  size_t sent = 0;
+  while (sent < data.size ()) {
+    ssize_t n = send (connfd, data.c_str () + sent, data.size () - sent, MSG_NOSIGNAL);
+    if (n > 0) {
+      sent += n;
+      continue;
+    }
+    if ((n < 0) && (errno == EINTR)) continue;
+    if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+      struct pollfd descriptor;
+      descriptor.fd = connfd;
+      descriptor.events = POLLOUT;
+      descriptor.revents = 0;
+      if (poll (&descriptor, 1, SATELLITE_REQUEST_TIMEOUT * 1000) > 0) continue;
+    }
+    return false;
+  }
+  return true;
+}
+
+
+// Processes a single request from a client.
+void process_binary_client_request (satellite_job & job)
+{
+  string reply = satellite_reply (job.clientaddress, job.request);
+  
+  // Send the response in a frame over the persistent connection, which stays open.
+  if (job.stream) {
+    string frame (8, '\0');
+    * (uint32_t *) &frame [0] = htonl (job.identifier);
+    * (uint32_t *) &frame [4] = htonl ((uint32_t) reply.size ());
+    frame.append (reply);
+    job.stream->write_mutex.lock ();
+    bool sent = satellite_send_all (job.stream->connfd, frame);
+    // If a frame was sent partially, the stream is out of sync: Disconnect the client.
+    if (!sent) shutdown (job.stream->connfd, SHUT_RDWR);
+    job.stream->write_mutex.unlock ();
+    return;
+  }
+  
+  // Send response to the client.
+  // The socket was read without blocking.
+  // Now it blocks again, so the whole reply gets sent in one go.
+  // It was tested that it disconnects an idle client after the specified timeout.
+  int connfd = job.connfd;
+  fcntl (connfd, F_SETFL, fcntl (connfd, F_GETFL, 0) & ~O_NONBLOCK);
+  struct timeval tv;
+  tv.tv_sec = SATELLITE_REQUEST_TIMEOUT;
+  tv.tv_usec = 0;
+  setsockopt (connfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  const char * output = reply.c_str();
+  // The C function strlen () fails on null characters in the reply, so use string::size() instead.
+  size_t length = reply.size ();
+  send (connfd, output, length, MSG_NOSIGNAL);
+  
   // Done: Close.
   shutdown (connfd, SHUT_RDWR);
   close (connfd);
-  
-  // Decrease the number of active threads.
-  active_thread_count--;
 }
 
 
-void binary_server ()
+// A worker takes requests from the queue and processes them.
+// It stops once the server shuts down and the queue is empty.
+void satellite_worker ()
+{
+  while (true) {
+    unique_lock <mutex> lock (satellite_jobs_mutex);
+    satellite_jobs_condition.wait (lock, [] { return !satellite_jobs.empty () || satellite_workers_stop; });
+    if (satellite_jobs.empty ()) return;
+    satellite_job job = satellite_jobs.front ();
+    satellite_jobs.pop ();
+    lock.unlock ();
+    process_binary_client_request (job);
+  }
+}
+
+
+// Creates a socket that listens on the $port without blocking.
+// Returns the socket, or a negative value on failure.
+int satellite_listen (int port)
 {
-  binary_listener_healthy = true;
-  
   // This server uses BSD sockets.
   // Create a listening socket.
   // This represents an endpoint.
@@ -329,7 +698,7 @@ void binary_server ()
   int listenfd = socket (AF_INET6, SOCK_STREAM, 0);
   if (listenfd < 0) {
     to_stdout ({"Error opening socket:", strerror (errno)});
-    binary_listener_healthy = false;
+    return listenfd;
   }
   
   // Eliminate "Address already in use" error from bind.
@@ -339,77 +708,518 @@ void binary_server ()
   int result = setsockopt (listenfd, SOL_SOCKET, SO_REUSEADDR, (const char *) &optval, sizeof (int));
   if (result != 0) {
     to_stdout ({"Error setting socket option:", strerror (errno)});
-    binary_listener_healthy = false;
   }
   
   // The listening socket will be an endpoint for all requests to a port on this host.
   // It listens on any IPv6 address.
-  struct sockaddr_in6 serveraddr;
-  memset (&serveraddr, 0, sizeof (serveraddr));
-  serveraddr.sin6_flowinfo = 0;
-  serveraddr.sin6_family = AF_INET6;
-  serveraddr.sin6_addr = in6addr_any;
-  serveraddr.sin6_port = htons (satellite_port ());
-  result = mybind (listenfd, (struct sockaddr *) &serveraddr, sizeof (serveraddr));
-  if (result != 0) {
-    to_stdout ({"Error binding server to socket:", strerror (errno)});
-    binary_listener_healthy = false;
+  if (result == 0) {
+    struct sockaddr_in6 serveraddr;
+    memset (&serveraddr, 0, sizeof (serveraddr));
+    serveraddr.sin6_flowinfo = 0;
+    serveraddr.sin6_family = AF_INET6;
+    serveraddr.sin6_addr = in6addr_any;
+    serveraddr.sin6_port = htons (port);
+    result = mybind (listenfd, (struct sockaddr *) &serveraddr, sizeof (serveraddr));
+    if (result != 0) {
+      to_stdout ({"Error binding server to socket:", strerror (errno)});
+    }
   }
   
   // Make it a listening socket ready to queue and accept many connection requests
   // before the system starts rejecting the incoming requests.
-  int backlog = 128;
-  result = listen (listenfd, backlog);
+  if (result == 0) {
+    int backlog = 128;
+    result = listen (listenfd, backlog);
+    if (result != 0) {
+      to_stdout ({"Error listening on socket:", strerror (errno)});
+    }
+  }
+  
   if (result != 0) {
-    to_stdout ({"Error listening on socket:", strerror (errno)});
-    binary_listener_healthy = false;
+    close (listenfd);
+    return -1;
   }
   
-  // Keep waiting for, accepting, and processing connections.
-  while (binary_listener_healthy) {
+  // The listening socket does not block.
+  // This enables the server loop to also read the requests of connected clients.
+  fcntl (listenfd, F_SETFL, fcntl (listenfd, F_GETFL, 0) | O_NONBLOCK);
+  
+  return listenfd;
+}
+
+
+// Accepts a waiting connection on the $listenfd.
+// Returns the connection without blocking, or a negative value if there's none.
+int satellite_accept (int listenfd, string & clientaddress)
+{
+  while (true) {
     
     // Socket and file descriptor for the client connection.
     struct sockaddr_in6 clientaddr6;
     socklen_t clientlen = sizeof (clientaddr6);
     int connfd = accept (listenfd, (struct sockaddr *)&clientaddr6, &clientlen);
-    if (connfd > 0) {
-      
-      // Socket send and receive timeout.
-      // It was tested that it disconnects an idle client after the specified timeout.
-      struct timeval tv;
-      tv.tv_sec = 60;
-      tv.tv_usec = 0;
-      setsockopt (connfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-      setsockopt (connfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
-      
-      // The client's remote IPv6 address in hexadecimal digits separated by colons.
-      // IPv4 addresses are mapped to IPv6 addresses.
+    if (connfd < 0) {
+      if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+        to_stdout ({"Error accepting connection on socket:", strerror (errno)});
+      }
+      return connfd;
+    }
+    
+    // The client's remote IPv6 address in hexadecimal digits separated by colons.
+    // IPv4 addresses are mapped to IPv6 addresses.
+    char remote_address[256];
+    inet_ntop (AF_INET6, &clientaddr6.sin6_addr, remote_address, sizeof (remote_address));
+    clientaddress = remote_address;
+    
+    // Handle dropping incoming connections from rogue clients.
+    binary_server_mutex.lock ();
+    int count = binary_server_addresses [clientaddress];
+    binary_server_mutex.unlock ();
+    if (count < 0) {
+      shutdown (connfd, SHUT_RDWR);
+      close (connfd);
+      continue;
+    }
+    
+    // Read the requests of this client without blocking.
+    fcntl (connfd, F_SETFL, fcntl (connfd, F_GETFL, 0) | O_NONBLOCK);
+    return connfd;
+  }
+}
+
+
+// Hands a request over to the workers.
+void satellite_queue (satellite_job job)
+{
+  satellite_jobs_mutex.lock ();
+  satellite_jobs.push (job);
+  satellite_jobs_mutex.unlock ();
+  satellite_jobs_condition.notify_one ();
+}
+
+
+// The Unix domain socket through which a new instance takes over the listening sockets.
+string satellite_handover_path ()
+{
+  return "/tmp/satellite.handover";
+}
+
+
+// Creates the socket on which the satellite waits for a next instance to take over.
+// Returns the socket, or a negative value on failure.
+int satellite_handover_listen ()
+{
+  string path = satellite_handover_path ();
+  int handoverfd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (handoverfd < 0) return handoverfd;
+  struct sockaddr_un address;
+  memset (&address, 0, sizeof (address));
+  address.sun_family = AF_UNIX;
+  strncpy (address.sun_path, path.c_str (), sizeof (address.sun_path) - 1);
+  // Replace the socket of a previous instance, if any.
+  unlink (path.c_str ());
+  int result = mybind (handoverfd, (struct sockaddr *) &address, sizeof (address));
+  if (result == 0) {
+    // Only this user can take the listening sockets over.
+    chmod (path.c_str (), S_IRUSR | S_IWUSR);
+    result = listen (handoverfd, 1);
+  }
+  if (result != 0) {
+    to_stdout ({"Error listening for handover:", strerror (errno)});
+    close (handoverfd);
+    return -1;
+  }
+  fcntl (handoverfd, F_SETFL, fcntl (handoverfd, F_GETFL, 0) | O_NONBLOCK);
+  return handoverfd;
+}
+
+
+// Passes the listening sockets over the connection to the next instance.
+bool satellite_handover_send (int connfd, int listenfd, int persistentfd)
+{
+  vector <int> descriptors = { listenfd };
+  if (persistentfd >= 0) descriptors.push_back (persistentfd);
+  size_t size = descriptors.size () * sizeof (int);
+  char payload [] = "OK";
+  struct iovec iov;
+  iov.iov_base = payload;
+  iov.iov_len = 2;
+  char control [CMSG_SPACE (2 * sizeof (int))];
+  memset (control, 0, sizeof (control));
+  struct msghdr message;
+  memset (&message, 0, sizeof (message));
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = CMSG_SPACE (size);
+  struct cmsghdr * cmsg = CMSG_FIRSTHDR (&message);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN (size);
+  memcpy (CMSG_DATA (cmsg), descriptors.data (), size);
+  return sendmsg (connfd, &message, 0) == 2;
+}
+
+
+// Asks a running instance of the satellite for its listening sockets.
+// Returns true if it got them.
+// An older satellite does not pass its sockets on: It has to quit before this instance can listen.
+bool satellite_handover_receive (int & listenfd, int & persistentfd)
+{
+  listenfd = -1;
+  persistentfd = -1;
+  int sock = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0) return false;
+  struct sockaddr_un address;
+  memset (&address, 0, sizeof (address));
+  address.sun_family = AF_UNIX;
+  strncpy (address.sun_path, satellite_handover_path ().c_str (), sizeof (address.sun_path) - 1);
+  if (connect (sock, (struct sockaddr *) &address, sizeof (address)) != 0) {
+    close (sock);
+    return false;
+  }
+  struct timeval tv;
+  tv.tv_sec = 5;
+  tv.tv_usec = 0;
+  setsockopt (sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+  char payload [2];
+  struct iovec iov;
+  iov.iov_base = payload;
+  iov.iov_len = sizeof (payload);
+  char control [CMSG_SPACE (2 * sizeof (int))];
+  struct msghdr message;
+  memset (&message, 0, sizeof (message));
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof (control);
+  ssize_t received = recvmsg (sock, &message, 0);
+  close (sock);
+  if (received <= 0) return false;
+  for (struct cmsghdr * cmsg = CMSG_FIRSTHDR (&message); cmsg != NULL; cmsg = CMSG_NXTHDR (&message, cmsg)) {
+    if ((cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS)) continue;
+    size_t count = (cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (int);
+    int descriptors [2] = { -1, -1 };
+    memcpy (descriptors, CMSG_DATA (cmsg), min (count, (size_t) 2) * sizeof (int));
+    listenfd = descriptors [0];
+    persistentfd = descriptors [1];
+  }
+  return listenfd >= 0;
+}
+
+
+// Runs the server.
+// It uses the $listenfd and the $persistentfd handed over by a previous instance,
+// or if there's none, it creates its own listening sockets.
+void binary_server (int listenfd, int persistentfd)
+{
+  binary_listener_healthy = true;
+  
+  // Listen for one-shot connections.
+  if (listenfd < 0) listenfd = satellite_listen (satellite_port ());
+  if (listenfd < 0) binary_listener_healthy = false;
+  
+  // Listen for persistent connections.
+  // The one-shot connections still work if this fails.
+  if (persistentfd < 0) persistentfd = satellite_listen (satellite_persistent_port ());
+  
+  // Wait for a next instance of the satellite to take over.
+  int handoverfd = satellite_handover_listen ();
+  bool handed_over = false;
+  
+  // Start the pool of workers.
+  for (int i = 0; i < SATELLITE_WORKER_COUNT; i++) {
+    satellite_workers.push_back (new thread (satellite_worker));
+  }
+  
+  // The client connections whose requests are being read.
+  vector <satellite_connection> connections;
+  
+  // The persistent client connections.
+  vector <shared_ptr <satellite_stream> > streams;
+  
+  // Keep waiting for, accepting, and reading connections.
+  while (binary_listener_healthy) {
+    
+    // Back-pressure: Only accept new connections if the workers can keep up.
+    satellite_jobs_mutex.lock ();
+    bool accepting = satellite_jobs.size () < SATELLITE_QUEUE_LIMIT;
+    satellite_jobs_mutex.unlock ();
+    
+    // Wait for new connections and for incoming data.
+    // Wake up regularly to see whether the server should shut down.
+    vector <struct pollfd> descriptors;
+    for (auto & connection : connections) {
+      struct pollfd descriptor;
+      descriptor.fd = connection.connfd;
+      descriptor.events = POLLIN;
+      descriptor.revents = 0;
+      descriptors.push_back (descriptor);
+    }
+    // The persistent connections are not read either while the workers are busy.
+    // Their requests then wait in the socket buffers.
+    for (auto & stream : streams) {
+      struct pollfd descriptor;
+      descriptor.fd = stream->connfd;
+      descriptor.events = accepting ? POLLIN : 0;
+      descriptor.revents = 0;
+      descriptors.push_back (descriptor);
+    }
+    for (auto fd : { listenfd, persistentfd }) {
+      struct pollfd descriptor;
+      descriptor.fd = (accepting && (fd >= 0)) ? fd : -1;
+      descriptor.events = POLLIN;
+      descriptor.revents = 0;
+      descriptors.push_back (descriptor);
+    }
+    {
+      struct pollfd descriptor;
+      descriptor.fd = handoverfd;
+      descriptor.events = POLLIN;
+      descriptor.revents = 0;
+      descriptors.push_back (descriptor);
+    }
+    int ready = poll (descriptors.data (), descriptors.size (), 100);
+    if (ready < 0) {
+      if (errno != EINTR) {
+        to_stdout ({"Error polling sockets:", strerror (errno)});
+      }
+      continue;
+    }
+    
+    // Read the requests of the connected clients.
+    // It is not possible to read the request till EOF.
+    // The EOF does not come right away.
+    // The client keeps the connection open for receiving the response.
+    // The binary protocol consists of one line of input.
+    vector <satellite_connection> still_reading;
+    size_t connections_count = connections.size ();
+    int now = seconds_since_epoch ();
+    for (size_t i = 0; i < connections.size (); i++) {
+      satellite_connection & connection = connections [i];
+      bool complete = false;
+      bool failed = false;
+      if (descriptors[i].revents) {
+        char buffer [SATELLITE_REQUEST_LIMIT + 1];
+        ssize_t n = recv (connection.connfd, buffer, sizeof (buffer) - 1, 0);
+        if (n > 0) {
+          connection.request.append (buffer, n);
+        } else if (n == 0) {
+          // End of file: Process whatever was received.
+          complete = true;
+        } else if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+          failed = true;
+        }
+      }
+      // A request is complete at the end of the line.
+      size_t pos = connection.request.find ('\n');
+      if (pos != string::npos) {
+        connection.request.erase (pos);
+        complete = true;
+      }
+      // Limit the input length, for dealing with rogue clients.
+      if (connection.request.size () >= SATELLITE_REQUEST_LIMIT) {
+        connection.request.erase (SATELLITE_REQUEST_LIMIT);
+        complete = true;
+      }
+      // Disconnect an idle client after the timeout.
+      if (now - connection.accepted > SATELLITE_REQUEST_TIMEOUT) {
+        failed = true;
+      }
+      if (failed) {
+        shutdown (connection.connfd, SHUT_RDWR);
+        close (connection.connfd);
+      } else if (complete) {
+        // Hand the request over to the workers.
+        satellite_job job;
+        job.connfd = connection.connfd;
+        job.clientaddress = connection.clientaddress;
+        job.request = connection.request;
+        satellite_queue (job);
+      } else {
+        still_reading.push_back (connection);
+      }
+    }
+    connections = still_reading;
+    
+    // Read the frames from the persistent connections.
+    vector <shared_ptr <satellite_stream> > still_streaming;
+    for (size_t i = 0; i < streams.size (); i++) {
+      shared_ptr <satellite_stream> stream = streams [i];
+      bool failed = false;
+      if (descriptors[connections_count + i].revents) {
+        char buffer [4096];
+        ssize_t n = recv (stream->connfd, buffer, sizeof (buffer), 0);
+        if (n > 0) {
+          stream->input.append (buffer, n);
+          stream->active = now;
+        } else if ((n == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK))) {
+          // The client closed the connection, or it broke.
+          failed = true;
+        }
+      }
+      // Take the complete frames out of the input.
+      while (!failed && (stream->input.size () >= 8)) {
+        uint32_t identifier = ntohl (* (uint32_t *) &stream->input [0]);
+        uint32_t length = ntohl (* (uint32_t *) &stream->input [4]);
+        // Limit the input length, for dealing with rogue clients.
+        if (length > SATELLITE_REQUEST_LIMIT) {
+          failed = true;
+          break;
+        }
+        if (stream->input.size () < 8 + length) break;
+        satellite_job job;
+        job.connfd = stream->connfd;
+        job.clientaddress = stream->clientaddress;
+        job.request = stream->input.substr (8, length);
+        job.stream = stream;
+        job.identifier = identifier;
+        stream->input.erase (0, 8 + length);
+        satellite_queue (job);
+      }
+      // Disconnect an idle client after the timeout.
+      if (now - stream->active > SATELLITE_REQUEST_TIMEOUT) {
+        failed = true;
+      }
+      // A failed stream is no longer read.
+      // It closes once the workers have sent the responses to its requests.
+      if (failed) shutdown (stream->connfd, SHUT_RD);
+      else still_streaming.push_back (stream);
+    }
+    streams = still_streaming;
+    
+    // Accept all waiting one-shot connections.
+    if (descriptors[descriptors.size () - 3].revents) {
       string clientaddress;
-      char remote_address[256];
-      inet_ntop (AF_INET6, &clientaddr6.sin6_addr, remote_address, sizeof (remote_address));
-      clientaddress = remote_address;
-      
-      // Handle dropping incoming connections from rogue clients.
-      binary_server_mutex.lock ();
-      int count = binary_server_addresses [clientaddress];
-      binary_server_mutex.unlock ();
-      if (count < 0) {
-        shutdown (connfd, SHUT_RDWR);
+      int connfd;
+      while ((connfd = satellite_accept (listenfd, clientaddress)) >= 0) {
+        satellite_connection connection;
+        connection.connfd = connfd;
+        connection.clientaddress = clientaddress;
+        connection.accepted = now;
+        connections.push_back (connection);
+      }
+    }
+    
+    // Accept all waiting persistent connections.
+    if (descriptors[descriptors.size () - 2].revents) {
+      string clientaddress;
+      int connfd;
+      while ((connfd = satellite_accept (persistentfd, clientaddress)) >= 0) {
+        // Send the responses without delay.
+        int optval = 1;
+        setsockopt (connfd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof (optval));
+        shared_ptr <satellite_stream> stream = make_shared <satellite_stream> ();
+        stream->connfd = connfd;
+        stream->clientaddress = clientaddress;
+        stream->active = now;
+        streams.push_back (stream);
+      }
+    }
+    
+    // Hand the listening sockets over to the next instance, and stop.
+    if (descriptors.back ().revents) {
+      int connfd = accept (handoverfd, NULL, NULL);
+      if (connfd >= 0) {
+        fcntl (connfd, F_SETFL, fcntl (connfd, F_GETFL, 0) & ~O_NONBLOCK);
+        if (satellite_handover_send (connfd, listenfd, persistentfd)) {
+          to_stdout ({"Handing over to the next instance"});
+          handed_over = true;
+          binary_listener_healthy = false;
+        }
         close (connfd);
-        continue;
       }
-      
-      // Handle this request in a thread, enabling parallel requests.
-      thread job (process_binary_client_request, connfd, clientaddress);
-      job.detach ();
-      
-    } else {
-      to_stdout ({"Error accepting connection on socket:", strerror (errno)});
     }
   }
   
-  // Close listening socket, freeing it for any next server process.
-  close (listenfd);
+  // Close the listening sockets, freeing them for any next server process.
+  // After a handover, the next instance keeps listening on them.
+  if (listenfd >= 0) close (listenfd);
+  if (persistentfd >= 0) close (persistentfd);
+  if (handoverfd >= 0) {
+    close (handoverfd);
+    // The next instance has replaced the handover socket with its own.
+    if (!handed_over) unlink (satellite_handover_path ().c_str ());
+  }
+  
+  // Disconnect the clients whose requests have not yet been read completely.
+  for (auto & connection : connections) {
+    shutdown (connection.connfd, SHUT_RDWR);
+    close (connection.connfd);
+  }
+  
+  // Stop reading the persistent connections.
+  // Each closes once the workers have sent the responses to the requests already queued.
+  for (auto & stream : streams) {
+    shutdown (stream->connfd, SHUT_RD);
+  }
+  streams.clear ();
+  
+  // Let the workers complete the requests in the queue, and then stop.
+  satellite_jobs_mutex.lock ();
+  satellite_workers_stop = true;
+  satellite_jobs_mutex.unlock ();
+  satellite_jobs_condition.notify_all ();
+}
+
+
+// The number of consecutive failed heartbeats after which the satellite shuts down.
+#define SATELLITE_HEARTBEAT_FAILURES 3
+
+
+// Checks the health of the satellite once a minute, while it runs.
+void satellite_monitor ()
+{
+  int heartbeat_failures = 0;
+  int seconds = 0;
+  while (binary_listener_healthy) {
+    this_thread::sleep_for (chrono::seconds (1));
+    if (++seconds < 60) continue;
+    seconds = 0;
+    
+    // Forget the rogue clients, so a client that once misbehaved, is not banned for good.
+    binary_server_mutex.lock ();
+    binary_server_addresses.clear ();
+    binary_server_mutex.unlock ();
+    
+    // Detect exchanges whose order books no longer change.
+    // Set up new connections to the exchanges, in case a connection got stuck.
+    satellite_books_mutex.lock ();
+    vector <string> exchanges;
+    for (auto & element : satellite_exchange_fetched) exchanges.push_back (element.first);
+    satellite_books_mutex.unlock ();
+    bool flush = false;
+    for (auto & exchange : exchanges) {
+      if (satellite_exchange_stale (exchange)) {
+        to_stdout ({"Stale order books at", exchange});
+        flush = true;
+      }
+    }
+    if (flush) http_pool_flush ();
+    
+    // Forget the order books no longer asked for.
+    long now = milliseconds_since_epoch ();
+    satellite_books_mutex.lock ();
+    for (auto iterator = satellite_books.begin (); iterator != satellite_books.end (); ) {
+      shared_ptr <satellite_book> book = iterator->second;
+      book->lock.lock ();
+      bool unused = !book->loading && (now - book->fetched > SATELLITE_STALE_SECONDS * 1000);
+      book->lock.unlock ();
+      if (unused) iterator = satellite_books.erase (iterator);
+      else iterator++;
+    }
+    satellite_books_mutex.unlock ();
+    
+    // Check that the satellite still responds.
+    string error;
+    string reply = satellite_request ("localhost", "heartbeat", true, error);
+    if (reply == "OK") heartbeat_failures = 0;
+    else heartbeat_failures++;
+    if (heartbeat_failures >= SATELLITE_HEARTBEAT_FAILURES) {
+      to_stdout ({"Satellite no longer responds:", error});
+      binary_listener_healthy = false;
+    }
+  }
 }
 
 
@@ -425,6 +1235,9 @@ int main (int argc, char *argv[])
   // Initialize the program, but not the proxy servers.
   initialize_program (argc, argv);
   
+  // The number of milliseconds to keep the order books.
+  if (argc > 1) satellite_book_cache_ttl = str2int (argv[1]);
+  
   to_stdout ({"Starting satellite"});
 
   // Register the device's public IP addresses.
@@ -433,34 +1246,53 @@ int main (int argc, char *argv[])
   // Test the known hosts for IPv6 access.
   satellite_register_known_hosts ();
   
-  // This satellite contacts a possible previous instance of this satellite.
-  // It waits till the previous instance has quit.
-  // Then it will proceed to act as the new satellite.
-  bool previous_satellite_live = true;
-  int tries = 0;
-  do {
-    string error;
-    satellite_request ("localhost", "next instance waiting", false, error);
-    previous_satellite_live = error.empty ();
-    tries++;
-    to_tty ({"try", to_string (tries), error});
-    this_thread::sleep_for (chrono::milliseconds (100));
-  } while (previous_satellite_live && (tries < 500));
+  // This satellite takes the listening sockets over from a possible previous instance.
+  int listenfd, persistentfd;
+  if (!satellite_handover_receive (listenfd, persistentfd)) {
+    // This satellite contacts a possible previous instance of this satellite.
+    // It waits till the previous instance has quit.
+    // Then it will proceed to act as the new satellite.
+    bool previous_satellite_live = true;
+    int tries = 0;
+    do {
+      string error;
+      satellite_request ("localhost", "next instance waiting", false, error);
+      previous_satellite_live = error.empty ();
+      tries++;
+      to_tty ({"try", to_string (tries), error});
+      this_thread::sleep_for (chrono::milliseconds (100));
+    } while (previous_satellite_live && (tries < 500));
+  }
+  
+  // Check the health of the satellite while it runs.
+  thread monitor (satellite_monitor);
   
   // Run the http server.
-  binary_server ();
+  binary_server (listenfd, persistentfd);
+  monitor.join ();
   
   // Start emergency exit timer.
   thread job (satellite_emergency_exit_timer);
   job.detach ();
 
   // After the server shuts down and no longer accepts new connections,
-  // wait till all client processors have completed.
+  // wait till the workers have completed all client requests in the queue.
   // So, it does not close or interrupt ongoing client requests: It completes them.
-  while (active_thread_count) this_thread::sleep_for (chrono::milliseconds (100));
+  for (auto worker : satellite_workers) {
+    worker->join ();
+    delete worker;
+  }
   
   to_stdout ({"Stopping satellite", "-", "done", to_string (total_client_count), "requests"});
 
+  // Statistics about the order book cache.
+  to_stdout ({"Order book cache", "fetched", to_string (satellite_books_fetched), "hits", to_string (satellite_books_hits), "coalesced", to_string (satellite_books_coalesced), "ttl", to_string (satellite_book_cache_ttl), "ms"});
+
+  // Statistics about reusing the connections to the exchanges.
+  for (auto line : http_pool_statistics ()) {
+    to_stdout ({"Connection pool", line});
+  }
+
   finalize_program ();
   
   return EXIT_SUCCESS;
@@ -124,6 +124,12 @@ extern const char * __progname;
 
 void finalize_program ()
 {
+  // Stop the workers that ran the tasks of the program.
+  thread_pool_finish ();
+  for (auto line : thread_pool_statistics ()) {
+    to_tty ({"Thread pool:", line});
+  }
+
   // OpenSSL stuff.
   thread_cleanup ();
   
@@ -140,8 +146,21 @@ void finalize_program ()
       if (passes) to_stdout ({"Number of succeeded time-sensitive calls to exchange", exchange, "is", to_string (passes)});
       int fails = exchange_get_hurried_call_fails (exchange);
       if (fails) to_stdout ({"Number of failed time-sensitive calls to exchange", exchange, "is", to_string (fails)});
+      int hedged = exchange_get_hedged_calls (exchange);
+      if (hedged) to_stdout ({"Number of hedged time-sensitive calls to exchange", exchange, "is", to_string (hedged), "of which the hedge won", to_string (exchange_get_hedge_wins (exchange))});
     }
   }
+  
+  // Write the deferred database writes.
+  SQL::write_behind_finish ();
+  for (auto line : SQL::write_behind_statistics ()) {
+    to_tty ({"Deferred database writes:", line});
+  }
+  
+  // How well the pool of database connections did.
+  for (auto line : SQL::pool_statistics ()) {
+    to_tty ({"Database connections:", line});
+  }
 }
 
 
@@ -290,6 +309,204 @@ size_t curl_write_function (void *ptr, size_t size, size_t count, void *stream)
 }
 
 
+// Extracts the host from a URL, e.g. "bittrex.com" from "https://bittrex.com/api/v1.1/public".
+string http_get_host (string url)
+{
+  // Remove the scheme http(s):// from the URL.
+  size_t pos = url.find ("://");
+  if (pos != string::npos) {
+    url.erase (0, pos + 3);
+  }
+  // Extract the host.
+  pos = url.find (":");
+  if (pos == string::npos) pos = url.find ("/");
+  if (pos == string::npos) pos = url.length () + 1;
+  return url.substr (0, pos);
+}
+
+
+// The bot used to create a new curl handle for every call, and clean it up afterwards.
+// This means that each call had to resolve the host, set up a TCP connection, and do the TLS handshake.
+// For arbitrage, where the order books are needed in a hurry, this took most of the available time.
+// It also took most of the CPU power of the satellite.
+// The bot now keeps a pool of curl handles per host.
+// A handle that completed a call goes back into the pool, keeping its connection alive.
+// The next call to the same host takes the handle out of the pool again, and reuses the live connection.
+// All handles share one DNS cache, one TLS session cache, and one connection cache.
+// This way a connection made by one handle can be reused by another one.
+// The handles and the share live as long as the process lives, or till the pool gets flushed.
+
+
+// The maximum number of idle handles to keep in the pool per host.
+// If more calls to one host run in parallel, the excess handles get cleaned up after use.
+#define HTTP_POOL_MAXIMUM_IDLE 16
+
+
+// Statistics about the usage of the pool for one host.
+struct http_pool_statistics_type
+{
+  int created = 0;
+  int reused = 0;
+  int failed = 0;
+  long milliseconds = 0;
+};
+
+
+mutex http_pool_mutex;
+unordered_map <string, vector <CURL *> > http_pool_handles;
+unordered_map <string, http_pool_statistics_type> http_pool_statistics_data;
+CURLSH * http_share = nullptr;
+mutex http_share_mutexes [CURL_LOCK_DATA_LAST];
+// The share each handle uses, and the number of handles that use each share.
+// A share that got replaced by a flush is cleaned up once no handle uses it anymore.
+unordered_map <CURL *, CURLSH *> http_handle_shares;
+unordered_map <CURLSH *, int> http_share_users;
+
+
+void http_share_lock (CURL * handle, curl_lock_data data, curl_lock_access access, void * userptr)
+{
+  (void) handle;
+  (void) access;
+  (void) userptr;
+  http_share_mutexes [data].lock ();
+}
+
+
+void http_share_unlock (CURL * handle, curl_lock_data data, void * userptr)
+{
+  (void) handle;
+  (void) userptr;
+  http_share_mutexes [data].unlock ();
+}
+
+
+// Takes a curl handle for the $host from the pool.
+// If the pool has no idle handle for this host, it creates a new one.
+CURL * http_pool_checkout (const string & host)
+{
+  CURL * curl = nullptr;
+  http_pool_mutex.lock ();
+  // Create the share once, and again after a flush.
+  if (!http_share) {
+    http_share = curl_share_init ();
+    if (http_share) {
+      curl_share_setopt (http_share, CURLSHOPT_LOCKFUNC, http_share_lock);
+      curl_share_setopt (http_share, CURLSHOPT_UNLOCKFUNC, http_share_unlock);
+      curl_share_setopt (http_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+      curl_share_setopt (http_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+      // Sharing the connection cache is supported since libcurl 7.57.0.
+      curl_share_setopt (http_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+    }
+  }
+  vector <CURL *> & idle = http_pool_handles [host];
+  if (!idle.empty ()) {
+    curl = idle.back ();
+    idle.pop_back ();
+    http_pool_statistics_data [host].reused++;
+  }
+  CURLSH * share = http_share;
+  http_pool_mutex.unlock ();
+  if (curl) {
+    // Clear the options of the previous call.
+    // This keeps the live connections, the DNS cache, and the TLS session cache.
+    curl_easy_reset (curl);
+  } else {
+    curl = curl_easy_init ();
+    if (curl) {
+      http_pool_mutex.lock ();
+      http_pool_statistics_data [host].created++;
+      http_handle_shares [curl] = share;
+      if (share) http_share_users [share]++;
+      http_pool_mutex.unlock ();
+      if (share) curl_easy_setopt (curl, CURLOPT_SHARE, share);
+    }
+  }
+  return curl;
+}
+
+
+// Returns the curl handle for the $host to the pool.
+// A handle whose call failed is cleaned up rather than reused,
+// as its connection may be in a bad state.
+void http_pool_return (const string & host, CURL * curl, bool healthy, long milliseconds)
+{
+  CURLSH * retired = nullptr;
+  http_pool_mutex.lock ();
+  http_pool_statistics_type & statistics = http_pool_statistics_data [host];
+  statistics.milliseconds += milliseconds;
+  if (!healthy) statistics.failed++;
+  vector <CURL *> & idle = http_pool_handles [host];
+  // A handle that uses a share replaced by a flush is not kept.
+  CURLSH * share = http_handle_shares [curl];
+  if (healthy && (share == http_share) && (idle.size () < HTTP_POOL_MAXIMUM_IDLE)) {
+    idle.push_back (curl);
+  } else {
+    curl_easy_cleanup (curl);
+    http_handle_shares.erase (curl);
+    if (share && (--http_share_users [share] == 0) && (share != http_share)) {
+      http_share_users.erase (share);
+      retired = share;
+    }
+  }
+  http_pool_mutex.unlock ();
+  // Cleaning up the share closes its connections.
+  if (retired) curl_share_cleanup (retired);
+}
+
+
+// Returns the statistics of the pools of curl handles, one line per host.
+vector <string> http_pool_statistics ()
+{
+  vector <string> lines;
+  http_pool_mutex.lock ();
+  for (auto & element : http_pool_statistics_data) {
+    const http_pool_statistics_type & statistics = element.second;
+    int calls = statistics.created + statistics.reused;
+    if (!calls) continue;
+    string line = element.first;
+    line.append (" calls " + to_string (calls));
+    line.append (" created " + to_string (statistics.created));
+    line.append (" reused " + to_string (statistics.reused));
+    line.append (" failed " + to_string (statistics.failed));
+    line.append (" idle " + to_string (http_pool_handles [element.first].size ()));
+    line.append (" average " + to_string (statistics.milliseconds / calls) + " ms");
+    lines.push_back (line);
+  }
+  http_pool_mutex.unlock ();
+  return lines;
+}
+
+
+// Closes the idle curl handles in the pools.
+// The connections live in the cache of the share rather than in the handles.
+// So the share gets replaced by a new one too, and the old one is cleaned up,
+// once the calls that are still using it have completed.
+// The next calls then set up fresh connections to the hosts.
+void http_pool_flush ()
+{
+  CURLSH * retired = nullptr;
+  http_pool_mutex.lock ();
+  for (auto & element : http_pool_handles) {
+    for (auto curl : element.second) {
+      curl_easy_cleanup (curl);
+      CURLSH * share = http_handle_shares [curl];
+      http_handle_shares.erase (curl);
+      if (share) http_share_users [share]--;
+    }
+    element.second.clear ();
+  }
+  if (http_share && (http_share_users [http_share] <= 0)) {
+    http_share_users.erase (http_share);
+    retired = http_share;
+  }
+  http_share = nullptr;
+  http_pool_mutex.unlock ();
+  if (retired) curl_share_cleanup (retired);
+}
+
+
 // Makes a http(s) call.
 // $url: The URL to call.
 // $error: Where it can store a possible error.
@@ -300,6 +517,7 @@ size_t curl_write_function (void *ptr, size_t size, size_t count, void *stream)
 // $headers: Extra http headers.
 // $hurry: Whether the caller is in a hurry to get the response.
 // $interface: The interface or IP address to connect from.
+// It takes the curl handle from the pool for the host, and returns it there afterwards.
 string http_call (const string & url,
                   string& error,
                   const string & proxy,
@@ -317,9 +535,13 @@ string http_call (const string & url,
   // Repeating a failed call only costs time.
   // With a time-sensitive operation like arbitrage, anything that costs time should be eliminated.
 
-  CURL *curl = curl_easy_init ();
+  string host = http_get_host (url);
+  CURL *curl = http_pool_checkout (host);
   if (curl) {
   
+    // Timer for the pool statistics.
+    long start = milliseconds_since_epoch ();
+
     // Set URL.
     curl_easy_setopt (curl, CURLOPT_URL, url.c_str());
     
@@ -387,6 +609,9 @@ string http_call (const string & url,
     // Timing out may use signals. Disable that.
     curl_easy_setopt (curl, CURLOPT_NOSIGNAL, 1L);
     
+    // Keep the connection alive while the handle waits in the pool for the next call.
+    curl_easy_setopt (curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    
     // Don't check the secure certificate.
     // There has been a case with Cryptopia being misconfigured,
     // so the certificate could not be verified,
@@ -418,8 +643,10 @@ string http_call (const string & url,
     }
 
     // Clean up.
+    // The handle goes back into the pool, so the next call to this host can reuse the connection.
+    // The header list is no longer used by the handle, because the handle gets reset before it is reused.
     if (list) curl_slist_free_all (list);
-    curl_easy_cleanup (curl);
+    http_pool_return (host, curl, res == CURLE_OK, milliseconds_since_epoch () - start);
   }
   
   // Done.
@@ -1428,9 +1655,13 @@ int satellite_port ()
 }
 
 
-// Sends a request to the satellite and reads the response.
-string satellite_request (const string & host, string request, bool hurry, string& error)
+// Sends a request to the satellite through a new connection, and reads the response.
+// The satellite closes the connection after sending the response.
+string satellite_request_oneshot (const string & host, string request, bool hurry, string& error)
 {
+  // The satellite may be an older one that does not know the binary format.
+  request = satellite_text_request (request);
+
   bool connection_healthy = true;
   
   // Resolve the host.
@@ -1516,9 +1747,10 @@ string satellite_request (const string & host, string request, bool hurry, strin
   }
 
   // Send the request.
+  // A satellite that closed the connection would raise SIGPIPE and kill the program: Get an error instead.
   if (connection_healthy) {
     request.append ("\n");
-    if (send (sock, request.c_str(), request.length(), 0) != (int) request.length ()) {
+    if (send (sock, request.c_str(), request.length(), MSG_NOSIGNAL) != (int) request.length ()) {
       error = "Sending request: ";
       error.append (strerror (errno));
       connection_healthy = false;
@@ -1556,6 +1788,1149 @@ string satellite_request (const string & host, string request, bool hurry, strin
 }
 
 
+// The port of the satellite for persistent connections.
+int satellite_persistent_port ()
+{
+  return 1235;
+}
+
+
+// The bot used to open a new connection to the satellite for every request.
+// For each request it resolved the host, connected, sent one line, and read till the satellite closed the socket.
+// Each arbitrage iteration needs at least four of those round trips,
+// so setting up the connections took time right on the trading path.
+// Now the bot keeps a few persistent connections open to each satellite.
+// The satellite listens for those on a separate port.
+// The requests and responses travel through them as frames.
+// Each frame has a header of 8 bytes: The request ID and the length of the payload,
+// both as 32 bits integers in network byte order.
+// The payload follows the header.
+// Multiple threads can send requests over the same connection simultaneously.
+// The satellite may respond in any order.
+// The request ID links each response to its request.
+// If a satellite does not listen on the persistent port, because it is an older version,
+// the bot falls back to a new connection per request.
+
+
+// The maximum number of persistent connections to one satellite.
+#define SATELLITE_LINKS_PER_HOST 4
+
+
+// A request sent over a persistent connection, waiting for its response.
+class satellite_pending
+{
+public:
+  mutex lock;
+  condition_variable condition;
+  bool done = false;
+  // When the request went out, and when the response came in, in milliseconds since the Epoch.
+  long sent = 0;
+  long completed = 0;
+  string response;
+  string error;
+  // Optionally called once the request completes.
+  function <void ()> notify;
+  // The connection the request went out on, and its identifier there.
+  weak_ptr <class satellite_link> link;
+  uint32_t identifier = 0;
+};
+
+
+// A persistent connection to a satellite.
+// Other threads may still be sending on a connection that broke,
+// so the socket is closed once the last of them lets go of the connection.
+// Closing it earlier could make them send on a reused file descriptor.
+class satellite_link
+{
+public:
+  ~satellite_link () { if (sock >= 0) close (sock); }
+  int sock = -1;
+  atomic <bool> healthy { false };
+  mutex write_mutex;
+  mutex pending_mutex;
+  unordered_map <uint32_t, shared_ptr <satellite_pending> > pending;
+};
+
+
+mutex satellite_links_mutex;
+unordered_map <string, vector <shared_ptr <satellite_link> > > satellite_links;
+atomic <uint32_t> satellite_link_identifier (0);
+// The satellites that do not accept persistent connections, with the second till when not to try again.
+unordered_map <string, int> satellite_links_refused;
+
+
+// Completes a pending request with the $response or the $error.
+void satellite_pending_complete (shared_ptr <satellite_pending> pending, const string & response, const string & error)
+{
+  pending->lock.lock ();
+  pending->response = response;
+  pending->error = error;
+  pending->completed = milliseconds_since_epoch ();
+  pending->done = true;
+  pending->lock.unlock ();
+  pending->condition.notify_all ();
+  if (pending->notify) pending->notify ();
+}
+
+
+// Reads all bytes of $length from the socket.
+bool satellite_read_all (int sock, char * buffer, size_t length)
+{
+  size_t received = 0;
+  while (received < length) {
+    ssize_t ret = recv (sock, buffer + received, length - received, 0);
+    if (ret <= 0) return false;
+    received += ret;
+  }
+  return true;
+}
+
+
+// Reads the responses from a persistent connection and hands them to the waiting requests.
+// This runs in its own thread for as long as the connection is healthy.
+void satellite_link_reader (shared_ptr <satellite_link> link)
+{
+  string error;
+  while (true) {
+    unsigned char header [8];
+    if (!satellite_read_all (link->sock, (char *) header, 8)) break;
+    uint32_t identifier = ntohl (* (uint32_t *) header);
+    uint32_t length = ntohl (* (uint32_t *) (header + 4));
+    string response (length, '\0');
+    if (length) {
+      if (!satellite_read_all (link->sock, &response [0], length)) break;
+    }
+    shared_ptr <satellite_pending> pending;
+    link->pending_mutex.lock ();
+    auto iterator = link->pending.find (identifier);
+    if (iterator != link->pending.end ()) {
+      pending = iterator->second;
+      link->pending.erase (iterator);
+    }
+    link->pending_mutex.unlock ();
+    // A response to a request that has timed out already is discarded.
+    if (pending) satellite_pending_complete (pending, response, "");
+  }
+  
+  // The connection broke or the satellite closed it: Fail all waiting requests.
+  link->healthy = false;
+  link->pending_mutex.lock ();
+  auto pending = link->pending;
+  link->pending.clear ();
+  link->pending_mutex.unlock ();
+  for (auto & element : pending) {
+    satellite_pending_complete (element.second, "", "Receiving: Persistent connection closed");
+  }
+  shutdown (link->sock, SHUT_RDWR);
+}
+
+
+// Opens a persistent connection to the satellite at $host.
+// Returns nothing if the connection could not be made.
+shared_ptr <satellite_link> satellite_link_open (const string & host, bool hurry)
+{
+  // Resolve the host.
+  struct addrinfo hints;
+  struct addrinfo * address_results = nullptr;
+  memset (&hints, 0, sizeof (struct addrinfo));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  string service = to_string (satellite_persistent_port ());
+  if (getaddrinfo (host.c_str(), service.c_str (), &hints, &address_results) != 0) return nullptr;
+
+  // Connect without blocking, so the connection attempt can time out quickly.
+  int sock = -1;
+  for (struct addrinfo * rp = address_results; rp != NULL; rp = rp->ai_next) {
+    sock = socket (rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+    if (sock < 0) continue;
+    int flags = fcntl (sock, F_GETFL, 0);
+    fcntl (sock, F_SETFL, flags | O_NONBLOCK);
+    int res = connect (sock, rp->ai_addr, rp->ai_addrlen);
+    if ((res < 0) && (errno == EINPROGRESS)) {
+      struct pollfd descriptor;
+      descriptor.fd = sock;
+      descriptor.events = POLLOUT;
+      descriptor.revents = 0;
+      res = -1;
+      if (poll (&descriptor, 1, hurry ? 2000 : 5000) > 0) {
+        int socket_error = 0;
+        socklen_t length = sizeof (socket_error);
+        getsockopt (sock, SOL_SOCKET, SO_ERROR, &socket_error, &length);
+        if (!socket_error) res = 0;
+      }
+    }
+    if (res == 0) {
+      // Back to blocking mode for the reader thread and the writers.
+      fcntl (sock, F_SETFL, flags);
+      break;
+    }
+    close (sock);
+    sock = -1;
+  }
+  freeaddrinfo (address_results);
+  if (sock < 0) return nullptr;
+
+  // Send the requests without delay.
+  int optval = 1;
+  setsockopt (sock, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof (optval));
+#ifdef SO_NOSIGPIPE
+  // A satellite that disconnects should not kill the bot.
+  setsockopt (sock, SOL_SOCKET, SO_NOSIGPIPE, &optval, sizeof (optval));
+#endif
+  // Timeout on sending a request.
+  struct timeval tv;
+  tv.tv_sec = 6;
+  tv.tv_usec = 0;
+  setsockopt (sock, SOL_SOCKET, SO_SNDTIMEO, (struct timeval *)&tv, sizeof(struct timeval));
+
+  shared_ptr <satellite_link> link = make_shared <satellite_link> ();
+  link->sock = sock;
+  link->healthy = true;
+  thread reader (satellite_link_reader, link);
+  reader.detach ();
+  return link;
+}
+
+
+// Sends the $request to the satellite at $host over a persistent connection.
+// It does not wait for the response.
+// Returns the pending request, or nothing if no persistent connection could be used.
+shared_ptr <satellite_pending> satellite_link_submit (const string & host, const string & request, bool hurry,
+                                                      function <void ()> notify = nullptr)
+{
+  // Skip satellites that recently refused a persistent connection.
+  satellite_links_mutex.lock ();
+  bool refused = satellite_links_refused [host] > seconds_since_epoch ();
+  satellite_links_mutex.unlock ();
+  if (refused) return nullptr;
+
+  // Select the healthy connection with the fewest waiting requests.
+  // Open a new connection if all existing ones are busy and the pool is not yet full.
+  shared_ptr <satellite_link> link;
+  size_t link_count = 0;
+  {
+    size_t fewest = numeric_limits <size_t>::max ();
+    satellite_links_mutex.lock ();
+    vector <shared_ptr <satellite_link> > & links = satellite_links [host];
+    links.erase (remove_if (links.begin (), links.end (), [] (shared_ptr <satellite_link> l) { return !l->healthy; }), links.end ());
+    for (auto & candidate : links) {
+      candidate->pending_mutex.lock ();
+      size_t count = candidate->pending.size ();
+      candidate->pending_mutex.unlock ();
+      if (count < fewest) {
+        fewest = count;
+        link = candidate;
+      }
+    }
+    link_count = links.size ();
+    satellite_links_mutex.unlock ();
+    if (link && fewest && (link_count < SATELLITE_LINKS_PER_HOST)) link = nullptr;
+  }
+  if (!link) {
+    link = satellite_link_open (host, hurry);
+    satellite_links_mutex.lock ();
+    if (link) {
+      satellite_links [host].push_back (link);
+    } else if (!link_count) {
+      // No persistent connections to this satellite: Use one-shot connections for a while.
+      // Keep this short: While a satellite restarts, the new instance is not yet listening.
+      satellite_links_refused [host] = seconds_since_epoch () + 10;
+    }
+    satellite_links_mutex.unlock ();
+    if (!link) return nullptr;
+  }
+
+  // Register the request, then send it.
+  uint32_t identifier = ++satellite_link_identifier;
+  shared_ptr <satellite_pending> pending = make_shared <satellite_pending> ();
+  pending->notify = notify;
+  pending->link = link;
+  pending->identifier = identifier;
+  link->pending_mutex.lock ();
+  link->pending [identifier] = pending;
+  link->pending_mutex.unlock ();
+  string frame (8, '\0');
+  * (uint32_t *) &frame [0] = htonl (identifier);
+  * (uint32_t *) &frame [4] = htonl ((uint32_t) request.size ());
+  frame.append (request);
+  pending->sent = milliseconds_since_epoch ();
+  link->write_mutex.lock ();
+  bool sent = send (link->sock, frame.c_str (), frame.size (), MSG_NOSIGNAL) == (ssize_t) frame.size ();
+  link->write_mutex.unlock ();
+  if (!sent) {
+    // The reader thread fails the other waiting requests.
+    link->healthy = false;
+    shutdown (link->sock, SHUT_RDWR);
+    link->pending_mutex.lock ();
+    link->pending.erase (identifier);
+    link->pending_mutex.unlock ();
+    return nullptr;
+  }
+  return pending;
+}
+
+
+// Waits till the $pending request has its response, or till the $deadline in milliseconds since the Epoch.
+// Returns false on timeout.
+bool satellite_link_wait (shared_ptr <satellite_pending> pending, long deadline)
+{
+  unique_lock <mutex> lock (pending->lock);
+  long remaining = deadline - milliseconds_since_epoch ();
+  if (remaining < 0) remaining = 0;
+  return pending->condition.wait_for (lock, chrono::milliseconds (remaining), [&] { return pending->done; });
+}
+
+
+// Gives up on the $pending request.
+// A satellite that stays connected but never responds,
+// would otherwise collect the requests that timed out.
+void satellite_link_abandon (shared_ptr <satellite_pending> pending)
+{
+  if (!pending) return;
+  shared_ptr <satellite_link> link = pending->link.lock ();
+  if (!link) return;
+  link->pending_mutex.lock ();
+  link->pending.erase (pending->identifier);
+  link->pending_mutex.unlock ();
+}
+
+
+// Sends a request to the satellite and reads the response.
+// It uses a persistent connection if the satellite supports it,
+// else it falls back to a new connection for this request only.
+// Once the request went out over a persistent connection, it is not sent again,
+// as the satellite may have run it already, and some requests, like placing an order, should not run twice.
+string satellite_request (const string & host, string request, bool hurry, string& error)
+{
+  error.clear ();
+  long deadline = milliseconds_since_epoch () + (hurry ? 6000 : 30000);
+  shared_ptr <satellite_pending> pending = satellite_link_submit (host, request, hurry);
+  if (pending) {
+    if (!satellite_link_wait (pending, deadline)) {
+      satellite_link_abandon (pending);
+      error = "Receiving: ";
+      error.append (strerror (ETIMEDOUT));
+      return "";
+    }
+    // The connection closed before the response came in.
+    if (!pending->error.empty ()) {
+      error = pending->error;
+      return "";
+    }
+    // A satellite with another version of the binary format gets asked for text.
+    if (!satellite_binary_mismatch (pending->response)) return pending->response;
+  }
+  return satellite_request_oneshot (host, request, hurry, error);
+}
+
+
+// Whether the $pending request has completed, with a response or with an error.
+bool satellite_pending_done (shared_ptr <satellite_pending> pending)
+{
+  if (!pending) return false;
+  lock_guard <mutex> guard (pending->lock);
+  return pending->done;
+}
+
+
+// Whether the $pending request has completed with a response.
+bool satellite_pending_succeeded (shared_ptr <satellite_pending> pending)
+{
+  return satellite_pending_done (pending) && pending->error.empty ();
+}
+
+
+// A hurried request waits on a single satellite.
+// If that satellite, or the exchange behind it, is slow, the bot waits till the timeout.
+// Hedging reduces that wait:
+// If the $primary satellite has not responded after $delay milliseconds,
+// the same request goes out to the secondary satellite.
+// The secondary satellite is only chosen by $secondary_get at that moment,
+// as choosing a satellite may start probing one that was left out.
+// The first good response wins, and the other one gets discarded when it comes in.
+// The $winner is the satellite that gave the response.
+// The outcomes give how it went at each satellite, timed from the moment the request went out to it.
+// Hedging needs persistent connections, else it makes an ordinary request to the primary satellite.
+string satellite_request_hedged (const string & primary, function <string ()> secondary_get,
+                                 const string & request, bool hurry, long delay,
+                                 string & error, string & winner,
+                                 satellite_hedge_outcome & primary_outcome,
+                                 satellite_hedge_outcome & secondary_outcome)
+{
+  error.clear ();
+  winner = primary;
+  primary_outcome = satellite_hedge_outcome ();
+  secondary_outcome = satellite_hedge_outcome ();
+  primary_outcome.host = primary;
+  long start = milliseconds_since_epoch ();
+  long deadline = milliseconds_since_epoch () + (hurry ? 6000 : 30000);
+  
+  // Completing requests wake up the waiting thread here.
+  shared_ptr <mutex> lock = make_shared <mutex> ();
+  shared_ptr <condition_variable> condition = make_shared <condition_variable> ();
+  function <void ()> notify = [lock, condition] {
+    lock->lock ();
+    lock->unlock ();
+    condition->notify_all ();
+  };
+  auto completed = satellite_pending_done;
+  auto succeeded = satellite_pending_succeeded;
+  
+  shared_ptr <satellite_pending> first = satellite_link_submit (primary, request, hurry, notify);
+  if (!first) {
+    string response = satellite_request (primary, request, hurry, error);
+    primary_outcome.completed = true;
+    primary_outcome.succeeded = error.empty ();
+    primary_outcome.milliseconds = milliseconds_since_epoch () - start;
+    return response;
+  }
+  
+  // Give the primary satellite some time.
+  {
+    unique_lock <mutex> guard (* lock);
+    condition->wait_until (guard, chrono::system_clock::now () + chrono::milliseconds (delay), [&] { return completed (first); });
+  }
+  shared_ptr <satellite_pending> second;
+  if (!succeeded (first)) {
+    string secondary = secondary_get ();
+    if (!secondary.empty ()) {
+      second = satellite_link_submit (secondary, request, hurry, notify);
+      if (second) secondary_outcome.host = secondary;
+    }
+  }
+  
+  // Wait for the first good response, or till both have failed, or till the timeout.
+  {
+    unique_lock <mutex> guard (* lock);
+    auto done = [&] {
+      if (succeeded (first) || succeeded (second)) return true;
+      return completed (first) && (!second || completed (second));
+    };
+    long remaining = deadline - milliseconds_since_epoch ();
+    if (remaining > 0) condition->wait_for (guard, chrono::milliseconds (remaining), done);
+  }
+  // Nobody waits for a response that has not come in yet.
+  if (!completed (first)) satellite_link_abandon (first);
+  if (!completed (second)) satellite_link_abandon (second);
+  // How it went at each satellite.
+  long now = milliseconds_since_epoch ();
+  vector <pair <shared_ptr <satellite_pending>, satellite_hedge_outcome *> > outcomes = {
+    make_pair (first, &primary_outcome), make_pair (second, &secondary_outcome)
+  };
+  for (auto & element : outcomes) {
+    shared_ptr <satellite_pending> pending = element.first;
+    if (!pending) continue;
+    satellite_hedge_outcome * outcome = element.second;
+    outcome->completed = completed (pending);
+    outcome->succeeded = succeeded (pending);
+    outcome->milliseconds = (outcome->completed ? pending->completed : now) - pending->sent;
+  }
+  if (succeeded (first) || succeeded (second)) {
+    shared_ptr <satellite_pending> pending = succeeded (first) ? first : second;
+    if (pending == second) winner = secondary_outcome.host;
+    // A satellite with another version of the binary format gets asked for text.
+    if (satellite_binary_mismatch (pending->response)) return satellite_request_oneshot (winner, request, hurry, error);
+    return pending->response;
+  }
+  if (completed (first)) error = first->error;
+  else {
+    error = "Receiving: ";
+    error.append (strerror (ETIMEDOUT));
+  }
+  return "";
+}
+
+
+// Records the time the finished $calls took since the $start.
+void satellite_request_multi_timing (vector <satellite_call> & calls, const vector <int> & stages, int done, long start)
+{
+  long now = milliseconds_since_epoch ();
+  for (size_t i = 0; i < calls.size (); i++) {
+    if (calls[i].milliseconds) continue;
+    if (stages [i] != done) continue;
+    calls[i].milliseconds = max (now - start, 1L);
+  }
+}
+
+
+// Sends a batch of requests to one or more satellites, and reads all responses.
+// The caller used to start a thread per request, and each thread blocked in satellite_request.
+// With many requests, this meant many threads, and the scheduling of them caused jitter.
+// This function runs all requests on the calling thread instead.
+// It connects to all satellites without blocking,
+// and then waits on all sockets at once for them to become ready for sending or receiving.
+// It uses poll () rather than epoll (), so it works on macOS too.
+// Each call gets its own timeout, normal or hurried, counted from the start of the batch.
+// A call over a persistent connection can be hedged, like satellite_request_hedged does.
+void satellite_request_multi (vector <satellite_call> & calls)
+{
+  // The stages each request goes through.
+  enum { stage_connecting, stage_sending, stage_receiving, stage_done };
+  
+  size_t count = calls.size ();
+  vector <int> sockets (count, -1);
+  vector <int> stages (count, stage_done);
+  vector <string> requests (count);
+  vector <size_t> sent (count, 0);
+  vector <long> deadlines (count, 0);
+  long start = milliseconds_since_epoch ();
+  string service = to_string (satellite_port ());
+
+  // Completing requests over the persistent connections wake up the waiting thread here.
+  shared_ptr <mutex> lock = make_shared <mutex> ();
+  shared_ptr <condition_variable> condition = make_shared <condition_variable> ();
+  function <void ()> notify = [lock, condition] {
+    lock->lock ();
+    lock->unlock ();
+    condition->notify_all ();
+  };
+
+  // Send the requests over the persistent connections to the satellites, where possible.
+  vector <shared_ptr <satellite_pending> > pendings (count);
+  vector <shared_ptr <satellite_pending> > hedges (count);
+  for (size_t i = 0; i < count; i++) {
+    calls[i].milliseconds = 0;
+    calls[i].winner = calls[i].host;
+    calls[i].primary_outcome = satellite_hedge_outcome ();
+    calls[i].hedge_outcome = satellite_hedge_outcome ();
+    pendings [i] = satellite_link_submit (calls[i].host, calls[i].request, calls[i].hurry, notify);
+  }
+
+  // Start to connect to the satellites for the remaining requests.
+  for (size_t i = 0; i < count; i++) {
+    if (pendings [i]) continue;
+    satellite_call & call = calls [i];
+    call.response.clear ();
+    call.error.clear ();
+    // An older satellite would not understand this request.
+    if (call.persistent) {
+      call.error = "No persistent connection to " + call.host;
+      continue;
+    }
+    requests [i] = satellite_text_request (call.request) + "\n";
+    // Resolve the host.
+    struct addrinfo hints;
+    struct addrinfo * address_results = nullptr;
+    memset (&hints, 0, sizeof (struct addrinfo));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int res = getaddrinfo (call.host.c_str(), service.c_str (), &hints, &address_results);
+    if (res != 0) {
+      call.error = call.host + ": ";
+      call.error.append (gai_strerror (res));
+      continue;
+    }
+    // Iterate over the list of address structures till one starts connecting.
+    vector <string> errors;
+    for (struct addrinfo * rp = address_results; rp != NULL; rp = rp->ai_next) {
+      int sock = socket (rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+      if (sock < 0) {
+        string err = "Creating socket: ";
+        err.append (strerror (errno));
+        errors.push_back (err);
+        continue;
+      }
+      // Make it a non-blocking socket so the connection is set up in the background.
+      fcntl (sock, F_SETFL, fcntl (sock, F_GETFL, 0) | O_NONBLOCK);
+      res = connect (sock, rp->ai_addr, rp->ai_addrlen);
+      if ((res == 0) || (errno == EINPROGRESS)) {
+        sockets [i] = sock;
+        stages [i] = stage_connecting;
+        break;
+      }
+      string err = call.host + ": ";
+      err.append (strerror (errno));
+      errors.push_back (err);
+      close (sock);
+    }
+    freeaddrinfo (address_results);
+    if (sockets [i] < 0) {
+      call.error = implode (errors, " | ");
+      continue;
+    }
+    // Normal or hurried timeout.
+    int timeout = 30;
+    if (call.hurry) timeout = 6;
+    deadlines [i] = start + (timeout * 1000);
+  }
+
+  // Handle the connections till all of them are done.
+  while (true) {
+
+    // Assemble the sockets to wait on.
+    vector <struct pollfd> descriptors;
+    vector <size_t> offsets;
+    long now = milliseconds_since_epoch ();
+    long wait = -1;
+    for (size_t i = 0; i < count; i++) {
+      if (stages [i] == stage_done) continue;
+      // Handle timeouts.
+      if (now >= deadlines [i]) {
+        calls [i].error = "Receiving: ";
+        calls [i].error.append (strerror (ETIMEDOUT));
+        stages [i] = stage_done;
+        continue;
+      }
+      struct pollfd descriptor;
+      descriptor.fd = sockets [i];
+      descriptor.events = (stages [i] == stage_receiving) ? POLLIN : POLLOUT;
+      descriptor.revents = 0;
+      descriptors.push_back (descriptor);
+      offsets.push_back (i);
+      long remaining = deadlines [i] - now;
+      if ((wait < 0) || (remaining < wait)) wait = remaining;
+    }
+    if (descriptors.empty ()) break;
+
+    // Wait till any of the sockets is ready, or till the first timeout expires.
+    int ready = poll (descriptors.data (), descriptors.size (), (int) wait);
+    if (ready < 0) {
+      if (errno == EINTR) continue;
+      for (auto i : offsets) {
+        calls [i].error = "Polling: ";
+        calls [i].error.append (strerror (errno));
+        stages [i] = stage_done;
+      }
+      break;
+    }
+
+    // Handle the sockets that are ready.
+    for (size_t d = 0; d < descriptors.size (); d++) {
+      if (!descriptors[d].revents) continue;
+      size_t i = offsets [d];
+      satellite_call & call = calls [i];
+      int sock = sockets [i];
+
+      // The connection has been set up, or it failed.
+      if (stages [i] == stage_connecting) {
+        int socket_error = 0;
+        socklen_t length = sizeof (socket_error);
+        getsockopt (sock, SOL_SOCKET, SO_ERROR, &socket_error, &length);
+        if (socket_error) {
+          call.error = call.host + ": ";
+          call.error.append (strerror (socket_error));
+          stages [i] = stage_done;
+          continue;
+        }
+        stages [i] = stage_sending;
+      }
+
+      // Send the request, or what remains of it.
+      if (stages [i] == stage_sending) {
+        const string & request = requests [i];
+        ssize_t ret = send (sock, request.c_str () + sent [i], request.length () - sent [i], MSG_NOSIGNAL);
+        if (ret < 0) {
+          if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) continue;
+          call.error = "Sending request: ";
+          call.error.append (strerror (errno));
+          stages [i] = stage_done;
+          continue;
+        }
+        sent [i] += ret;
+        if (sent [i] >= request.length ()) stages [i] = stage_receiving;
+        continue;
+      }
+
+      // Read the response, till the satellite closes the connection.
+      if (stages [i] == stage_receiving) {
+        char buffer [4096];
+        ssize_t ret = recv (sock, buffer, sizeof (buffer), 0);
+        if (ret > 0) {
+          call.response.append (buffer, ret);
+        } else if (ret == 0) {
+          stages [i] = stage_done;
+        } else if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+          call.error = "Receiving: ";
+          call.error.append (strerror (errno));
+          stages [i] = stage_done;
+        }
+      }
+    }
+    
+    // Record how long the finished calls took.
+    satellite_request_multi_timing (calls, stages, stage_done, start);
+  }
+  satellite_request_multi_timing (calls, stages, stage_done, start);
+
+  // Close the sockets and clear the responses of the failed calls.
+  for (size_t i = 0; i < count; i++) {
+    if (sockets [i] >= 0) close (sockets [i]);
+    if (!calls [i].error.empty ()) calls [i].response.clear ();
+  }
+  
+  // Hedge the calls over the persistent connections that have no good response after their delay.
+  // The secondary satellite is only chosen at that moment, as choosing it may start probing it.
+  for (size_t i = 0; i < count; i++) {
+    satellite_call & call = calls [i];
+    if (!pendings [i] || !call.hedge_delay || !call.hedge_get) continue;
+    {
+      unique_lock <mutex> guard (* lock);
+      long remaining = max (start + call.hedge_delay - milliseconds_since_epoch (), 0L);
+      condition->wait_for (guard, chrono::milliseconds (remaining), [&] { return satellite_pending_done (pendings [i]); });
+    }
+    if (satellite_pending_succeeded (pendings [i])) continue;
+    string secondary = call.hedge_get ();
+    if (secondary.empty ()) continue;
+    hedges [i] = satellite_link_submit (secondary, call.request, call.hurry, notify);
+    if (hedges [i]) call.hedge_outcome.host = secondary;
+  }
+
+  // Collect the responses that came in over the persistent connections.
+  // Those requests have been in flight all the time the other ones were handled.
+  for (size_t i = 0; i < count; i++) {
+    if (!pendings [i]) continue;
+    satellite_call & call = calls [i];
+    call.response.clear ();
+    call.error.clear ();
+    int timeout = call.hurry ? 6 : 30;
+    shared_ptr <satellite_pending> first = pendings [i];
+    shared_ptr <satellite_pending> second = hedges [i];
+    // Wait for the first good response, or till both have failed, or till the timeout.
+    {
+      unique_lock <mutex> guard (* lock);
+      auto done = [&] {
+        if (satellite_pending_succeeded (first) || satellite_pending_succeeded (second)) return true;
+        return satellite_pending_done (first) && (!second || satellite_pending_done (second));
+      };
+      long remaining = max (start + (timeout * 1000) - milliseconds_since_epoch (), 0L);
+      condition->wait_for (guard, chrono::milliseconds (remaining), done);
+    }
+    if (!satellite_pending_done (first)) satellite_link_abandon (first);
+    if (second && !satellite_pending_done (second)) satellite_link_abandon (second);
+    // The response of the hedge is used only if it was good and the primary one was not.
+    shared_ptr <satellite_pending> pending = first;
+    if (!satellite_pending_succeeded (first) && satellite_pending_succeeded (second)) {
+      pending = second;
+      call.winner = call.hedge_outcome.host;
+    }
+    bool completed = satellite_pending_done (pending);
+    long now = milliseconds_since_epoch ();
+    if (second) {
+      // How it went at each satellite, timed from the moment the request went out to it.
+      call.primary_outcome.host = call.host;
+      vector <pair <shared_ptr <satellite_pending>, satellite_hedge_outcome *> > outcomes = {
+        make_pair (first, &call.primary_outcome), make_pair (second, &call.hedge_outcome)
+      };
+      for (auto & element : outcomes) {
+        satellite_hedge_outcome * outcome = element.second;
+        outcome->completed = satellite_pending_done (element.first);
+        outcome->succeeded = satellite_pending_succeeded (element.first);
+        outcome->milliseconds = (outcome->completed ? element.first->completed : now) - element.first->sent;
+      }
+      call.milliseconds = (pending == second) ? call.hedge_outcome.milliseconds : call.primary_outcome.milliseconds;
+    } else {
+      call.milliseconds = (completed ? pending->completed : now) - start;
+    }
+    if (!completed) {
+      call.error = "Receiving: ";
+      call.error.append (strerror (ETIMEDOUT));
+    } else if (pending->error.empty () && !satellite_binary_mismatch (pending->response)) {
+      call.response = pending->response;
+    } else if (call.persistent || !pending->error.empty ()) {
+      // The connection closed before the response came in:
+      // The request is not sent again, as the satellite may have run it already.
+      call.error = pending->error;
+      if (call.error.empty ()) call.error = "Binary reply in another version from " + call.winner;
+    } else {
+      // The satellite has another version of the binary format: Ask it for text through a new connection.
+      call.response = satellite_request_oneshot (call.winner, call.request, call.hurry, call.error);
+    }
+  }
+}
+
+
+// The satellite used to send the market summaries and the order books as text,
+// with every rate and quantity formatted to ten decimals.
+// The bot then split the lines and words, and converted them back to floats.
+// Formatting and parsing took CPU time on both sides,
+// and the text took more bytes over the home link than needed.
+// Now the bot can ask for a binary reply, by putting "binary" in front of the request.
+// It does that only over a persistent connection.
+// A satellite that accepts those, knows the binary format.
+// Older satellites and older bots keep using the text format.
+//
+// A binary reply has a header of 22 bytes:
+// - the version of the format, 1 byte
+//   Version 1 had a header of 18 bytes, without the age of the data.
+// - the kind of reply, 1 byte: error, market summaries, or order book
+// - the identifiers of the exchange, the market, and the coin, 4 bytes each
+// - the number of entries, 4 bytes
+// - the age of the data in milliseconds, 4 bytes, for data the satellite had cached
+// The payload follows the header:
+// - for an error: the text of the error, the length being the number of entries
+// - for the market summaries: the coins, each preceded by one byte with its length,
+//   then all bids, then all asks
+// - for an order book: all quantities, then all rates
+// The numbers are in network byte order.
+// The floats are sent as they are, 4 bytes each, so no precision gets lost.
+
+
+#define SATELLITE_BINARY_VERSION 2
+// The versions of the format there may be, now or in future.
+// A text response never starts with any of these bytes.
+#define SATELLITE_BINARY_VERSIONS 8
+#define SATELLITE_BINARY_HEADER 22
+#define SATELLITE_BINARY_ERROR 0
+#define SATELLITE_BINARY_SUMMARIES 1
+#define SATELLITE_BINARY_ORDER_BOOK 2
+#define SATELLITE_BINARY_BATCH 3
+#define SATELLITE_BINARY_RATES 4
+
+
+// Returns the $request for the satellite, asking for a binary reply.
+string satellite_binary_request (const string & request)
+{
+  return "binary " + request;
+}
+
+
+// Returns the $request for the satellite, asking for the reply in text.
+string satellite_text_request (const string & request)
+{
+  if (request.find ("binary ") == 0) return request.substr (7);
+  return request;
+}
+
+
+// Whether the $response is in binary format.
+// A text response never starts with this byte.
+bool satellite_binary_reply (const string & response)
+{
+  if (response.size () < SATELLITE_BINARY_HEADER) return false;
+  return response [0] == SATELLITE_BINARY_VERSION;
+}
+
+
+// Whether the $response is a binary reply in another version of the format.
+// A bot and a satellite from different builds read the payload at different offsets.
+// The bot then asks for the reply in text.
+bool satellite_binary_mismatch (const string & response)
+{
+  if (response.empty ()) return false;
+  unsigned char version = response [0];
+  if (version == SATELLITE_BINARY_VERSION) return false;
+  return (version >= 1) && (version <= SATELLITE_BINARY_VERSIONS);
+}
+
+
+// The identifier of an exchange, market, or coin in the binary format.
+// It is a hash of the $name, so it remains the same when exchanges or coins are added.
+uint32_t satellite_binary_identifier (const string & name)
+{
+  // The 32 bits FNV-1a hash.
+  uint32_t hash = 2166136261u;
+  for (unsigned char c : name) {
+    hash ^= c;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+
+void satellite_binary_add (string & data, uint32_t value)
+{
+  value = htonl (value);
+  data.append ((const char *) &value, sizeof (value));
+}
+
+
+uint32_t satellite_binary_get (const string & data, size_t offset)
+{
+  uint32_t value;
+  memcpy (&value, data.c_str () + offset, sizeof (value));
+  return ntohl (value);
+}
+
+
+void satellite_binary_add (string & data, const vector <float> & values)
+{
+  for (float value : values) {
+    uint32_t bits;
+    memcpy (&bits, &value, sizeof (bits));
+    satellite_binary_add (data, bits);
+  }
+}
+
+
+void satellite_binary_get (const string & data, size_t offset, size_t count, vector <float> & values)
+{
+  for (size_t i = 0; i < count; i++) {
+    uint32_t bits = satellite_binary_get (data, offset + (i * 4));
+    float value;
+    memcpy (&value, &bits, sizeof (value));
+    values.push_back (value);
+  }
+}
+
+
+string satellite_binary_header (int kind, const string & exchange, const string & market, const string & coin, size_t count, int age = 0)
+{
+  string data;
+  data.push_back (SATELLITE_BINARY_VERSION);
+  data.push_back (kind);
+  satellite_binary_add (data, satellite_binary_identifier (exchange));
+  satellite_binary_add (data, satellite_binary_identifier (market));
+  satellite_binary_add (data, satellite_binary_identifier (coin));
+  satellite_binary_add (data, count);
+  satellite_binary_add (data, age);
+  return data;
+}
+
+
+// Reads and checks the header of the binary $response.
+// Returns the number of entries, or a negative value on error.
+int satellite_binary_check (const string & response, int kind,
+                            const string & exchange, const string & market, const string & coin,
+                            string & error)
+{
+  int reply_kind = response [1];
+  size_t count = satellite_binary_get (response, 14);
+  if (reply_kind == SATELLITE_BINARY_ERROR) {
+    if (response.size () < SATELLITE_BINARY_HEADER + count) error.append ("Binary reply too short");
+    else error.append (response.substr (SATELLITE_BINARY_HEADER, count));
+    return -1;
+  }
+  if ((reply_kind != kind)
+      || (satellite_binary_get (response, 2) != satellite_binary_identifier (exchange))
+      || (satellite_binary_get (response, 6) != satellite_binary_identifier (market))
+      || (satellite_binary_get (response, 10) != satellite_binary_identifier (coin))) {
+    error.append ("Binary reply for another request");
+    return -1;
+  }
+  return count;
+}
+
+
+// Encodes the market summaries, or the $error, in binary format.
+string satellite_encode_summaries (const string & exchange, const string & market,
+                                   const vector <string> & coins,
+                                   const vector <float> & bids,
+                                   const vector <float> & asks,
+                                   const string & error)
+{
+  if (!error.empty ()) {
+    return satellite_binary_header (SATELLITE_BINARY_ERROR, exchange, market, "", error.size ()) + error;
+  }
+  string data = satellite_binary_header (SATELLITE_BINARY_SUMMARIES, exchange, market, "", coins.size ());
+  for (auto & coin : coins) {
+    string name = coin.substr (0, 255);
+    data.push_back (name.size ());
+    data.append (name);
+  }
+  satellite_binary_add (data, bids);
+  satellite_binary_add (data, asks);
+  return data;
+}
+
+
+// Decodes the market summaries from the binary $response.
+void satellite_decode_summaries (const string & response, const string & exchange, const string & market,
+                                 vector <string> & coins,
+                                 vector <float> & bids,
+                                 vector <float> & asks,
+                                 string & error)
+{
+  int count = satellite_binary_check (response, SATELLITE_BINARY_SUMMARIES, exchange, market, "", error);
+  if (count < 0) return;
+  size_t offset = SATELLITE_BINARY_HEADER;
+  for (int i = 0; i < count; i++) {
+    if (offset >= response.size ()) break;
+    size_t length = (unsigned char) response [offset];
+    offset++;
+    coins.push_back (response.substr (offset, length));
+    offset += length;
+  }
+  if (((int) coins.size () < count) || (response.size () < offset + (count * 8))) {
+    coins.clear ();
+    error.append ("Binary reply too short");
+    return;
+  }
+  satellite_binary_get (response, offset, count, bids);
+  satellite_binary_get (response, offset + (count * 4), count, asks);
+}
+
+
+// Encodes the buyers or the sellers, or the $error, in binary format.
+// The $age is how many milliseconds ago the satellite fetched the order book.
+string satellite_encode_order_book (const string & exchange, const string & market, const string & coin,
+                                    const vector <float> & quantities,
+                                    const vector <float> & rates,
+                                    const string & error,
+                                    int age)
+{
+  if (!error.empty ()) {
+    return satellite_binary_header (SATELLITE_BINARY_ERROR, exchange, market, coin, error.size ()) + error;
+  }
+  string data = satellite_binary_header (SATELLITE_BINARY_ORDER_BOOK, exchange, market, coin, quantities.size (), age);
+  satellite_binary_add (data, quantities);
+  satellite_binary_add (data, rates);
+  return data;
+}
+
+
+// Decodes the buyers or the sellers from the binary $response.
+// It optionally gives the $age of the order book in milliseconds.
+void satellite_decode_order_book (const string & response, const string & exchange, const string & market, const string & coin,
+                                  vector <float> & quantities,
+                                  vector <float> & rates,
+                                  string & error,
+                                  int * age)
+{
+  int count = satellite_binary_check (response, SATELLITE_BINARY_ORDER_BOOK, exchange, market, coin, error);
+  if (count < 0) return;
+  if (age) * age = satellite_binary_get (response, 18);
+  if (response.size () < (size_t) SATELLITE_BINARY_HEADER + (count * 8)) {
+    error.append ("Binary reply too short");
+    return;
+  }
+  satellite_binary_get (response, SATELLITE_BINARY_HEADER, count, quantities);
+  satellite_binary_get (response, SATELLITE_BINARY_HEADER + (count * 4), count, rates);
+}
+
+
+// A batch request asks for many order books at once.
+// It looks like this: "batch buyers bittrex btc lumen;sellers bittrex btc lumen".
+// The satellite gets the order books simultaneously, and sends them back in one reply.
+// The reply starts with the version and the kind of reply, one byte each.
+// Then it has an entry for each order book:
+// The length of the tuple, the tuple, the length of the order book, and the binary order book.
+// The lengths are 4 bytes each, in network byte order.
+string satellite_encode_batch (const vector <string> & tuples, const vector <string> & replies)
+{
+  string data;
+  data.push_back (SATELLITE_BINARY_VERSION);
+  data.push_back (SATELLITE_BINARY_BATCH);
+  for (size_t i = 0; i < tuples.size (); i++) {
+    satellite_binary_add (data, tuples[i].size ());
+    data.append (tuples[i]);
+    satellite_binary_add (data, replies[i].size ());
+    data.append (replies[i]);
+  }
+  return data;
+}
+
+
+// Decodes the order books in a batch $response.
+// It stores each binary order book under its tuple in the $replies.
+// Returns false if the response is no valid batch.
+bool satellite_decode_batch (const string & response, map <string, string> & replies)
+{
+  if (response.size () < 2) return false;
+  if (response [0] != SATELLITE_BINARY_VERSION) return false;
+  if (response [1] != SATELLITE_BINARY_BATCH) return false;
+  size_t offset = 2;
+  while (offset < response.size ()) {
+    if (offset + 4 > response.size ()) return false;
+    size_t length = satellite_binary_get (response, offset);
+    offset += 4;
+    if (offset + length + 4 > response.size ()) return false;
+    string tuple = response.substr (offset, length);
+    offset += length;
+    length = satellite_binary_get (response, offset);
+    offset += 4;
+    if (offset + length > response.size ()) return false;
+    replies [tuple] = response.substr (offset, length);
+    offset += length;
+  }
+  return true;
+}
+
+
+// The back bots download the rates the front bot recorded in bulk, many seconds in one reply.
+// The reply starts with the version and the kind of reply, one byte each.
+// Then it has the number of exchange/market/coin pairs, 4 bytes,
+// followed by the pairs: the exchange, the market, and the coin, each preceded by one byte with its length.
+// Then it has the number of rates, 4 bytes,
+// followed by the rates: the second, the index of the pair, the bid, and the ask, 4 bytes each.
+// So the names of a pair are sent once, rather than once for every second.
+string satellite_encode_rates (const vector <int> & seconds,
+                               const vector <string> & exchanges,
+                               const vector <string> & markets,
+                               const vector <string> & coins,
+                               const vector <float> & bids,
+                               const vector <float> & asks)
+{
+  // Assign an index to every distinct pair.
+  map <string, uint32_t> indexes;
+  vector <uint32_t> pair_indexes;
+  string pairs;
+  for (size_t i = 0; i < seconds.size (); i++) {
+    string key = exchanges[i] + " " + markets[i] + " " + coins[i];
+    auto iterator = indexes.find (key);
+    if (iterator == indexes.end ()) {
+      uint32_t index = indexes.size ();
+      iterator = indexes.insert (make_pair (key, index)).first;
+      for (auto name : {exchanges[i], markets[i], coins[i]}) {
+        if (name.size () > 255) name.resize (255);
+        pairs.push_back (name.size ());
+        pairs.append (name);
+      }
+    }
+    pair_indexes.push_back (iterator->second);
+  }
+  string data;
+  data.push_back (SATELLITE_BINARY_VERSION);
+  data.push_back (SATELLITE_BINARY_RATES);
+  satellite_binary_add (data, indexes.size ());
+  data.append (pairs);
+  satellite_binary_add (data, seconds.size ());
+  for (size_t i = 0; i < seconds.size (); i++) {
+    satellite_binary_add (data, seconds[i]);
+    satellite_binary_add (data, pair_indexes[i]);
+    satellite_binary_add (data, vector <float> {bids[i], asks[i]});
+  }
+  return data;
+}
+
+
+// Decodes the bulk rates in the $response.
+// Returns false if the response is no valid bulk rates reply.
+bool satellite_decode_rates (const string & response,
+                             vector <int> & seconds,
+                             vector <string> & exchanges,
+                             vector <string> & markets,
+                             vector <string> & coins,
+                             vector <float> & bids,
+                             vector <float> & asks)
+{
+  if (response.size () < 10) return false;
+  if (response [0] != SATELLITE_BINARY_VERSION) return false;
+  if (response [1] != SATELLITE_BINARY_RATES) return false;
+  size_t offset = 2;
+  size_t pair_count = satellite_binary_get (response, offset);
+  offset += 4;
+  vector <vector <string> > pairs;
+  for (size_t p = 0; p < pair_count; p++) {
+    vector <string> names;
+    for (int n = 0; n < 3; n++) {
+      if (offset >= response.size ()) return false;
+      size_t length = (unsigned char) response [offset];
+      offset++;
+      if (offset + length > response.size ()) return false;
+      names.push_back (response.substr (offset, length));
+      offset += length;
+    }
+    pairs.push_back (names);
+  }
+  if (offset + 4 > response.size ()) return false;
+  size_t count = satellite_binary_get (response, offset);
+  offset += 4;
+  if (offset + (count * 16) != response.size ()) return false;
+  for (size_t i = 0; i < count; i++) {
+    size_t index = satellite_binary_get (response, offset + 4);
+    if (index >= pairs.size ()) return false;
+    seconds.push_back (satellite_binary_get (response, offset));
+    exchanges.push_back (pairs[index][0]);
+    markets.push_back (pairs[index][1]);
+    coins.push_back (pairs[index][2]);
+    satellite_binary_get (response, offset + 8, 1, bids);
+    satellite_binary_get (response, offset + 12, 1, asks);
+    offset += 16;
+  }
+  return true;
+}
+
+
 void plot (const vector <pair <float, float> > & data1,
            const vector <pair <float, float> > & data2,
            const string & title1, const string & title2,
@@ -1735,3 +3110,398 @@ string tmp_handelaar_path ()
 {
   return "/tmp/handelaar.log";
 }
+
+
+// The rates used to be prepared for the patterns and the learners in unordered maps,
+// keyed by the minute or the hour relative to now.
+// Going over 61 days minute by minute, every access hashed its key,
+// and every access of a missing minute inserted a zero rate into the map.
+// This object stores the asks and the bids in contiguous arrays instead.
+// The time is relative to now: 0 is now, -1 is one unit ago, and so on.
+// The first element of the arrays is for time $base.
+// A time without a rate, or outside of the arrays, has a zero ask and bid.
+TimeSeries::TimeSeries ()
+{
+  base = 0;
+  count = 0;
+}
+
+
+void TimeSeries::clear ()
+{
+  base = 0;
+  asks.clear ();
+  bids.clear ();
+  validity.clear ();
+  count = 0;
+}
+
+
+// Makes room for the times from $oldest to $newest, so setting them does not move the arrays.
+void TimeSeries::range (int oldest, int newest)
+{
+  if (newest < oldest) return;
+  if (asks.empty ()) {
+    base = oldest;
+  } else {
+    if (oldest > base) oldest = base;
+    int current_newest = base + (int) asks.size () - 1;
+    if (newest < current_newest) newest = current_newest;
+  }
+  if (oldest < base) {
+    size_t extra = base - oldest;
+    asks.insert (asks.begin (), extra, 0);
+    bids.insert (bids.begin (), extra, 0);
+    validity.insert (validity.begin (), extra, 0);
+    base = oldest;
+  }
+  size_t size = newest - base + 1;
+  if (size > asks.size ()) {
+    asks.resize (size, 0);
+    bids.resize (size, 0);
+    validity.resize (size, 0);
+  }
+}
+
+
+void TimeSeries::set (int time, float ask, float bid)
+{
+  if (asks.empty () || (time < base) || (time >= base + (int) asks.size ())) {
+    range (time, time);
+  }
+  size_t index = time - base;
+  asks [index] = ask;
+  bids [index] = bid;
+  if (!validity [index]) count++;
+  validity [index] = 1;
+}
+
+
+float TimeSeries::ask (int time) const
+{
+  size_t index = time - base;
+  if ((time < base) || (index >= asks.size ())) return 0;
+  return asks [index];
+}
+
+
+float TimeSeries::bid (int time) const
+{
+  size_t index = time - base;
+  if ((time < base) || (index >= bids.size ())) return 0;
+  return bids [index];
+}
+
+
+bool TimeSeries::valid (int time) const
+{
+  size_t index = time - base;
+  if ((time < base) || (index >= validity.size ())) return false;
+  return validity [index];
+}
+
+
+// Gives the oldest $time that has a rate.
+// It used to return 0 if there were no rates, the same as for a rate right at time 0.
+// It now returns false if there are no rates.
+bool TimeSeries::oldest (int & time) const
+{
+  for (size_t index = 0; index < validity.size (); index++) {
+    if (validity [index]) {
+      time = base + index;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+// The number of times that have a rate.
+size_t TimeSeries::size () const
+{
+  return count;
+}
+
+
+bool TimeSeries::empty () const
+{
+  return count == 0;
+}
+
+
+// The programs used to start a new thread per coin or per path.
+// They then polled a counter of running threads every ten milliseconds,
+// both to wait for a free slot and to wait for the end,
+// and the thread objects were never deleted.
+// The pool below starts its workers once and keeps them for the life of the program.
+// Every worker has its own queue of tasks.
+// It takes its newest task first, and when its queue is empty,
+// it takes the oldest task from the queue of another worker.
+
+
+#define THREAD_POOL_MAXIMUM_WORKERS 256
+
+
+struct thread_pool_task
+{
+  function <void ()> work;
+  task_group * group = nullptr;
+};
+
+
+struct thread_pool_queue
+{
+  mutex queue_mutex;
+  deque <thread_pool_task> tasks;
+};
+
+
+thread_pool_queue thread_pool_queues [THREAD_POOL_MAXIMUM_WORKERS];
+vector <thread *> thread_pool_threads;
+atomic <int> thread_pool_worker_count (0);
+mutex thread_pool_mutex;
+condition_variable thread_pool_condition;
+atomic <long> thread_pool_queued (0);
+bool thread_pool_stopping = false;
+atomic <unsigned int> thread_pool_next_queue (0);
+atomic <int> thread_pool_started (0);
+atomic <long> thread_pool_executed (0);
+atomic <long> thread_pool_stolen (0);
+// The index of the worker that runs on this thread, or -1 if it's not a worker.
+thread_local int thread_pool_worker_index = -1;
+
+
+// Takes a task for the worker at $index.
+// A thread that is not a worker only takes tasks from the workers.
+bool thread_pool_take (int index, thread_pool_task & task)
+{
+  if (index >= 0) {
+    thread_pool_queue & own = thread_pool_queues [index];
+    lock_guard <mutex> lock (own.queue_mutex);
+    if (!own.tasks.empty ()) {
+      task = move (own.tasks.back ());
+      own.tasks.pop_back ();
+      thread_pool_queued--;
+      return true;
+    }
+  }
+  int workers = thread_pool_worker_count;
+  for (int i = 1; i <= workers; i++) {
+    int victim = (index + i + workers) % workers;
+    if (victim == index) continue;
+    thread_pool_queue & other = thread_pool_queues [victim];
+    lock_guard <mutex> lock (other.queue_mutex);
+    if (!other.tasks.empty ()) {
+      task = move (other.tasks.front ());
+      other.tasks.pop_front ();
+      thread_pool_queued--;
+      thread_pool_stolen++;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+void thread_pool_execute (function <void ()> & work, task_group * group)
+{
+  exception_ptr failure;
+  try {
+    work ();
+  } catch (...) {
+    failure = current_exception ();
+  }
+  // Release whatever the task holds before the group learns that it's done.
+  work = nullptr;
+  thread_pool_executed++;
+  group->finished (failure);
+}
+
+
+void thread_pool_worker (int index)
+{
+  thread_pool_worker_index = index;
+  while (true) {
+    thread_pool_task task;
+    if (thread_pool_take (index, task)) {
+      thread_pool_execute (task.work, task.group);
+      continue;
+    }
+    unique_lock <mutex> lock (thread_pool_mutex);
+    thread_pool_condition.wait (lock, [] {
+      return (thread_pool_queued > 0) || thread_pool_stopping;
+    });
+    if (thread_pool_stopping && (thread_pool_queued == 0)) break;
+  }
+}
+
+
+// Starts the workers, as many as there are processors, and at least $minimum.
+// Returns the number of workers.
+int thread_pool_start (int minimum)
+{
+  int wanted = thread::hardware_concurrency ();
+  if (wanted < 2) wanted = 2;
+  if (minimum > wanted) wanted = minimum;
+  if (wanted > THREAD_POOL_MAXIMUM_WORKERS) wanted = THREAD_POOL_MAXIMUM_WORKERS;
+  int workers = thread_pool_worker_count;
+  if (workers >= wanted) return workers;
+  lock_guard <mutex> lock (thread_pool_mutex);
+  workers = thread_pool_worker_count;
+  for (int index = workers; index < wanted; index++) {
+    thread_pool_threads.push_back (new thread (thread_pool_worker, index));
+    thread_pool_started++;
+  }
+  if (wanted > workers) thread_pool_worker_count = wanted;
+  return thread_pool_worker_count;
+}
+
+
+void thread_pool_submit (thread_pool_task task)
+{
+  int workers = thread_pool_start (0);
+  // A worker queues its own tasks, other threads spread their tasks over the workers.
+  int index = thread_pool_worker_index;
+  if (index < 0) index = thread_pool_next_queue++ % workers;
+  {
+    thread_pool_queue & queue = thread_pool_queues [index];
+    lock_guard <mutex> lock (queue.queue_mutex);
+    queue.tasks.push_back (move (task));
+  }
+  {
+    lock_guard <mutex> lock (thread_pool_mutex);
+    thread_pool_queued++;
+  }
+  thread_pool_condition.notify_one ();
+}
+
+
+int thread_pool_workers ()
+{
+  return thread_pool_worker_count;
+}
+
+
+vector <string> thread_pool_statistics ()
+{
+  vector <string> lines;
+  if (thread_pool_started) {
+    lines.push_back (to_string (thread_pool_started) + " workers ran " + to_string (thread_pool_executed) + " tasks of which " + to_string (thread_pool_stolen) + " were taken from another worker");
+  }
+  return lines;
+}
+
+
+// Stops the workers once they have run all queued tasks.
+void thread_pool_finish ()
+{
+  {
+    lock_guard <mutex> lock (thread_pool_mutex);
+    thread_pool_stopping = true;
+  }
+  thread_pool_condition.notify_all ();
+  for (auto job : thread_pool_threads) {
+    job->join ();
+    delete job;
+  }
+  lock_guard <mutex> lock (thread_pool_mutex);
+  thread_pool_threads.clear ();
+  thread_pool_worker_count = 0;
+  thread_pool_stopping = false;
+}
+
+
+// A group of tasks to run on the pool.
+// If $maximum_simultaneous_tasks is given, the group runs no more tasks at the same time,
+// and the pool gets at least as many workers.
+// Else the group runs as many tasks at the same time as the pool has workers.
+task_group::task_group (int maximum_simultaneous_tasks)
+{
+  maximum = maximum_simultaneous_tasks;
+  running = 0;
+  pending = 0;
+  if (maximum > 0) thread_pool_start (maximum);
+}
+
+
+task_group::~task_group ()
+{
+  wait ();
+}
+
+
+// Runs the $task on the pool, or later if the group already runs its maximum number of tasks.
+void task_group::run (function <void ()> task)
+{
+  lock_guard <mutex> lock (group_mutex);
+  pending++;
+  if ((maximum > 0) && (running >= maximum)) {
+    waiting.push_back (move (task));
+    return;
+  }
+  running++;
+  thread_pool_task pooled;
+  pooled.work = move (task);
+  pooled.group = this;
+  thread_pool_submit (move (pooled));
+}
+
+
+// Waits till all tasks of the group have completed.
+// If a task threw an exception, it throws the first one.
+void task_group::wait_all ()
+{
+  wait ();
+  lock_guard <mutex> lock (group_mutex);
+  if (first_failure) {
+    exception_ptr failure = first_failure;
+    first_failure = nullptr;
+    rethrow_exception (failure);
+  }
+}
+
+
+void task_group::wait ()
+{
+  int index = thread_pool_worker_index;
+  if (index < 0) {
+    unique_lock <mutex> lock (group_mutex);
+    group_condition.wait (lock, [&] { return pending == 0; });
+    return;
+  }
+  // A worker that waits for a group runs tasks in the meantime,
+  // else the pool could run out of workers that are not waiting.
+  while (true) {
+    {
+      lock_guard <mutex> lock (group_mutex);
+      if (pending == 0) return;
+    }
+    thread_pool_task task;
+    if (thread_pool_take (index, task)) {
+      thread_pool_execute (task.work, task.group);
+    } else {
+      unique_lock <mutex> lock (group_mutex);
+      group_condition.wait_for (lock, chrono::milliseconds (1), [&] { return pending == 0; });
+    }
+  }
+}
+
+
+void task_group::finished (exception_ptr failure)
+{
+  // The condition is notified while locked,
+  // as the group may be destroyed right after the waiting thread sees it has no pending tasks.
+  lock_guard <mutex> lock (group_mutex);
+  if (failure && !first_failure) first_failure = failure;
+  running--;
+  pending--;
+  if (!waiting.empty ()) {
+    running++;
+    thread_pool_task pooled;
+    pooled.work = move (waiting.front ());
+    pooled.group = this;
+    waiting.pop_front ();
+    thread_pool_submit (move (pooled));
+  }
+  if (pending == 0) group_condition.notify_all ();
+}
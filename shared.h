@@ -46,6 +46,7 @@ int get_seconds_since_epoch (int year, int month, int day);
 long milliseconds_since_epoch ();
 
 
+string http_get_host (string url);
 string http_call (const string & url,
                   string& error,
                   const string & proxy,
@@ -54,6 +55,8 @@ string http_call (const string & url,
                   const vector <pair <string, string> > & headers,
                   bool hurry, bool persist,
                   const string & interface);
+vector <string> http_pool_statistics ();
+void http_pool_flush ();
 
 
 string base64_encode (const string &binary);
@@ -162,7 +165,84 @@ void api_call_sequencer (atomic <long> & sequencer);
 string string_fill (string s, int width, char filler);
 bool program_running (char *argv[]);
 int satellite_port ();
+int satellite_persistent_port ();
 string satellite_request (const string & host, string request, bool hurry, string& error);
+class satellite_hedge_outcome
+{
+public:
+  string host;
+  // Whether the satellite responded, and whether that went without a transport error.
+  bool completed = false;
+  bool succeeded = false;
+  // The time since the request went out to this satellite.
+  long milliseconds = 0;
+};
+class satellite_call
+{
+public:
+  string host;
+  string request;
+  bool hurry = false;
+  // Only send the request over a persistent connection, as an older satellite would not understand it.
+  bool persistent = false;
+  // Hedging: Without a good response after this many milliseconds,
+  // the request also goes out to the satellite that $hedge_get gives.
+  long hedge_delay = 0;
+  function <string ()> hedge_get;
+  string response;
+  string error;
+  // How long the call took.
+  long milliseconds = 0;
+  // The satellite that gave the response, and how it went at each satellite, if the call was hedged.
+  string winner;
+  satellite_hedge_outcome primary_outcome;
+  satellite_hedge_outcome hedge_outcome;
+};
+void satellite_request_multi (vector <satellite_call> & calls);
+string satellite_request_hedged (const string & primary, function <string ()> secondary_get,
+                                 const string & request, bool hurry, long delay,
+                                 string & error, string & winner,
+                                 satellite_hedge_outcome & primary_outcome,
+                                 satellite_hedge_outcome & secondary_outcome);
+string satellite_binary_request (const string & request);
+string satellite_text_request (const string & request);
+bool satellite_binary_reply (const string & response);
+bool satellite_binary_mismatch (const string & response);
+string satellite_encode_summaries (const string & exchange, const string & market,
+                                   const vector <string> & coins,
+                                   const vector <float> & bids,
+                                   const vector <float> & asks,
+                                   const string & error);
+void satellite_decode_summaries (const string & response, const string & exchange, const string & market,
+                                 vector <string> & coins,
+                                 vector <float> & bids,
+                                 vector <float> & asks,
+                                 string & error);
+string satellite_encode_order_book (const string & exchange, const string & market, const string & coin,
+                                    const vector <float> & quantities,
+                                    const vector <float> & rates,
+                                    const string & error,
+                                    int age = 0);
+void satellite_decode_order_book (const string & response, const string & exchange, const string & market, const string & coin,
+                                  vector <float> & quantities,
+                                  vector <float> & rates,
+                                  string & error,
+                                  int * age = nullptr);
+string satellite_encode_batch (const vector <string> & tuples, const vector <string> & replies);
+bool satellite_decode_batch (const string & response, map <string, string> & replies);
+string satellite_encode_rates (const vector <int> & seconds,
+                               const vector <string> & exchanges,
+                               const vector <string> & markets,
+                               const vector <string> & coins,
+                               const vector <float> & bids,
+                               const vector <float> & asks);
+bool satellite_decode_rates (const string & response,
+                             vector <int> & seconds,
+                             vector <string> & exchanges,
+                             vector <string> & markets,
+                             vector <string> & coins,
+                             vector <float> & bids,
+                             vector <float> & asks);
 void plot (const vector <pair <float, float> > & data1,
            const vector <pair <float, float> > & data2,
            const string & title1, const string & title2,
@@ -176,6 +256,48 @@ string hostname ();
 float get_percentage_change (float oldvalue, float newvalue);
 bool running_within_minute ();
 string tmp_handelaar_path ();
+class TimeSeries
+{
+public:
+  TimeSeries ();
+  void clear ();
+  void range (int oldest, int newest);
+  void set (int time, float ask, float bid);
+  float ask (int time) const;
+  float bid (int time) const;
+  bool valid (int time) const;
+  bool oldest (int & time) const;
+  size_t size () const;
+  bool empty () const;
+private:
+  int base;
+  vector <float> asks;
+  vector <float> bids;
+  vector <unsigned char> validity;
+  size_t count;
+};
+class task_group
+{
+public:
+  task_group (int maximum_simultaneous_tasks = 0);
+  ~task_group ();
+  void run (function <void ()> task);
+  void wait_all ();
+private:
+  friend void thread_pool_execute (function <void ()> & work, task_group * group);
+  void wait ();
+  void finished (exception_ptr failure);
+  mutex group_mutex;
+  condition_variable group_condition;
+  deque <function <void ()> > waiting;
+  int maximum;
+  int running;
+  int pending;
+  exception_ptr first_failure;
+};
+int thread_pool_workers ();
+vector <string> thread_pool_statistics ();
+void thread_pool_finish ();
 
 
 #endif
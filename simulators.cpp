@@ -82,84 +82,357 @@ string curve_title (curve_type curve)
 }
 
 
-float curve_get_fitting_accuracy (vector <float> & observed_xs, vector <float> & observed_ys,
-                                  curve_type curve,
-                                  float x_multiplier, float x_addend, float y_multiplier, float y_addend,
-                                  float & maximum_residual_percentage,
-                                  float & average_residual_percentage)
+// Fitting a curve evaluates the same curve type many thousands of times over the same observations.
+// Resolving the type of curve per observed point made this switch the hottest spot of the learner.
+// So each type of curve now gets its own kernel, resolved at compile time,
+// and the kernel processes the observations in SIMD lanes where the processor supports that.
+template <curve_type curve> inline float curve_shape (float)
 {
-  float sum_absolute_residuals = 0;
-  maximum_residual_percentage = 0;
-  average_residual_percentage = 0;
-  
-  curve_description parameters;
-  parameters.curve = curve;
-  parameters.x_multiplier = x_multiplier;
-  parameters.x_addend = x_addend;
-  parameters.y_multiplier = y_multiplier;
-  parameters.y_addend = y_addend;
-  
-  // At the end of the rates, that is, around the current rates, now,
-  // the curve should fit better than at the beginning of the rates.
-  // Because if the time progresses to be nearer the current time,
-  // the accuracy is important for determining the forecast of the coin rate.
-  // The weight given to a residual.
-  // A higher weight leads to a better fit.
-  float starting_weight = 0.5;
-  float weight_multiplier = 4.5 / observed_xs.size ();
-  
-  for (unsigned int i = 0; i < observed_xs.size(); i++) {
-    float observed_x = observed_xs [i];
+  return 0;
+}
+template <> inline float curve_shape <curve_type::linear> (float x) { return x; }
+template <> inline float curve_shape <curve_type::linear_negative> (float x) { return 0 - x; }
+template <> inline float curve_shape <curve_type::squared> (float x) { return x * x; }
+template <> inline float curve_shape <curve_type::squared_negative> (float x) { return 0 - (x * x); }
+template <> inline float curve_shape <curve_type::cubed> (float x) { return x * x * x; }
+template <> inline float curve_shape <curve_type::cubed_negative> (float x) { return 0 - (x * x * x); }
+template <> inline float curve_shape <curve_type::binary_logarithm> (float x) { return log2 (x); }
+template <> inline float curve_shape <curve_type::binary_logarithm_negative> (float x) { return 0 - log2 (x); }
+template <> inline float curve_shape <curve_type::binary_logarithm_multiplied> (float x) { return log2 (x) * x; }
+template <> inline float curve_shape <curve_type::binary_logarithm_multiplied_negative> (float x) { return 0 - (log2 (x) * x); }
+
+
+// The derivatives of the curve shapes, for the solvers that follow the gradient.
+template <curve_type curve> inline float curve_slope (float)
+{
+  return 0;
+}
+template <> inline float curve_slope <curve_type::linear> (float) { return 1; }
+template <> inline float curve_slope <curve_type::linear_negative> (float) { return -1; }
+template <> inline float curve_slope <curve_type::squared> (float x) { return 2 * x; }
+template <> inline float curve_slope <curve_type::squared_negative> (float x) { return -2 * x; }
+template <> inline float curve_slope <curve_type::cubed> (float x) { return 3 * x * x; }
+template <> inline float curve_slope <curve_type::cubed_negative> (float x) { return -3 * x * x; }
+template <> inline float curve_slope <curve_type::binary_logarithm> (float x) { return 1 / (x * M_LN2); }
+template <> inline float curve_slope <curve_type::binary_logarithm_negative> (float x) { return -1 / (x * M_LN2); }
+template <> inline float curve_slope <curve_type::binary_logarithm_multiplied> (float x) { return log2 (x) + (1 / M_LN2); }
+template <> inline float curve_slope <curve_type::binary_logarithm_multiplied_negative> (float x) { return 0 - (log2 (x) + (1 / M_LN2)); }
+
+
+// At the end of the rates, that is, around the current rates, now,
+// the curve should fit better than at the beginning of the rates.
+// Because if the time progresses to be nearer the current time,
+// the accuracy is important for determining the forecast of the coin rate.
+// The weight given to a residual.
+// A higher weight leads to a better fit.
+static const float curve_fitting_starting_weight = 0.5;
+
+
+// The scalar part of the kernel: It handles the observations from "begin" up to "end".
+// It serves as the fallback on processors without SIMD,
+// and it does the remaining observations that do not fill a whole SIMD register.
+template <curve_type curve>
+inline void curve_fitting_scalar_range (const float * observed_xs, const float * observed_ys,
+                                        unsigned int begin, unsigned int end, float weight_multiplier,
+                                        float x_multiplier, float x_addend, float y_multiplier, float y_addend,
+                                        float & sum_absolute_residuals,
+                                        float & maximum_residual_percentage,
+                                        float & total_residual_percentage)
+{
+  for (unsigned int i = begin; i < end; i++) {
     float observed_y = observed_ys [i];
-    float curve_y = curve_calculate (parameters, observed_x);
+    float curve_y = curve_shape <curve> ((observed_xs [i] * x_multiplier) + x_addend);
+    curve_y *= y_multiplier;
+    curve_y += y_addend;
     // Conventional wisdom says that the summed square residuals is a good indicator for curve fitting.
     // But on crypto coins, this does not work so well.
     // So here it does not take the square, but just the absolute value.
     float residual = abs (curve_y - observed_y);
     // Apply the weight at this position of the curve.
-    float weight = starting_weight + (i * weight_multiplier);
+    float weight = curve_fitting_starting_weight + (i * weight_multiplier);
     residual *= weight;
-    //to_tty ({to_string (i), "x", float2string (observed_x), "yin", float2string (observed_y), "yout", float2string (curve_y), "residual", float2string (squared_residual)});
     sum_absolute_residuals += residual;
     // The absolute percentage change.
     float absolute_change_percentage = abs (get_percentage_change (observed_y, curve_y));
     if (absolute_change_percentage > maximum_residual_percentage) {
       maximum_residual_percentage = absolute_change_percentage;
     }
-    average_residual_percentage += absolute_change_percentage;
+    total_residual_percentage += absolute_change_percentage;
   }
-  
-  average_residual_percentage /= observed_ys.size();
-  
+}
+
+
+template <curve_type curve>
+float curve_fitting_scalar (const float * observed_xs, const float * observed_ys, unsigned int count,
+                            float x_multiplier, float x_addend, float y_multiplier, float y_addend,
+                            float & maximum_residual_percentage,
+                            float & average_residual_percentage)
+{
+  float sum_absolute_residuals = 0;
+  maximum_residual_percentage = 0;
+  float total_residual_percentage = 0;
+  float weight_multiplier = 4.5 / count;
+  curve_fitting_scalar_range <curve> (observed_xs, observed_ys, 0, count, weight_multiplier,
+                                      x_multiplier, x_addend, y_multiplier, y_addend,
+                                      sum_absolute_residuals, maximum_residual_percentage, total_residual_percentage);
+  average_residual_percentage = total_residual_percentage / count;
   return sum_absolute_residuals;
 }
 
 
-float fitted_curve_get_optimized_residuals (vector <float> xs,
-                                            vector <float> ys,
-                                            curve_description & parameters)
+#ifdef CURVE_FITTING_SSE
+
+
+// The curve shapes on four lanes at once.
+// There is no SIMD logarithm, so the logarithmic shapes take that lane by lane.
+template <curve_type curve> inline __m128 curve_shape_sse (__m128 x)
+{
+  float lanes [4];
+  _mm_storeu_ps (lanes, x);
+  for (unsigned int i = 0; i < 4; i++) lanes [i] = curve_shape <curve> (lanes [i]);
+  return _mm_loadu_ps (lanes);
+}
+template <> inline __m128 curve_shape_sse <curve_type::linear> (__m128 x) { return x; }
+template <> inline __m128 curve_shape_sse <curve_type::linear_negative> (__m128 x) { return _mm_sub_ps (_mm_setzero_ps (), x); }
+template <> inline __m128 curve_shape_sse <curve_type::squared> (__m128 x) { return _mm_mul_ps (x, x); }
+template <> inline __m128 curve_shape_sse <curve_type::squared_negative> (__m128 x) { return _mm_sub_ps (_mm_setzero_ps (), _mm_mul_ps (x, x)); }
+template <> inline __m128 curve_shape_sse <curve_type::cubed> (__m128 x) { return _mm_mul_ps (_mm_mul_ps (x, x), x); }
+template <> inline __m128 curve_shape_sse <curve_type::cubed_negative> (__m128 x) { return _mm_sub_ps (_mm_setzero_ps (), _mm_mul_ps (_mm_mul_ps (x, x), x)); }
+
+
+template <curve_type curve>
+float curve_fitting_sse (const float * observed_xs, const float * observed_ys, unsigned int count,
+                         float x_multiplier, float x_addend, float y_multiplier, float y_addend,
+                         float & maximum_residual_percentage,
+                         float & average_residual_percentage)
+{
+  float weight_multiplier = 4.5 / count;
+  const __m128 sign_mask = _mm_set1_ps (-0.0f);
+  const __m128 hundred = _mm_set1_ps (100);
+  const __m128 four = _mm_set1_ps (4);
+  const __m128 x_multipliers = _mm_set1_ps (x_multiplier);
+  const __m128 x_addends = _mm_set1_ps (x_addend);
+  const __m128 y_multipliers = _mm_set1_ps (y_multiplier);
+  const __m128 y_addends = _mm_set1_ps (y_addend);
+  const __m128 starting_weights = _mm_set1_ps (curve_fitting_starting_weight);
+  const __m128 weight_multipliers = _mm_set1_ps (weight_multiplier);
+  __m128 indices = _mm_setr_ps (0, 1, 2, 3);
+  __m128 residual_sums = _mm_setzero_ps ();
+  __m128 maximum_percentages = _mm_setzero_ps ();
+  __m128 total_percentages = _mm_setzero_ps ();
+  unsigned int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128 curve_ys = curve_shape_sse <curve> (_mm_add_ps (_mm_mul_ps (_mm_loadu_ps (observed_xs + i), x_multipliers), x_addends));
+    curve_ys = _mm_add_ps (_mm_mul_ps (curve_ys, y_multipliers), y_addends);
+    __m128 observed = _mm_loadu_ps (observed_ys + i);
+    __m128 differences = _mm_sub_ps (curve_ys, observed);
+    __m128 weights = _mm_add_ps (starting_weights, _mm_mul_ps (indices, weight_multipliers));
+    residual_sums = _mm_add_ps (residual_sums, _mm_mul_ps (_mm_andnot_ps (sign_mask, differences), weights));
+    __m128 percentages = _mm_mul_ps (_mm_div_ps (differences, _mm_andnot_ps (sign_mask, observed)), hundred);
+    percentages = _mm_andnot_ps (sign_mask, percentages);
+    // The maximum takes the second operand if the first is not a number, the same as the scalar comparison.
+    maximum_percentages = _mm_max_ps (percentages, maximum_percentages);
+    total_percentages = _mm_add_ps (total_percentages, percentages);
+    indices = _mm_add_ps (indices, four);
+  }
+  float sums [4], maxima [4], totals [4];
+  _mm_storeu_ps (sums, residual_sums);
+  _mm_storeu_ps (maxima, maximum_percentages);
+  _mm_storeu_ps (totals, total_percentages);
+  float sum_absolute_residuals = 0;
+  maximum_residual_percentage = 0;
+  float total_residual_percentage = 0;
+  for (unsigned int lane = 0; lane < 4; lane++) {
+    sum_absolute_residuals += sums [lane];
+    if (maxima [lane] > maximum_residual_percentage) maximum_residual_percentage = maxima [lane];
+    total_residual_percentage += totals [lane];
+  }
+  curve_fitting_scalar_range <curve> (observed_xs, observed_ys, i, count, weight_multiplier,
+                                      x_multiplier, x_addend, y_multiplier, y_addend,
+                                      sum_absolute_residuals, maximum_residual_percentage, total_residual_percentage);
+  average_residual_percentage = total_residual_percentage / count;
+  return sum_absolute_residuals;
+}
+
+
+#endif
+
+
+#ifdef CURVE_FITTING_AVX2
+
+
+// The same kernel on eight lanes, for processors that have AVX2.
+// The build does not assume AVX2, so these functions are compiled for that target only,
+// and they are selected at runtime.
+#define CURVE_FITTING_AVX2_TARGET __attribute__ ((target ("avx2")))
+
+
+template <curve_type curve> CURVE_FITTING_AVX2_TARGET inline __m256 curve_shape_avx2 (__m256 x)
+{
+  float lanes [8];
+  _mm256_storeu_ps (lanes, x);
+  for (unsigned int i = 0; i < 8; i++) lanes [i] = curve_shape <curve> (lanes [i]);
+  return _mm256_loadu_ps (lanes);
+}
+template <> CURVE_FITTING_AVX2_TARGET inline __m256 curve_shape_avx2 <curve_type::linear> (__m256 x) { return x; }
+template <> CURVE_FITTING_AVX2_TARGET inline __m256 curve_shape_avx2 <curve_type::linear_negative> (__m256 x) { return _mm256_sub_ps (_mm256_setzero_ps (), x); }
+template <> CURVE_FITTING_AVX2_TARGET inline __m256 curve_shape_avx2 <curve_type::squared> (__m256 x) { return _mm256_mul_ps (x, x); }
+template <> CURVE_FITTING_AVX2_TARGET inline __m256 curve_shape_avx2 <curve_type::squared_negative> (__m256 x) { return _mm256_sub_ps (_mm256_setzero_ps (), _mm256_mul_ps (x, x)); }
+template <> CURVE_FITTING_AVX2_TARGET inline __m256 curve_shape_avx2 <curve_type::cubed> (__m256 x) { return _mm256_mul_ps (_mm256_mul_ps (x, x), x); }
+template <> CURVE_FITTING_AVX2_TARGET inline __m256 curve_shape_avx2 <curve_type::cubed_negative> (__m256 x) { return _mm256_sub_ps (_mm256_setzero_ps (), _mm256_mul_ps (_mm256_mul_ps (x, x), x)); }
+
+
+template <curve_type curve>
+CURVE_FITTING_AVX2_TARGET
+float curve_fitting_avx2 (const float * observed_xs, const float * observed_ys, unsigned int count,
+                          float x_multiplier, float x_addend, float y_multiplier, float y_addend,
+                          float & maximum_residual_percentage,
+                          float & average_residual_percentage)
+{
+  float weight_multiplier = 4.5 / count;
+  const __m256 sign_mask = _mm256_set1_ps (-0.0f);
+  const __m256 hundred = _mm256_set1_ps (100);
+  const __m256 eight = _mm256_set1_ps (8);
+  const __m256 x_multipliers = _mm256_set1_ps (x_multiplier);
+  const __m256 x_addends = _mm256_set1_ps (x_addend);
+  const __m256 y_multipliers = _mm256_set1_ps (y_multiplier);
+  const __m256 y_addends = _mm256_set1_ps (y_addend);
+  const __m256 starting_weights = _mm256_set1_ps (curve_fitting_starting_weight);
+  const __m256 weight_multipliers = _mm256_set1_ps (weight_multiplier);
+  __m256 indices = _mm256_setr_ps (0, 1, 2, 3, 4, 5, 6, 7);
+  __m256 residual_sums = _mm256_setzero_ps ();
+  __m256 maximum_percentages = _mm256_setzero_ps ();
+  __m256 total_percentages = _mm256_setzero_ps ();
+  unsigned int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 curve_ys = curve_shape_avx2 <curve> (_mm256_add_ps (_mm256_mul_ps (_mm256_loadu_ps (observed_xs + i), x_multipliers), x_addends));
+    curve_ys = _mm256_add_ps (_mm256_mul_ps (curve_ys, y_multipliers), y_addends);
+    __m256 observed = _mm256_loadu_ps (observed_ys + i);
+    __m256 differences = _mm256_sub_ps (curve_ys, observed);
+    __m256 weights = _mm256_add_ps (starting_weights, _mm256_mul_ps (indices, weight_multipliers));
+    residual_sums = _mm256_add_ps (residual_sums, _mm256_mul_ps (_mm256_andnot_ps (sign_mask, differences), weights));
+    __m256 percentages = _mm256_mul_ps (_mm256_div_ps (differences, _mm256_andnot_ps (sign_mask, observed)), hundred);
+    percentages = _mm256_andnot_ps (sign_mask, percentages);
+    maximum_percentages = _mm256_max_ps (percentages, maximum_percentages);
+    total_percentages = _mm256_add_ps (total_percentages, percentages);
+    indices = _mm256_add_ps (indices, eight);
+  }
+  float sums [8], maxima [8], totals [8];
+  _mm256_storeu_ps (sums, residual_sums);
+  _mm256_storeu_ps (maxima, maximum_percentages);
+  _mm256_storeu_ps (totals, total_percentages);
+  float sum_absolute_residuals = 0;
+  maximum_residual_percentage = 0;
+  float total_residual_percentage = 0;
+  for (unsigned int lane = 0; lane < 8; lane++) {
+    sum_absolute_residuals += sums [lane];
+    if (maxima [lane] > maximum_residual_percentage) maximum_residual_percentage = maxima [lane];
+    total_residual_percentage += totals [lane];
+  }
+  curve_fitting_scalar_range <curve> (observed_xs, observed_ys, i, count, weight_multiplier,
+                                      x_multiplier, x_addend, y_multiplier, y_addend,
+                                      sum_absolute_residuals, maximum_residual_percentage, total_residual_percentage);
+  average_residual_percentage = total_residual_percentage / count;
+  return sum_absolute_residuals;
+}
+
+
+#endif
+
+
+template <curve_type curve>
+curve_fitting_kernel curve_fitting_kernel_select ()
+{
+#ifdef CURVE_FITTING_AVX2
+  static bool avx2 = __builtin_cpu_supports ("avx2");
+  if (avx2) return curve_fitting_avx2 <curve>;
+#endif
+#ifdef CURVE_FITTING_SSE
+  return curve_fitting_sse <curve>;
+#else
+  return curve_fitting_scalar <curve>;
+#endif
+}
+
+
+// Gives the kernel that fits the given type of curve.
+// The callers select it once and then run it over the observations many times.
+curve_fitting_kernel curve_fitting_kernel_get (curve_type curve)
+{
+  switch (curve)
+  {
+    case curve_type::begin: break;
+    case curve_type::linear: return curve_fitting_kernel_select <curve_type::linear> ();
+    case curve_type::linear_negative: return curve_fitting_kernel_select <curve_type::linear_negative> ();
+    case curve_type::squared: return curve_fitting_kernel_select <curve_type::squared> ();
+    case curve_type::squared_negative: return curve_fitting_kernel_select <curve_type::squared_negative> ();
+    case curve_type::cubed: return curve_fitting_kernel_select <curve_type::cubed> ();
+    case curve_type::cubed_negative: return curve_fitting_kernel_select <curve_type::cubed_negative> ();
+    case curve_type::binary_logarithm: return curve_fitting_kernel_select <curve_type::binary_logarithm> ();
+    case curve_type::binary_logarithm_negative: return curve_fitting_kernel_select <curve_type::binary_logarithm_negative> ();
+    case curve_type::binary_logarithm_multiplied: return curve_fitting_kernel_select <curve_type::binary_logarithm_multiplied> ();
+    case curve_type::binary_logarithm_multiplied_negative: return curve_fitting_kernel_select <curve_type::binary_logarithm_multiplied_negative> ();
+    case curve_type::end: break;
+  }
+  return curve_fitting_kernel_select <curve_type::end> ();
+}
+
+
+// The plain scalar kernel, for checking the SIMD kernels against.
+curve_fitting_kernel curve_fitting_kernel_scalar (curve_type curve)
+{
+  switch (curve)
+  {
+    case curve_type::begin: break;
+    case curve_type::linear: return curve_fitting_scalar <curve_type::linear>;
+    case curve_type::linear_negative: return curve_fitting_scalar <curve_type::linear_negative>;
+    case curve_type::squared: return curve_fitting_scalar <curve_type::squared>;
+    case curve_type::squared_negative: return curve_fitting_scalar <curve_type::squared_negative>;
+    case curve_type::cubed: return curve_fitting_scalar <curve_type::cubed>;
+    case curve_type::cubed_negative: return curve_fitting_scalar <curve_type::cubed_negative>;
+    case curve_type::binary_logarithm: return curve_fitting_scalar <curve_type::binary_logarithm>;
+    case curve_type::binary_logarithm_negative: return curve_fitting_scalar <curve_type::binary_logarithm_negative>;
+    case curve_type::binary_logarithm_multiplied: return curve_fitting_scalar <curve_type::binary_logarithm_multiplied>;
+    case curve_type::binary_logarithm_multiplied_negative: return curve_fitting_scalar <curve_type::binary_logarithm_multiplied_negative>;
+    case curve_type::end: break;
+  }
+  return curve_fitting_scalar <curve_type::end>;
+}
+
+
+float curve_get_fitting_accuracy (vector <float> & observed_xs, vector <float> & observed_ys,
+                                  curve_type curve,
+                                  float x_multiplier, float x_addend, float y_multiplier, float y_addend,
+                                  float & maximum_residual_percentage,
+                                  float & average_residual_percentage)
+{
+  curve_fitting_kernel kernel = curve_fitting_kernel_get (curve);
+  return kernel (observed_xs.data (), observed_ys.data (), observed_xs.size (),
+                 x_multiplier, x_addend, y_multiplier, y_addend,
+                 maximum_residual_percentage, average_residual_percentage);
+}
+
+
+// The original solver: Coordinate descent with fixed steps of one percent on each of the four parameters.
+// It needs many thousands of evaluations of the curve,
+// and on many windows of rates it reaches its maximum number of iterations.
+float fitted_curve_coordinate_descent (vector <float> & xs,
+                                       vector <float> & ys,
+                                       curve_fitting_kernel kernel,
+                                       curve_description & parameters)
 {
-  // Requires at least three observed data points.
-  if (xs.size() < 3) return numeric_limits<float>::infinity();
-  if (ys.size() < 3) return numeric_limits<float>::infinity();
-  
-  // Number of points on X-axis and on Y-axis should be the same.
-  if (xs.size() != ys.size()) return numeric_limits<float>::infinity();
-  
-  // Initialize the fitting parameters.
-  parameters.x_multiplier = 1;
-  parameters.x_addend = xs[0];
   float diff_x = xs.back () - xs[0];
-  parameters.y_multiplier = 1;
-  parameters.y_addend = ys[0];
   float diff_y = ys.back () - ys[0];
   int iterations = 0;
   int no_convergence_counter = 0;
   
   float dummy;
   
+  unsigned int count = xs.size ();
+  
   // Result of the initial curve fitting.
-  float sum_residuals = curve_get_fitting_accuracy (xs, ys, parameters.curve, parameters.x_multiplier, parameters.x_addend, parameters.y_multiplier, parameters.y_addend, dummy, dummy);
+  float sum_residuals = kernel (xs.data (), ys.data (), count, parameters.x_multiplier, parameters.x_addend, parameters.y_multiplier, parameters.y_addend, dummy, dummy);
+  parameters.fitting_evaluations++;
   
   // Limit the number of iterations for convergence.
   int maximum_iterations = 5000;
@@ -170,8 +443,8 @@ float fitted_curve_get_optimized_residuals (vector <float> xs,
     
     float x_multiplier_up = parameters.x_multiplier * 1.01;
     float x_multiplier_down = parameters.x_multiplier * 0.99;
-    residue_up = curve_get_fitting_accuracy (xs, ys, parameters.curve, x_multiplier_up, parameters.x_addend, parameters.y_multiplier, parameters.y_addend, dummy, dummy);
-    residue_down = curve_get_fitting_accuracy (xs, ys, parameters.curve, x_multiplier_down, parameters.x_addend, parameters.y_multiplier, parameters.y_addend, dummy, dummy);
+    residue_up = kernel (xs.data (), ys.data (), count, x_multiplier_up, parameters.x_addend, parameters.y_multiplier, parameters.y_addend, dummy, dummy);
+    residue_down = kernel (xs.data (), ys.data (), count, x_multiplier_down, parameters.x_addend, parameters.y_multiplier, parameters.y_addend, dummy, dummy);
     if (residue_up < sum_residuals) {
       parameters.x_multiplier = x_multiplier_up;
       sum_residuals = residue_up;
@@ -185,8 +458,8 @@ float fitted_curve_get_optimized_residuals (vector <float> xs,
     
     float x_addend_up = parameters.x_addend + (0.01 * diff_x);
     float x_addend_down = parameters.x_addend - (0.01 * diff_x);
-    residue_up = curve_get_fitting_accuracy (xs, ys, parameters.curve, parameters.x_multiplier, x_addend_up, parameters.y_multiplier, parameters.y_addend, dummy, dummy);
-    residue_down = curve_get_fitting_accuracy (xs, ys, parameters.curve, parameters.x_multiplier, x_addend_down, parameters.y_multiplier, parameters.y_addend, dummy, dummy);
+    residue_up = kernel (xs.data (), ys.data (), count, parameters.x_multiplier, x_addend_up, parameters.y_multiplier, parameters.y_addend, dummy, dummy);
+    residue_down = kernel (xs.data (), ys.data (), count, parameters.x_multiplier, x_addend_down, parameters.y_multiplier, parameters.y_addend, dummy, dummy);
     if (residue_up < sum_residuals) {
       parameters.x_addend = x_addend_up;
       sum_residuals = residue_up;
@@ -200,8 +473,8 @@ float fitted_curve_get_optimized_residuals (vector <float> xs,
     
     float y_multiplier_up = parameters.y_multiplier * 1.01;
     float y_multiplier_down = parameters.y_multiplier * 0.99;
-    residue_up = curve_get_fitting_accuracy (xs, ys, parameters.curve, parameters.x_multiplier, parameters.x_addend, y_multiplier_up, parameters.y_addend, dummy, dummy);
-    residue_down = curve_get_fitting_accuracy (xs, ys, parameters.curve, parameters.x_multiplier, parameters.x_addend, y_multiplier_down, parameters.y_addend, dummy, dummy);
+    residue_up = kernel (xs.data (), ys.data (), count, parameters.x_multiplier, parameters.x_addend, y_multiplier_up, parameters.y_addend, dummy, dummy);
+    residue_down = kernel (xs.data (), ys.data (), count, parameters.x_multiplier, parameters.x_addend, y_multiplier_down, parameters.y_addend, dummy, dummy);
     if (residue_up < sum_residuals) {
       parameters.y_multiplier = y_multiplier_up;
       sum_residuals = residue_up;
@@ -215,8 +488,8 @@ float fitted_curve_get_optimized_residuals (vector <float> xs,
     
     float y_addend_up = parameters.y_addend + (0.01 * diff_y);
     float y_addend_down = parameters.y_addend - (0.01 * diff_y);
-    residue_up = curve_get_fitting_accuracy (xs, ys, parameters.curve, parameters.x_multiplier, parameters.x_addend, parameters.y_multiplier, y_addend_up, dummy, dummy);
-    residue_down = curve_get_fitting_accuracy (xs, ys, parameters.curve, parameters.x_multiplier, parameters.x_addend, parameters.y_multiplier, y_addend_down, dummy, dummy);
+    residue_up = kernel (xs.data (), ys.data (), count, parameters.x_multiplier, parameters.x_addend, parameters.y_multiplier, y_addend_up, dummy, dummy);
+    residue_down = kernel (xs.data (), ys.data (), count, parameters.x_multiplier, parameters.x_addend, parameters.y_multiplier, y_addend_down, dummy, dummy);
     if (residue_up < sum_residuals) {
       parameters.y_addend = y_addend_up;
       sum_residuals = residue_up;
@@ -229,6 +502,7 @@ float fitted_curve_get_optimized_residuals (vector <float> xs,
     }
     
     iterations++;
+    parameters.fitting_evaluations += 8;
     if (convergence) {
       no_convergence_counter = 0;
     } else {
@@ -238,27 +512,339 @@ float fitted_curve_get_optimized_residuals (vector <float> xs,
   
   //to_tty ({"iterations", to_string (iterations), "no convergence counter", to_string (no_convergence_counter)});
   
+  parameters.fitting_iterations = iterations;
+  
   // If there were too many iterations,
   // it means that a fitting curve was not found.
   if (iterations >= maximum_iterations) {
     return numeric_limits<float>::infinity();
   }
   
+  return sum_residuals;
+}
+
+
+// Several curves have more parameters than degrees of freedom.
+// A scaled x in a power can be taken up by the y multiplier, and a scaled x in a logarithm by the y addend.
+// For the linear curves even the x addend goes into the y addend.
+// A solver that moves all four parameters at once drifts along those redundant directions,
+// until the large parameters that cancel each other out exhaust the precision of a float.
+// So the solver that follows the gradient leaves these parameters as they were initialized.
+template <curve_type curve> inline bool curve_fits_x_multiplier () { return false; }
+template <> inline bool curve_fits_x_multiplier <curve_type::binary_logarithm_multiplied> () { return true; }
+template <> inline bool curve_fits_x_multiplier <curve_type::binary_logarithm_multiplied_negative> () { return true; }
+template <curve_type curve> inline bool curve_fits_x_addend () { return true; }
+template <> inline bool curve_fits_x_addend <curve_type::linear> () { return false; }
+template <> inline bool curve_fits_x_addend <curve_type::linear_negative> () { return false; }
+
+
+// Solves the linear system "matrix * solution = values" in place, with the solution going into the values.
+// The matrix has "size" rows and columns, stored row by row.
+// It uses Gaussian elimination with partial pivoting.
+// Returns false if the system is singular.
+bool solve_normal_equations (double * matrix, double * values, int size)
+{
+  for (int column = 0; column < size; column++) {
+    int pivot = column;
+    for (int row = column + 1; row < size; row++) {
+      if (abs (matrix [row * size + column]) > abs (matrix [pivot * size + column])) pivot = row;
+    }
+    if (matrix [pivot * size + column] == 0) return false;
+    if (!isfinite (matrix [pivot * size + column])) return false;
+    if (pivot != column) {
+      for (int k = 0; k < size; k++) swap (matrix [column * size + k], matrix [pivot * size + k]);
+      swap (values [column], values [pivot]);
+    }
+    for (int row = column + 1; row < size; row++) {
+      double factor = matrix [row * size + column] / matrix [column * size + column];
+      for (int k = column; k < size; k++) matrix [row * size + k] -= factor * matrix [column * size + k];
+      values [row] -= factor * values [column];
+    }
+  }
+  for (int row = size - 1; row >= 0; row--) {
+    for (int k = row + 1; k < size; k++) values [row] -= matrix [row * size + k] * values [k];
+    values [row] /= matrix [row * size + row];
+  }
+  return true;
+}
+
+
+// The Levenberg-Marquardt solver with iteratively reweighted least squares.
+// The fitting objective is the weighted sum of the absolute residuals.
+// Every iteration reweights each point by the inverse of its current absolute residual,
+// so that the weighted least squares of the next step approximate that objective,
+// and then it takes a damped Gauss-Newton step on all free parameters at once.
+// A step is accepted only when it lowers the objective as the fitting kernel calculates it,
+// so the residual is directly comparable to the one of the coordinate descent.
+// It usually converges within some dozens of iterations.
+template <curve_type curve>
+float curve_levenberg_marquardt (vector <float> & xs, vector <float> & ys,
+                                 curve_fitting_kernel kernel,
+                                 curve_description & parameters,
+                                 const curve_description * warm_start)
+{
+  unsigned int count = xs.size ();
+  float weight_multiplier = 4.5 / count;
+  float dummy;
+  
+  double current [4] = { parameters.x_multiplier, parameters.x_addend, parameters.y_multiplier, parameters.y_addend };
+  float sum_residuals = kernel (xs.data (), ys.data (), count, current [0], current [1], current [2], current [3], dummy, dummy);
+  parameters.fitting_evaluations++;
+  if (isnan (sum_residuals)) sum_residuals = numeric_limits<float>::infinity();
+  
+  // The curves with a power or a logarithm have more than one local optimum,
+  // depending on where their vertex or their asymptote falls relative to the observations.
+  // So try several x addends that put that point before, inside, and after the observations.
+  // Given the x parameters, the curve is linear in the y parameters.
+  // So at each x addend the y parameters follow from their weighted least squares solution, which is only a few sums away.
+  // This also fixes initial y parameters that are off by many orders of magnitude,
+  // for example for a cubed curve on minutes in the thousands.
+  vector <float> x_addends = { parameters.x_addend };
+  if (curve_fits_x_addend <curve> ()) {
+    float span = xs.back () - xs [0];
+    for (float fraction : { -1.0f, 0.0f, 0.25f, 0.5f, 0.75f, 1.0f, 2.0f }) {
+      x_addends.push_back (0 - ((xs [0] + (fraction * span)) * parameters.x_multiplier));
+    }
+  }
+  for (float x_addend : x_addends) {
+    double sum_weights = 0, sum_shapes = 0, sum_ys = 0, sum_shapes_squared = 0, sum_shapes_ys = 0;
+    for (unsigned int i = 0; i < count; i++) {
+      double shape = curve_shape <curve> ((xs [i] * parameters.x_multiplier) + x_addend);
+      double weight = curve_fitting_starting_weight + (i * weight_multiplier);
+      sum_weights += weight;
+      sum_shapes += weight * shape;
+      sum_ys += weight * ys [i];
+      sum_shapes_squared += weight * shape * shape;
+      sum_shapes_ys += weight * shape * ys [i];
+    }
+    double determinant = (sum_weights * sum_shapes_squared) - (sum_shapes * sum_shapes);
+    if (determinant == 0) continue;
+    double y_multiplier = ((sum_weights * sum_shapes_ys) - (sum_shapes * sum_ys)) / determinant;
+    double y_addend = (sum_ys - (y_multiplier * sum_shapes)) / sum_weights;
+    float residuals = kernel (xs.data (), ys.data (), count, current [0], x_addend, y_multiplier, y_addend, dummy, dummy);
+    parameters.fitting_evaluations++;
+    if (residuals < sum_residuals) {
+      current [1] = x_addend;
+      current [2] = y_multiplier;
+      current [3] = y_addend;
+      sum_residuals = residuals;
+    }
+  }
+  
+  // When sliding a window along the rates, the fit of the previous window is a good start for the current one.
+  // The two windows share all but a few points, so usually it is the best start by far.
+  // The fit then needs no more than the few iterations to take up the points that entered and left the window.
+  double smoothing = 1;
+  if (warm_start) {
+    float residuals = kernel (xs.data (), ys.data (), count, warm_start->x_multiplier, warm_start->x_addend, warm_start->y_multiplier, warm_start->y_addend, dummy, dummy);
+    parameters.fitting_evaluations++;
+    if (residuals < sum_residuals) {
+      current [0] = warm_start->x_multiplier;
+      current [1] = warm_start->x_addend;
+      current [2] = warm_start->y_multiplier;
+      current [3] = warm_start->y_addend;
+      sum_residuals = residuals;
+      // The weights of the residuals are known to be close already, so start with a tight cap on them.
+      smoothing = 0.001;
+    }
+  }
+  if (!isfinite (sum_residuals)) return numeric_limits<float>::infinity();
+  
+  double damping = 0.001;
+  int iterations = 0;
+  int maximum_iterations = 500;
+  int stalled_counter = 0;
+  while ((iterations < maximum_iterations) && (stalled_counter < 10)) {
+    
+    iterations++;
+    
+    // A residual close to zero would get an unlimited weight, so cap the weights.
+    // Starting with a loose cap and tightening it stops the fit from pinning itself to the first point it hits.
+    smoothing = max (smoothing * 0.5, 0.000001);
+    double smallest_residual = smoothing * sum_residuals / count;
+    if (smallest_residual < numeric_limits<float>::min ()) smallest_residual = numeric_limits<float>::min ();
+    
+    // The normal equations of the reweighted least squares.
+    double normal [4][4] = { {0} };
+    double gradient [4] = { 0 };
+    float x_multiplier = current [0];
+    float x_addend = current [1];
+    float y_multiplier = current [2];
+    float y_addend = current [3];
+    for (unsigned int i = 0; i < count; i++) {
+      float x = xs [i];
+      float u = (x * x_multiplier) + x_addend;
+      float shape = curve_shape <curve> (u);
+      float slope = y_multiplier * curve_slope <curve> (u);
+      double residual = (shape * y_multiplier) + y_addend - ys [i];
+      double jacobian [4] = { slope * x, slope, shape, 1 };
+      if (!curve_fits_x_multiplier <curve> ()) jacobian [0] = 0;
+      if (!curve_fits_x_addend <curve> ()) jacobian [1] = 0;
+      double weight = curve_fitting_starting_weight + (i * weight_multiplier);
+      weight /= max (abs (residual), smallest_residual);
+      for (int j = 0; j < 4; j++) {
+        for (int k = j; k < 4; k++) normal [j][k] += weight * jacobian [j] * jacobian [k];
+        gradient [j] += weight * jacobian [j] * residual;
+      }
+    }
+    for (int j = 0; j < 4; j++) {
+      for (int k = 0; k < j; k++) normal [j][k] = normal [k][j];
+    }
+    
+    // The parameters differ in scale by many orders of magnitude.
+    // Scale the equations to a unit diagonal, so the damping acts evenly on all parameters.
+    double scale [4];
+    for (int j = 0; j < 4; j++) {
+      scale [j] = sqrt (normal [j][j]);
+      if ((scale [j] == 0) || !isfinite (scale [j])) scale [j] = 1;
+    }
+    
+    // Try steps with increasing damping, until one lowers the residuals.
+    float previous_sum_residuals = sum_residuals;
+    bool improved = false;
+    while (!improved && (damping < 1e12)) {
+      double matrix [4][4];
+      double step [4];
+      for (int j = 0; j < 4; j++) {
+        for (int k = 0; k < 4; k++) matrix [j][k] = normal [j][k] / (scale [j] * scale [k]);
+        matrix [j][j] += damping;
+        step [j] = 0 - (gradient [j] / scale [j]);
+      }
+      if (solve_normal_equations (&matrix [0][0], step, 4)) {
+        double candidate [4];
+        for (int j = 0; j < 4; j++) candidate [j] = current [j] + (step [j] / scale [j]);
+        float candidate_residuals = kernel (xs.data (), ys.data (), count, candidate [0], candidate [1], candidate [2], candidate [3], dummy, dummy);
+        parameters.fitting_evaluations++;
+        if (candidate_residuals < sum_residuals) {
+          for (int j = 0; j < 4; j++) current [j] = candidate [j];
+          sum_residuals = candidate_residuals;
+          damping = max (damping * 0.3, 1e-9);
+          improved = true;
+          continue;
+        }
+      }
+      damping *= 10;
+    }
+    
+    // No step lowers the residuals any further.
+    // While the cap on the weights is still loose, tighten it and try again, else it has converged.
+    if (!improved) {
+      if (smoothing > 0.000001) {
+        damping = 0.001;
+        continue;
+      }
+      break;
+    }
+    
+    if (previous_sum_residuals - sum_residuals < previous_sum_residuals * 0.0000001) {
+      stalled_counter++;
+    } else {
+      stalled_counter = 0;
+    }
+  }
+  
+  parameters.x_multiplier = current [0];
+  parameters.x_addend = current [1];
+  parameters.y_multiplier = current [2];
+  parameters.y_addend = current [3];
+  parameters.fitting_iterations = iterations;
+  
+  return sum_residuals;
+}
+
+
+float fitted_curve_levenberg_marquardt (vector <float> & xs,
+                                        vector <float> & ys,
+                                        curve_fitting_kernel kernel,
+                                        curve_description & parameters,
+                                        const curve_description * warm_start)
+{
+  switch (parameters.curve)
+  {
+    case curve_type::begin: break;
+    case curve_type::linear: return curve_levenberg_marquardt <curve_type::linear> (xs, ys, kernel, parameters, warm_start);
+    case curve_type::linear_negative: return curve_levenberg_marquardt <curve_type::linear_negative> (xs, ys, kernel, parameters, warm_start);
+    case curve_type::squared: return curve_levenberg_marquardt <curve_type::squared> (xs, ys, kernel, parameters, warm_start);
+    case curve_type::squared_negative: return curve_levenberg_marquardt <curve_type::squared_negative> (xs, ys, kernel, parameters, warm_start);
+    case curve_type::cubed: return curve_levenberg_marquardt <curve_type::cubed> (xs, ys, kernel, parameters, warm_start);
+    case curve_type::cubed_negative: return curve_levenberg_marquardt <curve_type::cubed_negative> (xs, ys, kernel, parameters, warm_start);
+    case curve_type::binary_logarithm: return curve_levenberg_marquardt <curve_type::binary_logarithm> (xs, ys, kernel, parameters, warm_start);
+    case curve_type::binary_logarithm_negative: return curve_levenberg_marquardt <curve_type::binary_logarithm_negative> (xs, ys, kernel, parameters, warm_start);
+    case curve_type::binary_logarithm_multiplied: return curve_levenberg_marquardt <curve_type::binary_logarithm_multiplied> (xs, ys, kernel, parameters, warm_start);
+    case curve_type::binary_logarithm_multiplied_negative: return curve_levenberg_marquardt <curve_type::binary_logarithm_multiplied_negative> (xs, ys, kernel, parameters, warm_start);
+    case curve_type::end: break;
+  }
+  return numeric_limits<float>::infinity();
+}
+
+
+float fitted_curve_get_optimized_residuals (vector <float> xs,
+                                            vector <float> ys,
+                                            curve_description & parameters,
+                                            curve_solver solver,
+                                            const curve_description * warm_start)
+{
+  // Requires at least three observed data points.
+  if (xs.size() < 3) return numeric_limits<float>::infinity();
+  if (ys.size() < 3) return numeric_limits<float>::infinity();
+  
+  // Number of points on X-axis and on Y-axis should be the same.
+  if (xs.size() != ys.size()) return numeric_limits<float>::infinity();
+  
+  // Initialize the fitting parameters.
+  parameters.x_multiplier = 1;
+  parameters.x_addend = xs[0];
+  parameters.y_multiplier = 1;
+  parameters.y_addend = ys[0];
+  parameters.fitting_iterations = 0;
+  parameters.fitting_evaluations = 0;
+  
+  // A previous fit is only of use to the same type of curve.
+  if (warm_start) {
+    if (warm_start->curve != parameters.curve) warm_start = nullptr;
+  }
+  
+  // Select the fitting kernel for this curve once, rather than per iteration or per point.
+  curve_fitting_kernel kernel = curve_fitting_kernel_get (parameters.curve);
+  
+  float sum_residuals = numeric_limits<float>::infinity();
+  switch (solver) {
+    case curve_solver::coordinate_descent:
+      if (warm_start) {
+        parameters.x_multiplier = warm_start->x_multiplier;
+        parameters.x_addend = warm_start->x_addend;
+        parameters.y_multiplier = warm_start->y_multiplier;
+        parameters.y_addend = warm_start->y_addend;
+      }
+      sum_residuals = fitted_curve_coordinate_descent (xs, ys, kernel, parameters);
+      break;
+    case curve_solver::levenberg_marquardt:
+      sum_residuals = fitted_curve_levenberg_marquardt (xs, ys, kernel, parameters, warm_start);
+      break;
+  }
+  if (isinf (sum_residuals)) return sum_residuals;
+  
   // Final calculation of other fitting quality indicators.
-  curve_get_fitting_accuracy (xs, ys, parameters.curve, parameters.x_multiplier, parameters.x_addend, parameters.y_multiplier, parameters.y_addend, parameters.maximum_residual_percentage, parameters.average_residual_percentage);
+  kernel (xs.data (), ys.data (), xs.size (), parameters.x_multiplier, parameters.x_addend, parameters.y_multiplier, parameters.y_addend, parameters.maximum_residual_percentage, parameters.average_residual_percentage);
   
   // Done.
   return sum_residuals;
 }
 
 
-void get_fitted_curve (vector <float> xs, vector <float> ys, curve_description & parameters)
+void get_fitted_curve (vector <float> xs, vector <float> ys, curve_description & parameters, curve_solver solver,
+                       vector <curve_description> * sliding_fits)
 {
   // Initialize default to no fitting curve found.
   parameters.curve = curve_type::end;
   float best_summed_residuals = numeric_limits<double>::infinity();
   parameters.maximum_residual_percentage = numeric_limits<double>::infinity();
   parameters.average_residual_percentage = numeric_limits<double>::infinity();
+  parameters.fitting_iterations = 0;
+  parameters.fitting_evaluations = 0;
+  
+  // In the sliding window mode, the container keeps the fits of every type of curve of the previous window.
+  if (sliding_fits) sliding_fits->resize (static_cast <int> (curve_type::end));
   
   for (int iter = static_cast <int> (curve_type::begin) + 1; iter < static_cast <int> (curve_type::end); iter++)
   {
@@ -266,7 +852,23 @@ void get_fitted_curve (vector <float> xs, vector <float> ys, curve_description &
     local_parameters.curve = static_cast <curve_type> (iter);
     local_parameters.maximum_residual_percentage = 0;
     local_parameters.average_residual_percentage = 0;
-    float residual = fitted_curve_get_optimized_residuals (xs, ys, local_parameters);
+    const curve_description * warm_start = nullptr;
+    if (sliding_fits) warm_start = & sliding_fits->at (iter);
+    float residual = fitted_curve_get_optimized_residuals (xs, ys, local_parameters, solver, warm_start);
+    parameters.fitting_iterations += local_parameters.fitting_iterations;
+    parameters.fitting_evaluations += local_parameters.fitting_evaluations;
+    if (sliding_fits) {
+      // A failed fit is no start for the next window.
+      if (!isfinite (residual)) local_parameters.curve = curve_type::end;
+      sliding_fits->at (iter) = local_parameters;
+    }
+    // A curve that cannot be extrapolated to the period of the forecast is of no use to the forecaster.
+    // This happens to a logarithm whose asymptote falls just after the observations.
+    if (parameters.minutes_measured || parameters.hours_measured) {
+      int next_period_x_value, weight_hours;
+      forecast_curve_period (parameters, next_period_x_value, weight_hours);
+      if (!isfinite (curve_calculate (local_parameters, next_period_x_value))) continue;
+    }
     if (residual < best_summed_residuals) {
       parameters.curve = local_parameters.curve;
       parameters.x_multiplier = local_parameters.x_multiplier;
@@ -288,6 +890,29 @@ vector <int> deep_learning_hours ()
 }
 
 
+// Gets the next period, moving forward, for extrapolating the coin's rate with a fitted curve.
+// This period will be the same period the curve was fitted to,
+// with a maximum of 24 hours.
+// It also gets the number of hours of the weight that applies to this curve, or -1 for none.
+void forecast_curve_period (const curve_description & parameters, int & next_period_x_value, int & weight_hours)
+{
+  next_period_x_value = parameters.last_seen_x_value;
+  weight_hours = -1;
+  if (parameters.minutes_measured) {
+    int minutes = parameters.minutes_measured;
+    if (minutes > 60 * 24) minutes = 60 * 24;
+    next_period_x_value += minutes;
+    weight_hours = minutes / 60;
+  }
+  if (parameters.hours_measured) {
+    int hours = parameters.hours_measured;
+    if (hours > 24) hours = 24;
+    next_period_x_value += hours;
+    weight_hours = hours;
+  }
+}
+
+
 // Looks at the curves that capture the rate pattern.
 // Takes in account the object with the parameters for the forecast.
 // Does a forecast about the new rate of the coin after 24 hours.
@@ -311,22 +936,10 @@ float rate_24h_forecast (void * output,
     float most_recent_smoothed_coin_rate = curve_calculate (parameters, parameters.last_seen_x_value);
     
     // Get the next period, moving forward, for extrapolating the coin's rate.
-    // This period will be the same period the curve was fitted to,
-    // with a maximum of 24 hours.
     float weight = 0;
-    int next_period_x_value = parameters.last_seen_x_value;
-    if (parameters.minutes_measured) {
-      int minutes = parameters.minutes_measured;
-      if (minutes > 60 * 24) minutes = 60 * 24;
-      next_period_x_value += minutes;
-      weight = weights.hours_curve_weights [minutes / 60];
-    }
-    if (parameters.hours_measured) {
-      int hours = parameters.hours_measured;
-      if (hours > 24) hours = 24;
-      next_period_x_value += hours;
-      weight = weights.hours_curve_weights [hours];
-    }
+    int next_period_x_value, weight_hours;
+    forecast_curve_period (parameters, next_period_x_value, weight_hours);
+    if (weight_hours >= 0) weight = weights.hours_curve_weights [weight_hours];
     
     // Extrapolate the coin rate that it is going to be based on the statistical information.
     float next_period_expected_coin_rate = curve_calculate (parameters, next_period_x_value);
@@ -396,7 +1009,7 @@ void rate_forecast_validator (const string & exchange, const string & coin,
   output.add ({"Exchange", exchange, "has a balance of", float2string (total), coin});
 
   // Storage for the prepared rates.
-  unordered_map <int, float> minute_asks, minute_bids, hour_asks, hour_bids;
+  TimeSeries minutes, hour_series;
   // The change in a coin's value is measured against the Euro.
   // Measuring change against the Bitcoin is not always a good indicator of
   // how much the value of the coin changes.
@@ -408,14 +1021,13 @@ void rate_forecast_validator (const string & exchange, const string & coin,
   // The number of hours passed to the preparer is more than enough to cover all curves below.
   string market = euro_id ();
   // Prepare the rates for looking at the patterns.
-  pattern_prepare (&output, exchange, market, coin, 10 * 24,
-                   minute_asks, minute_bids, hour_asks, hour_bids);
+  pattern_prepare (&output, exchange, market, coin, 10 * 24, minutes, hour_series);
   
   // Get the current rate.
   // This is the average over the most recent hour.
   int last_hour = 0;
-  float current_bid = hour_bids[last_hour];
-  float current_ask = hour_asks[last_hour];
+  float current_bid = hour_series.bid (last_hour);
+  float current_ask = hour_series.ask (last_hour);
   float current_rate = (current_bid + current_ask) / 2;
   
   // Output and store information about the accuracy of the previous forecast.
@@ -461,15 +1073,15 @@ void rate_forecast_validator (const string & exchange, const string & coin,
   {
     // Add the change percentages.
     float percents;
-    percents = pattern_change (minute_asks, minute_bids, 0, 60);
+    percents = pattern_change (minutes, 0, 60);
     if (isnan (percents)) percents = 0;
     if (isinf (percents)) percents = 0;
     forecast_parameters.hourly_change_percentage = percents;
-    percents = pattern_change (hour_asks, hour_bids, 0, 24);
+    percents = pattern_change (hour_series, 0, 24);
     if (isnan (percents)) percents = 0;
     if (isinf (percents)) percents = 0;
     forecast_parameters.daily_change_percentage = percents;
-    percents = pattern_change (hour_asks, hour_bids, 0, 24 * 7);
+    percents = pattern_change (hour_series, 0, 24 * 7);
     if (isnan (percents)) percents = 0;
     if (isinf (percents)) percents = 0;
     forecast_parameters.weekly_change_percentage = percents;
@@ -495,8 +1107,8 @@ void rate_forecast_validator (const string & exchange, const string & coin,
     vector <float> ys;
     if (hours > 15) {
       for (int hour = 0 - hours; hour <= 0; hour++) {
-        float ask = hour_asks [hour];
-        float bid = hour_bids [hour];
+        float ask = hour_series.ask (hour);
+        float bid = hour_series.bid (hour);
         float rate = (ask + bid) / 2;
         if (rate > 0) {
           xs.push_back (hour);
@@ -509,8 +1121,8 @@ void rate_forecast_validator (const string & exchange, const string & coin,
       parameters.hours_measured = hours;
     } else {
       for (int minute = 0 - hours * 60; minute <= 0; minute++) {
-        float ask = minute_asks [minute];
-        float bid = minute_bids [minute];
+        float ask = minutes.ask (minute);
+        float bid = minutes.bid (minute);
         float rate = (ask + bid) / 2;
         if (rate > 0) {
           xs.push_back (minute);
@@ -568,10 +1180,8 @@ void rate_forecast_validator (const string & exchange, const string & coin,
 
 void learn_rates_process_observations (void * output,
                                        const string & exchange, const string & market, const string & coin,
-                                       unordered_map <int, float> & minute_asks,
-                                       unordered_map <int, float> & minute_bids,
-                                       unordered_map <int, float> & hour_asks,
-                                       unordered_map <int, float> & hour_bids,
+                                       TimeSeries & minutes,
+                                       TimeSeries & hour_series,
                                        vector <forecast_properties> & all_forecast_properties,
                                        forecast_weights & weights)
 {
@@ -582,6 +1192,11 @@ void learn_rates_process_observations (void * output,
     weights.hours_curve_weights [hours] = 1.0;
   }
 
+  // The simulations step one hour at a time, so the windows of neighbouring simulated hours share nearly all their rates.
+  // Per number of hours, this keeps the curves fitted in the previous simulated hour,
+  // so the fits of the next simulated hour can start from them.
+  unordered_map <int, vector <curve_description> > sliding_fits;
+  
   // It will run simulations for the last 30 days.
   // One simulation covers a period of 30 days too.
   // It needs the realized average rate one day after the last day in the simulation.
@@ -598,15 +1213,15 @@ void learn_rates_process_observations (void * output,
     // Get the average rate over the last simulation hour.
     float last_simulation_hour_rate = 0;
     {
-      float bid = hour_bids [last_simulation_hour];
-      float ask = hour_asks [last_simulation_hour];
+      float bid = hour_series.bid (last_simulation_hour);
+      float ask = hour_series.ask (last_simulation_hour);
       last_simulation_hour_rate = (bid + ask) / 2;
     }
     // Get the avarage rate for 24 hours later.
     float next_day_observed_rate = 0;
     {
-      float bid = hour_bids [last_simulation_hour + 24];
-      float ask = hour_asks [last_simulation_hour + 24];
+      float bid = hour_series.bid (last_simulation_hour + 24);
+      float ask = hour_series.ask (last_simulation_hour + 24);
       next_day_observed_rate = (bid + ask) / 2;
     }
     // Feedback.
@@ -621,13 +1236,13 @@ void learn_rates_process_observations (void * output,
     forecast_parameters.next_day_observed_average_hourly_rate = next_day_observed_rate;
     {
       // Get the change percentages.
-      forecast_parameters.hourly_change_percentage = pattern_change (minute_asks, minute_bids, last_simulation_hour * 60, 60);
+      forecast_parameters.hourly_change_percentage = pattern_change (minutes, last_simulation_hour * 60, 60);
       if (isnan (forecast_parameters.hourly_change_percentage)) forecast_parameters.hourly_change_percentage = 0;
       if (isinf (forecast_parameters.hourly_change_percentage)) forecast_parameters.hourly_change_percentage = 0;
-      forecast_parameters.daily_change_percentage = pattern_change (hour_asks, hour_bids, last_simulation_hour, 24);
+      forecast_parameters.daily_change_percentage = pattern_change (hour_series, last_simulation_hour, 24);
       if (isnan (forecast_parameters.daily_change_percentage)) forecast_parameters.daily_change_percentage = 0;
       if (isinf (forecast_parameters.daily_change_percentage)) forecast_parameters.daily_change_percentage = 0;
-      forecast_parameters.weekly_change_percentage = pattern_change (hour_asks, hour_bids, last_simulation_hour, 24 * 7);
+      forecast_parameters.weekly_change_percentage = pattern_change (hour_series, last_simulation_hour, 24 * 7);
       if (isnan (forecast_parameters.weekly_change_percentage)) forecast_parameters.weekly_change_percentage = 0;
       if (isinf (forecast_parameters.weekly_change_percentage)) forecast_parameters.weekly_change_percentage = 0;
       // Output the change percentages.
@@ -646,8 +1261,8 @@ void learn_rates_process_observations (void * output,
       vector <pair <float, float> > plotdata;
       for (int hour = first_simulation_hour; hour < last_simulation_hour; hour++) {
         float x = hour;
-        float bid = hour_bids [hour];
-        float ask = hour_asks [hour];
+        float bid = hour_series.bid (hour);
+        float ask = hour_series.ask (hour);
         float rate = (bid + ask) / 2;
         plotdata.push_back (make_pair (x, rate));
       }
@@ -665,8 +1280,8 @@ void learn_rates_process_observations (void * output,
       
       if (hours > 15) {
         for (int hour = last_simulation_hour - hours; hour <= last_simulation_hour; hour++) {
-          float ask = hour_asks [hour];
-          float bid = hour_bids [hour];
+          float ask = hour_series.ask (hour);
+          float bid = hour_series.bid (hour);
           float rate = (ask + bid) / 2;
           if (rate > 0) {
             xs.push_back (hour);
@@ -679,8 +1294,8 @@ void learn_rates_process_observations (void * output,
         parameters.hours_measured = hours;
       } else {
         for (int minute = (last_simulation_hour - hours) * 60; minute <= last_simulation_hour * 60; minute++) {
-          float ask = minute_asks [minute];
-          float bid = minute_bids [minute];
+          float ask = minutes.ask (minute);
+          float bid = minutes.bid (minute);
           float rate = (ask + bid) / 2;
           if (rate > 0) {
             xs.push_back (minute);
@@ -694,7 +1309,7 @@ void learn_rates_process_observations (void * output,
       }
       
       // Capture the rates curve in a mathematical formula.
-      get_fitted_curve (xs, ys, parameters);
+      get_fitted_curve (xs, ys, parameters, curve_solver::levenberg_marquardt, &sliding_fits [hours]);
       
       // Plot the observed rates and the fitted curve in one graph.
       // Having one graph is easier for visual inspection of the curve fitting accuracy.
@@ -799,8 +1414,119 @@ void get_forecast_residuals (void * output,
 }
 
 
+// The weights of the forecast factors, in the order of the columns:
+// The hourly, daily and weekly changes, followed by the curves per number of hours for deep learning.
+vector <float> forecast_factors::get_weights (forecast_weights & weights)
+{
+  vector <float> values = { weights.hourly_change_weight, weights.daily_change_weight, weights.weekly_change_weight };
+  for (int hours : deep_learning_hours ()) {
+    values.push_back (weights.hours_curve_weights [hours]);
+  }
+  return values;
+}
+
+
+void forecast_factors::set_weights (const vector <float> & values, forecast_weights & weights)
+{
+  weights.hourly_change_weight = values [0];
+  weights.daily_change_weight = values [1];
+  weights.weekly_change_weight = values [2];
+  vector <int> all_hours = deep_learning_hours ();
+  for (unsigned int i = 0; i < all_hours.size (); i++) {
+    weights.hours_curve_weights [all_hours [i]] = values [i + 3];
+  }
+}
+
+
+// Splits the forecasts of all simulated hours into the contributions of their factors.
+// This does the same calculations as the rate forecaster, except for multiplying by the weights.
+forecast_factors::forecast_factors (vector <forecast_properties> & all_forecast_properties, forecast_weights & weights)
+{
+  vector <int> all_hours = deep_learning_hours ();
+  unsigned int count = all_forecast_properties.size ();
+  columns.assign (3 + all_hours.size (), vector <float> (count, 0));
+  constants.assign (count, 0);
+  observed.assign (count, 0);
+  for (unsigned int i = 0; i < count; i++) {
+    forecast_properties & properties = all_forecast_properties [i];
+    observed [i] = properties.next_day_observed_average_hourly_rate;
+    // The forecaster divides the total by the number of factors taken in account.
+    float factors_count = properties.curves.size () + 3;
+    for (auto & parameters : properties.curves) {
+      int next_period_x_value, weight_hours;
+      forecast_curve_period (parameters, next_period_x_value, weight_hours);
+      float contribution = curve_calculate (parameters, next_period_x_value) / factors_count;
+      auto iterator = find (all_hours.begin (), all_hours.end (), weight_hours);
+      if (iterator != all_hours.end ()) {
+        columns [3 + (iterator - all_hours.begin ())] [i] += contribution;
+      } else if (weights.hours_curve_weights.count (weight_hours)) {
+        // A weight outside of the deep learning hours is not optimized, so it goes into the constant part.
+        constants [i] += weights.hours_curve_weights [weight_hours] * contribution;
+      }
+    }
+    float rate = properties.last_observed_average_hourly_rate;
+    columns [0] [i] = (rate + (rate * properties.hourly_change_percentage * 24 / 100)) / factors_count;
+    columns [1] [i] = (rate + (rate * properties.daily_change_percentage / 100)) / factors_count;
+    columns [2] [i] = (rate + (rate * properties.weekly_change_percentage / 7 / 100)) / factors_count;
+  }
+}
+
+
+// The forecasts of all simulated hours for the given weights.
+// Column by column, this is a dense multiply-add over contiguous floats, which the compiler vectorizes.
+void forecast_factors::forecasts (const vector <float> & values, vector <float> & forecasts)
+{
+  forecasts = constants;
+  unsigned int count = forecasts.size ();
+  float * output = forecasts.data ();
+  for (unsigned int factor = 0; factor < columns.size (); factor++) {
+    float weight = values [factor];
+    const float * column = columns [factor].data ();
+    for (unsigned int i = 0; i < count; i++) {
+      output [i] += weight * column [i];
+    }
+  }
+}
+
+
+// The same accuracy indicators as get_forecast_residuals gives, for the given weights.
+float forecast_factors::residuals (const vector <float> & values,
+                                   float & maximum_residual_percentage,
+                                   float & average_residual_percentage)
+{
+  vector <float> forecast_values;
+  forecasts (values, forecast_values);
+  float sum_absolute_residuals = 0;
+  maximum_residual_percentage = 0;
+  average_residual_percentage = 0;
+  unsigned int count = forecast_values.size ();
+  float starting_weight = 0.5;
+  float weight_multiplier = 4.5 / count;
+  for (unsigned int i = 0; i < count; i++) {
+    float residual = abs (forecast_values [i] - observed [i]);
+    residual *= starting_weight + (i * weight_multiplier);
+    sum_absolute_residuals += residual;
+    float absolute_change_percentage = abs (get_percentage_change (observed [i], forecast_values [i]));
+    if (absolute_change_percentage > maximum_residual_percentage) {
+      maximum_residual_percentage = absolute_change_percentage;
+    }
+    average_residual_percentage += absolute_change_percentage;
+  }
+  average_residual_percentage /= count;
+  return sum_absolute_residuals;
+}
+
+
 // Iterate over the rates learning data.
 // Optimize the weights to get the best forecasts.
+// It used to nudge one weight at a time by one percent,
+// and to run the complete rate forecaster over all simulated hours for every nudge.
+// That ran all the curves thousands of times over, while the curves do not depend on the weights.
+// Now it calculates the contributions of all factors once.
+// The forecast is linear in the weights.
+// So it minimizes the weighted absolute residuals by iteratively reweighted least squares,
+// with Levenberg-Marquardt damping for the weights that have little or no influence.
+// The weights do not go below zero, as they could not with the nudging.
 float optimize_forecast_weights (void * output,
                                  vector <forecast_properties> & all_forecast_properties,
                                  forecast_weights & weights)
@@ -811,127 +1537,107 @@ float optimize_forecast_weights (void * output,
   if (all_forecast_properties.size() < 3) return numeric_limits<float>::infinity();
 
   // The object with the weights is assumed to have been initialized already.
-  // Initialize the fitting parameters.
-  int iterations = 0;
-  int no_convergence_counter = 0;
-  float sum_absolute_residuals;
+  forecast_factors factors (all_forecast_properties, weights);
+  vector <float> values = factors.get_weights (weights);
+  int size = values.size ();
+  unsigned int count = all_forecast_properties.size ();
+  float starting_weight = 0.5;
+  float weight_multiplier = 4.5 / count;
   float dummy;
   
-  // Result of the initial curve fitting.
-  get_forecast_residuals (output, all_forecast_properties, weights, sum_absolute_residuals, dummy, dummy);
+  // Result of the initial weights.
+  float sum_absolute_residuals = factors.residuals (values, dummy, dummy);
   
-  // Limit the number of iterations for finding maximum convergence.
-  int maximum_iterations = 5000;
-  while ((iterations < maximum_iterations) && (no_convergence_counter < 10)) {
-
-    // Variables for this convergence iteration.
-    bool convergence = false;
-    float weight_saved, weight_up, weight_down, residue_up, residue_down;
-    
-    // Optimize the weight for the hourly change.
-    weight_saved = weights.hourly_change_weight;
-    weight_up = weight_saved * 1.01;
-    weights.hourly_change_weight = weight_up;
-    get_forecast_residuals (output, all_forecast_properties, weights, residue_up, dummy, dummy);
-    weight_down = weight_saved * 0.99;
-    weights.hourly_change_weight = weight_down;
-    get_forecast_residuals (output, all_forecast_properties, weights, residue_down, dummy, dummy);
-    if (residue_up < sum_absolute_residuals) {
-      weights.hourly_change_weight = weight_up;
-      sum_absolute_residuals = residue_up;
-      convergence = true;
-    }
-    else if (residue_down < sum_absolute_residuals) {
-      weights.hourly_change_weight = weight_down;
-      sum_absolute_residuals = residue_down;
-      convergence = true;
-    }
-    else {
-      weights.hourly_change_weight = weight_saved;
-    }
-
-    // Optimize the weight for the daily change.
-    weight_saved = weights.daily_change_weight;
-    weight_up = weight_saved * 1.01;
-    weights.daily_change_weight = weight_up;
-    get_forecast_residuals (output, all_forecast_properties, weights, residue_up, dummy, dummy);
-    weight_down = weight_saved * 0.99;
-    weights.daily_change_weight = weight_down;
-    get_forecast_residuals (output, all_forecast_properties, weights, residue_down, dummy, dummy);
-    if (residue_up < sum_absolute_residuals) {
-      weights.daily_change_weight = weight_up;
-      sum_absolute_residuals = residue_up;
-      convergence = true;
-    }
-    else if (residue_down < sum_absolute_residuals) {
-      weights.daily_change_weight = weight_down;
-      sum_absolute_residuals = residue_down;
-      convergence = true;
-    }
-    else {
-      weights.daily_change_weight = weight_saved;
-    }
-
-    // Optimize the weight for the weekly change.
-    weight_saved = weights.weekly_change_weight;
-    weight_up = weight_saved * 1.01;
-    weights.weekly_change_weight = weight_up;
-    get_forecast_residuals (output, all_forecast_properties, weights, residue_up, dummy, dummy);
-    weight_down = weight_saved * 0.99;
-    weights.weekly_change_weight = weight_down;
-    get_forecast_residuals (output, all_forecast_properties, weights, residue_down, dummy, dummy);
-    if (residue_up < sum_absolute_residuals) {
-      weights.weekly_change_weight = weight_up;
-      sum_absolute_residuals = residue_up;
-      convergence = true;
+  double damping = 0.001;
+  double smoothing = 1;
+  int iterations = 0;
+  int maximum_iterations = 500;
+  int stalled_counter = 0;
+  vector <float> forecasts;
+  while ((iterations < maximum_iterations) && (stalled_counter < 10)) {
+    
+    iterations++;
+    
+    // Cap the weights of the residuals close to zero, starting loose, then tightening it.
+    smoothing = max (smoothing * 0.5, 0.000001);
+    double smallest_residual = smoothing * sum_absolute_residuals / count;
+    if (smallest_residual < numeric_limits<float>::min ()) smallest_residual = numeric_limits<float>::min ();
+    
+    // The normal equations of the reweighted least squares.
+    factors.forecasts (values, forecasts);
+    vector <double> normal (size * size, 0);
+    vector <double> gradient (size, 0);
+    for (unsigned int i = 0; i < count; i++) {
+      double residual = forecasts [i] - factors.observed [i];
+      double weight = (starting_weight + (i * weight_multiplier)) / max (abs (residual), smallest_residual);
+      for (int j = 0; j < size; j++) {
+        double factor_j = factors.columns [j] [i];
+        if (factor_j == 0) continue;
+        for (int k = j; k < size; k++) normal [j * size + k] += weight * factor_j * factors.columns [k] [i];
+        gradient [j] += weight * factor_j * residual;
+      }
     }
-    else if (residue_down < sum_absolute_residuals) {
-      weights.weekly_change_weight = weight_down;
-      sum_absolute_residuals = residue_down;
-      convergence = true;
+    for (int j = 0; j < size; j++) {
+      for (int k = 0; k < j; k++) normal [j * size + k] = normal [k * size + j];
     }
-    else {
-      weights.weekly_change_weight = weight_saved;
+    vector <double> scale (size);
+    for (int j = 0; j < size; j++) {
+      scale [j] = sqrt (normal [j * size + j]);
+      if ((scale [j] == 0) || !isfinite (scale [j])) scale [j] = 1;
     }
-
-    // Iterate over the hours for simulation to optimize all their weights.
-    for (int hours : deep_learning_hours () ) {
-      weight_saved = weights.hours_curve_weights [hours];
-      weight_up = weight_saved * 1.01;
-      weights.hours_curve_weights [hours] = weight_up;
-      get_forecast_residuals (output, all_forecast_properties, weights, residue_up, dummy, dummy);
-      weight_down = weight_saved * 0.99;
-      weights.hours_curve_weights [hours] = weight_down;
-      get_forecast_residuals (output, all_forecast_properties, weights, residue_down, dummy, dummy);
-      if (residue_up < sum_absolute_residuals) {
-        weights.hours_curve_weights [hours] = weight_up;
-        sum_absolute_residuals = residue_up;
-        convergence = true;
+    
+    // Try steps with increasing damping, until one lowers the residuals.
+    float previous_sum_residuals = sum_absolute_residuals;
+    bool improved = false;
+    while (!improved && (damping < 1e12)) {
+      vector <double> matrix (size * size);
+      vector <double> step (size);
+      for (int j = 0; j < size; j++) {
+        for (int k = 0; k < size; k++) matrix [j * size + k] = normal [j * size + k] / (scale [j] * scale [k]);
+        matrix [j * size + j] += damping;
+        step [j] = 0 - (gradient [j] / scale [j]);
       }
-      else if (residue_down < sum_absolute_residuals) {
-        weights.hours_curve_weights [hours] = weight_down;
-        sum_absolute_residuals = residue_down;
-        convergence = true;
+      if (solve_normal_equations (matrix.data (), step.data (), size)) {
+        vector <float> candidate (size);
+        for (int j = 0; j < size; j++) {
+          candidate [j] = values [j] + (step [j] / scale [j]);
+          if (candidate [j] < 0) candidate [j] = 0;
+        }
+        float candidate_residuals = factors.residuals (candidate, dummy, dummy);
+        if (candidate_residuals < sum_absolute_residuals) {
+          values = candidate;
+          sum_absolute_residuals = candidate_residuals;
+          damping = max (damping * 0.3, 1e-9);
+          improved = true;
+          continue;
+        }
       }
-      else {
-        weights.hours_curve_weights [hours] = weight_saved;
+      damping *= 10;
+    }
+    
+    // No step lowers the residuals any further.
+    // While the cap on the weights is still loose, tighten it and try again, else it has converged.
+    if (!improved) {
+      if (smoothing > 0.000001) {
+        damping = 0.001;
+        continue;
       }
+      break;
     }
-
-    // Update the counters.
-    iterations++;
-    if (convergence) {
-      no_convergence_counter = 0;
+    
+    if (previous_sum_residuals - sum_absolute_residuals < previous_sum_residuals * 0.0000001) {
+      stalled_counter++;
     } else {
-      no_convergence_counter++;
+      stalled_counter = 0;
     }
-
   }
   
-  out->add ({"Iterations:", to_string (iterations), "no convergence counter:", to_string (no_convergence_counter)});
+  factors.set_weights (values, weights);
+  
+  out->add ({"Iterations:", to_string (iterations), "stalled counter:", to_string (stalled_counter)});
   
   // If there were too many iterations,
-  // it means that a fitting curve was not found.
+  // it means that the optimum was not found.
   if (iterations >= maximum_iterations) {
     return numeric_limits<float>::infinity();
   }
@@ -39,6 +39,12 @@ enum class curve_type {
   end
 };
 
+// The solvers that fit a curve to the observed rates.
+enum class curve_solver {
+  coordinate_descent,
+  levenberg_marquardt
+};
+
 class curve_description
 {
 public:
@@ -52,10 +58,18 @@ public:
   float y_addend = 0;
   float maximum_residual_percentage = 0;
   float average_residual_percentage = 0;
+  int fitting_iterations = 0;
+  int fitting_evaluations = 0;
 };
 
 float curve_calculate (curve_description parameters, float x);
 string curve_title (curve_type curve);
+typedef float (* curve_fitting_kernel) (const float * observed_xs, const float * observed_ys, unsigned int count,
+                                        float x_multiplier, float x_addend, float y_multiplier, float y_addend,
+                                        float & maximum_residual_percentage,
+                                        float & average_residual_percentage);
+curve_fitting_kernel curve_fitting_kernel_get (curve_type curve);
+curve_fitting_kernel curve_fitting_kernel_scalar (curve_type curve);
 float curve_get_fitting_accuracy (vector <float> & observed_xs, vector <float> & observed_ys,
                                   curve_type curve,
                                   float x_multiplier, float x_addend, float y_multiplier, float y_addend,
@@ -63,8 +77,12 @@ float curve_get_fitting_accuracy (vector <float> & observed_xs, vector <float> &
                                   float & average_residual_percentage);
 float fitted_curve_get_optimized_residuals (vector <float> xs,
                                             vector <float> ys,
-                                            curve_description & parameters);
-void get_fitted_curve (vector <float> xs, vector <float> ys, curve_description & parameters);
+                                            curve_description & parameters,
+                                            curve_solver solver = curve_solver::levenberg_marquardt,
+                                            const curve_description * warm_start = nullptr);
+void get_fitted_curve (vector <float> xs, vector <float> ys, curve_description & parameters,
+                       curve_solver solver = curve_solver::levenberg_marquardt,
+                       vector <curve_description> * sliding_fits = nullptr);
 
 class forecast_properties
 {
@@ -88,6 +106,7 @@ public:
 };
 
 vector <int> deep_learning_hours ();
+void forecast_curve_period (const curve_description & parameters, int & next_period_x_value, int & weight_hours);
 float rate_24h_forecast (void * output,
                          forecast_properties forecast_parameters,
                          forecast_weights weights);
@@ -98,10 +117,8 @@ void rate_forecast_validator (const string & exchange, const string & coin,
 
 void learn_rates_process_observations (void * output,
                                        const string & exchange, const string & market, const string & coin,
-                                       unordered_map <int, float> & minute_asks,
-                                       unordered_map <int, float> & minute_bids,
-                                       unordered_map <int, float> & hour_asks,
-                                       unordered_map <int, float> & hour_bids,
+                                       TimeSeries & minutes,
+                                       TimeSeries & hour_series,
                                        vector <forecast_properties> & all_forecast_properties,
                                        forecast_weights & weights);
 void get_forecast_residuals (void * output,
@@ -110,6 +127,22 @@ void get_forecast_residuals (void * output,
                              float & sum_absolute_residuals,
                              float & maximum_residual_percentage,
                              float & average_residual_percentage);
+class forecast_factors
+{
+public:
+  forecast_factors (vector <forecast_properties> & all_forecast_properties, forecast_weights & weights);
+  vector <float> get_weights (forecast_weights & weights);
+  void set_weights (const vector <float> & values, forecast_weights & weights);
+  void forecasts (const vector <float> & values, vector <float> & forecasts);
+  float residuals (const vector <float> & values,
+                   float & maximum_residual_percentage,
+                   float & average_residual_percentage);
+  // One column per weight, with the contribution of that factor to the forecast of each simulated hour.
+  vector <vector <float> > columns;
+  // The contributions that do not depend on any of the weights being optimized.
+  vector <float> constants;
+  vector <float> observed;
+};
 float optimize_forecast_weights (void * output,
                                  vector <forecast_properties> & all_forecast_properties,
                                  forecast_weights & weights);
@@ -18,19 +18,141 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 
 
 #include <sql.h>
+#include <sqlite.h>
 #include <my_global.h>
 #include <mysql.h>
 
 
-SQL::SQL (string ip_address)
+// Every model and controller function used to connect to the database afresh.
+// Setting up a connection takes longer than most of the queries run over it,
+// and it counts against the 'max_connections_per_hour' resource of the server.
+// Now the connections are kept in a pool shared by all threads in the process.
+// An SQL object takes a connection for its host from the pool,
+// and hands it back to the pool when it goes out of scope.
+// The prepared statements stay with the connection they were prepared on.
+
+
+// The maximum number of connections to one host the process keeps open at once.
+// If all of them are in use, the next SQL object waits till one gets handed back.
+// A thread may hold a connection while the code it calls asks for another one to the same host.
+// So if the wait takes too long, it opens one more connection beyond the limit, rather than risking a deadlock.
+#define SQL_POOL_MAXIMUM_CONNECTIONS 20
+#define SQL_POOL_WAIT_SECONDS 10
+
+
+// A connection that has been idle for this long gets pinged before it is used again,
+// as the server may have closed it in the meantime.
+#define SQL_POOL_PING_SECONDS 60
+
+
+// The client errors that indicate the connection to the server is broken.
+// These are CR_SERVER_GONE_ERROR and CR_SERVER_LOST.
+#define SQL_ERROR_SERVER_GONE 2006
+#define SQL_ERROR_SERVER_LOST 2013
+
+
+// One connection in the pool.
+class sql_connection
 {
-  // Initialize the MySQL structure.
-  MYSQL * con = mysql_init (NULL);
+public:
+  MYSQL * mysql = nullptr;
+  string host;
+  int returned = 0;
+  bool healthy = true;
+  map <string, MYSQL_STMT *> statements;
+};
+
+
+// Statistics about the usage of the pool for one host.
+struct sql_pool_statistics_type
+{
+  int created = 0;
+  int reused = 0;
+  int failed = 0;
+  int waited = 0;
+};
+
+
+// The pool is allocated once and never freed.
+// The write-behind thread may still be writing after the program returned from main,
+// and the pool should still be there for it then.
+mutex & sql_pool_mutex = * new mutex;
+condition_variable & sql_pool_condition = * new condition_variable;
+unordered_map <string, vector <sql_connection *> > & sql_pool_idle = * new unordered_map <string, vector <sql_connection *> >;
+unordered_map <string, int> & sql_pool_open = * new unordered_map <string, int>;
+unordered_map <string, sql_pool_statistics_type> & sql_pool_statistics_data = * new unordered_map <string, sql_pool_statistics_type>;
+
+
+// The client library needs to be set up for each thread that uses it.
+// Since a thread may use a connection that another thread opened,
+// it is done for every thread that creates an SQL object,
+// and undone when the thread finishes.
+class sql_thread_guard
+{
+public:
+  sql_thread_guard () { mysql_thread_init (); }
+  ~sql_thread_guard () { mysql_thread_end (); }
+};
+
+
+void sql_connection_close (sql_connection * pooled)
+{
+  for (auto & element : pooled->statements) {
+    mysql_stmt_close (element.second);
+  }
+  if (pooled->mysql) mysql_close (pooled->mysql);
+  delete pooled;
+}
+
+
+// Takes a connection to the $host from the pool, or opens a new one.
+// Returns a connection whose mysql member is NULL if it could not connect.
+sql_connection * sql_pool_checkout (const string & host)
+{
+  thread_local sql_thread_guard guard;
+  (void) guard;
   
-  // Initialize the object's variables.
-  connection = con;
-  connected = true;
+  sql_connection * pooled = nullptr;
+  {
+    unique_lock <mutex> lock (sql_pool_mutex);
+    vector <sql_connection *> & idle = sql_pool_idle [host];
+    if (idle.empty () && (sql_pool_open [host] >= SQL_POOL_MAXIMUM_CONNECTIONS)) {
+      sql_pool_statistics_data [host].waited++;
+      sql_pool_condition.wait_for (lock, chrono::seconds (SQL_POOL_WAIT_SECONDS), [&] {
+        return !idle.empty () || (sql_pool_open [host] < SQL_POOL_MAXIMUM_CONNECTIONS);
+      });
+    }
+    if (!idle.empty ()) {
+      // Take the most recently returned connection, as that one is most likely to be alive.
+      pooled = idle.back ();
+      idle.pop_back ();
+    } else {
+      sql_pool_open [host]++;
+    }
+  }
   
+  // Health check on a connection that has been idle for a while.
+  if (pooled) {
+    if (seconds_since_epoch () - pooled->returned > SQL_POOL_PING_SECONDS) {
+      if (mysql_ping (pooled->mysql)) {
+        sql_connection_close (pooled);
+        pooled = nullptr;
+        // The slot of the closed connection is taken over by the new one opened below.
+        lock_guard <mutex> lock (sql_pool_mutex);
+        sql_pool_statistics_data [host].failed++;
+      }
+    }
+  }
+  if (pooled) {
+    lock_guard <mutex> lock (sql_pool_mutex);
+    sql_pool_statistics_data [host].reused++;
+    return pooled;
+  }
+  
+  // Open a new connection.
+  pooled = new sql_connection;
+  pooled->host = host;
+  MYSQL * con = mysql_init (NULL);
   if (con != NULL) {
 
     // The architecture of all programs should be such that it does not make too many connections
@@ -38,35 +160,126 @@ SQL::SQL (string ip_address)
     // Else this error comes up:
     // ERROR 1226 (42000): User 'u940645557_store' has exceeded the 'max_connections_per_hour' resource (current value: 500)
     
-    // The IP address of the MySQL server.
-    // If an IP address is given, take that.
-    // Else it connects to localhost.
-    if (ip_address.empty ()) ip_address = "127.0.0.1";
-    
     // Use another MySQL structure for the result of connecting.
     // It should not overwrite the earlier initialized structure.
     // Because in case of returning NULL, and putting that in the main MySQL structure,
     // no error message can be extracted.
-    MYSQL * result = mysql_real_connect (con, ip_address.c_str(), "root", "yourpasswordhere",  "store", 0, NULL, 0);
+    MYSQL * result = mysql_real_connect (con, host.c_str(), "root", "yourpasswordhere",  "store", 0, NULL, 0);
     // MYSQL * result = mysql_real_connect (con, "sql124.main-hosting.eu", "u940645557_store", "pRHs6Dgra4fxB3R9l",  "u940645557_store", 0, NULL, 0);
     
-    if (result != NULL) return;
+    if (result != NULL) {
+      pooled->mysql = con;
+      lock_guard <mutex> lock (sql_pool_mutex);
+      sql_pool_statistics_data [host].created++;
+      return pooled;
+    }
+  
+    // Error information.
+    // Since this may not be a logical error in the SQL, it it not considered very important.
+    to_stdout ({mysql_error (con)});
+    mysql_close (con);
+  }
+  
+  // Not connected: Give the slot back.
+  {
+    lock_guard <mutex> lock (sql_pool_mutex);
+    sql_pool_statistics_data [host].failed++;
+    sql_pool_open [host]--;
+  }
+  sql_pool_condition.notify_one ();
+  return pooled;
+}
+
+
+// Hands the connection back to the pool.
+// A connection that is broken, or that never connected, gets closed instead.
+void sql_pool_return (sql_connection * pooled)
+{
+  string host = pooled->host;
+  if (pooled->mysql && pooled->healthy) {
+    pooled->returned = seconds_since_epoch ();
+    lock_guard <mutex> lock (sql_pool_mutex);
+    sql_pool_idle [host].push_back (pooled);
+  } else {
+    bool connected = pooled->mysql;
+    sql_connection_close (pooled);
+    if (connected) {
+      lock_guard <mutex> lock (sql_pool_mutex);
+      sql_pool_open [host]--;
+    }
   }
+  sql_pool_condition.notify_one ();
+}
+
+
+// Returns the statistics of the pools of connections, one line per host.
+vector <string> SQL::pool_statistics ()
+{
+  vector <string> lines;
+  lock_guard <mutex> lock (sql_pool_mutex);
+  for (auto & element : sql_pool_statistics_data) {
+    const sql_pool_statistics_type & statistics = element.second;
+    int calls = statistics.created + statistics.reused;
+    if (!calls && !statistics.failed) continue;
+    string line = element.first;
+    line.append (" connections " + to_string (calls));
+    line.append (" created " + to_string (statistics.created));
+    line.append (" reused " + to_string (statistics.reused));
+    line.append (" failed " + to_string (statistics.failed));
+    line.append (" waited " + to_string (statistics.waited));
+    line.append (" idle " + to_string (sql_pool_idle [element.first].size ()));
+    lines.push_back (line);
+  }
+  return lines;
+}
 
-  // Error information.
-  // Since this may not be a logical error in the SQL, it it not considered very important.
-  to_stdout ({mysql_error (con)});
+
+SQL::SQL (string ip_address)
+{
+  // Initialize the object's variables.
+  result = NULL;
+  row = NULL;
+  lengths = NULL;
+  statement = NULL;
+  max_packet = 0;
+  
+  // The IP address of the MySQL server.
+  // If an IP address is given, take that.
+  // Else it connects to localhost.
+  if (ip_address.empty ()) ip_address = "127.0.0.1";
+  host = ip_address;
   
-  // Not connected.
-  connected = false;
+  // Take a connection from the pool.
+  sql_connection * pooled = sql_pool_checkout (ip_address);
+  this->pooled = pooled;
+  connection = pooled->mysql;
+  connected = (connection != NULL);
 }
 
 
 SQL::~SQL ()
 {
-  if (connection) {
-    MYSQL * con = (MYSQL *) connection;
-    mysql_close(con);
+  finish ();
+  sql_pool_return ((sql_connection *) pooled);
+}
+
+
+// The IP address of the MySQL server this object talks to.
+string SQL::address ()
+{
+  return host;
+}
+
+
+// Logs the error on the connection after running $prefix.
+// If the error shows the connection to be broken, it won't go back to the pool.
+void SQL::diagnose (const string & prefix)
+{
+  MYSQL * con = (MYSQL *) connection;
+  to_stderr ({prefix, mysql_error (con)});
+  unsigned int error = mysql_errno (con);
+  if ((error == SQL_ERROR_SERVER_GONE) || (error == SQL_ERROR_SERVER_LOST)) {
+    ((sql_connection *) pooled)->healthy = false;
   }
 }
 
@@ -96,10 +309,7 @@ void SQL::add (int value)
 void SQL::add (float value)
 {
   sql.append (" ");
-  stringstream ss;
-  ss << setprecision (numeric_limits<float>::digits10+1);
-  ss << value;
-  sql.append (ss.str());
+  sql.append (format (value));
   sql.append (" ");
 }
 
@@ -107,7 +317,32 @@ void SQL::add (float value)
 void SQL::add (string value)
 {
   sql.append (" '");
+  sql.append (escape (value));
+  sql.append ("' ");
+}
+
+
+void SQL::add (const SQL & value)
+{
+  sql.append (" (");
+  sql.append (value.sql);
+  sql.append (") ");
+}
+
+
+// Formats the float for use in a statement.
+string SQL::format (float value)
+{
+  stringstream ss;
+  ss << setprecision (numeric_limits<float>::digits10+1);
+  ss << value;
+  return ss.str();
+}
+
 
+// Escapes the value for use as a string in a statement.
+string SQL::escape (const string & value)
+{
   /*
    This is the old code.
    It crashed the bot multiple times per day.
@@ -118,46 +353,63 @@ void SQL::add (string value)
    mysql_real_escape_string (con, to, from, strlen (from));
    value = to;
 
-   The new code below has not yet crashed the bot even once.
+   The code that replaced it escaped the value one character at a time,
+   taking each character as a new string, and comparing it with seven other strings.
+   The code below does the same, but on plain characters,
+   and it does not have to allocate memory for every character.
    */
 
   // Put an extra backslash before the following characters:
   // \x00, \n, \r, \, ', " and \x1a
+  // The \x00 is written as \0, because the statement is passed on as a C string.
   string escaped;
-  for (unsigned int i = 0; i < value.size (); i++) {
-    string character = value.substr (i, 1);
-    bool escape = false;
-    if (character == "\x00") escape = true;
-    if (character == "\n") escape = true;
-    if (character == "\r") escape = true;
-    if (character == "\\") escape = true;
-    if (character == "'") escape = true;
-    if (character == "\"") escape = true;
-    if (character == "\x1a") escape = true;
-    if (escape) escaped.append ("\\");
-    escaped.append (character);
+  escaped.reserve (value.size () + 8);
+  for (char character : value) {
+    switch (character) {
+      case '\0':
+        escaped.append ("\\0");
+        break;
+      case '\n':
+      case '\r':
+      case '\\':
+      case '\'':
+      case '"':
+      case '\x1a':
+        escaped.push_back ('\\');
+        escaped.push_back (character);
+        break;
+      default:
+        escaped.push_back (character);
+    }
   }
-  
-  sql.append (escaped);
-  sql.append ("' ");
+  return escaped;
 }
 
 
-void SQL::add (const SQL & value)
+// Whether the last statement failed.
+bool SQL::failed ()
 {
-  sql.append (" (");
-  sql.append (value.sql);
-  sql.append (") ");
+  if (!connected) return true;
+  return mysql_errno ((MYSQL *) connection) != 0;
+}
+
+
+// Whether the connection to the database got lost.
+bool SQL::lost ()
+{
+  if (!connected) return true;
+  return !((sql_connection *) pooled)->healthy;
 }
 
 
 void SQL::execute ()
 {
   if (!connected) return;
+  finish ();
   MYSQL * con = (MYSQL *) connection;
   int result = mysql_query (con, sql.c_str());
   if (result) {
-    to_stderr ({sql, mysql_error (con)});
+    diagnose (sql);
   }
 }
 
@@ -165,19 +417,20 @@ void SQL::execute ()
 map <string, vector <string> > SQL::query ()
 {
   if (!connected) return {};
+  finish ();
   
   MYSQL * con = (MYSQL *) connection;
 
   int query_result = mysql_query (con, sql.c_str());
   if (query_result) {
-    to_stderr ({sql, mysql_error (con)});
+    diagnose (sql);
     return {};
   }
   
   MYSQL_RES * result = mysql_store_result (con);
   if (result == NULL)
   {
-    to_stderr ({sql, mysql_error (con)});
+    diagnose (sql);
     return {};
   }
 
@@ -206,3 +459,633 @@ map <string, vector <string> > SQL::query ()
 
   return values;
 }
+
+
+// Reading a large result through query () holds all of it in memory twice:
+// Once in the client library, and once as strings in the returned map.
+// The streaming cursor below fetches the rows from the server one by one instead,
+// and the caller reads the values of the current row as typed values.
+// It goes like this:
+// sql.add ("SELECT second, bid FROM rates;");
+// if (sql.stream ()) {
+//   while (sql.fetch ()) {
+//     int second = sql.column_int (0);
+//     float bid = sql.column_float (1);
+//   }
+// }
+// While the rows are being streamed, the connection cannot run other statements.
+// Running another statement discards the rows not yet fetched.
+bool SQL::stream ()
+{
+  if (!connected) return false;
+  finish ();
+  MYSQL * con = (MYSQL *) connection;
+  if (mysql_real_query (con, sql.c_str(), sql.size ())) {
+    diagnose (sql);
+    return false;
+  }
+  MYSQL_RES * res = mysql_use_result (con);
+  if (res == NULL) {
+    diagnose (sql);
+    return false;
+  }
+  result = res;
+  return true;
+}
+
+
+// Fetches the next row from the stream.
+// Returns false when there's no more rows.
+bool SQL::fetch ()
+{
+  if (!result) return false;
+  MYSQL_RES * res = (MYSQL_RES *) result;
+  row = mysql_fetch_row (res);
+  if (row == NULL) {
+    MYSQL * con = (MYSQL *) connection;
+    if (mysql_errno (con)) diagnose (sql);
+    finish ();
+    return false;
+  }
+  lengths = mysql_fetch_lengths (res);
+  return true;
+}
+
+
+// Reads the value of $column in the current row.
+// The first column has index 0.
+// A NULL value reads as zero or as an empty string.
+int SQL::column_int (int column)
+{
+  if (!row || !row [column]) return 0;
+  return atoi (row [column]);
+}
+
+
+float SQL::column_float (int column)
+{
+  if (!row || !row [column]) return 0;
+  return strtof (row [column], NULL);
+}
+
+
+string SQL::column_text (int column)
+{
+  if (!row || !row [column]) return "";
+  return string (row [column], lengths ? lengths [column] : strlen (row [column]));
+}
+
+
+// Discards the rest of the streamed rows, if any.
+void SQL::finish ()
+{
+  if (result) {
+    mysql_free_result ((MYSQL_RES *) result);
+    result = NULL;
+  }
+  row = NULL;
+  lengths = NULL;
+}
+
+
+// Server-side prepared statements.
+// The server parses the statement once per connection,
+// and the values are sent along in binary, without formatting or escaping them.
+// It goes like this:
+// sql.prepare ("INSERT INTO availables (second, seller) VALUES (?, ?);");
+// sql.bind (1, second); sql.bind (2, seller);
+// sql.run ();
+// ... repeat prepare / bind / run for every row ...
+// The prepared statements are cached per connection.
+// Returns false if the statement could not be prepared.
+bool SQL::prepare (const string & statement)
+{
+  this->statement = NULL;
+  statement_sql = statement;
+  parameters.clear ();
+  if (!connected) return false;
+  finish ();
+  MYSQL * con = (MYSQL *) connection;
+  MYSQL_STMT * stmt = NULL;
+  map <string, MYSQL_STMT *> & statements = ((sql_connection *) pooled)->statements;
+  auto iterator = statements.find (statement);
+  if (iterator != statements.end ()) {
+    stmt = iterator->second;
+  } else {
+    stmt = mysql_stmt_init (con);
+    if (stmt == NULL) {
+      diagnose (statement);
+      return false;
+    }
+    if (mysql_stmt_prepare (stmt, statement.c_str (), statement.size ())) {
+      to_stderr ({statement, mysql_stmt_error (stmt)});
+      mysql_stmt_close (stmt);
+      return false;
+    }
+    statements [statement] = stmt;
+  }
+  this->statement = stmt;
+  parameters.resize (mysql_stmt_param_count (stmt));
+  return true;
+}
+
+
+// Binds $value to the parameter at $index in the prepared statement.
+// The first parameter has index 1.
+void SQL::bind (int index, int value)
+{
+  if ((index < 1) || (index > (int) parameters.size ())) return;
+  parameters [index - 1] = make_tuple (MYSQL_TYPE_LONGLONG, value, 0, "");
+}
+
+
+void SQL::bind (int index, float value)
+{
+  if ((index < 1) || (index > (int) parameters.size ())) return;
+  parameters [index - 1] = make_tuple (MYSQL_TYPE_DOUBLE, 0, value, "");
+}
+
+
+void SQL::bind (int index, const string & value)
+{
+  if ((index < 1) || (index > (int) parameters.size ())) return;
+  parameters [index - 1] = make_tuple (MYSQL_TYPE_STRING, 0, 0, value);
+}
+
+
+// Executes the prepared statement with the bound values.
+void SQL::run ()
+{
+  if (!statement) return;
+  MYSQL_STMT * stmt = (MYSQL_STMT *) statement;
+  vector <MYSQL_BIND> binds (parameters.size ());
+  vector <unsigned long> text_lengths (parameters.size ());
+  for (size_t i = 0; i < parameters.size (); i++) {
+    MYSQL_BIND & bind = binds [i];
+    memset (&bind, 0, sizeof (bind));
+    auto & parameter = parameters [i];
+    bind.buffer_type = (enum_field_types) get <0> (parameter);
+    if (bind.buffer_type == MYSQL_TYPE_LONGLONG) {
+      bind.buffer = &get <1> (parameter);
+    } else if (bind.buffer_type == MYSQL_TYPE_DOUBLE) {
+      bind.buffer = &get <2> (parameter);
+    } else {
+      bind.buffer_type = MYSQL_TYPE_STRING;
+      text_lengths [i] = get <3> (parameter).size ();
+      bind.buffer = (void *) get <3> (parameter).data ();
+      bind.buffer_length = text_lengths [i];
+      bind.length = &text_lengths [i];
+    }
+  }
+  if (!binds.empty ()) {
+    if (mysql_stmt_bind_param (stmt, binds.data ())) {
+      to_stderr ({statement_sql, mysql_stmt_error (stmt)});
+      return;
+    }
+  }
+  if (mysql_stmt_execute (stmt)) {
+    to_stderr ({statement_sql, mysql_stmt_error (stmt)});
+    unsigned int error = mysql_stmt_errno (stmt);
+    if ((error == SQL_ERROR_SERVER_GONE) || (error == SQL_ERROR_SERVER_LOST)) {
+      ((sql_connection *) pooled)->healthy = false;
+    }
+  }
+}
+
+
+// The maximum size of a statement the server accepts.
+size_t SQL::maximum_packet ()
+{
+  if (!max_packet) {
+    // The default of older servers, in case the server does not tell.
+    max_packet = 1024 * 1024;
+    string saved_sql = sql;
+    clear ();
+    add ("SELECT @@max_allowed_packet;");
+    vector <string> values = query () ["@@max_allowed_packet"];
+    if (!values.empty ()) {
+      long long value = atoll (values [0].c_str ());
+      if (value > 0) max_packet = value;
+    }
+    sql = saved_sql;
+  }
+  return max_packet;
+}
+
+
+// The $statement is the part before the values, like so:
+// "INSERT INTO balances (seconds, exchange, coin) VALUES"
+// The optional suffix goes after the values of every statement sent,
+// for example an "ON DUPLICATE KEY UPDATE" clause.
+SQLInsert::SQLInsert (SQL & sql, const string & statement, const string & suffix) : sql (sql), statement (statement), suffix (suffix)
+{
+  row_count = 0;
+  total_count = 0;
+}
+
+
+SQLInsert::~SQLInsert ()
+{
+  flush ();
+}
+
+
+// Starts a new row.
+void SQLInsert::row ()
+{
+  end_row ();
+}
+
+
+void SQLInsert::add (int value)
+{
+  if (!current.empty ()) current.append (",");
+  current.append (to_string (value));
+}
+
+
+void SQLInsert::add (float value)
+{
+  if (!current.empty ()) current.append (",");
+  current.append (SQL::format (value));
+}
+
+
+void SQLInsert::add (const string & value)
+{
+  if (!current.empty ()) current.append (",");
+  current.append ("'");
+  current.append (SQL::escape (value));
+  current.append ("'");
+}
+
+
+// Sends the rows collected so far to the database.
+void SQLInsert::flush ()
+{
+  end_row ();
+  if (!row_count) return;
+  sql.clear ();
+  sql.sql = statement + " " + values;
+  if (!suffix.empty ()) sql.sql.append (" " + suffix);
+  sql.sql.append (";");
+  sql.execute ();
+  values.clear ();
+  row_count = 0;
+}
+
+
+// The number of rows added.
+int SQLInsert::rows ()
+{
+  return total_count + (current.empty () ? 0 : 1);
+}
+
+
+void SQLInsert::end_row ()
+{
+  if (current.empty ()) return;
+  string entry = "(" + current + ")";
+  current.clear ();
+  // Leave some room for the statement and the terminator.
+  size_t maximum = sql.maximum_packet () - 1024;
+  if (row_count && (statement.size () + suffix.size () + values.size () + entry.size () + 3 > maximum)) {
+    flush ();
+  }
+  if (row_count) values.append (",");
+  values.append (entry);
+  row_count++;
+  total_count++;
+}
+
+
+
+// Many writes on the trading path are not critical for trading:
+// Failures, trades and availables for the reports, forecasts for the optimizer, and so on.
+// Writing them to the database used to block the thread till the database had stored them,
+// while that thread should be placing orders.
+// Such writes can now be deferred to a write-behind queue.
+// A background thread takes the statements from the queue,
+// and runs them per host in groups, each group in one transaction, so the database commits them in one go.
+// The queue is bounded:
+// If it is full, the statement is run straight away, as it used to be.
+// When the program finishes, the thread writes what remains in the queue.
+// What it cannot write, because the database cannot be reached, it spills to a file.
+// The next program that defers a write, picks up the spilled statements again.
+// Writes that are critical should still call execute ().
+
+
+// The maximum number of bytes of the statements in the queue.
+#define SQL_WRITE_BEHIND_MAXIMUM_BYTES (8 * 1024 * 1024)
+
+
+// The maximum number of statements per transaction.
+#define SQL_WRITE_BEHIND_GROUP 500
+
+
+// The time the program waits for the queue to be written when it finishes.
+#define SQL_WRITE_BEHIND_FINISH_SECONDS 30
+
+
+// A statement in the queue, and the host to run it on.
+struct sql_deferred_type
+{
+  string host;
+  string statement;
+};
+
+
+// Statistics about the write-behind queue.
+struct sql_write_behind_statistics_type
+{
+  long queued = 0;
+  long written = 0;
+  long failed = 0;
+  long synchronous = 0;
+  long spilled = 0;
+  long replayed = 0;
+  size_t maximum_depth = 0;
+  long flushes = 0;
+  long flush_milliseconds = 0;
+  long maximum_flush_milliseconds = 0;
+};
+
+
+// The queue is allocated once and never freed.
+// If the database is too slow when the program finishes, the thread keeps writing,
+// while the program returns from main and destroys the static objects.
+mutex & sql_write_behind_mutex = * new mutex;
+condition_variable & sql_write_behind_condition = * new condition_variable;
+deque <sql_deferred_type> & sql_write_behind_queue = * new deque <sql_deferred_type>;
+size_t sql_write_behind_bytes = 0;
+bool sql_write_behind_running = false;
+bool sql_write_behind_stopping = false;
+bool sql_write_behind_stopped = false;
+sql_write_behind_statistics_type sql_write_behind_statistics_data;
+
+
+string sql_write_behind_spill_prefix ()
+{
+  return "writebehind_";
+}
+
+
+string sql_write_behind_spill_suffix ()
+{
+  return ".spill";
+}
+
+
+// Writes the $statements to a spill file in the databases folder.
+// Each statement is stored with its host, both preceded by their lengths.
+// It writes a temporary file first, and renames that once it is complete.
+// So a crash or a full disk does not leave a truncated spill file behind.
+void sql_write_behind_spill (const deque <sql_deferred_type> & statements)
+{
+  if (statements.empty ()) return;
+  string contents;
+  for (auto & deferred : statements) {
+    for (auto & text : {deferred.host, deferred.statement}) {
+      contents.append (to_string (text.size ()));
+      contents.append (" ");
+      contents.append (text);
+    }
+  }
+  string name = sql_write_behind_spill_prefix () + to_string (getpid ()) + "_" + to_string (milliseconds_since_epoch ());
+  string path = SqliteDatabase::path ("") + "/" + name + sql_write_behind_spill_suffix ();
+  string temporary = SqliteDatabase::path ("") + "/" + name + ".tmp";
+  ofstream file (temporary, ios::binary | ios::trunc);
+  file << contents;
+  file.close ();
+  if (!file || (rename (temporary.c_str (), path.c_str ()) != 0)) {
+    unlink (temporary.c_str ());
+    to_stderr ({"Could not spill", to_string (statements.size ()), "database writes to", path});
+    return;
+  }
+  to_stderr ({"Spilled", to_string (statements.size ()), "database writes to", path});
+}
+
+
+// Reads the statements from the spill files left by earlier programs.
+// A file is renamed first, so only one program picks it up.
+deque <sql_deferred_type> sql_write_behind_replay ()
+{
+  deque <sql_deferred_type> statements;
+  string folder = SqliteDatabase::path ("");
+  for (auto file : scandir (folder)) {
+    if (file.find (sql_write_behind_spill_prefix ()) != 0) continue;
+    if (file.find (sql_write_behind_spill_suffix ()) == string::npos) continue;
+    string path = folder + "/" + file;
+    string claimed = path + "." + to_string (getpid ());
+    if (rename (path.c_str (), claimed.c_str ()) != 0) continue;
+    string contents = file_get_contents (claimed);
+    unlink (claimed.c_str ());
+    size_t offset = 0;
+    while (offset < contents.size ()) {
+      size_t record = offset;
+      vector <string> texts;
+      for (int i = 0; i < 2; i++) {
+        size_t space = contents.find (' ', offset);
+        if (space == string::npos) break;
+        size_t length = atol (contents.substr (offset, space - offset).c_str ());
+        // A text that goes past the end of the file got truncated.
+        if (length > contents.size () - space - 1) break;
+        texts.push_back (contents.substr (space + 1, length));
+        offset = space + 1 + length;
+      }
+      // Never run part of a statement.
+      if (texts.size () != 2) {
+        to_stderr ({"Skipping the incomplete database writes from byte", to_string (record), "in", file});
+        break;
+      }
+      statements.push_back ({texts[0], texts[1]});
+    }
+  }
+  return statements;
+}
+
+
+// The background thread that writes the queued statements.
+void sql_write_behind_writer ()
+{
+  // Pick up the statements spilled by earlier programs.
+  {
+    deque <sql_deferred_type> replayed = sql_write_behind_replay ();
+    lock_guard <mutex> lock (sql_write_behind_mutex);
+    sql_write_behind_statistics_data.replayed += replayed.size ();
+    for (auto & deferred : replayed) {
+      sql_write_behind_bytes += deferred.statement.size ();
+      sql_write_behind_queue.push_back (deferred);
+    }
+  }
+  
+  while (true) {
+    
+    // Take a group of statements for one host from the queue.
+    vector <string> statements;
+    string host;
+    bool stopping = false;
+    {
+      unique_lock <mutex> lock (sql_write_behind_mutex);
+      sql_write_behind_condition.wait (lock, [] {
+        return !sql_write_behind_queue.empty () || sql_write_behind_stopping;
+      });
+      stopping = sql_write_behind_stopping;
+      if (sql_write_behind_queue.empty ()) break;
+      host = sql_write_behind_queue.front ().host;
+      for (auto iterator = sql_write_behind_queue.begin (); iterator != sql_write_behind_queue.end ();) {
+        if (statements.size () >= SQL_WRITE_BEHIND_GROUP) break;
+        if (iterator->host == host) {
+          statements.push_back (iterator->statement);
+          sql_write_behind_bytes -= iterator->statement.size ();
+          iterator = sql_write_behind_queue.erase (iterator);
+        } else {
+          ++iterator;
+        }
+      }
+    }
+    
+    // Write the group in one transaction.
+    // A statement that fails on its own, e.g. on a duplicate key, is left out and counted.
+    // If the connection gets lost, the database rolls back the transaction,
+    // so the whole group is still to be written.
+    // The same goes for a deadlock or a lock wait timeout:
+    // The database may have rolled back the statements before it, so all of them get written again.
+    long start = milliseconds_since_epoch ();
+    SQL sql (host);
+    bool lost = !sql.connected;
+    size_t failed = 0;
+    if (!lost) {
+      sql.sql = "START TRANSACTION;";
+      sql.execute ();
+      lost = sql.lost ();
+    }
+    for (size_t i = 0; !lost && (i < statements.size ()); i++) {
+      sql.sql = statements [i];
+      sql.execute ();
+      lost = sql.lost ();
+      if (!lost && sql.failed ()) {
+        unsigned int error = mysql_errno ((MYSQL *) sql.connection);
+        if ((error == 1213) || (error == 1205)) lost = true;
+        else failed++;
+      }
+    }
+    if (!lost) {
+      sql.sql = "COMMIT;";
+      sql.execute ();
+      lost = sql.failed ();
+    }
+    if (lost) {
+      // The database cannot be reached, or the transaction did not get committed.
+      // Make sure nothing of the group gets committed later on the same connection.
+      if (!sql.lost ()) {
+        sql.sql = "ROLLBACK;";
+        sql.execute ();
+      }
+      // Put the statements back in the queue in their original order, and try again later.
+      // When the program finishes, spill them all.
+      unique_lock <mutex> lock (sql_write_behind_mutex);
+      for (auto iterator = statements.rbegin (); iterator != statements.rend (); ++iterator) {
+        sql_write_behind_bytes += iterator->size ();
+        sql_write_behind_queue.push_front ({host, * iterator});
+      }
+      if (stopping) break;
+      sql_write_behind_condition.wait_for (lock, chrono::seconds (5), [] { return sql_write_behind_stopping; });
+      continue;
+    }
+    long milliseconds = milliseconds_since_epoch () - start;
+    
+    lock_guard <mutex> lock (sql_write_behind_mutex);
+    sql_write_behind_statistics_type & statistics = sql_write_behind_statistics_data;
+    statistics.written += statements.size () - failed;
+    statistics.failed += failed;
+    statistics.flushes++;
+    statistics.flush_milliseconds += milliseconds;
+    if (milliseconds > statistics.maximum_flush_milliseconds) statistics.maximum_flush_milliseconds = milliseconds;
+  }
+  
+  // Spill what could not be written.
+  {
+    lock_guard <mutex> lock (sql_write_behind_mutex);
+    sql_write_behind_spill (sql_write_behind_queue);
+    sql_write_behind_statistics_data.spilled += sql_write_behind_queue.size ();
+    sql_write_behind_queue.clear ();
+    sql_write_behind_bytes = 0;
+    sql_write_behind_stopped = true;
+  }
+  sql_write_behind_condition.notify_all ();
+}
+
+
+// Defers running the statement to the write-behind queue.
+// The statement should not depend on being run straight away,
+// and the caller should not depend on reading its result back straight away.
+void SQL::defer ()
+{
+  {
+    lock_guard <mutex> lock (sql_write_behind_mutex);
+    bool full = (sql_write_behind_bytes + sql.size () > SQL_WRITE_BEHIND_MAXIMUM_BYTES);
+    if (!full && !sql_write_behind_stopping) {
+      if (!sql_write_behind_running) {
+        sql_write_behind_running = true;
+        // The thread is detached, so a program that exits without finishing the queue, does not crash.
+        thread (sql_write_behind_writer).detach ();
+      }
+      sql_write_behind_queue.push_back ({host, sql});
+      sql_write_behind_bytes += sql.size ();
+      sql_write_behind_statistics_type & statistics = sql_write_behind_statistics_data;
+      statistics.queued++;
+      if (sql_write_behind_queue.size () > statistics.maximum_depth) statistics.maximum_depth = sql_write_behind_queue.size ();
+      sql_write_behind_condition.notify_all ();
+      return;
+    }
+    sql_write_behind_statistics_data.synchronous++;
+  }
+  // The queue is full, or the program is finishing: Run the statement now.
+  execute ();
+}
+
+
+// Writes the remaining statements in the queue, and stops the background thread.
+// The program calls this when it finishes.
+void SQL::write_behind_finish ()
+{
+  unique_lock <mutex> lock (sql_write_behind_mutex);
+  if (!sql_write_behind_running) return;
+  sql_write_behind_stopping = true;
+  sql_write_behind_condition.notify_all ();
+  bool stopped = sql_write_behind_condition.wait_for (lock, chrono::seconds (SQL_WRITE_BEHIND_FINISH_SECONDS), [] {
+    return sql_write_behind_stopped;
+  });
+  // If the database is too slow, spill what remains.
+  // The statement being written now, if any, is left to the thread.
+  if (!stopped) {
+    sql_write_behind_spill (sql_write_behind_queue);
+    sql_write_behind_statistics_data.spilled += sql_write_behind_queue.size ();
+    sql_write_behind_queue.clear ();
+    sql_write_behind_bytes = 0;
+  }
+}
+
+
+// Returns the statistics of the write-behind queue.
+vector <string> SQL::write_behind_statistics ()
+{
+  lock_guard <mutex> lock (sql_write_behind_mutex);
+  const sql_write_behind_statistics_type & statistics = sql_write_behind_statistics_data;
+  if (!statistics.queued && !statistics.synchronous && !statistics.replayed) return {};
+  string line = "queued " + to_string (statistics.queued);
+  line.append (" written " + to_string (statistics.written));
+  line.append (" failed " + to_string (statistics.failed));
+  line.append (" synchronous " + to_string (statistics.synchronous));
+  line.append (" replayed " + to_string (statistics.replayed));
+  line.append (" spilled " + to_string (statistics.spilled));
+  line.append (" depth " + to_string (sql_write_behind_queue.size ()));
+  line.append (" maximum depth " + to_string (statistics.maximum_depth));
+  if (statistics.flushes) {
+    line.append (" flushes " + to_string (statistics.flushes));
+    line.append (" average " + to_string (statistics.flush_milliseconds / statistics.flushes) + " ms");
+    line.append (" maximum " + to_string (statistics.maximum_flush_milliseconds) + " ms");
+  }
+  return { line };
+}
@@ -37,10 +37,67 @@ public:
   void add (const SQL & value);
   string sql;
   void execute ();
+  bool failed ();
+  bool lost ();
   map <string, vector <string> > query ();
+  bool stream ();
+  bool fetch ();
+  int column_int (int column);
+  float column_float (int column);
+  string column_text (int column);
+  bool prepare (const string & statement);
+  void bind (int index, int value);
+  void bind (int index, float value);
+  void bind (int index, const string & value);
+  void run ();
+  size_t maximum_packet ();
+  string address ();
+  static string escape (const string & value);
+  static string format (float value);
+  static vector <string> pool_statistics ();
+  void defer ();
+  static void write_behind_finish ();
+  static vector <string> write_behind_statistics ();
 private:
+  friend void sql_write_behind_writer ();
+  string host;
   void * connection;
   bool connected;
+  void * result;
+  char ** row;
+  unsigned long * lengths;
+  void finish ();
+  void * pooled;
+  void diagnose (const string & prefix);
+  void * statement;
+  string statement_sql;
+  vector <tuple <int, long long, double, string> > parameters;
+  size_t max_packet;
+};
+
+
+// Builds INSERT statements with many rows each,
+// and sends them to the database whenever the statement would exceed the maximum packet size.
+class SQLInsert
+{
+public:
+  SQLInsert (SQL & sql, const string & statement, const string & suffix = "");
+  ~SQLInsert ();
+  void row ();
+  void add (int value);
+  void add (float value);
+  void add (const string & value);
+  void flush ();
+  int rows ();
+private:
+  SQL & sql;
+  string statement;
+  string suffix;
+  string values;
+  string current;
+  int row_count;
+  int total_count;
+  void end_row ();
 };
 
 
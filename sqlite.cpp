@@ -45,6 +45,7 @@ int SqliteReader::callback (void *userdata, int argc, char **argv, char **column
 SqliteDatabase::SqliteDatabase (string database)
 {
   db = NULL;
+  statement = NULL;
   name = database;
   string filename = path (database);
   sqlite3 *db3;
@@ -61,6 +62,9 @@ SqliteDatabase::SqliteDatabase (string database)
 
 SqliteDatabase::~SqliteDatabase ()
 {
+  for (auto & element : statements) {
+    sqlite3_finalize ((sqlite3_stmt *) element.second);
+  }
   if (db) {
     sqlite3 * database = (sqlite3 *) db;
     sqlite3_close (database);
@@ -142,6 +146,132 @@ map <string, vector <string> > SqliteDatabase::query ()
 }
 
 
+// Storing or reading many rows by building SQL text, with the values formatted as text,
+// and getting every value back as text to be converted again,
+// costs more than the work SQLite does.
+// The prepared statements below avoid that.
+// They are compiled once per database connection and kept in a cache,
+// and the values are bound to, and read from, them as typed values.
+// It goes like this:
+// sql.begin ();
+// sql.prepare ("INSERT INTO pattern (second, bid, ask) VALUES (?, ?, ?);");
+// sql.bind (1, second); sql.bind (2, bid); sql.bind (3, ask);
+// sql.step ();
+// ... repeat prepare / bind / step for every row ...
+// sql.commit ();
+// Or for reading:
+// sql.prepare ("SELECT second, bid FROM pattern;");
+// while (sql.step ()) { int second = sql.column_int (0); double bid = sql.column_double (1); }
+
+
+void SqliteDatabase::begin ()
+{
+  clear ();
+  add ("BEGIN;");
+  execute ();
+}
+
+
+void SqliteDatabase::commit ()
+{
+  clear ();
+  add ("COMMIT;");
+  execute ();
+}
+
+
+void SqliteDatabase::rollback ()
+{
+  clear ();
+  add ("ROLLBACK;");
+  execute ();
+}
+
+
+// Makes $statement the current statement, ready for binding values and stepping through it.
+// Preparing the same statement again reuses the compiled statement from the cache.
+void SqliteDatabase::prepare (const string & statement)
+{
+  this->statement = NULL;
+  statement_sql = statement;
+  if (!db) return;
+  sqlite3_stmt * stmt = NULL;
+  auto iterator = statements.find (statement);
+  if (iterator != statements.end ()) {
+    stmt = (sqlite3_stmt *) iterator->second;
+    sqlite3_reset (stmt);
+    sqlite3_clear_bindings (stmt);
+  } else {
+    int rc = sqlite3_prepare_v2 ((sqlite3 *) db, statement.c_str (), -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+      diagnose (statement, NULL);
+      if (stmt) sqlite3_finalize (stmt);
+      return;
+    }
+    statements [statement] = stmt;
+  }
+  this->statement = stmt;
+}
+
+
+// Binds $value to the parameter at $index in the current statement.
+// The first parameter has index 1.
+void SqliteDatabase::bind (int index, int value)
+{
+  if (statement) sqlite3_bind_int ((sqlite3_stmt *) statement, index, value);
+}
+
+
+void SqliteDatabase::bind (int index, double value)
+{
+  if (statement) sqlite3_bind_double ((sqlite3_stmt *) statement, index, value);
+}
+
+
+void SqliteDatabase::bind (int index, const string & value)
+{
+  if (statement) sqlite3_bind_text ((sqlite3_stmt *) statement, index, value.c_str (), value.size (), SQLITE_TRANSIENT);
+}
+
+
+// Runs the current statement up to the next row.
+// Returns true if there's a row to read with the column accessors.
+// Returns false once the statement is done, or on error.
+bool SqliteDatabase::step ()
+{
+  if (!statement) return false;
+  int rc = sqlite3_step ((sqlite3_stmt *) statement);
+  if (rc == SQLITE_ROW) return true;
+  if (rc != SQLITE_DONE) diagnose (statement_sql, NULL);
+  return false;
+}
+
+
+// Reads the value of $column in the current row.
+// The first column has index 0.
+int SqliteDatabase::column_int (int column)
+{
+  if (!statement) return 0;
+  return sqlite3_column_int ((sqlite3_stmt *) statement, column);
+}
+
+
+double SqliteDatabase::column_double (int column)
+{
+  if (!statement) return 0;
+  return sqlite3_column_double ((sqlite3_stmt *) statement, column);
+}
+
+
+string SqliteDatabase::column_text (int column)
+{
+  if (!statement) return "";
+  const unsigned char * text = sqlite3_column_text ((sqlite3_stmt *) statement, column);
+  if (!text) return "";
+  return string ((const char *) text, sqlite3_column_bytes ((sqlite3_stmt *) statement, column));
+}
+
+
 // The function provides the path fo the database in the default database folder.
 string SqliteDatabase::path (string database)
 {
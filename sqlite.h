@@ -38,10 +38,24 @@ public:
   string sql;
   void execute ();
   map <string, vector <string> > query ();
+  void begin ();
+  void commit ();
+  void rollback ();
+  void prepare (const string & statement);
+  void bind (int index, int value);
+  void bind (int index, double value);
+  void bind (int index, const string & value);
+  bool step ();
+  int column_int (int column);
+  double column_double (int column);
+  string column_text (int column);
 private:
   string name;
   static string suffix ();
   void * db;
+  map <string, void *> statements;
+  void * statement;
+  string statement_sql;
   void diagnose (const string & prefix, char * error);
 };
 
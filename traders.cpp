@@ -572,9 +572,9 @@ void pattern_buy_coin_now (vector <string> exchanges,
       
       // Check the average rates over the past hour.
       if (checks_good) {
-        unordered_map <int, float> minute_asks, minute_bids, hour_asks, hour_bids;
-        pattern_prepare (&output, exchange, market, coin, minute_asks, minute_bids, hour_asks, hour_bids);
-        float average_hourly_rate = hour_asks [0];
+        TimeSeries minutes, hours;
+        pattern_prepare (&output, exchange, market, coin, minutes, hours);
+        float average_hourly_rate = hours.ask (0);
         if (average_hourly_rate > 0) {
           output.add ({"The average hourly rate just now is", float2string (average_hourly_rate), market});
           if (average_hourly_rate < rate) {
@@ -715,9 +715,9 @@ void set_likely_coin_bought_price (string exchange, string market, string coin)
   // The reason this is a good way of doing things is that this coin is just now encountered,
   // so taking the current price is a very realistic thing to do.
   if (buy_rate == 0) {
-    unordered_map <int, float> minute_asks, minute_bids, hour_asks, hour_bids;
-    pattern_prepare (NULL, exchange, market, coin, minute_asks, minute_bids, hour_asks, hour_bids);
-    buy_rate = hour_asks[0];
+    TimeSeries minutes, hours;
+    pattern_prepare (NULL, exchange, market, coin, minutes, hours);
+    buy_rate = hours.ask (0);
     rate_method = "current hourly average";
   }
   
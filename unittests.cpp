@@ -33,6 +33,7 @@
 #include "sqlite.h"
 #include "kraken.h"
 #include "traders.h"
+#include "simulators.h"
 
 
 void error_message (int line, string func, string desired, string actual)
@@ -1170,6 +1171,13 @@ void test_basic_functions ()
     array_remove (4, values);
     evaluate (__LINE__, __func__, { 2, 3, 5 }, values);
   }
+  // Escaping strings for MySQL.
+  {
+    evaluate (__LINE__, __func__, "bittrex", SQL::escape ("bittrex"));
+    evaluate (__LINE__, __func__, "it\\'s \\\"a\\\\b\\\n", SQL::escape ("it's \"a\\b\n"));
+    evaluate (__LINE__, __func__, "a\\0b", SQL::escape (string ("a\0b", 3)));
+    evaluate (__LINE__, __func__, "1.23e-06", SQL::format (0.00000123f));
+  }
   {
     string datestamp;
     int seconds;
@@ -1685,10 +1693,7 @@ void test_allrates ()
     string exchange = "unittestexchange";
     string market = "unittestmarket";
     string coin = "unittestcoin";
-    unordered_map <int, float> minute_asks;
-    unordered_map <int, float> minute_bids;
-    unordered_map <int, float> hour_asks;
-    unordered_map <int, float> hour_bids;
+    TimeSeries minutes, hours;
 
     // Create pattern with increasing rates.
     float bid = 0.0010;
@@ -1707,72 +1712,154 @@ void test_allrates ()
     }
 
     // Prepare the pattern for analysis.
-    pattern_prepare (nullptr, exchange, market, coin, minute_asks, minute_bids, hour_asks, hour_bids);
+    pattern_prepare (nullptr, exchange, market, coin, minutes, hours);
 
     /*
     vector <pair <string, string> > plotdata;
     string picturepath;
     for (int minute = -2000; minute <= 0; minute++) {
-      float rate = (minute_asks [minute] + minute_bids [minute]) / 2;
+      float rate = (minutes.ask (minute) + minutes.bid (minute)) / 2;
       plotdata.push_back (make_pair (to_string (minute), float2string (rate)));
     }
     plot (plotdata, "unittest", picturepath);
     */
     
     // Spot-check the pattern and its interpolated values.
-    evaluate (__LINE__, __func__, 0.0155097414, minute_asks[0]);
-    evaluate (__LINE__, __func__, 0.0154797425, minute_asks[-3]);
-    evaluate (__LINE__, __func__, 0.0041100127, minute_asks[-1140]);
-    evaluate (__LINE__, __func__, 0.0040100119, minute_asks[-1150]);
-    evaluate (__LINE__, __func__, 0.0154097453, minute_bids[0]);
-    evaluate (__LINE__, __func__, 0.0153797464, minute_bids[-3]);
-    evaluate (__LINE__, __func__, 0.0152147524, hour_asks[0]);
-    evaluate (__LINE__, __func__, 0.0134148216, hour_asks[-3]);
-    evaluate (__LINE__, __func__, 0.0151147572, hour_bids[0]);
-    evaluate (__LINE__, __func__, 0.0133148264, hour_bids[-3]);
+    evaluate (__LINE__, __func__, 0.0155097414, minutes.ask (0));
+    evaluate (__LINE__, __func__, 0.0154797425, minutes.ask (-3));
+    evaluate (__LINE__, __func__, 0.0041100127, minutes.ask (-1140));
+    evaluate (__LINE__, __func__, 0.0040100119, minutes.ask (-1150));
+    evaluate (__LINE__, __func__, 0.0154097453, minutes.bid (0));
+    evaluate (__LINE__, __func__, 0.0153797464, minutes.bid (-3));
+    evaluate (__LINE__, __func__, 0.0152147524, hours.ask (0));
+    evaluate (__LINE__, __func__, 0.0134148216, hours.ask (-3));
+    evaluate (__LINE__, __func__, 0.0151147572, hours.bid (0));
+    evaluate (__LINE__, __func__, 0.0133148264, hours.bid (-3));
 
     // Delete the data again.
     allrates_delete (exchange, market, coin);
     //allrates2_delete (sql, exchange, market, coin);
 
     // Prepare the pattern for analysis but there should be nothing after deleting it.
-    pattern_prepare (nullptr, exchange, market, coin, minute_asks, minute_bids, hour_asks, hour_bids);
-    evaluate (__LINE__, __func__, 0, hour_bids.size());
+    pattern_prepare (nullptr, exchange, market, coin, minutes, hours);
+    evaluate (__LINE__, __func__, 0, hours.size());
   }
 
 }
 
 
+void test_allrates_store ()
+{
+  string exchange = "unittestexchange";
+  string market = "unittestmarket";
+  string coin = "unittestcoin";
+  allrates_delete (exchange, market, coin);
+  int day = 86400;
+  int current_second = seconds_since_epoch ();
+
+  // Append rates over three days, the older ones last, as a back bot may do after downtime.
+  allrates_add (exchange, market, coin, current_second, 3.0f, 3.1f);
+  allrates_add (exchange, market, coin, current_second - 60, 2.0f, 2.1f);
+  allrates_append (exchange, market, coin,
+                   {current_second - (2 * day), current_second - day},
+                   {0.5f, 1.5f}, {0.6f, 1.6f});
+  evaluate (__LINE__, __func__, true, allrates_exists (exchange, market, coin));
+
+  // The reader returns the rates ordered by second.
+  vector <int> seconds;
+  vector <float> bids, asks;
+  allrates_get (exchange, market, coin, seconds, bids, asks);
+  evaluate (__LINE__, __func__, vector <int> {current_second - (2 * day), current_second - day, current_second - 60, current_second}, seconds);
+  evaluate (__LINE__, __func__, 1.5f, bids[1]);
+  evaluate (__LINE__, __func__, 3.1f, asks[3]);
+
+  // The reader starts at the given second.
+  seconds.clear ();
+  bids.clear ();
+  asks.clear ();
+  allrates_get (exchange, market, coin, current_second - 60, seconds, bids, asks);
+  evaluate (__LINE__, __func__, vector <int> {current_second - 60, current_second}, seconds);
+  evaluate (__LINE__, __func__, 2.0f, bids[0]);
+
+  // Expiring removes whole segments older than the cut-off day.
+  allrates_expire (exchange, market, coin, 1);
+  seconds.clear ();
+  bids.clear ();
+  asks.clear ();
+  allrates_get (exchange, market, coin, seconds, bids, asks);
+  evaluate (__LINE__, __func__, 3, (int)seconds.size ());
+
+  // Deleting removes the pair from the store.
+  allrates_delete (exchange, market, coin);
+  evaluate (__LINE__, __func__, false, allrates_exists (exchange, market, coin));
+  evaluate (__LINE__, __func__, false, file_or_dir_exists (allrates_folder (exchange, market, coin)));
+}
+
+
 void test_patterns ()
 {
+  {
+    // Missing times have zero rates, and reading them does not add them.
+    TimeSeries rates;
+    int oldest = 1;
+    evaluate (__LINE__, __func__, false, rates.oldest (oldest));
+    evaluate (__LINE__, __func__, 1, oldest);
+    rates.set (-5, 2, 1);
+    rates.set (-2, 4, 3);
+    evaluate (__LINE__, __func__, 2, (int)rates.size ());
+    evaluate (__LINE__, __func__, true, rates.oldest (oldest));
+    evaluate (__LINE__, __func__, -5, oldest);
+    evaluate (__LINE__, __func__, 4.0, rates.ask (-2));
+    evaluate (__LINE__, __func__, 1.0, rates.bid (-5));
+    evaluate (__LINE__, __func__, 0.0, rates.ask (-3));
+    evaluate (__LINE__, __func__, 0.0, rates.bid (-100));
+    evaluate (__LINE__, __func__, 0.0, rates.ask (100));
+    evaluate (__LINE__, __func__, false, rates.valid (-3));
+    evaluate (__LINE__, __func__, 2, (int)rates.size ());
+    // Making room for more times keeps the stored rates.
+    rates.range (-60, 0);
+    evaluate (__LINE__, __func__, 4.0, rates.ask (-2));
+    evaluate (__LINE__, __func__, true, rates.oldest (oldest));
+    evaluate (__LINE__, __func__, -5, oldest);
+    rates.set (-60, 6, 5);
+    evaluate (__LINE__, __func__, true, rates.oldest (oldest));
+    evaluate (__LINE__, __func__, -60, oldest);
+    evaluate (__LINE__, __func__, 3, (int)rates.size ());
+  }
+  {
+    // A rate right at time 0 is a rate like any other.
+    TimeSeries rates;
+    int oldest = 1;
+    rates.set (0, 2, 1);
+    evaluate (__LINE__, __func__, true, rates.oldest (oldest));
+    evaluate (__LINE__, __func__, 0, oldest);
+  }
   {
     int start = -10;
     int window = 15;
-    unordered_map <int, float> bids, asks;
+    TimeSeries rates;
     float bid = 0.00021;
     float ask = 0.00022;
     for (int i = start - window; i <= start; i++) {
       bid += 0.0000021;
       ask += 0.0000021;
-      bids[i] = bid;
-      asks[i] = ask;
+      rates.set (i, ask, bid);
     }
-    float change = pattern_change (bids, asks, start, window);
+    float change = pattern_change (rates, start, window);
     evaluate (__LINE__, __func__, 0.9073446393, change);
   }
   {
     int start = -10;
     int window = 15;
-    unordered_map <int, float> bids, asks;
+    TimeSeries rates;
     float bid = 0.00021;
     float ask = 0.00022;
     for (int i = start - window; i <= start; i++) {
       bid -= 0.0000021;
       ask -= 0.0000021;
-      bids[i] = bid;
-      asks[i] = ask;
+      rates.set (i, ask, bid);
     }
-    float change = pattern_change (bids, asks, start, window);
+    float change = pattern_change (rates, start, window);
     evaluate (__LINE__, __func__, -1.0617648363, change);
   }
 }
@@ -1787,6 +1874,44 @@ void test_sqlite ()
   string coin = "</div><!--";
   allrates_add (exchange, market, coin, seconds_since_epoch (), 0.2f, 0.21f);
 
+  // Prepared statements with typed values.
+  {
+    string database = "unittest_prepared";
+    unlink (SqliteDatabase::path (database).c_str ());
+    SqliteDatabase sql (database);
+    sql.prepare ("CREATE TABLE test (number integer, value real, text text);");
+    sql.step ();
+    sql.begin ();
+    for (int i = 0; i < 3; i++) {
+      sql.prepare ("INSERT INTO test (number, value, text) VALUES (?, ?, ?);");
+      sql.bind (1, i);
+      sql.bind (2, i + 0.5);
+      sql.bind (3, string ("it's ") + to_string (i));
+      sql.step ();
+    }
+    sql.commit ();
+    vector <int> numbers;
+    vector <float> values;
+    vector <string> texts;
+    sql.prepare ("SELECT number, value, text FROM test ORDER BY number;");
+    while (sql.step ()) {
+      numbers.push_back (sql.column_int (0));
+      values.push_back (sql.column_double (1));
+      texts.push_back (sql.column_text (2));
+    }
+    evaluate (__LINE__, __func__, vector <int> { 0, 1, 2 }, numbers);
+    evaluate (__LINE__, __func__, vector <float> { 0.5, 1.5, 2.5 }, values);
+    evaluate (__LINE__, __func__, vector <string> { "it's 0", "it's 1", "it's 2" }, texts);
+    // A rolled back transaction leaves no trace.
+    sql.begin ();
+    sql.prepare ("DELETE FROM test;");
+    sql.step ();
+    sql.rollback ();
+    sql.prepare ("SELECT COUNT(*) FROM test;");
+    sql.step ();
+    evaluate (__LINE__, __func__, 3, sql.column_int (0));
+    unlink (SqliteDatabase::path (database).c_str ());
+  }
 }
 
 
@@ -1835,8 +1960,23 @@ void test_approximate_order_books ()
   evaluate (__LINE__, __func__, standard_quantities, quantities);
   evaluate (__LINE__, __func__, standard_rates, rates);
 
+  // The cache keeps the best 256 levels of a deep order book.
+  standard_quantities.clear ();
+  standard_rates.clear ();
+  for (int i = 0; i < 300; i++) {
+    standard_quantities.push_back (i);
+    standard_rates.push_back (0.001 * i);
+  }
+  buyers_set (exchange, market, coin, standard_price, standard_quantities, standard_rates);
+  buyers_get (exchange, market, coin, price, quantities, rates);
+  evaluate (__LINE__, __func__, 256, quantities.size());
+  evaluate (__LINE__, __func__, 255.0, quantities.back());
+
   // Delete all data.
   buyers_sellers_delete (exchange, market, coin);
+  buyers_get (exchange, market, coin, price, quantities, rates);
+  evaluate (__LINE__, __func__, 0.0, price);
+  evaluate (__LINE__, __func__, 0, quantities.size());
 }
 
 
@@ -1945,7 +2085,7 @@ void test_optimizer ()
   evaluate (__LINE__, __func__, false, in_array (coin, coins));
 
   // Add the values for the unit test.
-  optimizer_add (sql, exchange, coin, rate, projected);
+  optimizer_add (sql, exchange, coin, rate, projected, true);
   
   // Check the added values are there now in the database.
   optimizer_get (sql, ids, exchanges, coins, starts, forecasts, realizeds);
@@ -2305,6 +2445,453 @@ void test_sells ()
 }
 
 
+void test_satellite_binary ()
+{
+  // Market summaries.
+  {
+    vector <string> coins = { "bitcoin", "monero" };
+    vector <float> bids = { 0.0000470000, 0.0268538408 };
+    vector <float> asks = { 0.0000471300, 0.0269063301 };
+    string reply = satellite_encode_summaries ("bittrex", "btc", coins, bids, asks, "");
+    evaluate (__LINE__, __func__, true, satellite_binary_reply (reply));
+    vector <string> coins2;
+    vector <float> bids2, asks2;
+    string error;
+    satellite_decode_summaries (reply, "bittrex", "btc", coins2, bids2, asks2, error);
+    evaluate (__LINE__, __func__, "", error);
+    evaluate (__LINE__, __func__, coins, coins2);
+    evaluate (__LINE__, __func__, bids, bids2);
+    evaluate (__LINE__, __func__, asks, asks2);
+    // A reply for another market.
+    coins2.clear ();
+    satellite_decode_summaries (reply, "bittrex", "eth", coins2, bids2, asks2, error);
+    evaluate (__LINE__, __func__, "Binary reply for another request", error);
+    evaluate (__LINE__, __func__, 0, coins2.size ());
+  }
+  // Order book.
+  {
+    vector <float> quantities = { 1260, 164.7058868408, 189.1515197754 };
+    vector <float> rates = { 0.0000003500, 0.0000003400, 0.0000003300 };
+    string reply = satellite_encode_order_book ("bittrex", "btc", "lumen", quantities, rates, "");
+    // Header plus two floats per entry.
+    evaluate (__LINE__, __func__, 22 + 24, reply.size ());
+    vector <float> quantities2, rates2;
+    string error;
+    satellite_decode_order_book (reply, "bittrex", "btc", "lumen", quantities2, rates2, error);
+    evaluate (__LINE__, __func__, "", error);
+    // The age of cached data.
+    int age = -1;
+    reply = satellite_encode_order_book ("bittrex", "btc", "lumen", quantities, rates, "", 250);
+    quantities2.clear ();
+    rates2.clear ();
+    satellite_decode_order_book (reply, "bittrex", "btc", "lumen", quantities2, rates2, error, &age);
+    evaluate (__LINE__, __func__, 250, age);
+    evaluate (__LINE__, __func__, quantities, quantities2);
+    evaluate (__LINE__, __func__, rates, rates2);
+    // A truncated reply.
+    quantities2.clear ();
+    rates2.clear ();
+    satellite_decode_order_book (reply.substr (0, 34), "bittrex", "btc", "lumen", quantities2, rates2, error);
+    evaluate (__LINE__, __func__, "Binary reply too short", error);
+    evaluate (__LINE__, __func__, 0, quantities2.size ());
+  }
+  // Errors.
+  {
+    string reply = satellite_encode_order_book ("bittrex", "btc", "lumen", {}, {}, "Timeout");
+    vector <float> quantities, rates;
+    string error;
+    satellite_decode_order_book (reply, "bittrex", "btc", "lumen", quantities, rates, error);
+    evaluate (__LINE__, __func__, "Timeout", error);
+  }
+  // Batches.
+  {
+    vector <string> tuples = { "buyers bittrex btc lumen", "sellers bittrex btc lumen" };
+    vector <string> replies = {
+      satellite_encode_order_book ("bittrex", "btc", "lumen", { 1 }, { 2 }, ""),
+      satellite_encode_order_book ("bittrex", "btc", "lumen", {}, {}, "Timeout")
+    };
+    string batch = satellite_encode_batch (tuples, replies);
+    map <string, string> decoded;
+    evaluate (__LINE__, __func__, true, satellite_decode_batch (batch, decoded));
+    evaluate (__LINE__, __func__, 2, decoded.size ());
+    evaluate (__LINE__, __func__, replies[0], decoded [tuples[0]]);
+    evaluate (__LINE__, __func__, replies[1], decoded [tuples[1]]);
+    evaluate (__LINE__, __func__, false, satellite_decode_batch (batch.substr (0, batch.size () - 1), decoded));
+    evaluate (__LINE__, __func__, false, satellite_decode_batch ("", decoded));
+  }
+  // Bulk rates.
+  {
+    string reply = satellite_encode_rates ({ 1500000000, 1500000000, 1500000060 },
+                                           { "bittrex", "yobit", "bittrex" },
+                                           { "btc", "btc", "btc" },
+                                           { "lumen", "lumen", "lumen" },
+                                           { 0.0000000123f, 2, 3 },
+                                           { 0.0000000124f, 2.5, 3.5 });
+    vector <int> seconds;
+    vector <string> exchanges, markets, coins;
+    vector <float> bids, asks;
+    evaluate (__LINE__, __func__, true, satellite_decode_rates (reply, seconds, exchanges, markets, coins, bids, asks));
+    evaluate (__LINE__, __func__, vector <int> { 1500000000, 1500000000, 1500000060 }, seconds);
+    evaluate (__LINE__, __func__, vector <string> { "bittrex", "yobit", "bittrex" }, exchanges);
+    evaluate (__LINE__, __func__, vector <string> { "lumen", "lumen", "lumen" }, coins);
+    evaluate (__LINE__, __func__, vector <float> { 0.0000000123f, 2, 3 }, bids);
+    evaluate (__LINE__, __func__, vector <float> { 0.0000000124f, 2.5, 3.5 }, asks);
+    seconds.clear ();
+    evaluate (__LINE__, __func__, false, satellite_decode_rates (reply.substr (0, reply.size () - 1), seconds, exchanges, markets, coins, bids, asks));
+    evaluate (__LINE__, __func__, false, satellite_decode_rates ("", seconds, exchanges, markets, coins, bids, asks));
+  }
+  // The text replies remain as they are.
+  {
+    evaluate (__LINE__, __func__, false, satellite_binary_reply ("1260.0000000000 0.0000003500"));
+    evaluate (__LINE__, __func__, "buyers bittrex btc lumen", satellite_text_request (satellite_binary_request ("buyers bittrex btc lumen")));
+    evaluate (__LINE__, __func__, "heartbeat", satellite_text_request ("heartbeat"));
+    evaluate (__LINE__, __func__, false, satellite_binary_mismatch ("1260.0000000000 0.0000003500"));
+  }
+  // A binary reply in another version of the format is not read as binary.
+  {
+    string reply = satellite_encode_summaries ("bittrex", "btc", { "bitcoin" }, { 1 }, { 2 }, "");
+    evaluate (__LINE__, __func__, false, satellite_binary_mismatch (reply));
+    reply [0] = 1;
+    evaluate (__LINE__, __func__, false, satellite_binary_reply (reply));
+    evaluate (__LINE__, __func__, true, satellite_binary_mismatch (reply));
+  }
+}
+
+
+void test_curve_fitting_kernels ()
+{
+  // Observations that do not fill a whole number of SIMD registers, so the scalar tail runs too.
+  vector <float> xs, ys;
+  for (int i = 0; i < 37; i++) {
+    xs.push_back (i + 1);
+    ys.push_back (0.0001 + (0.000001 * i) + (0.0000002 * (i % 5)));
+  }
+  for (int iter = static_cast <int> (curve_type::begin) + 1; iter < static_cast <int> (curve_type::end); iter++) {
+    curve_description parameters;
+    parameters.curve = static_cast <curve_type> (iter);
+    parameters.x_multiplier = 1.1;
+    parameters.x_addend = 2;
+    parameters.y_multiplier = 0.00001;
+    parameters.y_addend = 0.0001;
+    // The reference calculation, point by point.
+    float sum = 0, maximum = 0, average = 0;
+    for (unsigned int i = 0; i < xs.size (); i++) {
+      float curve_y = curve_calculate (parameters, xs[i]);
+      sum += abs (curve_y - ys[i]) * (0.5f + (i * (4.5f / xs.size ())));
+      float percentage = abs (get_percentage_change (ys[i], curve_y));
+      if (percentage > maximum) maximum = percentage;
+      average += percentage;
+    }
+    average /= xs.size ();
+    for (auto kernel : { curve_fitting_kernel_get (parameters.curve), curve_fitting_kernel_scalar (parameters.curve) }) {
+      float kernel_maximum, kernel_average;
+      float kernel_sum = kernel (xs.data (), ys.data (), xs.size (), parameters.x_multiplier, parameters.x_addend, parameters.y_multiplier, parameters.y_addend, kernel_maximum, kernel_average);
+      evaluate (__LINE__, __func__, true, abs (kernel_sum - sum) <= sum * 0.0001);
+      evaluate (__LINE__, __func__, maximum, kernel_maximum);
+      evaluate (__LINE__, __func__, true, abs (kernel_average - average) <= average * 0.0001);
+    }
+  }
+}
+
+
+void test_curve_solvers ()
+{
+  // Observations on a straight line, with a few points off it.
+  vector <float> xs, ys;
+  for (int hour = -72; hour <= -24; hour++) {
+    xs.push_back (hour);
+    float rate = 0.001 + (0.00001 * hour);
+    if (hour % 10 == 0) rate *= 1.01;
+    ys.push_back (rate);
+  }
+  for (int iter = static_cast <int> (curve_type::begin) + 1; iter < static_cast <int> (curve_type::end); iter++) {
+    curve_description descent, marquardt;
+    descent.curve = marquardt.curve = static_cast <curve_type> (iter);
+    float descent_residuals = fitted_curve_get_optimized_residuals (xs, ys, descent, curve_solver::coordinate_descent);
+    float marquardt_residuals = fitted_curve_get_optimized_residuals (xs, ys, marquardt, curve_solver::levenberg_marquardt);
+    // The Levenberg-Marquardt solver fits every curve, and at least as well as coordinate descent.
+    // And it needs far fewer evaluations of the curve.
+    evaluate (__LINE__, __func__, true, isfinite (marquardt_residuals));
+    evaluate (__LINE__, __func__, true, marquardt.fitting_iterations > 0);
+    if (isfinite (descent_residuals)) {
+      evaluate (__LINE__, __func__, true, marquardt_residuals <= descent_residuals * 1.001);
+      evaluate (__LINE__, __func__, true, marquardt.fitting_evaluations * 5 < descent.fitting_evaluations);
+    }
+  }
+  // The robust fit ignores the points off the line.
+  {
+    curve_description parameters;
+    parameters.curve = curve_type::linear;
+    fitted_curve_get_optimized_residuals (xs, ys, parameters);
+    evaluate (__LINE__, __func__, 0.00076, curve_calculate (parameters, -24));
+    evaluate (__LINE__, __func__, 0.00028, curve_calculate (parameters, -72));
+  }
+  // Slide the window along by one hour, and fit it again, starting from the fits of the previous window.
+  {
+    vector <curve_description> sliding_fits;
+    curve_description parameters;
+    get_fitted_curve (xs, ys, parameters, curve_solver::levenberg_marquardt, &sliding_fits);
+    evaluate (__LINE__, __func__, static_cast <int> (curve_type::end), static_cast <int> (sliding_fits.size ()));
+    xs.erase (xs.begin ());
+    ys.erase (ys.begin ());
+    xs.push_back (-23);
+    ys.push_back (0.001 - 0.00023);
+    curve_description cold, warm;
+    get_fitted_curve (xs, ys, cold);
+    get_fitted_curve (xs, ys, warm, curve_solver::levenberg_marquardt, &sliding_fits);
+    evaluate (__LINE__, __func__, static_cast <int> (cold.curve), static_cast <int> (warm.curve));
+    evaluate (__LINE__, __func__, true, warm.fitting_iterations < cold.fitting_iterations);
+    evaluate (__LINE__, __func__, true, abs (curve_calculate (warm, -23) - curve_calculate (cold, -23)) < 0.000001);
+  }
+}
+
+
+void test_forecast_factors ()
+{
+  // Simulated hours with a curve over two hours of minutes and a curve over a day of hours.
+  vector <forecast_properties> all_forecast_properties;
+  for (int hour = -100; hour < -24; hour++) {
+    forecast_properties properties;
+    properties.last_observed_hour = hour;
+    properties.last_observed_average_hourly_rate = 10 + (hour % 7);
+    properties.next_day_observed_average_hourly_rate = 11 + (hour % 5);
+    properties.hourly_change_percentage = (hour % 3);
+    properties.daily_change_percentage = (hour % 4);
+    properties.weekly_change_percentage = 2;
+    curve_description minutes_curve;
+    minutes_curve.curve = curve_type::linear;
+    minutes_curve.y_multiplier = 0.001;
+    minutes_curve.y_addend = 12;
+    minutes_curve.last_seen_x_value = hour * 60;
+    minutes_curve.minutes_measured = 2 * 60;
+    properties.curves.push_back (minutes_curve);
+    curve_description hours_curve;
+    hours_curve.curve = curve_type::squared;
+    hours_curve.y_multiplier = 0.0001;
+    hours_curve.y_addend = 9;
+    hours_curve.last_seen_x_value = hour;
+    hours_curve.hours_measured = 48;
+    properties.curves.push_back (hours_curve);
+    all_forecast_properties.push_back (properties);
+  }
+  forecast_weights weights;
+  for (int hours : deep_learning_hours ()) weights.hours_curve_weights [hours] = 1.0;
+  weights.daily_change_weight = 0.5;
+  weights.hours_curve_weights [2] = 2;
+  // The precalculated factors give the same residuals as running the forecaster.
+  float sum, maximum, average;
+  get_forecast_residuals (nullptr, all_forecast_properties, weights, sum, maximum, average);
+  forecast_factors factors (all_forecast_properties, weights);
+  float factors_maximum, factors_average;
+  float factors_sum = factors.residuals (factors.get_weights (weights), factors_maximum, factors_average);
+  evaluate (__LINE__, __func__, true, abs (factors_sum - sum) < sum * 0.0001);
+  evaluate (__LINE__, __func__, true, abs (factors_maximum - maximum) < maximum * 0.0001);
+  evaluate (__LINE__, __func__, true, abs (factors_average - average) < average * 0.0001);
+  // Optimizing the weights lowers the residuals.
+  to_output output ("");
+  float optimized = optimize_forecast_weights (&output, all_forecast_properties, weights);
+  get_forecast_residuals (nullptr, all_forecast_properties, weights, factors_sum, factors_maximum, factors_average);
+  evaluate (__LINE__, __func__, true, optimized < sum * 0.9);
+  evaluate (__LINE__, __func__, true, abs (factors_sum - optimized) < optimized * 0.0001);
+  evaluate (__LINE__, __func__, true, weights.daily_change_weight >= 0);
+}
+
+
+void test_thread_pool ()
+{
+  // A group runs all its tasks, and no more of them at the same time than its maximum.
+  {
+    atomic <int> done (0);
+    atomic <int> running (0);
+    atomic <int> most_running (0);
+    task_group group (3);
+    for (int i = 0; i < 200; i++) {
+      group.run ([&] {
+        int now = ++running;
+        int most = most_running;
+        while ((now > most) && !most_running.compare_exchange_weak (most, now)) {};
+        this_thread::sleep_for (chrono::microseconds (100));
+        running--;
+        done++;
+      });
+    }
+    group.wait_all ();
+    evaluate (__LINE__, __func__, 200, done);
+    evaluate (__LINE__, __func__, true, most_running <= 3);
+    evaluate (__LINE__, __func__, true, thread_pool_workers () >= 3);
+  }
+  // Tasks can run groups of their own and wait for them.
+  {
+    atomic <int> done (0);
+    task_group outer;
+    for (int i = 0; i < 20; i++) {
+      outer.run ([&] {
+        task_group inner;
+        for (int j = 0; j < 10; j++) inner.run ([&] { done++; });
+        inner.wait_all ();
+      });
+    }
+    outer.wait_all ();
+    evaluate (__LINE__, __func__, 200, done);
+  }
+  // The first exception thrown by a task is thrown by wait_all, after all tasks have completed.
+  {
+    atomic <int> done (0);
+    task_group group;
+    for (int i = 0; i < 10; i++) {
+      group.run ([&, i] {
+        done++;
+        if (i == 5) throw runtime_error ("task failed");
+      });
+    }
+    string error;
+    try {
+      group.wait_all ();
+    } catch (exception & e) {
+      error = e.what ();
+    }
+    evaluate (__LINE__, __func__, "task failed", error);
+    evaluate (__LINE__, __func__, 10, done);
+  }
+}
+
+
+void test_market_snapshot ()
+{
+  // Use a snapshot of its own, not the one the bot uses.
+  string prefix = shared_memory_prefix;
+  shared_memory_prefix = "cryptobot_unittest_";
+  SQL sql (front_bot_ip_address ());
+  int now = seconds_since_epoch ();
+  // The serial the front bot has for the market data.
+  string serial = settings_get (sql, front_bot_name (), "market_snapshot_serial");
+  // The market data as the rates program publishes it.
+  // One rate is recent and one is older, and one pause is still on and one has expired.
+  auto payload = [&] (float bid) {
+    string data;
+    market_snapshot_add (data, serial);
+    market_snapshot_add (data, (uint32_t) 2);
+    market_snapshot_add (data, (uint32_t) now);
+    market_snapshot_add (data, "bittrex");
+    market_snapshot_add (data, "btc");
+    market_snapshot_add (data, "monero");
+    market_snapshot_add (data, bid);
+    market_snapshot_add (data, (float) 0.5);
+    market_snapshot_add (data, (float) 0.25);
+    market_snapshot_add (data, (uint32_t) (now - 600));
+    market_snapshot_add (data, "kraken");
+    market_snapshot_add (data, "eur");
+    market_snapshot_add (data, "lumen");
+    market_snapshot_add (data, (float) 0.125);
+    market_snapshot_add (data, (float) 0.375);
+    market_snapshot_add (data, (float) 0.0625);
+    market_snapshot_add (data, (uint32_t) 1);
+    market_snapshot_add (data, "bittrex");
+    market_snapshot_add (data, "btc");
+    market_snapshot_add (data, "monero lumen");
+    market_snapshot_add (data, (uint32_t) 1);
+    market_snapshot_add (data, "bittrexbtcmonero");
+    market_snapshot_add (data, (float) 0.75);
+    market_snapshot_add (data, (uint32_t) 2);
+    market_snapshot_add (data, "bittrexbtcmonero");
+    market_snapshot_add (data, (uint32_t) (now + 3600));
+    market_snapshot_add (data, "krakeneurlumen");
+    market_snapshot_add (data, (uint32_t) (now - 10));
+    return data;
+  };
+  vector <int> seconds;
+  vector <string> exchanges, markets, coins;
+  vector <float> bids, asks, rates;
+  auto get_rates = [&] (bool only_recent) {
+    seconds.clear ();
+    exchanges.clear ();
+    markets.clear ();
+    coins.clear ();
+    bids.clear ();
+    asks.clear ();
+    rates.clear ();
+    return market_snapshot_rates (sql, seconds, exchanges, markets, coins, bids, asks, rates, only_recent);
+  };
+  // The data published for this MySQL server reads back the same.
+  {
+    market_snapshot_write (sql.address (), now, payload (1.5));
+    evaluate (__LINE__, __func__, true, get_rates (false));
+    evaluate (__LINE__, __func__, { now, now - 600 }, seconds);
+    evaluate (__LINE__, __func__, { "bittrex", "kraken" }, exchanges);
+    evaluate (__LINE__, __func__, { "btc", "eur" }, markets);
+    evaluate (__LINE__, __func__, { "monero", "lumen" }, coins);
+    evaluate (__LINE__, __func__, { 1.5, 0.125 }, bids);
+    evaluate (__LINE__, __func__, { 0.5, 0.375 }, asks);
+    evaluate (__LINE__, __func__, { 0.25, 0.0625 }, rates);
+    evaluate (__LINE__, __func__, true, get_rates (true));
+    evaluate (__LINE__, __func__, { "monero" }, coins);
+    evaluate (__LINE__, __func__, true, market_snapshot_coins_market (sql, exchanges, markets, coins));
+    evaluate (__LINE__, __func__, { "bittrex" }, exchanges);
+    evaluate (__LINE__, __func__, { "btc" }, markets);
+    evaluate (__LINE__, __func__, { "monero lumen" }, coins);
+    map <string, float> minimum_trades;
+    evaluate (__LINE__, __func__, true, market_snapshot_minimum_trades (sql, minimum_trades));
+    evaluate (__LINE__, __func__, 1, minimum_trades.size ());
+    evaluate (__LINE__, __func__, 0.75, minimum_trades ["bittrexbtcmonero"]);
+    vector <string> paused;
+    evaluate (__LINE__, __func__, true, market_snapshot_paused_trades (sql, paused));
+    evaluate (__LINE__, __func__, { "bittrexbtcmonero" }, paused);
+    // Another MySQL server has other data.
+    SQL sql2 ("127.0.0.2");
+    evaluate (__LINE__, __func__, false, market_snapshot_minimum_trades (sql2, minimum_trades));
+  }
+  // Once the data was changed at the front bot, the serial differs, and the snapshot is no longer used.
+  {
+    string current = serial;
+    serial = "1";
+    market_snapshot_write (sql.address (), now, payload (1.5));
+    vector <string> paused;
+    evaluate (__LINE__, __func__, false, market_snapshot_paused_trades (sql, paused));
+    serial = current;
+    market_snapshot_write (sql.address (), now, payload (1.5));
+    evaluate (__LINE__, __func__, true, market_snapshot_paused_trades (sql, paused));
+  }
+  // The sequence number at the start of the snapshot is odd while a writer replaces the snapshot.
+  int fd = open (market_snapshot_path ().c_str (), O_RDWR);
+  void * address = mmap (nullptr, sizeof (uint32_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  atomic <uint32_t> * sequence = (atomic <uint32_t> *) address;
+  // A reader does not take a snapshot halfway through being replaced.
+  // It waits a bit for the writer, then gives up, and the caller queries MySQL.
+  {
+    sequence->store (sequence->load () + 1);
+    evaluate (__LINE__, __func__, false, get_rates (false));
+  }
+  // A reader that finds the writer busy, retries, and gets the complete new snapshot.
+  {
+    thread writer ([&] {
+      this_thread::sleep_for (chrono::milliseconds (2));
+      market_snapshot_write (sql.address (), now, payload (2.5));
+    });
+    evaluate (__LINE__, __func__, true, get_rates (false));
+    evaluate (__LINE__, __func__, { 2.5, 0.125 }, bids);
+    evaluate (__LINE__, __func__, 0u, sequence->load () & 1);
+    writer.join ();
+  }
+  munmap (address, sizeof (uint32_t));
+  close (fd);
+  // After invalidating the snapshot, the readers go to MySQL till the next snapshot is there.
+  {
+    market_snapshot_invalidate (sql);
+    // The invalidation stored a new serial at the front bot, if it can be reached.
+    serial = settings_get (sql, front_bot_name (), "market_snapshot_serial");
+    evaluate (__LINE__, __func__, false, get_rates (false));
+    vector <string> paused;
+    evaluate (__LINE__, __func__, false, market_snapshot_paused_trades (sql, paused));
+    market_snapshot_write (sql.address (), now, payload (3.5));
+    evaluate (__LINE__, __func__, true, get_rates (false));
+    evaluate (__LINE__, __func__, { 3.5, 0.125 }, bids);
+  }
+  // Remove the test snapshot.
+  unlink (market_snapshot_path ().c_str ());
+  shared_memory_prefix = prefix;
+}
+
+
 int main (int argc, char *argv[])
 {
   initialize_program (argc, argv);
@@ -2324,6 +2911,7 @@ int main (int argc, char *argv[])
   //test_database_pausetrade ();
   //test_multipath ();
   //test_allrates ();
+  //test_allrates_store ();
   //test_patterns ();
   //test_sqlite ();
   //test_approximate_order_books ();
@@ -2335,6 +2923,12 @@ int main (int argc, char *argv[])
   //test_surfer ();
   //test_bought ();
   //test_sells ();
+  //test_satellite_binary ();
+  //test_curve_fitting_kernels ();
+  //test_curve_solvers ();
+  //test_forecast_factors ();
+  //test_thread_pool ();
+  //test_market_snapshot ();
 
   finalize_program ();
   return EXIT_SUCCESS;